@@ -0,0 +1,242 @@
+#include "alarm.h"
+#include <math.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "state_manager.h"
+#include "settings_manager.h"
+#include "config_store.h"
+
+// Snapshots the rate of change is measured over
+#define ALARM_RATE_WINDOW 16
+
+static const char *TAG = "alarm";
+
+typedef struct
+{
+    bool active;
+    bool pending;        // the condition for the opposite state holds
+    uint32_t pending_ms; // since when
+} alarm_limit_state_t;
+
+typedef struct
+{
+    alarm_limit_state_t limits[ALARM_TYPE_COUNT];
+    float history[ALARM_RATE_WINDOW];
+    uint32_t history_ms[ALARM_RATE_WINDOW];
+    uint8_t history_head;
+    uint8_t history_used;
+} alarm_channel_state_t;
+
+// Guards system_state.alarm_rules
+static portMUX_TYPE alarm_rules_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Only touched by the temperature task, readers see the active bits
+static alarm_channel_state_t alarm_states[SENSOR_MAX_COUNT];
+static volatile uint8_t alarm_active[SENSOR_MAX_COUNT];
+
+void alarm_rule_default(alarm_rule_t *rule)
+{
+    *rule = (alarm_rule_t){
+        .limits = {
+            [ALARM_TYPE_HIGH] = {
+                .enabled = true,
+                .threshold = CONFIG_ALARM_HIGH_C,
+                .hysteresis = CONFIG_ALARM_HYSTERESIS_C,
+                .min_duration_ms = CONFIG_ALARM_MIN_DURATION_MS,
+            },
+            [ALARM_TYPE_LOW] = {
+                .enabled = true,
+                .threshold = CONFIG_ALARM_LOW_C,
+                .hysteresis = CONFIG_ALARM_HYSTERESIS_C,
+                .min_duration_ms = CONFIG_ALARM_MIN_DURATION_MS,
+            },
+            [ALARM_TYPE_RATE] = {
+                .enabled = CONFIG_ALARM_RATE_C_PER_MIN > 0,
+                .threshold = CONFIG_ALARM_RATE_C_PER_MIN,
+                .hysteresis = CONFIG_ALARM_RATE_HYSTERESIS_C_PER_MIN,
+                .min_duration_ms = CONFIG_ALARM_MIN_DURATION_MS,
+            },
+        },
+    };
+}
+
+bool alarm_rule_valid(const alarm_rule_t *rule)
+{
+    for (int type = 0; type < ALARM_TYPE_COUNT; type++)
+    {
+        const alarm_limit_t *limit = &rule->limits[type];
+        if (!isfinite(limit->threshold) || !isfinite(limit->hysteresis) || limit->hysteresis < 0 ||
+            limit->min_duration_ms > ALARM_MIN_DURATION_MAX_MS)
+        {
+            return false;
+        }
+    }
+    return rule->limits[ALARM_TYPE_RATE].threshold >= 0;
+}
+
+void alarm_init(void)
+{
+    for (int i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        if (!alarm_rule_valid(&system_state.alarm_rules[i]))
+        {
+            ESP_LOGW(TAG, "Channel %d: invalid stored alarm rule, using the default", i);
+            alarm_rule_default(&system_state.alarm_rules[i]);
+        }
+    }
+}
+
+esp_err_t alarm_set_rule(uint8_t channel, const alarm_rule_t *rule)
+{
+    if (channel >= SENSOR_MAX_COUNT || !alarm_rule_valid(rule))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    taskENTER_CRITICAL(&alarm_rules_lock);
+    system_state.alarm_rules[channel] = *rule;
+    taskEXIT_CRITICAL(&alarm_rules_lock);
+    config_store_mark_dirty(SETTINGS_FIELD_ALARMS);
+    return ESP_OK;
+}
+
+esp_err_t alarm_get_rule(uint8_t channel, alarm_rule_t *rule)
+{
+    if (channel >= SENSOR_MAX_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    taskENTER_CRITICAL(&alarm_rules_lock);
+    *rule = system_state.alarm_rules[channel];
+    taskEXIT_CRITICAL(&alarm_rules_lock);
+    return ESP_OK;
+}
+
+const char *alarm_type_name(alarm_type_t type)
+{
+    static const char *const names[ALARM_TYPE_COUNT] = {"high", "low", "rate"};
+    return type < ALARM_TYPE_COUNT ? names[type] : "unknown";
+}
+
+uint8_t alarm_get_active(uint8_t channel)
+{
+    return channel < SENSOR_MAX_COUNT ? alarm_active[channel] : 0;
+}
+
+bool alarm_any_active(void)
+{
+    for (int i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        if (alarm_active[i])
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void alarm_transition(uint8_t channel, alarm_type_t type, bool active, float value)
+{
+    alarm_event_t event = {.channel = channel, .type = type, .value = value};
+    if (active)
+    {
+        alarm_active[channel] |= 1 << type;
+    }
+    else
+    {
+        alarm_active[channel] &= ~(1 << type);
+    }
+    ESP_LOGW(TAG, "Channel %d %s alarm %s at %.2f", channel, alarm_type_name(type), active ? "raised" : "cleared",
+             value);
+    events_post(active ? EVENT_ALARM_RAISED : EVENT_ALARM_CLEARED, &event, sizeof(event));
+}
+
+// value is compared as "above the threshold", LOW limits pass value and threshold negated
+static void alarm_check(uint8_t channel, alarm_type_t type, const alarm_limit_t *limit, alarm_limit_state_t *state,
+                        float value, float reported, uint32_t now_ms)
+{
+    if (!limit->enabled)
+    {
+        if (state->active)
+        {
+            state->active = false;
+            alarm_transition(channel, type, false, reported);
+        }
+        state->pending = false;
+        return;
+    }
+
+    bool flip = state->active ? value < limit->threshold - limit->hysteresis : value > limit->threshold;
+    if (!flip)
+    {
+        state->pending = false;
+        return;
+    }
+    if (!state->pending)
+    {
+        state->pending = true;
+        state->pending_ms = now_ms;
+    }
+    if (now_ms - state->pending_ms >= limit->min_duration_ms)
+    {
+        state->pending = false;
+        state->active = !state->active;
+        alarm_transition(channel, type, state->active, reported);
+    }
+}
+
+void alarm_evaluate(const float *temperatures, uint8_t channel_mask, uint32_t now_ms)
+{
+    for (uint8_t i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        alarm_channel_state_t *state = &alarm_states[i];
+        float temperature = temperatures[i];
+        bool enabled = channel_mask & (1 << i);
+        if (!enabled || !isfinite(temperature))
+        {
+            // No reading: restart the timers and the rate window; alarms of a
+            // disabled channel clear, a channel that lost its reading keeps them
+            for (int type = 0; type < ALARM_TYPE_COUNT; type++)
+            {
+                state->limits[type].pending = false;
+                if (!enabled && state->limits[type].active)
+                {
+                    state->limits[type].active = false;
+                    alarm_transition(i, type, false, NAN);
+                }
+            }
+            state->history_used = 0;
+            continue;
+        }
+
+        alarm_rule_t rule;
+        alarm_get_rule(i, &rule);
+
+        // Rate against the oldest snapshot in the window
+        uint8_t oldest = (state->history_head + ALARM_RATE_WINDOW - state->history_used) % ALARM_RATE_WINDOW;
+        float rate = 0.0f;
+        if (state->history_used > 0 && now_ms != state->history_ms[oldest])
+        {
+            rate = (temperature - state->history[oldest]) * 60000.0f / (float)(now_ms - state->history_ms[oldest]);
+        }
+        state->history[state->history_head] = temperature;
+        state->history_ms[state->history_head] = now_ms;
+        state->history_head = (state->history_head + 1) % ALARM_RATE_WINDOW;
+        if (state->history_used < ALARM_RATE_WINDOW - 1)
+        {
+            state->history_used++;
+        }
+
+        alarm_check(i, ALARM_TYPE_HIGH, &rule.limits[ALARM_TYPE_HIGH], &state->limits[ALARM_TYPE_HIGH],
+                    temperature, temperature, now_ms);
+        alarm_limit_t low = rule.limits[ALARM_TYPE_LOW];
+        low.threshold = -low.threshold;
+        alarm_check(i, ALARM_TYPE_LOW, &low, &state->limits[ALARM_TYPE_LOW], -temperature, temperature, now_ms);
+        if (state->history_used > 1 || state->limits[ALARM_TYPE_RATE].active)
+        {
+            alarm_check(i, ALARM_TYPE_RATE, &rule.limits[ALARM_TYPE_RATE], &state->limits[ALARM_TYPE_RATE],
+                        fabsf(rate), rate, now_ms);
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef ALARM_H
+#define ALARM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "config.h"
+
+#define ALARM_MIN_DURATION_MAX_MS 600000
+
+typedef enum
+{
+    ALARM_TYPE_HIGH = 0, // temperature above the threshold
+    ALARM_TYPE_LOW,      // temperature below the threshold
+    ALARM_TYPE_RATE,     // temperature changing faster than the threshold, either way
+    ALARM_TYPE_COUNT
+} alarm_type_t;
+
+typedef struct
+{
+    bool enabled;
+    float threshold;          // °C, °C/min for ALARM_TYPE_RATE
+    float hysteresis;         // distance back inside the threshold needed to clear
+    uint32_t min_duration_ms; // the condition must hold this long to raise or clear
+} alarm_limit_t;
+
+typedef struct
+{
+    alarm_limit_t limits[ALARM_TYPE_COUNT];
+} alarm_rule_t;
+
+// Data of EVENT_ALARM_RAISED and EVENT_ALARM_CLEARED
+typedef struct
+{
+    uint8_t channel;
+    uint8_t type;  // alarm_type_t
+    float value;   // °C, °C/min for ALARM_TYPE_RATE
+} alarm_event_t;
+
+/**
+ * @brief Fill in the default rule from the Kconfig "Alarms" menu.
+ */
+void alarm_rule_default(alarm_rule_t *rule);
+
+/**
+ * @brief Check for finite thresholds, non-negative hysteresis and rate threshold,
+ * and a duration of at most ALARM_MIN_DURATION_MAX_MS.
+ */
+bool alarm_rule_valid(const alarm_rule_t *rule);
+
+/**
+ * @brief Check the rules stored in system_state; invalid ones get the default rule.
+ */
+void alarm_init(void);
+
+/**
+ * @brief Change the rule of a channel and store it in the config.
+ * @return ESP_ERR_INVALID_ARG for an invalid channel or rule.
+ */
+esp_err_t alarm_set_rule(uint8_t channel, const alarm_rule_t *rule);
+
+esp_err_t alarm_get_rule(uint8_t channel, alarm_rule_t *rule);
+
+/**
+ * @brief Evaluate all rules against a snapshot; transitions are posted as
+ * EVENT_ALARM_RAISED / EVENT_ALARM_CLEARED. Constant work per channel.
+ * Called on the temperature task after each published snapshot.
+ * @param temperatures °C per channel; non-finite values are skipped.
+ */
+void alarm_evaluate(const float *temperatures, uint8_t channel_mask, uint32_t now_ms);
+
+const char *alarm_type_name(alarm_type_t type);
+
+/**
+ * @brief Active alarms of a channel as a bitmask of (1 << alarm_type_t).
+ */
+uint8_t alarm_get_active(uint8_t channel);
+
+/**
+ * @brief Check whether any channel has an active alarm.
+ */
+bool alarm_any_active(void);
+
+#endif // ALARM_H
@@ -0,0 +1,121 @@
+#include "asset_store.h"
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+
+static const char *TAG = "asset_store";
+
+static const uint8_t *asset_base = NULL;
+static const asset_entry_t *asset_index = NULL;
+static uint16_t asset_count = 0;
+static esp_partition_mmap_handle_t asset_mmap_handle;
+
+esp_err_t asset_store_init(void)
+{
+    if (asset_base != NULL)
+    {
+        return ESP_OK;
+    }
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ASSET_PARTITION_SUBTYPE, ASSET_PARTITION_LABEL);
+    if (partition == NULL)
+    {
+        ESP_LOGE(TAG, "Asset partition '%s' not found", ASSET_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    const void *mapped = NULL;
+    esp_err_t err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &mapped, &asset_mmap_handle);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to map asset partition: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    const asset_header_t *header = (const asset_header_t *)mapped;
+    size_t index_end = sizeof(asset_header_t) + (size_t)header->count * sizeof(asset_entry_t);
+    if (header->magic != ASSET_MAGIC || header->version != ASSET_VERSION ||
+        header->image_size > partition->size || index_end > header->image_size)
+    {
+        ESP_LOGE(TAG, "Asset partition holds no valid image (magic 0x%08lx, version %d)", (unsigned long)header->magic, header->version);
+        esp_partition_munmap(asset_mmap_handle);
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    asset_base = (const uint8_t *)mapped;
+    asset_index = (const asset_entry_t *)(asset_base + sizeof(asset_header_t));
+    asset_count = header->count;
+
+    ESP_LOGI(TAG, "Mapped %d assets, %lu bytes", asset_count, (unsigned long)header->image_size);
+    return ESP_OK;
+}
+
+// Compare a NUL-padded index path with a length-bounded request path
+static int compare_path(const char *entry_path, const char *path, size_t path_len)
+{
+    int cmp = strncmp(entry_path, path, path_len);
+    if (cmp != 0)
+    {
+        return cmp;
+    }
+    // Equal prefix: the entry is longer unless it ends here
+    return (path_len < ASSET_PATH_MAX && entry_path[path_len] != '\0') ? 1 : 0;
+}
+
+const asset_entry_t *asset_store_find(const char *path, size_t path_len)
+{
+    if (asset_index == NULL || path == NULL)
+    {
+        return NULL;
+    }
+
+    // Index paths always carry the leading '/'
+    char key[ASSET_PATH_MAX];
+    if (path_len > 0 && path[0] == '/')
+    {
+        path++;
+        path_len--;
+    }
+    if (path_len + 1 >= sizeof(key))
+    {
+        return NULL;
+    }
+    key[0] = '/';
+    memcpy(key + 1, path, path_len);
+    path_len++;
+
+    size_t lo = 0;
+    size_t hi = asset_count;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = compare_path(asset_index[mid].path, key, path_len);
+        if (cmp == 0)
+        {
+            return &asset_index[mid];
+        }
+        if (cmp < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t asset_store_send(httpd_req_t *req, const char *path, size_t path_len)
+{
+    const asset_entry_t *entry = asset_store_find(path, path_len);
+    if (entry == NULL)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ESP_LOGI(TAG, "Serving asset %s (%lu bytes) from flash", entry->path, (unsigned long)entry->size);
+    httpd_resp_set_type(req, entry->mime);
+    // The blob is sent straight from the cache-mapped partition, no intermediate buffer
+    return httpd_resp_send(req, (const char *)(asset_base + entry->offset), entry->size);
+}
@@ -0,0 +1,54 @@
+#ifndef ASSET_STORE_H
+#define ASSET_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+#define ASSET_PARTITION_LABEL "assets"
+#define ASSET_PARTITION_SUBTYPE 0x40
+#define ASSET_MAGIC 0x53545341 // "ASTS"
+#define ASSET_VERSION 1
+#define ASSET_PATH_MAX 64
+#define ASSET_MIME_MAX 32
+
+// Image header, followed by `count` index entries (see tools/mkassets.py)
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t image_size;
+} asset_header_t;
+
+typedef struct
+{
+    char path[ASSET_PATH_MAX];
+    char mime[ASSET_MIME_MAX];
+    uint32_t offset;
+    uint32_t size;
+} asset_entry_t;
+
+/**
+ * @brief Map the asset partition into the data address space and validate its index.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the partition is missing,
+ *         ESP_ERR_INVALID_VERSION if the image is not valid.
+ */
+esp_err_t asset_store_init(void);
+
+/**
+ * @brief Look up an asset by path.
+ * @param path Path relative to the web root, with or without a leading '/'.
+ * @param path_len Number of characters of `path` to compare (e.g. up to the query string).
+ * @return Index entry, or NULL if the store is not mapped or the asset does not exist.
+ */
+const asset_entry_t *asset_store_find(const char *path, size_t path_len);
+
+/**
+ * @brief Send an asset as the complete HTTP response, straight from mapped flash.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the asset does not exist.
+ */
+esp_err_t asset_store_send(httpd_req_t *req, const char *path, size_t path_len);
+
+#endif // ASSET_STORE_H
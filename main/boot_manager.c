@@ -0,0 +1,125 @@
+#include "boot_manager.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "boot";
+
+static EventGroupHandle_t boot_events = NULL;
+static boot_record_t boot_timeline[BOOT_STEP_COUNT];
+
+static void boot_step_task(void *pvParameter)
+{
+    const boot_step_t *step = (const boot_step_t *)pvParameter;
+
+    if (step->deps != 0)
+    {
+        // Same deadline as boot_run(), a dependency that never finishes must not block the task forever
+        EventBits_t done = xEventGroupWaitBits(boot_events, step->deps, pdFALSE, pdTRUE, pdMS_TO_TICKS(BOOT_TIMEOUT_MS));
+        if ((done & step->deps) != step->deps)
+        {
+            for (int i = 0; i < BOOT_STEP_COUNT; i++)
+            {
+                if ((step->deps & ~done) & BOOT_DEP(i))
+                {
+                    ESP_LOGE(TAG, "Skipping %s, %s not done after %d ms", step->name,
+                             boot_timeline[i].name != NULL ? boot_timeline[i].name : "?", BOOT_TIMEOUT_MS);
+                }
+            }
+            vTaskDelete(NULL);
+            return;
+        }
+    }
+
+    boot_record_t *record = &boot_timeline[step->id];
+    record->core = xPortGetCoreID();
+    record->start_us = esp_timer_get_time();
+    step->run();
+    record->end_us = esp_timer_get_time();
+
+    xEventGroupSetBits(boot_events, BOOT_DEP(step->id));
+    vTaskDelete(NULL);
+}
+
+static void boot_log_timeline(void)
+{
+    ESP_LOGI(TAG, "Boot timeline (ms since start):");
+    for (int i = 0; i < BOOT_STEP_COUNT; i++)
+    {
+        const boot_record_t *record = &boot_timeline[i];
+        if (record->name == NULL)
+        {
+            continue;
+        }
+        if (record->end_us == 0)
+        {
+            ESP_LOGW(TAG, "  %-14s pending", record->name);
+        }
+        else if (record->start_us == record->end_us)
+        {
+            ESP_LOGI(TAG, "  %-14s reached at %lld", record->name, record->end_us / 1000);
+        }
+        else
+        {
+            ESP_LOGI(TAG, "  %-14s core %d  %6lld .. %6lld  (%lld ms)", record->name, record->core,
+                     record->start_us / 1000, record->end_us / 1000, (record->end_us - record->start_us) / 1000);
+        }
+    }
+}
+
+void boot_run(const boot_step_t *steps, size_t count)
+{
+    boot_events = xEventGroupCreate();
+    if (boot_events == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create boot event group");
+        abort();
+    }
+
+    EventBits_t all_steps = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        boot_timeline[steps[i].id].name = steps[i].name;
+        all_steps |= BOOT_DEP(steps[i].id);
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (steps[i].run == NULL)
+        {
+            continue; // Milestone
+        }
+        if (xTaskCreatePinnedToCore(boot_step_task, steps[i].name, TASK_BOOT_STEP_STACK_SIZE, (void *)&steps[i],
+                                    TASK_BOOT_STEP_PRIORITY, NULL, steps[i].core) != pdPASS)
+        {
+            ESP_LOGE(TAG, "Failed to start boot step %s", steps[i].name);
+        }
+    }
+
+    EventBits_t done = xEventGroupWaitBits(boot_events, all_steps, pdFALSE, pdTRUE, pdMS_TO_TICKS(BOOT_TIMEOUT_MS));
+    if ((done & all_steps) != all_steps)
+    {
+        ESP_LOGW(TAG, "Boot not finished after %d ms", BOOT_TIMEOUT_MS);
+    }
+    boot_log_timeline();
+}
+
+void boot_mark_done(boot_step_id_t id)
+{
+    if (boot_events == NULL || id >= BOOT_STEP_COUNT || boot_timeline[id].end_us != 0)
+    {
+        return;
+    }
+    boot_record_t *record = &boot_timeline[id];
+    record->core = xPortGetCoreID();
+    record->end_us = esp_timer_get_time();
+    record->start_us = record->end_us;
+    xEventGroupSetBits(boot_events, BOOT_DEP(id));
+}
+
+const boot_record_t *boot_get_timeline(size_t *count)
+{
+    *count = BOOT_STEP_COUNT;
+    return boot_timeline;
+}
@@ -0,0 +1,66 @@
+#ifndef BOOT_MANAGER_H
+#define BOOT_MANAGER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "config.h"
+
+// Boot steps and milestones, at most 24 (one event group bit each)
+typedef enum
+{
+    BOOT_STEP_SYSTEM = 0,   // system state, config store, NVS
+    BOOT_STEP_EVENTS,       // custom event loop
+    BOOT_STEP_ADC,          // ADC and temperature task
+    BOOT_STEP_FIRST_READING,// milestone: first sample stored by the temperature task
+    BOOT_STEP_LCD,          // I2C bus and LCD
+    BOOT_STEP_UI,           // status LED and button
+    BOOT_STEP_WIFI,         // TCP/IP stack and WiFi event handlers
+    BOOT_STEP_WIFI_CONNECT, // WiFi started in the configured mode
+    BOOT_STEP_HTTP,         // asset store and HTTP server
+    BOOT_STEP_START_SCREEN, // LCD leaves the splash screen
+    BOOT_STEP_HISTORY,      // history store recovered, recording started
+    BOOT_STEP_COUNT,
+} boot_step_id_t;
+
+#define BOOT_DEP(step) (1UL << (step))
+
+typedef struct
+{
+    boot_step_id_t id;
+    const char *name;
+    void (*run)(void); // NULL for milestones, marked with boot_mark_done()
+    uint32_t deps;     // BOOT_DEP() mask of steps that have to finish first
+    BaseType_t core;
+} boot_step_t;
+
+typedef struct
+{
+    const char *name;
+    int64_t start_us; // esp_timer time, 0 if the step has not started
+    int64_t end_us;   // esp_timer time, 0 if the step has not finished
+    int8_t core;
+} boot_record_t;
+
+/**
+ * @brief Run the boot steps, each on its own task as soon as its dependencies are done.
+ * A step whose dependencies are not done within BOOT_TIMEOUT_MS is skipped, and so are
+ * the steps depending on it. Blocks until all steps finished or BOOT_TIMEOUT_MS passed,
+ * then logs the timeline.
+ * @param steps Step table, has to stay valid while booting.
+ * @param count Number of entries in steps.
+ */
+void boot_run(const boot_step_t *steps, size_t count);
+
+/**
+ * @brief Mark a milestone (a step without run function) as reached.
+ */
+void boot_mark_done(boot_step_id_t id);
+
+/**
+ * @brief Get the boot timeline, indexed by boot_step_id_t.
+ * @param count Set to BOOT_STEP_COUNT.
+ */
+const boot_record_t *boot_get_timeline(size_t *count);
+
+#endif // BOOT_MANAGER_H
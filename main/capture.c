@@ -0,0 +1,376 @@
+#include "capture.h"
+#include <math.h>
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "ntc_adc.h"
+
+// Pending requests for the temperature task
+#define CAPTURE_PENDING_ARM    0x01
+#define CAPTURE_PENDING_DISARM 0x02
+#define CAPTURE_PENDING_FIRE   0x04
+
+static const char *TAG = "capture";
+
+typedef struct
+{
+    int64_t time_us;
+    uint16_t length; // bytes, 0: slot empty
+} capture_frame_info_t;
+
+// Placed in PSRAM when the build allows .bss there, internal RAM otherwise
+static EXT_RAM_BSS_ATTR uint8_t capture_ring[CAPTURE_FRAMES][CAPTURE_FRAME_SIZE];
+static capture_frame_info_t capture_info[CAPTURE_FRAMES];
+// Frames read while the ring is frozen
+static uint8_t capture_spare[CAPTURE_FRAME_SIZE];
+
+// Only touched by the temperature task
+static uint16_t capture_head; // slot the next frame is read into
+static uint16_t capture_used;
+static bool capture_into_spare;
+static uint16_t capture_start;       // first slot of the capture
+static uint16_t capture_pre_frames;  // up to and including the trigger frame
+static uint16_t capture_post_frames;
+static uint16_t capture_post_max;
+static float slope_means[CAPTURE_SLOPE_FRAMES];
+static int64_t slope_times[CAPTURE_SLOPE_FRAMES];
+static uint8_t slope_head;
+static uint8_t slope_used;
+
+// Shared with the API, under capture_lock
+static portMUX_TYPE capture_lock = portMUX_INITIALIZER_UNLOCKED;
+static volatile capture_state_t capture_state = CAPTURE_RECORDING;
+static volatile uint8_t capture_pending = 0;
+static bool capture_reading = false; // a download holds the frozen ring
+static capture_trigger_t capture_trigger;
+static capture_trigger_t staged_trigger;
+static capture_status_t capture_result;
+static uint32_t capture_rate_hz;
+
+void capture_set_rate(uint32_t rate_hz)
+{
+    capture_rate_hz = rate_hz;
+}
+
+uint8_t *capture_frame_buffer(void)
+{
+    capture_into_spare = capture_state == CAPTURE_FROZEN;
+    return capture_into_spare ? capture_spare : capture_ring[capture_head];
+}
+
+static void capture_apply_pending(void)
+{
+    taskENTER_CRITICAL(&capture_lock);
+    uint8_t pending = capture_pending;
+    capture_pending = 0;
+    if (pending & (CAPTURE_PENDING_ARM | CAPTURE_PENDING_DISARM))
+    {
+        capture_trigger = staged_trigger;
+        capture_state = (pending & CAPTURE_PENDING_ARM) ? CAPTURE_ARMED : CAPTURE_RECORDING;
+        capture_result.frames = 0;
+        capture_result.conversions = 0;
+    }
+    // A manual trigger fires with the next frame unless a capture is already running
+    if ((pending & CAPTURE_PENDING_FIRE) && (capture_state == CAPTURE_RECORDING || capture_state == CAPTURE_ARMED))
+    {
+        capture_pending = CAPTURE_PENDING_FIRE;
+    }
+    taskEXIT_CRITICAL(&capture_lock);
+
+    if (pending & (CAPTURE_PENDING_ARM | CAPTURE_PENDING_DISARM))
+    {
+        // Frames before a frozen capture are not contiguous with what follows
+        capture_used = 0;
+        slope_used = 0;
+    }
+}
+
+// Slope: change of the channel's frame mean over the last CAPTURE_SLOPE_FRAMES frames
+static bool capture_check_slope(float mean, int64_t time_us)
+{
+    slope_means[slope_head] = mean;
+    slope_times[slope_head] = time_us;
+    slope_head = (slope_head + 1) % CAPTURE_SLOPE_FRAMES;
+    if (slope_used < CAPTURE_SLOPE_FRAMES)
+    {
+        slope_used++;
+        return false;
+    }
+    // The slot after the newest holds the oldest entry
+    float delta = mean - slope_means[slope_head];
+    int64_t span_us = time_us - slope_times[slope_head];
+    return span_us > 0 && fabsf(delta) * 1e6f / span_us > capture_trigger.level;
+}
+
+static bool capture_check_trigger(uint16_t slot)
+{
+    const capture_trigger_t *trigger = &capture_trigger;
+    if (trigger->type == CAPTURE_TRIGGER_MANUAL)
+    {
+        return false;
+    }
+    const uint8_t *frame = capture_ring[slot];
+    uint32_t sum = 0;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i + sizeof(adc_digi_output_data_t) <= capture_info[slot].length; i += sizeof(adc_digi_output_data_t))
+    {
+        const adc_digi_output_data_t *data = (const adc_digi_output_data_t *)&frame[i];
+        if (data->type1.channel != trigger->channel)
+        {
+            continue;
+        }
+        uint16_t code = data->type1.data;
+        if (trigger->type == CAPTURE_TRIGGER_SLOPE)
+        {
+            sum += code;
+            count++;
+            continue;
+        }
+        // NAN (code outside the table) never fires
+        float temperature = ntc_adc_raw_to_temperature(trigger->channel, code);
+        if (trigger->type == CAPTURE_TRIGGER_ABOVE ? temperature > trigger->level : temperature < trigger->level)
+        {
+            return true;
+        }
+    }
+    if (trigger->type != CAPTURE_TRIGGER_SLOPE || count == 0)
+    {
+        return false;
+    }
+    float mean = ntc_adc_raw_to_temperature(trigger->channel, (uint16_t)((sum + count / 2) / count));
+    return isfinite(mean) && capture_check_slope(mean, capture_info[slot].time_us);
+}
+
+static void capture_freeze(void)
+{
+    uint16_t frames = capture_pre_frames + capture_post_frames;
+    uint32_t conversions = 0;
+    for (uint16_t n = 0; n < frames; n++)
+    {
+        conversions += capture_info[(capture_start + n) % CAPTURE_FRAMES].length / sizeof(adc_digi_output_data_t);
+    }
+    uint16_t last = (capture_start + frames - 1) % CAPTURE_FRAMES;
+
+    taskENTER_CRITICAL(&capture_lock);
+    capture_result.frames = frames;
+    capture_result.conversions = conversions;
+    capture_result.first_us = capture_info[capture_start].time_us;
+    capture_result.last_us = capture_info[last].time_us;
+    capture_result.captures++;
+    capture_state = CAPTURE_FROZEN;
+    taskEXIT_CRITICAL(&capture_lock);
+    ESP_LOGI(TAG, "Captured %d frames, %lu conversions, %lld ms before and %lld ms after the trigger", frames,
+             (unsigned long)conversions, (capture_result.trigger_us - capture_result.first_us) / 1000,
+             (capture_result.last_us - capture_result.trigger_us) / 1000);
+}
+
+// Keep the pre-trigger window behind the trigger frame, leave the rest of the ring to the post-trigger window
+static void capture_fire(uint16_t slot)
+{
+    int64_t trigger_us = capture_info[slot].time_us;
+    uint16_t pre_max = capture_trigger.pre_ms > 0 ? CAPTURE_FRAMES - 1 : CAPTURE_FRAMES / 2;
+    uint16_t pre_frames = 1;
+    while (pre_frames < capture_used && pre_frames < pre_max)
+    {
+        const capture_frame_info_t *previous = &capture_info[(slot + CAPTURE_FRAMES - pre_frames) % CAPTURE_FRAMES];
+        if (capture_trigger.pre_ms > 0 && trigger_us - previous->time_us > capture_trigger.pre_ms * 1000LL)
+        {
+            break;
+        }
+        pre_frames++;
+    }
+    capture_start = (slot + CAPTURE_FRAMES + 1 - pre_frames) % CAPTURE_FRAMES;
+    capture_pre_frames = pre_frames;
+    capture_post_frames = 0;
+    capture_post_max = CAPTURE_FRAMES - pre_frames;
+
+    taskENTER_CRITICAL(&capture_lock);
+    capture_result.trigger_us = trigger_us;
+    capture_state = CAPTURE_TRIGGERED;
+    taskEXIT_CRITICAL(&capture_lock);
+    ESP_LOGI(TAG, "Trigger fired");
+    if (capture_post_max == 0)
+    {
+        capture_freeze();
+    }
+}
+
+void capture_commit(uint32_t length, int64_t time_us)
+{
+    if (capture_pending)
+    {
+        capture_apply_pending();
+    }
+    if (capture_into_spare || length == 0 || capture_state == CAPTURE_FROZEN)
+    {
+        return;
+    }
+
+    uint16_t slot = capture_head;
+    capture_info[slot].time_us = time_us;
+    capture_info[slot].length = (uint16_t)MIN(length, CAPTURE_FRAME_SIZE);
+    capture_head = (capture_head + 1) % CAPTURE_FRAMES;
+    capture_used = MIN(capture_used + 1, CAPTURE_FRAMES);
+
+    if (capture_state == CAPTURE_TRIGGERED)
+    {
+        capture_post_frames++;
+        if (capture_post_frames >= capture_post_max ||
+            (capture_trigger.post_ms > 0 && time_us - capture_result.trigger_us >= capture_trigger.post_ms * 1000LL))
+        {
+            capture_freeze();
+        }
+        return;
+    }
+
+    bool fire = (capture_pending & CAPTURE_PENDING_FIRE) != 0;
+    if (capture_state == CAPTURE_ARMED && !fire)
+    {
+        fire = capture_check_trigger(slot);
+    }
+    if (fire)
+    {
+        taskENTER_CRITICAL(&capture_lock);
+        capture_pending &= ~CAPTURE_PENDING_FIRE;
+        taskEXIT_CRITICAL(&capture_lock);
+        capture_fire(slot);
+    }
+}
+
+// Stage a request for the temperature task, refused while a download holds the ring
+static esp_err_t capture_request(uint8_t request, const capture_trigger_t *trigger)
+{
+    esp_err_t err = ESP_OK;
+    taskENTER_CRITICAL(&capture_lock);
+    if (capture_reading)
+    {
+        err = ESP_ERR_INVALID_STATE;
+    }
+    else
+    {
+        if (trigger != NULL)
+        {
+            staged_trigger = *trigger;
+        }
+        capture_pending |= request;
+    }
+    taskEXIT_CRITICAL(&capture_lock);
+    return err;
+}
+
+esp_err_t capture_arm(const capture_trigger_t *trigger)
+{
+    if (trigger->type > CAPTURE_TRIGGER_SLOPE || !isfinite(trigger->level) ||
+        (trigger->type != CAPTURE_TRIGGER_MANUAL && trigger->channel >= SENSOR_MAX_COUNT) ||
+        (trigger->type == CAPTURE_TRIGGER_SLOPE && trigger->level <= 0))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = capture_request(CAPTURE_PENDING_ARM, trigger);
+    if (err == ESP_OK)
+    {
+        ESP_LOGI(TAG, "Armed: type %d, channel %d, level %.2f, %lu ms / %lu ms", trigger->type, trigger->channel,
+                 trigger->level, (unsigned long)trigger->pre_ms, (unsigned long)trigger->post_ms);
+    }
+    return err;
+}
+
+esp_err_t capture_trigger_now(void)
+{
+    return capture_request(CAPTURE_PENDING_FIRE, NULL);
+}
+
+esp_err_t capture_disarm(void)
+{
+    capture_trigger_t manual = {.type = CAPTURE_TRIGGER_MANUAL};
+    return capture_request(CAPTURE_PENDING_DISARM, &manual);
+}
+
+bool capture_is_armed(void)
+{
+    capture_state_t state = capture_state;
+    return state == CAPTURE_ARMED || state == CAPTURE_TRIGGERED || (capture_pending & CAPTURE_PENDING_ARM);
+}
+
+void capture_get_status(capture_status_t *status)
+{
+    taskENTER_CRITICAL(&capture_lock);
+    *status = capture_result;
+    status->state = capture_state;
+    status->trigger = capture_trigger;
+    taskEXIT_CRITICAL(&capture_lock);
+    status->frame_capacity = CAPTURE_FRAMES;
+    status->rate_hz = capture_rate_hz;
+}
+
+esp_err_t capture_write(chunk_writer_t *writer, bool binary)
+{
+    taskENTER_CRITICAL(&capture_lock);
+    bool available = capture_state == CAPTURE_FROZEN && capture_pending == 0 && !capture_reading;
+    if (available)
+    {
+        capture_reading = true;
+    }
+    taskEXIT_CRITICAL(&capture_lock);
+    if (!available)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // The frozen ring is only read from here on, the temperature task reads into the spare slot
+    uint32_t period_us = capture_rate_hz > 0 ? 1000000 / capture_rate_hz : 0;
+    uint16_t frames = capture_result.frames;
+    if (binary)
+    {
+        capture_file_header_t header = {
+            .magic = CAPTURE_FILE_MAGIC,
+            .version = CAPTURE_FILE_VERSION,
+            .sample_size = sizeof(adc_digi_output_data_t),
+            .frames = frames,
+            .rate_hz = capture_rate_hz,
+            .trigger_us = capture_result.trigger_us,
+        };
+        chunk_writer_write(writer, &header, sizeof(header));
+    }
+    else
+    {
+        chunk_writer_printf(writer, "time_us,channel,code,temperature\n");
+    }
+    for (uint16_t n = 0; n < frames && chunk_writer_ok(writer); n++)
+    {
+        uint16_t slot = (capture_start + n) % CAPTURE_FRAMES;
+        const capture_frame_info_t *info = &capture_info[slot];
+        if (binary)
+        {
+            chunk_writer_write(writer, &info->time_us, sizeof(info->time_us));
+            chunk_writer_write(writer, &info->length, sizeof(info->length));
+            chunk_writer_write(writer, capture_ring[slot], info->length);
+            continue;
+        }
+        // The read returned with the last conversion of the frame
+        uint16_t count = info->length / sizeof(adc_digi_output_data_t);
+        for (uint16_t k = 0; k < count; k++)
+        {
+            const adc_digi_output_data_t *data = (const adc_digi_output_data_t *)&capture_ring[slot][k * sizeof(adc_digi_output_data_t)];
+            int64_t time_us = info->time_us - (int64_t)(count - 1 - k) * period_us;
+            uint8_t channel = data->type1.channel;
+            uint16_t code = data->type1.data;
+            float temperature = channel < SENSOR_MAX_COUNT ? ntc_adc_raw_to_temperature(channel, code) : NAN;
+            if (isfinite(temperature))
+            {
+                chunk_writer_printf(writer, "%lld,%d,%d,%.2f\n", time_us, channel, code, temperature);
+            }
+            else
+            {
+                chunk_writer_printf(writer, "%lld,%d,%d,\n", time_us, channel, code);
+            }
+        }
+    }
+
+    taskENTER_CRITICAL(&capture_lock);
+    capture_reading = false;
+    taskEXIT_CRITICAL(&capture_lock);
+    return ESP_OK;
+}
@@ -0,0 +1,129 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "config.h"
+#include "chunk_writer.h"
+
+// One slot holds one ADC frame as the driver delivers it
+#define CAPTURE_FRAME_SIZE 256
+#define CAPTURE_FRAMES (CONFIG_CAPTURE_BUFFER_KB * 1024 / CAPTURE_FRAME_SIZE)
+// Frames the slope trigger measures over
+#define CAPTURE_SLOPE_FRAMES 8
+
+#define CAPTURE_FILE_MAGIC   0x4343544E // "NTCC"
+#define CAPTURE_FILE_VERSION 1
+
+/*
+ * Transient capture. The temperature task reads every ADC frame straight
+ * into the next slot of a fixed ring, so the last CAPTURE_FRAMES frames of
+ * raw conversions are always at hand without another copy. When the armed
+ * trigger fires, the frames of the pre-trigger window are kept, recording
+ * goes on for the post-trigger window and then the ring is frozen until it
+ * has been downloaded and re-armed. While the capture is armed the sample
+ * scheduler does not pause the ADC.
+ */
+typedef enum
+{
+    CAPTURE_TRIGGER_MANUAL = 0, // only capture_trigger_now()
+    CAPTURE_TRIGGER_ABOVE,      // one conversion of the channel above level °C
+    CAPTURE_TRIGGER_BELOW,      // one conversion of the channel below level °C
+    CAPTURE_TRIGGER_SLOPE,      // frame mean changing faster than level °C/s, either way
+} capture_trigger_type_t;
+
+typedef enum
+{
+    CAPTURE_RECORDING = 0, // ring running, no trigger armed
+    CAPTURE_ARMED,         // waiting for the trigger
+    CAPTURE_TRIGGERED,     // recording the post-trigger window
+    CAPTURE_FROZEN,        // capture complete, ready for download
+} capture_state_t;
+
+typedef struct
+{
+    uint8_t type;     // capture_trigger_type_t
+    uint8_t channel;  // physical channel, ignored for CAPTURE_TRIGGER_MANUAL
+    float level;      // °C, °C/s for CAPTURE_TRIGGER_SLOPE
+    uint32_t pre_ms;  // window kept before the trigger, 0: half the ring
+    uint32_t post_ms; // window recorded after the trigger, 0: the rest of the ring
+} capture_trigger_t;
+
+typedef struct
+{
+    capture_state_t state;
+    capture_trigger_t trigger;
+    uint16_t frame_capacity;
+    uint16_t frames;      // frames of the frozen capture
+    uint32_t conversions; // conversions of the frozen capture
+    uint32_t rate_hz;     // ADC conversion rate
+    int64_t trigger_us;   // esp_timer time of the frame that fired the trigger
+    int64_t first_us;     // capture window
+    int64_t last_us;
+    uint32_t captures;    // completed since boot
+} capture_status_t;
+
+/*
+ * Binary download, little-endian: this header, then per frame i64 time_us,
+ * u16 length and `length` bytes of adc_digi_output_data_t as read from the ADC.
+ */
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint8_t version;
+    uint8_t sample_size; // bytes per conversion
+    uint16_t frames;
+    uint32_t rate_hz;    // conversions per second, spacing of the conversions in a frame
+    int64_t trigger_us;  // time_us of the frame that fired the trigger
+} capture_file_header_t;
+
+/**
+ * @brief Conversion rate of the ADC, used to time the conversions inside a frame.
+ */
+void capture_set_rate(uint32_t rate_hz);
+
+/**
+ * @brief Buffer for the next ADC frame (CAPTURE_FRAME_SIZE bytes). Temperature task only.
+ */
+uint8_t *capture_frame_buffer(void);
+
+/**
+ * @brief Hand over the frame read into capture_frame_buffer(): evaluate the trigger and advance the ring.
+ * Temperature task only.
+ * @param time_us esp_timer time the read returned, taken as the time of the last conversion.
+ */
+void capture_commit(uint32_t length, int64_t time_us);
+
+/**
+ * @brief Arm a trigger; the current capture is discarded.
+ * @return ESP_ERR_INVALID_ARG for an invalid trigger, ESP_ERR_INVALID_STATE while a download runs.
+ */
+esp_err_t capture_arm(const capture_trigger_t *trigger);
+
+/**
+ * @brief Fire the trigger with the next frame, armed or not.
+ */
+esp_err_t capture_trigger_now(void);
+
+/**
+ * @brief Drop the trigger and the capture, back to CAPTURE_RECORDING.
+ */
+esp_err_t capture_disarm(void);
+
+/**
+ * @brief Whether a trigger is armed or firing, the ADC has to run continuously.
+ */
+bool capture_is_armed(void);
+
+void capture_get_status(capture_status_t *status);
+
+/**
+ * @brief Write the frozen capture as CSV (time_us,channel,code,temperature per conversion)
+ * or binary (per frame: i64 time_us, u16 length, the raw ADC frame).
+ * @return ESP_ERR_INVALID_STATE if there is no frozen capture.
+ */
+esp_err_t capture_write(chunk_writer_t *writer, bool binary);
+
+#endif // CAPTURE_H
@@ -0,0 +1,101 @@
+#include "chunk_writer.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+void chunk_writer_init(chunk_writer_t *writer, httpd_req_t *req)
+{
+    writer->req = req;
+    writer->err = ESP_OK;
+    writer->done = false;
+    writer->length = 0;
+    writer->position = 0;
+    writer->range_start = 0;
+    writer->range_end = UINT64_MAX;
+}
+
+void chunk_writer_set_range(chunk_writer_t *writer, uint64_t start, uint64_t end)
+{
+    writer->range_start = start;
+    writer->range_end = end;
+}
+
+bool chunk_writer_ok(const chunk_writer_t *writer)
+{
+    return writer->err == ESP_OK && !writer->done;
+}
+
+static void chunk_writer_flush(chunk_writer_t *writer)
+{
+    uint64_t start = MAX(writer->position, writer->range_start);
+    uint64_t end = writer->position + writer->length;
+    if (writer->range_end < end)
+    {
+        end = writer->range_end + 1;
+    }
+    if (writer->req != NULL && writer->err == ESP_OK && start < end)
+    {
+        writer->err = httpd_resp_send_chunk(writer->req, writer->buffer + (start - writer->position), end - start);
+    }
+    writer->position += writer->length;
+    writer->length = 0;
+    if (writer->range_end != UINT64_MAX && writer->position > writer->range_end)
+    {
+        writer->done = true;
+    }
+}
+
+void chunk_writer_write(chunk_writer_t *writer, const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    while (length > 0 && writer->err == ESP_OK)
+    {
+        size_t n = MIN(length, sizeof(writer->buffer) - writer->length);
+        memcpy(writer->buffer + writer->length, bytes, n);
+        writer->length += n;
+        bytes += n;
+        length -= n;
+        if (writer->length == sizeof(writer->buffer))
+        {
+            chunk_writer_flush(writer);
+        }
+    }
+}
+
+void chunk_writer_printf(chunk_writer_t *writer, const char *format, ...)
+{
+    for (int attempt = 0; attempt < 2 && writer->err == ESP_OK; attempt++)
+    {
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(writer->buffer + writer->length, sizeof(writer->buffer) - writer->length, format, args);
+        va_end(args);
+        if (n < 0 || (size_t)n >= sizeof(writer->buffer))
+        {
+            writer->err = ESP_ERR_INVALID_SIZE;
+            return;
+        }
+        if (writer->length + n < sizeof(writer->buffer))
+        {
+            writer->length += n;
+            return;
+        }
+        chunk_writer_flush(writer);
+    }
+}
+
+uint64_t chunk_writer_size(const chunk_writer_t *writer)
+{
+    return writer->position + writer->length;
+}
+
+esp_err_t chunk_writer_finish(chunk_writer_t *writer)
+{
+    chunk_writer_flush(writer);
+    if (writer->req != NULL && writer->err == ESP_OK)
+    {
+        writer->err = httpd_resp_send_chunk(writer->req, NULL, 0);
+    }
+    return writer->err;
+}
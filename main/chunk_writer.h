@@ -0,0 +1,61 @@
+#ifndef CHUNK_WRITER_H
+#define CHUNK_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// Size of the chunks streamed responses are sent in
+#define CHUNK_WRITER_SIZE 1024
+
+/*
+ * Buffers small writes into chunks of a chunked HTTP response. Only the
+ * bytes inside the selected range are sent, so a Range request can be
+ * answered by generating the body again and skipping the start. Without a
+ * request the writer only counts bytes.
+ */
+typedef struct
+{
+    httpd_req_t *req;     // NULL to count only
+    esp_err_t err;        // first error seen
+    bool done;            // the end of the range has been passed
+    size_t length;        // bytes in buffer
+    uint64_t position;    // body offset of buffer[0]
+    uint64_t range_start;
+    uint64_t range_end;   // inclusive
+    char buffer[CHUNK_WRITER_SIZE];
+} chunk_writer_t;
+
+/**
+ * @brief Prepare a writer for the whole body.
+ */
+void chunk_writer_init(chunk_writer_t *writer, httpd_req_t *req);
+
+/**
+ * @brief Only send body bytes start..end (inclusive).
+ */
+void chunk_writer_set_range(chunk_writer_t *writer, uint64_t start, uint64_t end);
+
+/**
+ * @brief Check whether the producer should go on writing.
+ */
+bool chunk_writer_ok(const chunk_writer_t *writer);
+
+void chunk_writer_write(chunk_writer_t *writer, const void *data, size_t length);
+
+void chunk_writer_printf(chunk_writer_t *writer, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Bytes produced so far, including the skipped ones.
+ */
+uint64_t chunk_writer_size(const chunk_writer_t *writer);
+
+/**
+ * @brief Send what is buffered and end the response.
+ * @return The first error seen.
+ */
+esp_err_t chunk_writer_finish(chunk_writer_t *writer);
+
+#endif // CHUNK_WRITER_H
@@ -10,6 +10,7 @@
     #define LCD_SENSOR_DISPLAY_MASK 0xFF
     #define SENSOR_COUNT 8
     #define SENSOR_COUNT_PER_COLUMN 4
+    #define VIRTUAL_CHANNEL_MAX 4
 #elif defined(CONFIG_IDF_TARGET_ESP32)
     #define LCD_6_SENSORS
     #define STATUS_LINE_ENABLED
@@ -17,17 +18,37 @@
     #define LCD_SENSOR_DISPLAY_MASK 0xF9
     #define SENSOR_COUNT 6
     #define SENSOR_COUNT_PER_COLUMN 3
+    #define VIRTUAL_CHANNEL_MAX 2 // history tiers live in internal RAM
 #endif
 
+// Physical channels first, then the virtual ones (virtual_channel), as numbered
+// by history and the HTTP APIs. At most 16, history masks are 16 bits wide.
+#define CHANNEL_MAX_COUNT (SENSOR_MAX_COUNT + VIRTUAL_CHANNEL_MAX)
+
 #define SSID_MAX_LEN 32
 #define PASS_MAX_LEN 64
 
-#define AP_SSID_KEY "as"
-#define AP_PASS_KEY "ap"
-#define STA_SSID_KEY "ss"
-#define STA_PASS_KEY "sp"
-#define SENSOR_MASK_KEY "sm"
-#define WIFI_STARTUP_MODE_KEY "wm"
+// In-RAM history tiers (history_rrd): resolution in seconds and points kept per tier
+#define HISTORY_TIER_COUNT         3
+#define HISTORY_TIER0_RESOLUTION_S 1
+#define HISTORY_TIER1_RESOLUTION_S 60
+#define HISTORY_TIER2_RESOLUTION_S 900
+#if defined(CONFIG_IDF_TARGET_ESP32S3) && defined(CONFIG_SPIRAM_ALLOW_BSS_SEG_EXTERNAL_MEMORY)
+    // 10 min, 24 h, 30 days; tiers 1 and 2 are placed in PSRAM
+    #define HISTORY_TIER0_POINTS 600
+    #define HISTORY_TIER1_POINTS 1440
+    #define HISTORY_TIER2_POINTS 2880
+#elif defined(CONFIG_IDF_TARGET_ESP32S3)
+    // 10 min, 12 h, 7 days
+    #define HISTORY_TIER0_POINTS 600
+    #define HISTORY_TIER1_POINTS 720
+    #define HISTORY_TIER2_POINTS 672
+#else
+    // 5 min, 6 h, 3 days
+    #define HISTORY_TIER0_POINTS 300
+    #define HISTORY_TIER1_POINTS 360
+    #define HISTORY_TIER2_POINTS 288
+#endif
 
 // Button config
 #define BUTTON_GPIO GPIO_NUM_0  // IO0 button
@@ -39,6 +60,7 @@
 #define EVENT_LOOP_TASK_STACK_SIZE 3072
 #define EVENT_LOOP_TASK_PRIORITY   20
 #define EVENT_LOOP_TASK_CORE       0
+#define EVENT_SUBSCRIPTION_MAX     16 // events_subscribe() calls, each handler is timed through a slot
 
 #define TASK_STATUS_LED_STACK_SIZE 2048
 #define TASK_STATUS_LED_PRIORITY   8
@@ -60,4 +82,21 @@
 #define TASK_APP_PRIORITY          18
 #define TASK_APP_CORE              0
 
+// One short-lived task per boot step
+#define TASK_BOOT_STEP_STACK_SIZE  4096
+#define TASK_BOOT_STEP_PRIORITY    5
+#define BOOT_TIMEOUT_MS            30000
+
+#define TASK_HISTORY_STACK_SIZE    3072
+#define TASK_HISTORY_PRIORITY      3
+#define TASK_HISTORY_CORE          tskNO_AFFINITY
+
+#define TASK_CONFIG_WRITER_STACK_SIZE 3072
+#define TASK_CONFIG_WRITER_PRIORITY   2
+#define TASK_CONFIG_WRITER_CORE       0
+
+#define TASK_HTTP_WORKER_STACK_SIZE 4096
+#define TASK_HTTP_WORKER_PRIORITY   5
+#define TASK_HTTP_WORKER_CORE       ((CONFIG_HTTP_WORKER_CORE) < 0 ? tskNO_AFFINITY : (CONFIG_HTTP_WORKER_CORE))
+
 #endif // CONFIG_H
\ No newline at end of file
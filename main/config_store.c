@@ -0,0 +1,373 @@
+#include "config_store.h"
+#include <string.h>
+#include <stddef.h>
+#include <sys/param.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "state_manager.h"
+
+static const char *TAG = "config_store";
+
+static const esp_partition_t *config_partition = NULL;
+static size_t config_slot_size = 0;
+static int config_active_slot = -1; // slot holding the newest valid record, -1 if none
+static uint32_t config_sequence = 0;
+
+// Write-behind state
+static SemaphoreHandle_t config_write_mutex = NULL;
+static TaskHandle_t config_writer_handle = NULL;
+static portMUX_TYPE config_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static config_store_stats_t config_stats;
+
+// How long esp_restart() waits for a write in progress; a slot erase and write take far less
+#define CONFIG_SHUTDOWN_WAIT_MS 1000
+
+static void config_writer_task(void *pvParameter);
+static void config_store_shutdown_handler(void);
+
+esp_err_t config_store_init(void)
+{
+    if (config_partition != NULL)
+    {
+        return ESP_OK;
+    }
+
+    config_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, CONFIG_PARTITION_SUBTYPE, CONFIG_PARTITION_LABEL);
+    if (config_partition == NULL)
+    {
+        ESP_LOGE(TAG, "Config partition '%s' not found", CONFIG_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // Every slot has to be erasable on its own
+    config_slot_size = (config_partition->size / CONFIG_SLOT_COUNT) & ~(config_partition->erase_size - 1);
+    if (config_slot_size < sizeof(config_record_header_t) + sizeof(config_payload_t))
+    {
+        ESP_LOGE(TAG, "Config partition too small: %lu bytes", (unsigned long)config_partition->size);
+        config_partition = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    config_write_mutex = xSemaphoreCreateMutex();
+    if (config_write_mutex == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create config write mutex");
+        return ESP_ERR_NO_MEM;
+    }
+    xTaskCreatePinnedToCore(config_writer_task, "config_writer", TASK_CONFIG_WRITER_STACK_SIZE, NULL, TASK_CONFIG_WRITER_PRIORITY, &config_writer_handle, TASK_CONFIG_WRITER_CORE);
+    // Pending changes are not lost on esp_restart()
+    esp_register_shutdown_handler(config_store_shutdown_handler);
+    return ESP_OK;
+}
+
+static void config_payload_from_state(config_payload_t *payload)
+{
+    memset(payload, 0, sizeof(*payload));
+    strlcpy(payload->ap_ssid, system_state.ap_ssid, sizeof(payload->ap_ssid));
+    strlcpy(payload->ap_pass, system_state.ap_pass, sizeof(payload->ap_pass));
+    strlcpy(payload->sta_ssid, system_state.sta_ssid, sizeof(payload->sta_ssid));
+    strlcpy(payload->sta_pass, system_state.sta_pass, sizeof(payload->sta_pass));
+    payload->sensor_mask = system_state.sensor_mask;
+    payload->wifi_startup_mode = system_state.wifi_startup_mode;
+    for (int i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        ntc_calibration_get(i, &payload->calibration[i]);
+    }
+    for (int i = 0; i < VIRTUAL_CHANNEL_MAX; i++)
+    {
+        virtual_channel_get(i, &payload->virtual_channels[i]);
+    }
+    for (int i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        alarm_get_rule(i, &payload->alarm_rules[i]);
+    }
+}
+
+static void config_payload_to_state(const config_payload_t *payload, size_t length)
+{
+#define PAYLOAD_HAS(field) (offsetof(config_payload_t, field) + sizeof(payload->field) <= length)
+    if (PAYLOAD_HAS(ap_ssid))
+    {
+        strlcpy(system_state.ap_ssid, payload->ap_ssid, sizeof(system_state.ap_ssid));
+    }
+    if (PAYLOAD_HAS(ap_pass))
+    {
+        strlcpy(system_state.ap_pass, payload->ap_pass, sizeof(system_state.ap_pass));
+    }
+    if (PAYLOAD_HAS(sta_ssid))
+    {
+        strlcpy(system_state.sta_ssid, payload->sta_ssid, sizeof(system_state.sta_ssid));
+    }
+    if (PAYLOAD_HAS(sta_pass))
+    {
+        strlcpy(system_state.sta_pass, payload->sta_pass, sizeof(system_state.sta_pass));
+    }
+    if (PAYLOAD_HAS(sensor_mask))
+    {
+        system_state.sensor_mask = payload->sensor_mask;
+    }
+    if (PAYLOAD_HAS(wifi_startup_mode))
+    {
+        system_state.wifi_startup_mode = payload->wifi_startup_mode;
+    }
+    if (PAYLOAD_HAS(calibration))
+    {
+        // Checked when the tables are built
+        memcpy(system_state.calibration, payload->calibration, sizeof(system_state.calibration));
+    }
+    if (PAYLOAD_HAS(virtual_channels))
+    {
+        // Compiled, and dropped if broken, by virtual_channel_init()
+        memcpy(system_state.virtual_channels, payload->virtual_channels, sizeof(system_state.virtual_channels));
+    }
+    if (PAYLOAD_HAS(alarm_rules))
+    {
+        // Checked by alarm_init()
+        memcpy(system_state.alarm_rules, payload->alarm_rules, sizeof(system_state.alarm_rules));
+    }
+#undef PAYLOAD_HAS
+}
+
+// Read and verify one slot. The payload is checksummed in chunks, so records
+// written by a newer firmware with a longer payload still verify.
+static esp_err_t config_read_slot(int slot, config_record_header_t *header, config_payload_t *payload)
+{
+    size_t offset = slot * config_slot_size;
+    esp_err_t err = esp_partition_read(config_partition, offset, header, sizeof(*header));
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (header->magic != CONFIG_RECORD_MAGIC || header->version == 0 ||
+        header->length > config_slot_size - sizeof(*header))
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    config_record_header_t crc_header = *header;
+    crc_header.crc = 0;
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&crc_header, sizeof(crc_header));
+
+    memset(payload, 0, sizeof(*payload));
+    uint8_t chunk[64];
+    size_t done = 0;
+    offset += sizeof(*header);
+    while (done < header->length)
+    {
+        size_t len = MIN(sizeof(chunk), header->length - done);
+        err = esp_partition_read(config_partition, offset + done, chunk, len);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        crc = esp_rom_crc32_le(crc, chunk, len);
+        if (done < sizeof(*payload))
+        {
+            memcpy((uint8_t *)payload + done, chunk, MIN(len, sizeof(*payload) - done));
+        }
+        done += len;
+    }
+
+    return crc == header->crc ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+esp_err_t config_store_load(void)
+{
+    if (config_partition == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    config_record_header_t header;
+    config_payload_t payload;
+    config_record_header_t best_header = {0};
+    config_payload_t best_payload;
+    int best_slot = -1;
+
+    for (int slot = 0; slot < CONFIG_SLOT_COUNT; slot++)
+    {
+        esp_err_t err = config_read_slot(slot, &header, &payload);
+        if (err != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Slot %d holds no valid record (%s)", slot, esp_err_to_name(err));
+            continue;
+        }
+        // Sequence numbers are compared with wrap-around
+        if (best_slot < 0 || (int32_t)(header.sequence - best_header.sequence) > 0)
+        {
+            best_slot = slot;
+            best_header = header;
+            best_payload = payload;
+        }
+    }
+
+    if (best_slot < 0)
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    config_payload_to_state(&best_payload, MIN(best_header.length, sizeof(best_payload)));
+    config_active_slot = best_slot;
+    config_sequence = best_header.sequence;
+    ESP_LOGI(TAG, "Loaded config v%d #%lu from slot %d in %lld us", best_header.version,
+             (unsigned long)best_header.sequence, best_slot, esp_timer_get_time() - start_us);
+    return ESP_OK;
+}
+
+esp_err_t config_store_save(void)
+{
+    if (config_partition == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    struct
+    {
+        config_record_header_t header;
+        config_payload_t payload;
+    } record;
+    config_payload_from_state(&record.payload);
+    record.header = (config_record_header_t){
+        .magic = CONFIG_RECORD_MAGIC,
+        .version = CONFIG_RECORD_VERSION,
+        .length = sizeof(record.payload),
+        .sequence = config_sequence + 1,
+        .crc = 0,
+    };
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&record.header, sizeof(record.header));
+    record.header.crc = esp_rom_crc32_le(crc, (const uint8_t *)&record.payload, sizeof(record.payload));
+
+    // Never touch the slot holding the current record
+    int slot = (config_active_slot + 1) % CONFIG_SLOT_COUNT;
+    size_t offset = slot * config_slot_size;
+    esp_err_t err = esp_partition_erase_range(config_partition, offset, config_slot_size);
+    if (err == ESP_OK)
+    {
+        err = esp_partition_write(config_partition, offset, &record, sizeof(record));
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write config slot %d: %s", slot, esp_err_to_name(err));
+        return err;
+    }
+
+    config_record_header_t header;
+    config_payload_t payload;
+    err = config_read_slot(slot, &header, &payload);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Config slot %d failed verification: %s", slot, esp_err_to_name(err));
+        return err;
+    }
+
+    config_active_slot = slot;
+    config_sequence = record.header.sequence;
+    ESP_LOGI(TAG, "Stored config #%lu in slot %d", (unsigned long)config_sequence, slot);
+    return ESP_OK;
+}
+
+void config_store_mark_dirty(uint32_t fields)
+{
+    taskENTER_CRITICAL(&config_stats_lock);
+    config_stats.pending |= fields;
+    config_stats.dirty_marks++;
+    taskEXIT_CRITICAL(&config_stats_lock);
+
+    if (config_writer_handle != NULL)
+    {
+        xTaskNotifyGive(config_writer_handle);
+    }
+}
+
+static esp_err_t config_store_write_pending(TickType_t wait)
+{
+    if (config_write_mutex == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (xSemaphoreTake(config_write_mutex, wait) != pdTRUE)
+    {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    // Claim the pending fields before the payload is copied, a change made
+    // while writing marks them dirty again and gets its own write
+    taskENTER_CRITICAL(&config_stats_lock);
+    uint32_t pending = config_stats.pending;
+    config_stats.pending = 0;
+    taskEXIT_CRITICAL(&config_stats_lock);
+
+    esp_err_t err = ESP_OK;
+    if (pending != 0)
+    {
+        err = config_store_save();
+
+        taskENTER_CRITICAL(&config_stats_lock);
+        if (err == ESP_OK)
+        {
+            config_stats.writes++;
+            config_stats.last_write_us = esp_timer_get_time();
+        }
+        else
+        {
+            config_stats.write_errors++;
+            config_stats.pending |= pending;
+        }
+        taskEXIT_CRITICAL(&config_stats_lock);
+    }
+
+    xSemaphoreGive(config_write_mutex);
+    return err;
+}
+
+esp_err_t config_store_flush(void)
+{
+    return config_store_write_pending(portMAX_DELAY);
+}
+
+void config_store_get_stats(config_store_stats_t *stats)
+{
+    taskENTER_CRITICAL(&config_stats_lock);
+    *stats = config_stats;
+    taskEXIT_CRITICAL(&config_stats_lock);
+}
+
+static void config_writer_task(void *pvParameter)
+{
+    while (1)
+    {
+        // Sleep until the first change, then let further changes pile up
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_SETTINGS_WRITE_DELAY_MS));
+        ulTaskNotifyTake(pdTRUE, 0); // Changes during the delay are covered by this write
+
+        if (config_store_flush() != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Deferred config write failed, retrying later");
+            vTaskDelay(pdMS_TO_TICKS(CONFIG_SETTINGS_WRITE_DELAY_MS));
+            xTaskNotifyGive(config_writer_handle);
+        }
+    }
+}
+
+static void config_store_shutdown_handler(void)
+{
+    // The pending fields are read under the write mutex, a bounded wait keeps a stuck writer from blocking the restart
+    esp_err_t err = config_store_write_pending(pdMS_TO_TICKS(CONFIG_SHUTDOWN_WAIT_MS));
+    if (err == ESP_ERR_TIMEOUT)
+    {
+        ESP_LOGW(TAG, "Config writer busy, restarting without writing pending changes");
+    }
+    else if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Writing pending config before shutdown failed: %s", esp_err_to_name(err));
+    }
+}
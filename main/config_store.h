@@ -0,0 +1,96 @@
+#ifndef CONFIG_STORE_H
+#define CONFIG_STORE_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "config.h"
+#include "ntc_calibration.h"
+#include "virtual_channel.h"
+#include "alarm.h"
+
+#define CONFIG_PARTITION_LABEL "config"
+#define CONFIG_PARTITION_SUBTYPE 0x41
+#define CONFIG_RECORD_MAGIC 0x47464343 // "CCFG"
+#define CONFIG_RECORD_VERSION 4
+#define CONFIG_SLOT_COUNT 2
+
+/*
+ * Fixed-layout persistent config. New fields are only ever appended and
+ * CONFIG_RECORD_VERSION is bumped; a shorter record from an older firmware
+ * is loaded as far as it goes and the remaining fields keep their defaults.
+ */
+typedef struct
+{
+    char ap_ssid[SSID_MAX_LEN];
+    char ap_pass[PASS_MAX_LEN];
+    char sta_ssid[SSID_MAX_LEN];
+    char sta_pass[PASS_MAX_LEN];
+    uint8_t sensor_mask;
+    uint8_t wifi_startup_mode;
+    uint8_t reserved[2];
+    // Version 2
+    ntc_calibration_t calibration[SENSOR_MAX_COUNT];
+    // Version 3
+    virtual_channel_config_t virtual_channels[VIRTUAL_CHANNEL_MAX];
+    // Version 4
+    alarm_rule_t alarm_rules[SENSOR_MAX_COUNT];
+} config_payload_t;
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t length;   // payload length in bytes
+    uint32_t sequence; // incremented on every save, the highest valid slot wins
+    uint32_t crc;      // CRC32 of this header (with crc = 0) and the payload
+} config_record_header_t;
+
+typedef struct
+{
+    uint32_t dirty_marks;   // change notifications received
+    uint32_t writes;        // records written to flash
+    uint32_t write_errors;  // failed writes, the fields stay dirty
+    uint32_t pending;       // bitmask of fields waiting to be written
+    int64_t last_write_us;  // esp_timer time of the last successful write
+} config_store_stats_t;
+
+/**
+ * @brief Locate the config partition and start the background writer task.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the partition is missing.
+ */
+esp_err_t config_store_init(void);
+
+/**
+ * @brief Load the newest valid record into system_state.
+ * Fields not covered by the record are left untouched, so load the defaults first.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if no slot holds a valid record.
+ */
+esp_err_t config_store_load(void);
+
+/**
+ * @brief Write the persistent fields of system_state into the inactive slot.
+ * The previous record stays valid until the new one is completely written.
+ * @return ESP_OK on success, or an error code on failure.
+ */
+esp_err_t config_store_save(void);
+
+/**
+ * @brief Mark fields of system_state as changed.
+ * The write is deferred by CONFIG_SETTINGS_WRITE_DELAY_MS so bursts of changes
+ * end up in a single flash write done by the background task.
+ * @param fields Bitmask of changed fields (settings_field_t), only used for bookkeeping.
+ */
+void config_store_mark_dirty(uint32_t fields);
+
+/**
+ * @brief Write pending changes right now, e.g. before a restart.
+ * @return ESP_OK when nothing is pending or the write succeeded.
+ */
+esp_err_t config_store_flush(void);
+
+/**
+ * @brief Take a snapshot of the write counters.
+ */
+void config_store_get_stats(config_store_stats_t *stats);
+
+#endif // CONFIG_STORE_H
@@ -0,0 +1,491 @@
+#include "form_parser.h"
+#include <string.h>
+
+/*
+ * Single pass, chunk-safe tokenizer for small request bodies.
+ * Every byte is looked at once; decoded key bytes go into a small bounded
+ * buffer, decoded value bytes go straight into the matching field.
+ */
+
+enum {
+    // application/x-www-form-urlencoded
+    FORM_STATE_KEY = 0,
+    FORM_STATE_VALUE,
+    // JSON
+    JSON_STATE_START,
+    JSON_STATE_KEY_OR_END,
+    JSON_STATE_KEY,
+    JSON_STATE_COLON,
+    JSON_STATE_VALUE,
+    JSON_STATE_STRING,
+    JSON_STATE_LITERAL,
+    JSON_STATE_AFTER_VALUE,
+    JSON_STATE_SKIP,
+    JSON_STATE_SKIP_STRING,
+    JSON_STATE_DONE,
+};
+
+enum {
+    ESCAPE_NONE = 0,
+    ESCAPE_PERCENT, // inside %XX
+    ESCAPE_BACKSLASH, // after '\' in a JSON string
+    ESCAPE_UNICODE, // inside \uXXXX
+};
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static bool is_json_whitespace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static void emit_byte(form_parser_t *parser, char c)
+{
+    if (parser->in_key)
+    {
+        if (parser->key_len < sizeof(parser->key) - 1)
+        {
+            parser->key[parser->key_len++] = c;
+        }
+        else
+        {
+            parser->key_truncated = true;
+        }
+        return;
+    }
+
+    form_field_t *field = parser->current;
+    if (field == NULL)
+    {
+        return; // Value of a field nobody asked for
+    }
+    if (parser->value_len + 1 < field->value_size)
+    {
+        field->value[parser->value_len++] = c;
+        field->value[parser->value_len] = '\0';
+    }
+    else
+    {
+        field->truncated = true;
+    }
+}
+
+static void begin_key(form_parser_t *parser)
+{
+    parser->in_key = true;
+    parser->key_len = 0;
+    parser->key_truncated = false;
+    parser->current = NULL;
+}
+
+static void end_key(form_parser_t *parser)
+{
+    parser->in_key = false;
+    parser->key[parser->key_len] = '\0';
+    parser->current = parser->key_truncated ? NULL : form_parser_get(parser, parser->key);
+    parser->value_len = 0;
+    if (parser->current != NULL)
+    {
+        // Repeated keys: the last one wins
+        parser->current->found = true;
+        parser->current->truncated = false;
+        parser->current->value[0] = '\0';
+    }
+}
+
+static void end_value(form_parser_t *parser)
+{
+    parser->current = NULL;
+}
+
+// Encode a \uXXXX code unit as UTF-8; surrogate halves are replaced with '?'
+static void emit_unicode(form_parser_t *parser, uint32_t cp)
+{
+    if (cp < 0x80)
+    {
+        emit_byte(parser, (char)cp);
+    }
+    else if (cp < 0x800)
+    {
+        emit_byte(parser, (char)(0xC0 | (cp >> 6)));
+        emit_byte(parser, (char)(0x80 | (cp & 0x3F)));
+    }
+    else if (cp >= 0xD800 && cp <= 0xDFFF)
+    {
+        emit_byte(parser, '?');
+    }
+    else
+    {
+        emit_byte(parser, (char)(0xE0 | (cp >> 12)));
+        emit_byte(parser, (char)(0x80 | ((cp >> 6) & 0x3F)));
+        emit_byte(parser, (char)(0x80 | (cp & 0x3F)));
+    }
+}
+
+static esp_err_t feed_urlencoded(form_parser_t *parser, char c)
+{
+    if (parser->escape_state == ESCAPE_PERCENT)
+    {
+        int v = hex_value(c);
+        if (v < 0)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        parser->escape_value = (parser->escape_value << 4) | v;
+        if (++parser->escape_value_len == 2)
+        {
+            parser->escape_state = ESCAPE_NONE;
+            emit_byte(parser, (char)parser->escape_value);
+        }
+        return ESP_OK;
+    }
+
+    switch (c)
+    {
+    case '%':
+        parser->escape_state = ESCAPE_PERCENT;
+        parser->escape_value = 0;
+        parser->escape_value_len = 0;
+        break;
+    case '+':
+        emit_byte(parser, ' ');
+        break;
+    case '=':
+        if (parser->state == FORM_STATE_KEY)
+        {
+            end_key(parser);
+            parser->state = FORM_STATE_VALUE;
+        }
+        else
+        {
+            emit_byte(parser, c);
+        }
+        break;
+    case '&':
+        if (parser->state == FORM_STATE_KEY && parser->key_len > 0)
+        {
+            end_key(parser); // Key without '=' has an empty value
+        }
+        end_value(parser);
+        begin_key(parser);
+        parser->state = FORM_STATE_KEY;
+        break;
+    default:
+        emit_byte(parser, c);
+        break;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t feed_json_string(form_parser_t *parser, char c)
+{
+    switch (parser->escape_state)
+    {
+    case ESCAPE_BACKSLASH:
+        parser->escape_state = ESCAPE_NONE;
+        switch (c)
+        {
+        case '"':
+        case '\\':
+        case '/':
+            emit_byte(parser, c);
+            break;
+        case 'b':
+            emit_byte(parser, '\b');
+            break;
+        case 'f':
+            emit_byte(parser, '\f');
+            break;
+        case 'n':
+            emit_byte(parser, '\n');
+            break;
+        case 'r':
+            emit_byte(parser, '\r');
+            break;
+        case 't':
+            emit_byte(parser, '\t');
+            break;
+        case 'u':
+            parser->escape_state = ESCAPE_UNICODE;
+            parser->escape_value = 0;
+            parser->escape_value_len = 0;
+            break;
+        default:
+            return ESP_ERR_INVALID_ARG;
+        }
+        return ESP_OK;
+    case ESCAPE_UNICODE:
+    {
+        int v = hex_value(c);
+        if (v < 0)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        parser->escape_value = (parser->escape_value << 4) | v;
+        if (++parser->escape_value_len == 4)
+        {
+            parser->escape_state = ESCAPE_NONE;
+            emit_unicode(parser, parser->escape_value);
+        }
+        return ESP_OK;
+    }
+    default:
+        break;
+    }
+
+    if (c == '\\')
+    {
+        parser->escape_state = ESCAPE_BACKSLASH;
+    }
+    else if (c == '"')
+    {
+        if (parser->in_key)
+        {
+            end_key(parser);
+            parser->state = JSON_STATE_COLON;
+        }
+        else
+        {
+            end_value(parser);
+            parser->state = JSON_STATE_AFTER_VALUE;
+        }
+    }
+    else if ((unsigned char)c < 0x20)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    else
+    {
+        emit_byte(parser, c);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t feed_json(form_parser_t *parser, char c)
+{
+    switch (parser->state)
+    {
+    case JSON_STATE_STRING:
+        return feed_json_string(parser, c);
+
+    case JSON_STATE_LITERAL:
+        if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '.' || c == '-' || c == '+')
+        {
+            emit_byte(parser, c);
+            return ESP_OK;
+        }
+        if (parser->current != NULL && strcmp(parser->current->value, "null") == 0)
+        {
+            parser->current->found = false;
+        }
+        end_value(parser);
+        parser->state = JSON_STATE_AFTER_VALUE;
+        return feed_json(parser, c); // The terminator belongs to the next token
+
+    case JSON_STATE_SKIP:
+        if (c == '{' || c == '[')
+        {
+            // depth would wrap around and end the skip early
+            if (parser->depth >= FORM_PARSER_DEPTH_MAX)
+            {
+                return ESP_ERR_INVALID_ARG;
+            }
+            parser->depth++;
+        }
+        else if (c == '}' || c == ']')
+        {
+            if (--parser->depth == 0)
+            {
+                parser->state = JSON_STATE_AFTER_VALUE;
+            }
+        }
+        else if (c == '"')
+        {
+            parser->state = JSON_STATE_SKIP_STRING;
+        }
+        return ESP_OK;
+
+    case JSON_STATE_SKIP_STRING:
+        if (parser->escape_state == ESCAPE_BACKSLASH)
+        {
+            parser->escape_state = ESCAPE_NONE;
+        }
+        else if (c == '\\')
+        {
+            parser->escape_state = ESCAPE_BACKSLASH;
+        }
+        else if (c == '"')
+        {
+            parser->state = JSON_STATE_SKIP;
+        }
+        return ESP_OK;
+
+    default:
+        break;
+    }
+
+    if (is_json_whitespace(c))
+    {
+        return ESP_OK;
+    }
+
+    switch (parser->state)
+    {
+    case JSON_STATE_START:
+        if (c != '{')
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        parser->state = JSON_STATE_KEY_OR_END;
+        return ESP_OK;
+    case JSON_STATE_KEY_OR_END:
+    case JSON_STATE_KEY:
+        if (c == '}' && parser->state == JSON_STATE_KEY_OR_END)
+        {
+            parser->state = JSON_STATE_DONE;
+            return ESP_OK;
+        }
+        if (c != '"')
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        begin_key(parser);
+        parser->state = JSON_STATE_STRING;
+        return ESP_OK;
+    case JSON_STATE_COLON:
+        if (c != ':')
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        parser->state = JSON_STATE_VALUE;
+        return ESP_OK;
+    case JSON_STATE_VALUE:
+        if (c == '"')
+        {
+            parser->state = JSON_STATE_STRING;
+        }
+        else if (c == '{' || c == '[')
+        {
+            // Nested values are not supported as fields, skip them
+            if (parser->current != NULL)
+            {
+                parser->current->found = false;
+            }
+            end_value(parser);
+            parser->depth = 1;
+            parser->state = JSON_STATE_SKIP;
+        }
+        else
+        {
+            parser->state = JSON_STATE_LITERAL;
+            return feed_json(parser, c);
+        }
+        return ESP_OK;
+    case JSON_STATE_AFTER_VALUE:
+        if (c == ',')
+        {
+            parser->state = JSON_STATE_KEY;
+        }
+        else if (c == '}')
+        {
+            parser->state = JSON_STATE_DONE;
+        }
+        else
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        return ESP_OK;
+    default:
+        return ESP_ERR_INVALID_ARG; // Trailing garbage after the object
+    }
+}
+
+void form_parser_init(form_parser_t *parser, form_parser_format_t format, form_field_t *fields, size_t field_count)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->format = format;
+    parser->fields = fields;
+    parser->field_count = field_count;
+    for (size_t i = 0; i < field_count; i++)
+    {
+        fields[i].found = false;
+        fields[i].truncated = false;
+        if (fields[i].value_size > 0)
+        {
+            fields[i].value[0] = '\0';
+        }
+    }
+
+    if (format == FORM_PARSER_JSON)
+    {
+        parser->state = JSON_STATE_START;
+    }
+    else
+    {
+        parser->state = FORM_STATE_KEY;
+        begin_key(parser);
+    }
+}
+
+esp_err_t form_parser_feed(form_parser_t *parser, const char *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        esp_err_t err = parser->format == FORM_PARSER_JSON ? feed_json(parser, data[i]) : feed_urlencoded(parser, data[i]);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t form_parser_finish(form_parser_t *parser)
+{
+    if (parser->format == FORM_PARSER_JSON)
+    {
+        if (parser->state == JSON_STATE_LITERAL)
+        {
+            return ESP_ERR_INVALID_ARG; // A bare literal can't end the object
+        }
+        return parser->state == JSON_STATE_DONE ? ESP_OK : ESP_ERR_INVALID_ARG;
+    }
+
+    if (parser->escape_state != ESCAPE_NONE)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (parser->state == FORM_STATE_KEY && parser->key_len > 0)
+    {
+        end_key(parser);
+    }
+    end_value(parser);
+    return ESP_OK;
+}
+
+form_field_t *form_parser_get(form_parser_t *parser, const char *name)
+{
+    for (size_t i = 0; i < parser->field_count; i++)
+    {
+        if (strcmp(parser->fields[i].name, name) == 0)
+        {
+            return &parser->fields[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,70 @@
+#ifndef FORM_PARSER_H
+#define FORM_PARSER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define FORM_PARSER_KEY_MAX 32
+#define FORM_PARSER_DEPTH_MAX 32 // nesting of skipped JSON values, deeper bodies are rejected
+
+typedef enum {
+    FORM_PARSER_URLENCODED = 0, // application/x-www-form-urlencoded
+    FORM_PARSER_JSON,           // flat JSON object of strings, numbers and booleans
+} form_parser_format_t;
+
+// A field the caller is interested in; the value is copied into `value`
+typedef struct
+{
+    const char *name;
+    char *value;       // NUL-terminated, decoded value
+    size_t value_size; // size of `value` including the terminator
+    bool found;
+    bool truncated;    // the value did not fit into `value`
+} form_field_t;
+
+typedef struct
+{
+    form_parser_format_t format;
+    form_field_t *fields;
+    size_t field_count;
+
+    // Tokenizer state, see form_parser.c
+    uint8_t state;
+    uint8_t escape_state;
+    uint8_t escape_value_len;
+    uint32_t escape_value;
+    uint8_t depth;
+    bool in_key;
+    char key[FORM_PARSER_KEY_MAX];
+    size_t key_len;
+    bool key_truncated;
+    form_field_t *current;
+    size_t value_len;
+} form_parser_t;
+
+/**
+ * @brief Prepare a parser for one request body.
+ * @param fields Fields to extract; their `found`, `truncated` and values are reset.
+ */
+void form_parser_init(form_parser_t *parser, form_parser_format_t format, form_field_t *fields, size_t field_count);
+
+/**
+ * @brief Feed the next chunk of the body. Chunks can split tokens anywhere.
+ * @return ESP_OK, or ESP_ERR_INVALID_ARG on malformed input or nesting deeper than FORM_PARSER_DEPTH_MAX.
+ */
+esp_err_t form_parser_feed(form_parser_t *parser, const char *data, size_t len);
+
+/**
+ * @brief Signal the end of the body.
+ * @return ESP_OK, or ESP_ERR_INVALID_ARG if the body ended in the middle of a token.
+ */
+esp_err_t form_parser_finish(form_parser_t *parser);
+
+/**
+ * @brief Look up a field by name after parsing.
+ */
+form_field_t *form_parser_get(form_parser_t *parser, const char *name);
+
+#endif // FORM_PARSER_H
@@ -0,0 +1,141 @@
+#include "histogram.h"
+#include <string.h>
+#include <sys/param.h>
+#include "esp_attr.h"
+#include "esp_rom_sys.h"
+
+static histogram_t *registered_histograms = NULL;
+static portMUX_TYPE registry_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void histogram_register(histogram_t *histogram)
+{
+    taskENTER_CRITICAL(&registry_lock);
+    histogram_t **tail = &registered_histograms;
+    while (*tail != NULL && *tail != histogram)
+    {
+        tail = &(*tail)->next;
+    }
+    if (*tail == NULL)
+    {
+        histogram->next = NULL;
+        *tail = histogram;
+    }
+    taskEXIT_CRITICAL(&registry_lock);
+}
+
+histogram_t *histogram_next(const histogram_t *histogram)
+{
+    // Histograms are only ever appended, the list can be walked without the lock
+    return histogram == NULL ? registered_histograms : histogram->next;
+}
+
+// 0..7 map to themselves, above that the top bit selects the group and the next 3 bits the sub-bucket
+static inline uint32_t histogram_bucket(uint32_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS)
+    {
+        return value;
+    }
+    uint32_t shift = 31 - __builtin_clz(value) - HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << HISTOGRAM_SUB_BITS) | ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+// Largest value that falls into a bucket
+static uint32_t histogram_bucket_upper(uint32_t bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    uint32_t shift = (bucket >> HISTOGRAM_SUB_BITS) - 1;
+    uint64_t lower = (uint64_t)(HISTOGRAM_SUB_BUCKETS | (bucket & (HISTOGRAM_SUB_BUCKETS - 1))) << shift;
+    return (uint32_t)MIN(lower + (1ULL << shift) - 1, UINT32_MAX);
+}
+
+void IRAM_ATTR histogram_record(histogram_t *histogram, uint32_t value)
+{
+    uint32_t bucket = histogram_bucket(value);
+    // Masking the interrupts keeps the task on this core and any other writer of the shard out
+    uint32_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    histogram_shard_t *shard = &histogram->shards[esp_cpu_get_core_id()];
+    shard->sequence++;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    shard->buckets[bucket]++;
+    shard->count++;
+    shard->sum += value;
+    if (value > shard->max)
+    {
+        shard->max = value;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    shard->sequence++;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+}
+
+// Consistent count, sum and max of a shard that may be written on the other core
+static void histogram_read_shard(const histogram_shard_t *shard, uint32_t *count, uint64_t *sum, uint32_t *max)
+{
+    for (int attempt = 0; attempt < 8; attempt++)
+    {
+        uint32_t sequence = shard->sequence;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        *count = shard->count;
+        *sum = shard->sum;
+        *max = shard->max;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((sequence & 1) == 0 && sequence == shard->sequence)
+        {
+            return;
+        }
+    }
+}
+
+// Upper bound of the bucket holding the given rank; buckets are read live, a record in flight may be missed
+static uint32_t histogram_percentile(const histogram_t *histogram, uint32_t total, uint32_t permille, uint32_t max)
+{
+    if (total == 0)
+    {
+        return 0;
+    }
+    uint32_t rank = (uint32_t)(((uint64_t)total * permille + 999) / 1000);
+    uint32_t seen = 0;
+    for (uint32_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+    {
+        for (int core = 0; core < portNUM_PROCESSORS; core++)
+        {
+            seen += histogram->shards[core].buckets[bucket];
+        }
+        if (seen >= rank)
+        {
+            return MIN(histogram_bucket_upper(bucket), max);
+        }
+    }
+    return max;
+}
+
+void histogram_get_stats(const histogram_t *histogram, histogram_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        uint32_t count;
+        uint64_t sum;
+        uint32_t max;
+        histogram_read_shard(&histogram->shards[core], &count, &sum, &max);
+        stats->count += count;
+        stats->sum += sum;
+        stats->max = MAX(stats->max, max);
+    }
+    stats->p50 = histogram_percentile(histogram, stats->count, 500, stats->max);
+    stats->p90 = histogram_percentile(histogram, stats->count, 900, stats->max);
+    stats->p99 = histogram_percentile(histogram, stats->count, 990, stats->max);
+}
+
+double histogram_to_us(const histogram_t *histogram, uint64_t value)
+{
+    if (histogram->unit == HISTOGRAM_UNIT_US)
+    {
+        return (double)value;
+    }
+    return (double)value / esp_rom_get_cpu_ticks_per_us();
+}
@@ -0,0 +1,146 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+
+// Sub-buckets per power of two: every recorded value is kept within 1/8 (12.5 %)
+#define HISTOGRAM_SUB_BITS    3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+// Values 0..7 exactly, then 8 sub-buckets for every power of two up to 2^32
+#define HISTOGRAM_BUCKETS     ((32 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+/*
+ * Log-bucketed (HDR-style) histogram for timing hot paths in production.
+ * Every core records into its own shard with interrupts masked for the few
+ * instructions it takes, so there is no lock and no contention between the
+ * cores; readers merge the shards without stopping the writers. A shard
+ * costs about 1 KiB.
+ *
+ * Histograms are statically allocated by the module that owns them and
+ * registered once, which makes them visible to /api/diag:
+ *
+ *     static histogram_t render_histogram = HISTOGRAM_INITIALIZER("lcd_render", HISTOGRAM_UNIT_CYCLES);
+ *     histogram_register(&render_histogram);
+ *     ...
+ *     HISTOGRAM_TIME_SCOPE(&render_histogram); // until the end of the block
+ */
+typedef enum
+{
+    HISTOGRAM_UNIT_CYCLES = 0, // CPU cycles, for short sections on a pinned task; wraps after ~17 s at 240 MHz
+    HISTOGRAM_UNIT_US,         // esp_timer microseconds, for sections that block or may change cores
+} histogram_unit_t;
+
+typedef struct
+{
+    volatile uint32_t sequence; // odd while a record is in progress
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+} histogram_shard_t;
+
+typedef struct histogram
+{
+    const char *name;
+    histogram_unit_t unit;
+    struct histogram *next; // registered histograms
+    uint32_t dropped;       // cycle timings that changed cores
+    histogram_shard_t shards[portNUM_PROCESSORS];
+} histogram_t;
+
+#define HISTOGRAM_INITIALIZER(name_, unit_) {.name = (name_), .unit = (unit_)}
+
+typedef struct
+{
+    uint32_t count;
+    uint64_t sum;
+    uint32_t p50; // upper bound of the bucket, at most max
+    uint32_t p90;
+    uint32_t p99;
+    uint32_t max;
+} histogram_stats_t;
+
+/**
+ * @brief Make a histogram visible to histogram_next(). Once, before or after the first record.
+ */
+void histogram_register(histogram_t *histogram);
+
+/**
+ * @brief Walk the registered histograms.
+ * @param histogram NULL for the first one.
+ * @return The next registered histogram, NULL after the last.
+ */
+histogram_t *histogram_next(const histogram_t *histogram);
+
+/**
+ * @brief Add one value to the shard of the calling core. Safe from tasks and interrupts.
+ */
+void histogram_record(histogram_t *histogram, uint32_t value);
+
+/**
+ * @brief Merge the shards into count, sum, p50, p90, p99 and max, in the unit of the histogram.
+ */
+void histogram_get_stats(const histogram_t *histogram, histogram_stats_t *stats);
+
+/**
+ * @brief Value in the unit of the histogram converted to microseconds.
+ */
+double histogram_to_us(const histogram_t *histogram, uint64_t value);
+
+// Scope timing, started and stopped on the same task
+typedef struct
+{
+    histogram_t *histogram;
+    uint32_t start;
+    int core;
+} histogram_scope_t;
+
+static inline histogram_scope_t histogram_scope_begin(histogram_t *histogram)
+{
+    histogram_scope_t scope = {.histogram = histogram};
+    if (histogram->unit == HISTOGRAM_UNIT_CYCLES)
+    {
+        scope.core = esp_cpu_get_core_id();
+        scope.start = esp_cpu_get_cycle_count();
+    }
+    else
+    {
+        scope.start = (uint32_t)esp_timer_get_time();
+    }
+    return scope;
+}
+
+static inline void histogram_scope_end(histogram_scope_t *scope)
+{
+    if (scope->histogram->unit == HISTOGRAM_UNIT_US)
+    {
+        histogram_record(scope->histogram, (uint32_t)esp_timer_get_time() - scope->start);
+        return;
+    }
+    uint32_t end = esp_cpu_get_cycle_count();
+    // The cycle counters of the cores are not synchronised
+    if (esp_cpu_get_core_id() != scope->core)
+    {
+        scope->histogram->dropped++;
+        return;
+    }
+    histogram_record(scope->histogram, end - scope->start);
+}
+
+#define HISTOGRAM_CONCAT_(a, b) a##b
+#define HISTOGRAM_CONCAT(a, b) HISTOGRAM_CONCAT_(a, b)
+
+// Time from here to the end of the enclosing block
+#define HISTOGRAM_TIME_SCOPE(histogram)                                                              \
+    histogram_scope_t HISTOGRAM_CONCAT(histogram_scope_, __LINE__) __attribute__((cleanup(histogram_scope_end))) = \
+        histogram_scope_begin(histogram)
+
+// Time an explicit range
+#define HISTOGRAM_TIME_START(scope, histogram) histogram_scope_t scope = histogram_scope_begin(histogram)
+#define HISTOGRAM_TIME_STOP(scope) histogram_scope_end(&(scope))
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,89 @@
+#include "history.h"
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "ntc_adc.h"
+#include "virtual_channel.h"
+
+static const char *TAG = "history";
+
+int16_t history_encode_temperature(float temperature)
+{
+    if (!isfinite(temperature))
+    {
+        return TS_VALUE_INVALID;
+    }
+    float centi = roundf(temperature * 100.0f);
+    if (centi <= TS_VALUE_INVALID || centi > INT16_MAX)
+    {
+        return TS_VALUE_INVALID;
+    }
+    return (int16_t)centi;
+}
+
+static void history_task(void *pvParameter)
+{
+    bool store_available = (bool)(intptr_t)pvParameter;
+    uint32_t store_countdown = 0;
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1)
+    {
+        // Sampled at the finest in-RAM resolution, a subset goes to flash
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(HISTORY_TIER0_RESOLUTION_S * 1000));
+
+        // Retained readings from before a reset are already stored
+        if (ntc_adc_is_stale())
+        {
+            continue;
+        }
+
+        ts_sample_t sample = {
+            .timestamp = ts_store_now(),
+            .channel_mask = system_state.sensor_mask | virtual_channel_get_mask() << SENSOR_MAX_COUNT,
+        };
+        for (uint8_t i = 0; i < CHANNEL_MAX_COUNT; i++)
+        {
+            if ((sample.channel_mask & (1 << i)) == 0)
+            {
+                sample.values[i] = TS_VALUE_INVALID;
+                continue;
+            }
+            float temperature = i < SENSOR_MAX_COUNT ? ntc_get_channel_temperature(i)
+                                                     : virtual_channel_get_value(i - SENSOR_MAX_COUNT);
+            sample.values[i] = history_encode_temperature(temperature);
+        }
+
+        history_rrd_add(&sample);
+
+        if (!store_available || store_countdown-- > 0)
+        {
+            continue;
+        }
+        store_countdown = CONFIG_HISTORY_SAMPLE_INTERVAL_S / HISTORY_TIER0_RESOLUTION_S - 1;
+        esp_err_t err = ts_store_append(&sample);
+        if (err != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Failed to store sample: %s", esp_err_to_name(err));
+        }
+    }
+}
+
+void history_start(void)
+{
+    esp_err_t err = history_rrd_init();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "History disabled: %s", esp_err_to_name(err));
+        return;
+    }
+
+    // Without the flash store the in-RAM tiers are still recorded
+    err = ts_store_init();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Flash history disabled: %s", esp_err_to_name(err));
+    }
+    xTaskCreatePinnedToCore(history_task, "history_task", TASK_HISTORY_STACK_SIZE, (void *)(intptr_t)(err == ESP_OK),
+                            TASK_HISTORY_PRIORITY, NULL, TASK_HISTORY_CORE);
+}
@@ -0,0 +1,20 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "esp_err.h"
+#include "ts_store.h"
+#include "history_rrd.h"
+
+/**
+ * @brief Open the history store and start recording all enabled channels:
+ * every second into the in-RAM tiers, every CONFIG_HISTORY_SAMPLE_INTERVAL_S
+ * seconds to flash.
+ */
+void history_start(void);
+
+/**
+ * @brief Convert a temperature to the stored 0.01 °C representation.
+ */
+int16_t history_encode_temperature(float temperature);
+
+#endif // HISTORY_H
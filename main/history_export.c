@@ -0,0 +1,175 @@
+#include "history_export.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "ts_store.h"
+#include "ts_codec.h"
+
+static const char *TAG = "history_export";
+
+typedef struct
+{
+    const history_export_t *export;
+    chunk_writer_t *writer;
+    uint32_t samples;
+    ts_codec_state_t codec;
+    uint16_t block_length;
+    uint16_t block_count;
+    uint8_t block[HISTORY_EXPORT_BLOCK_SIZE];
+} history_export_ctx_t;
+
+static void history_export_flush_block(history_export_ctx_t *ctx)
+{
+    if (ctx->block_count == 0)
+    {
+        return;
+    }
+    chunk_writer_write(ctx->writer, &ctx->block_length, sizeof(ctx->block_length));
+    chunk_writer_write(ctx->writer, &ctx->block_count, sizeof(ctx->block_count));
+    chunk_writer_write(ctx->writer, ctx->block, ctx->block_length);
+    ctx->block_length = 0;
+    ctx->block_count = 0;
+}
+
+static void history_export_compressed(history_export_ctx_t *ctx, const ts_sample_t *sample)
+{
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        if (ctx->block_count == 0)
+        {
+            ts_codec_init(&ctx->codec, ctx->export->channel_mask);
+        }
+        size_t n = ts_codec_encode(&ctx->codec, sample, ctx->block + ctx->block_length,
+                                   sizeof(ctx->block) - ctx->block_length);
+        if (n > 0)
+        {
+            ctx->block_length += n;
+            ctx->block_count++;
+            return;
+        }
+        history_export_flush_block(ctx);
+    }
+}
+
+static void history_export_row(history_export_ctx_t *ctx, const ts_sample_t *sample)
+{
+    chunk_writer_t *writer = ctx->writer;
+    if (ctx->export->format == HISTORY_EXPORT_CSV)
+    {
+        chunk_writer_printf(writer, "%lu", (unsigned long)sample->timestamp);
+        for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+        {
+            if ((ctx->export->channel_mask & (1 << i)) == 0)
+            {
+                continue;
+            }
+            if (sample->values[i] == TS_VALUE_INVALID)
+            {
+                chunk_writer_printf(writer, ",");
+            }
+            else
+            {
+                chunk_writer_printf(writer, ",%.2f", sample->values[i] / 100.0);
+            }
+        }
+        chunk_writer_printf(writer, "\n");
+        return;
+    }
+
+    chunk_writer_write(writer, &sample->timestamp, sizeof(sample->timestamp));
+    for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+    {
+        if (ctx->export->channel_mask & (1 << i))
+        {
+            chunk_writer_write(writer, &sample->values[i], sizeof(sample->values[i]));
+        }
+    }
+}
+
+static bool history_export_visitor(const ts_sample_t *stored, void *arg)
+{
+    history_export_ctx_t *ctx = arg;
+    ts_sample_t sample = {.timestamp = stored->timestamp, .channel_mask = ctx->export->channel_mask};
+    for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+    {
+        sample.values[i] = (stored->channel_mask & (1 << i)) ? stored->values[i] : TS_VALUE_INVALID;
+    }
+
+    if (ctx->export->format == HISTORY_EXPORT_BINARY && ctx->export->compress)
+    {
+        history_export_compressed(ctx, &sample);
+    }
+    else
+    {
+        history_export_row(ctx, &sample);
+    }
+    ctx->samples++;
+    return chunk_writer_ok(ctx->writer);
+}
+
+esp_err_t history_export_write(const history_export_t *export, chunk_writer_t *writer)
+{
+    history_export_ctx_t *ctx = calloc(1, sizeof(history_export_ctx_t));
+    if (ctx == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    ctx->export = export;
+    ctx->writer = writer;
+
+    if (export->format == HISTORY_EXPORT_CSV)
+    {
+        chunk_writer_printf(writer, "timestamp");
+        for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+        {
+            if (export->channel_mask & (1 << i))
+            {
+                chunk_writer_printf(writer, ",ch%d", i);
+            }
+        }
+        chunk_writer_printf(writer, "\n");
+    }
+    else
+    {
+        history_export_header_t header = {
+            .magic = HISTORY_EXPORT_MAGIC,
+            .version = HISTORY_EXPORT_VERSION,
+            .flags = export->compress ? HISTORY_EXPORT_FLAG_COMPRESSED : 0,
+            .channel_mask = export->channel_mask,
+            .from = export->from,
+            .to = export->to,
+        };
+        chunk_writer_write(writer, &header, sizeof(header));
+    }
+
+    esp_err_t err = ts_store_query(export->from, export->to, history_export_visitor, ctx);
+    if (err == ESP_OK)
+    {
+        history_export_flush_block(ctx);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "Export failed: %s", esp_err_to_name(err));
+    }
+    ESP_LOGD(TAG, "%lu samples, %llu bytes", (unsigned long)ctx->samples, chunk_writer_size(writer));
+    free(ctx);
+    return err;
+}
+
+uint32_t history_export_etag(const history_export_t *export)
+{
+    ts_store_stats_t stats;
+    ts_store_get_stats(&stats);
+
+    // Samples older than the store reaches do not change the output, recycling the segment holding `from` does
+    uint32_t key[5] = {
+        MAX(export->from, stats.oldest_ts),
+        export->to,
+        export->channel_mask,
+        export->format,
+        export->compress,
+    };
+    return esp_rom_crc32_le(0, (const uint8_t *)key, sizeof(key));
+}
@@ -0,0 +1,58 @@
+#ifndef HISTORY_EXPORT_H
+#define HISTORY_EXPORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "chunk_writer.h"
+
+#define HISTORY_EXPORT_MAGIC   0x4843544E // "NTCH"
+#define HISTORY_EXPORT_VERSION 2
+#define HISTORY_EXPORT_FLAG_COMPRESSED 0x01
+// Payload limit of one compressed block
+#define HISTORY_EXPORT_BLOCK_SIZE 512
+
+typedef enum
+{
+    HISTORY_EXPORT_CSV,
+    HISTORY_EXPORT_BINARY,
+} history_export_format_t;
+
+/*
+ * Binary export, little-endian: this header, then one row per sample with
+ * u32 timestamp and i16 0.01 °C per channel in the mask (TS_VALUE_INVALID
+ * if missing). Compressed exports hold blocks instead of rows: u16 length,
+ * u16 sample count, then `length` bytes of ts_codec data.
+ */
+typedef struct
+{
+    uint32_t magic;
+    uint8_t version;
+    uint8_t flags; // HISTORY_EXPORT_FLAG_*
+    uint16_t channel_mask; // version 1: channels 0-7 and a zero byte
+    uint32_t from;
+    uint32_t to;
+} history_export_header_t;
+
+typedef struct
+{
+    uint32_t from;
+    uint32_t to;
+    uint16_t channel_mask;
+    history_export_format_t format;
+    bool compress; // binary only
+} history_export_t;
+
+/**
+ * @brief Write the recorded samples of the range to writer, reading the
+ * flash store as it goes. The output only depends on the parameters and
+ * the stored data, so it can be generated again to serve a byte range.
+ */
+esp_err_t history_export_write(const history_export_t *export, chunk_writer_t *writer);
+
+/**
+ * @brief Validator for the export; it changes when the stored range does.
+ */
+uint32_t history_export_etag(const history_export_t *export);
+
+#endif // HISTORY_EXPORT_H
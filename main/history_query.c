@@ -0,0 +1,222 @@
+#include "history_query.h"
+#include <string.h>
+#include <sys/param.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "ts_store.h"
+
+static const char *TAG = "history_query";
+
+typedef struct
+{
+    history_source_t source;
+    int tier;
+    uint32_t resolution_s;
+    uint32_t oldest;
+    bool has_data;
+} history_candidate_t;
+
+// Bucket being built while the source is streamed
+typedef struct
+{
+    const history_query_t *query;
+    uint32_t bucket_s;
+    history_point_visitor_t visitor;
+    void *ctx;
+    bool active;
+    bool stopped;
+    history_point_t point;
+    int32_t sum[CHANNEL_MAX_COUNT];
+    uint32_t count[CHANNEL_MAX_COUNT];
+} history_bucket_t;
+
+void history_query_plan(const history_query_t *query, history_plan_t *plan)
+{
+    history_candidate_t candidates[HISTORY_TIER_COUNT + 1];
+    int candidate_count = 0;
+    for (int tier = 0; tier < HISTORY_TIER_COUNT; tier++)
+    {
+        history_tier_info_t info;
+        if (history_rrd_get_info(tier, &info) != ESP_OK)
+        {
+            break;
+        }
+        candidates[candidate_count++] = (history_candidate_t){
+            .source = HISTORY_SOURCE_RRD,
+            .tier = tier,
+            .resolution_s = info.resolution_s,
+            .oldest = info.oldest,
+            .has_data = info.used > 0,
+        };
+    }
+    ts_store_stats_t store;
+    ts_store_get_stats(&store);
+    candidates[candidate_count++] = (history_candidate_t){
+        .source = HISTORY_SOURCE_STORE,
+        .tier = -1,
+        .resolution_s = CONFIG_HISTORY_SAMPLE_INTERVAL_S,
+        .oldest = store.segments_used > 0 ? store.oldest_ts : store.newest_ts,
+        .has_data = store.segments_used > 0 || store.samples_pending > 0,
+    };
+
+    uint32_t span = query->to - query->from + 1;
+    uint32_t max_resolution = MAX(span / MAX(query->points, 1), 1);
+
+    // Coarsest source that still fills the requested points and covers the range,
+    // then the finest one that covers it, then the one reaching back furthest
+    const history_candidate_t *best = NULL;
+    for (int i = 0; i < candidate_count; i++)
+    {
+        const history_candidate_t *c = &candidates[i];
+        if (c->has_data && c->oldest <= query->from && c->resolution_s <= max_resolution &&
+            (best == NULL || c->resolution_s > best->resolution_s))
+        {
+            best = c;
+        }
+    }
+    bool fills = best != NULL;
+    for (int i = 0; i < candidate_count && !fills; i++)
+    {
+        const history_candidate_t *c = &candidates[i];
+        if (c->has_data && c->oldest <= query->from && (best == NULL || c->resolution_s < best->resolution_s))
+        {
+            best = c;
+        }
+    }
+    for (int i = 0; i < candidate_count; i++)
+    {
+        const history_candidate_t *c = &candidates[i];
+        if (c->has_data && (best == NULL || (best->oldest > query->from && c->oldest < best->oldest)))
+        {
+            best = c;
+        }
+    }
+    if (best == NULL)
+    {
+        best = &candidates[0];
+    }
+
+    plan->source = best->source;
+    plan->tier = best->tier;
+    plan->resolution_s = best->resolution_s;
+    // Round the bucket up to whole source intervals
+    uint32_t bucket_s = (span + MAX(query->points, 1) - 1) / MAX(query->points, 1);
+    plan->bucket_s = MAX((bucket_s + best->resolution_s - 1) / best->resolution_s, 1) * best->resolution_s;
+}
+
+static void history_bucket_emit(history_bucket_t *bucket)
+{
+    if (!bucket->active)
+    {
+        return;
+    }
+    bucket->active = false;
+    bool empty = true;
+    for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+    {
+        if (bucket->count[i] == 0)
+        {
+            bucket->point.min[i] = bucket->point.avg[i] = bucket->point.max[i] = TS_VALUE_INVALID;
+            continue;
+        }
+        bucket->point.avg[i] = (int16_t)(bucket->sum[i] / (int32_t)bucket->count[i]);
+        empty = false;
+    }
+    // Gaps in the source (RRD slots without samples, disabled channels) do not produce points
+    if (empty)
+    {
+        return;
+    }
+    if (!bucket->visitor(&bucket->point, bucket->ctx))
+    {
+        bucket->stopped = true;
+    }
+}
+
+static bool history_bucket_add(history_bucket_t *bucket, uint32_t timestamp, const int16_t *min, const int16_t *avg,
+                               const int16_t *max)
+{
+    // Buckets start at query->from, so the range splits into at most query->points of them
+    uint32_t offset = timestamp > bucket->query->from ? timestamp - bucket->query->from : 0;
+    uint32_t start = bucket->query->from + offset - offset % bucket->bucket_s;
+    if (bucket->active && start != bucket->point.timestamp)
+    {
+        history_bucket_emit(bucket);
+    }
+    if (bucket->stopped)
+    {
+        return false;
+    }
+    if (!bucket->active)
+    {
+        bucket->active = true;
+        bucket->point.timestamp = start;
+        bucket->point.resolution_s = bucket->bucket_s;
+        for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+        {
+            bucket->point.min[i] = INT16_MAX;
+            bucket->point.max[i] = INT16_MIN;
+            bucket->sum[i] = 0;
+            bucket->count[i] = 0;
+        }
+    }
+
+    for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+    {
+        if ((bucket->query->channel_mask & (1 << i)) == 0 || avg[i] == TS_VALUE_INVALID)
+        {
+            continue;
+        }
+        bucket->point.min[i] = MIN(bucket->point.min[i], min[i]);
+        bucket->point.max[i] = MAX(bucket->point.max[i], max[i]);
+        bucket->sum[i] += avg[i];
+        bucket->count[i]++;
+    }
+    return true;
+}
+
+static bool history_rrd_visitor(const history_point_t *point, void *ctx)
+{
+    return history_bucket_add(ctx, point->timestamp, point->min, point->avg, point->max);
+}
+
+static bool history_store_visitor(const ts_sample_t *sample, void *ctx)
+{
+    int16_t values[CHANNEL_MAX_COUNT];
+    for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+    {
+        values[i] = (sample->channel_mask & (1 << i)) ? sample->values[i] : TS_VALUE_INVALID;
+    }
+    return history_bucket_add(ctx, sample->timestamp, values, values, values);
+}
+
+esp_err_t history_query_run(const history_query_t *query, const history_plan_t *plan,
+                            history_point_visitor_t visitor, void *ctx)
+{
+    history_bucket_t bucket = {
+        .query = query,
+        .bucket_s = plan->bucket_s,
+        .visitor = visitor,
+        .ctx = ctx,
+    };
+
+    esp_err_t err;
+    if (plan->source == HISTORY_SOURCE_RRD)
+    {
+        err = history_rrd_read(plan->tier, query->from, query->to, history_rrd_visitor, &bucket);
+    }
+    else
+    {
+        err = ts_store_query(query->from, query->to, history_store_visitor, &bucket);
+    }
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Query failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    if (!bucket.stopped)
+    {
+        history_bucket_emit(&bucket);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,49 @@
+#ifndef HISTORY_QUERY_H
+#define HISTORY_QUERY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "history_rrd.h"
+
+#define HISTORY_QUERY_MAX_POINTS 2000
+
+typedef enum
+{
+    HISTORY_SOURCE_RRD,   // one of the in-RAM tiers
+    HISTORY_SOURCE_STORE, // the flash store
+} history_source_t;
+
+typedef struct
+{
+    uint32_t from;
+    uint32_t to;
+    uint16_t channel_mask;
+    uint16_t points; // upper bound for the number of buckets
+} history_query_t;
+
+typedef struct
+{
+    history_source_t source;
+    int tier;              // valid for HISTORY_SOURCE_RRD
+    uint32_t resolution_s; // resolution of the source
+    uint32_t bucket_s;     // width of one output bucket, a multiple of resolution_s
+} history_plan_t;
+
+/**
+ * @brief Pick the coarsest source whose resolution still gives `points`
+ * buckets over the range and that reaches back to `from`.
+ */
+void history_query_plan(const history_query_t *query, history_plan_t *plan);
+
+/**
+ * @brief Downsample the range into min/avg/max buckets and pass them to visitor, oldest first.
+ * Points are streamed from the source, memory use does not depend on the range.
+ * Buckets are plan->bucket_s wide and start at query->from, so there are at most
+ * query->points of them. Buckets without a reading on any selected channel are
+ * skipped; point->resolution_s is the bucket width.
+ */
+esp_err_t history_query_run(const history_query_t *query, const history_plan_t *plan,
+                            history_point_visitor_t visitor, void *ctx);
+
+#endif // HISTORY_QUERY_H
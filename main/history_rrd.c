@@ -0,0 +1,260 @@
+#include "history_rrd.h"
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+
+static const char *TAG = "history_rrd";
+
+typedef struct
+{
+    int16_t min;
+    int16_t avg;
+    int16_t max;
+} history_aggregate_t;
+
+// Point being built for one tier
+typedef struct
+{
+    bool active;
+    uint32_t start;
+    int16_t min[CHANNEL_MAX_COUNT];
+    int16_t max[CHANNEL_MAX_COUNT];
+    int32_t sum[CHANNEL_MAX_COUNT];    // avg * count of the finer points
+    uint32_t count[CHANNEL_MAX_COUNT]; // samples behind the point
+} history_accumulator_t;
+
+typedef struct
+{
+    uint32_t resolution_s;
+    uint16_t points;
+    uint16_t head; // slot of the newest point
+    uint16_t used;
+    uint32_t newest;
+    int16_t (*values)[CHANNEL_MAX_COUNT];             // tier 0: one value per channel
+    history_aggregate_t (*aggregates)[CHANNEL_MAX_COUNT]; // coarser tiers
+    history_accumulator_t accumulator;
+} history_tier_t;
+
+static int16_t tier0_values[HISTORY_TIER0_POINTS][CHANNEL_MAX_COUNT];
+// Placed in PSRAM when the build allows .bss there, internal RAM otherwise
+static EXT_RAM_BSS_ATTR history_aggregate_t tier1_aggregates[HISTORY_TIER1_POINTS][CHANNEL_MAX_COUNT];
+static EXT_RAM_BSS_ATTR history_aggregate_t tier2_aggregates[HISTORY_TIER2_POINTS][CHANNEL_MAX_COUNT];
+
+static history_tier_t tiers[HISTORY_TIER_COUNT] = {
+    {.resolution_s = HISTORY_TIER0_RESOLUTION_S, .points = HISTORY_TIER0_POINTS, .values = tier0_values},
+    {.resolution_s = HISTORY_TIER1_RESOLUTION_S, .points = HISTORY_TIER1_POINTS, .aggregates = tier1_aggregates},
+    {.resolution_s = HISTORY_TIER2_RESOLUTION_S, .points = HISTORY_TIER2_POINTS, .aggregates = tier2_aggregates},
+};
+
+static SemaphoreHandle_t history_mutex = NULL;
+
+esp_err_t history_rrd_init(void)
+{
+    if (history_mutex != NULL)
+    {
+        return ESP_OK;
+    }
+    history_mutex = xSemaphoreCreateMutex();
+    if (history_mutex == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    size_t bytes = sizeof(tier0_values) + sizeof(tier1_aggregates) + sizeof(tier2_aggregates);
+    ESP_LOGI(TAG, "%d tiers, %u bytes", HISTORY_TIER_COUNT, (unsigned)bytes);
+    return ESP_OK;
+}
+
+static void history_accumulator_reset(history_accumulator_t *acc, uint32_t start)
+{
+    acc->active = true;
+    acc->start = start;
+    for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+    {
+        acc->min[i] = INT16_MAX;
+        acc->max[i] = INT16_MIN;
+        acc->sum[i] = 0;
+        acc->count[i] = 0;
+    }
+}
+
+// Store a point in the slot of its timestamp; slots skipped by a gap are marked empty
+static void history_tier_store(history_tier_t *tier, uint32_t timestamp, const history_aggregate_t *point)
+{
+    if (tier->used > 0 && timestamp <= tier->newest)
+    {
+        // Clock went backwards (e.g. the system time was set), start over
+        tier->used = 0;
+    }
+
+    uint32_t steps = tier->used > 0 ? (timestamp - tier->newest) / tier->resolution_s : 1;
+    if (steps >= tier->points)
+    {
+        tier->used = 0;
+        steps = 1;
+    }
+    for (uint32_t step = 1; step <= steps; step++)
+    {
+        tier->head = (tier->head + 1) % tier->points;
+        for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+        {
+            history_aggregate_t value = step == steps ? point[i] : (history_aggregate_t){TS_VALUE_INVALID, TS_VALUE_INVALID, TS_VALUE_INVALID};
+            if (tier->values != NULL)
+            {
+                tier->values[tier->head][i] = value.avg;
+            }
+            else
+            {
+                tier->aggregates[tier->head][i] = value;
+            }
+        }
+        if (tier->used < tier->points)
+        {
+            tier->used++;
+        }
+    }
+    tier->newest = timestamp;
+}
+
+static void history_tier_feed(int level, uint32_t timestamp, const history_aggregate_t *point, const uint32_t *count);
+
+// Close the point being built and hand it to the next tier
+static void history_tier_commit(int level)
+{
+    history_tier_t *tier = &tiers[level];
+    history_accumulator_t *acc = &tier->accumulator;
+    history_aggregate_t point[CHANNEL_MAX_COUNT];
+    for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+    {
+        if (acc->count[i] == 0)
+        {
+            point[i] = (history_aggregate_t){TS_VALUE_INVALID, TS_VALUE_INVALID, TS_VALUE_INVALID};
+            continue;
+        }
+        point[i].min = acc->min[i];
+        point[i].max = acc->max[i];
+        point[i].avg = (int16_t)(acc->sum[i] / (int32_t)acc->count[i]);
+    }
+    history_tier_store(tier, acc->start, point);
+    acc->active = false;
+
+    if (level + 1 < HISTORY_TIER_COUNT)
+    {
+        history_tier_feed(level + 1, acc->start, point, acc->count);
+    }
+}
+
+static void history_tier_feed(int level, uint32_t timestamp, const history_aggregate_t *point, const uint32_t *count)
+{
+    history_tier_t *tier = &tiers[level];
+    history_accumulator_t *acc = &tier->accumulator;
+    uint32_t start = timestamp - timestamp % tier->resolution_s;
+
+    if (acc->active && start != acc->start)
+    {
+        history_tier_commit(level);
+    }
+    if (!acc->active)
+    {
+        history_accumulator_reset(acc, start);
+    }
+
+    for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+    {
+        if (count[i] == 0 || point[i].avg == TS_VALUE_INVALID)
+        {
+            continue;
+        }
+        acc->min[i] = MIN(acc->min[i], point[i].min);
+        acc->max[i] = MAX(acc->max[i], point[i].max);
+        acc->sum[i] += (int32_t)point[i].avg * (int32_t)count[i];
+        acc->count[i] += count[i];
+    }
+}
+
+void history_rrd_add(const ts_sample_t *sample)
+{
+    history_aggregate_t point[CHANNEL_MAX_COUNT];
+    uint32_t count[CHANNEL_MAX_COUNT];
+    for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+    {
+        bool valid = (sample->channel_mask & (1 << i)) && sample->values[i] != TS_VALUE_INVALID;
+        point[i].min = point[i].avg = point[i].max = sample->values[i];
+        count[i] = valid ? 1 : 0;
+    }
+
+    xSemaphoreTake(history_mutex, portMAX_DELAY);
+    history_tier_feed(0, sample->timestamp, point, count);
+    xSemaphoreGive(history_mutex);
+}
+
+esp_err_t history_rrd_get_info(int tier, history_tier_info_t *info)
+{
+    if (tier < 0 || tier >= HISTORY_TIER_COUNT || history_mutex == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const history_tier_t *t = &tiers[tier];
+    xSemaphoreTake(history_mutex, portMAX_DELAY);
+    info->resolution_s = t->resolution_s;
+    info->points = t->points;
+    info->used = t->used;
+    info->newest = t->newest;
+    info->oldest = t->newest - (t->used > 0 ? (t->used - 1) * t->resolution_s : 0);
+    xSemaphoreGive(history_mutex);
+    return ESP_OK;
+}
+
+esp_err_t history_rrd_read(int tier, uint32_t from, uint32_t to, history_point_visitor_t visitor, void *ctx)
+{
+    if (tier < 0 || tier >= HISTORY_TIER_COUNT || history_mutex == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const history_tier_t *t = &tiers[tier];
+    history_point_t point = {.resolution_s = t->resolution_s};
+
+    // Walk by timestamp, so points added meanwhile do not shift the position
+    uint32_t timestamp = from - from % t->resolution_s;
+    while (timestamp <= to)
+    {
+        xSemaphoreTake(history_mutex, portMAX_DELAY);
+        if (t->used == 0 || timestamp > t->newest)
+        {
+            xSemaphoreGive(history_mutex);
+            break;
+        }
+        uint32_t oldest = t->newest - (t->used - 1) * t->resolution_s;
+        if (timestamp < oldest)
+        {
+            timestamp = oldest;
+        }
+        uint32_t back = (t->newest - timestamp) / t->resolution_s;
+        uint16_t slot = (t->head + t->points - back) % t->points;
+        point.timestamp = timestamp;
+        for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+        {
+            if (t->values != NULL)
+            {
+                point.min[i] = point.avg[i] = point.max[i] = t->values[slot][i];
+            }
+            else
+            {
+                point.min[i] = t->aggregates[slot][i].min;
+                point.avg[i] = t->aggregates[slot][i].avg;
+                point.max[i] = t->aggregates[slot][i].max;
+            }
+        }
+        xSemaphoreGive(history_mutex);
+
+        if (timestamp > to || !visitor(&point, ctx) || timestamp > UINT32_MAX - t->resolution_s)
+        {
+            break;
+        }
+        timestamp += t->resolution_s;
+    }
+    return ESP_OK;
+}
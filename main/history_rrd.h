@@ -0,0 +1,60 @@
+#ifndef HISTORY_RRD_H
+#define HISTORY_RRD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "config.h"
+#include "ts_store.h"
+
+/*
+ * Fixed-size, multi-resolution history kept in RAM. Tier 0 holds the
+ * samples themselves, every coarser tier holds min/avg/max per channel,
+ * built incrementally from the points of the tier below it. Sizes are set
+ * per target in config.h.
+ */
+typedef struct
+{
+    uint32_t timestamp;             // start of the interval, see ts_store_now()
+    uint32_t resolution_s;          // interval length
+    int16_t min[CHANNEL_MAX_COUNT]; // 0.01 °C, TS_VALUE_INVALID if there was no sample
+    int16_t avg[CHANNEL_MAX_COUNT];
+    int16_t max[CHANNEL_MAX_COUNT];
+} history_point_t;
+
+typedef struct
+{
+    uint32_t resolution_s;
+    uint16_t points; // capacity
+    uint16_t used;
+    uint32_t oldest; // timestamp of the oldest point, valid if used > 0
+    uint32_t newest; // timestamp of the newest point, valid if used > 0
+} history_tier_info_t;
+
+// Return false to stop reading
+typedef bool (*history_point_visitor_t)(const history_point_t *point, void *ctx);
+
+/**
+ * @brief Prepare the tiers. Called from history_start().
+ */
+esp_err_t history_rrd_init(void);
+
+/**
+ * @brief Add a sample to tier 0; completed intervals roll up into the coarser tiers.
+ */
+void history_rrd_add(const ts_sample_t *sample);
+
+/**
+ * @brief Describe a tier.
+ * @return ESP_ERR_INVALID_ARG if tier >= HISTORY_TIER_COUNT.
+ */
+esp_err_t history_rrd_get_info(int tier, history_tier_info_t *info);
+
+/**
+ * @brief Call visitor for the points of a tier with from <= timestamp <= to, oldest first.
+ * The tier is locked only while a point is copied.
+ */
+esp_err_t history_rrd_read(int tier, uint32_t from, uint32_t to, history_point_visitor_t visitor, void *ctx);
+
+#endif // HISTORY_RRD_H
@@ -0,0 +1,181 @@
+#include "http_workers.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "http_workers";
+
+typedef struct
+{
+    httpd_req_t *req;
+    http_worker_handler_t handler;
+    int64_t enqueued_us;
+} http_worker_job_t;
+
+static QueueHandle_t job_queue = NULL;
+static TaskHandle_t worker_handles[CONFIG_HTTP_WORKER_COUNT];
+// Task running a handler inline because the pool is not running
+static TaskHandle_t inline_task = NULL;
+static http_workers_stats_t stats;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+bool http_workers_is_worker_task(void)
+{
+    TaskHandle_t current = xTaskGetCurrentTaskHandle();
+    if (current == inline_task)
+    {
+        return true;
+    }
+    for (int i = 0; i < CONFIG_HTTP_WORKER_COUNT; i++)
+    {
+        if (worker_handles[i] == current)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void http_worker_task(void *pvParameter)
+{
+    http_worker_job_t job;
+    while (1)
+    {
+        if (xQueueReceive(job_queue, &job, portMAX_DELAY) != pdTRUE)
+        {
+            continue;
+        }
+
+        uint32_t wait_us = (uint32_t)(esp_timer_get_time() - job.enqueued_us);
+        taskENTER_CRITICAL(&stats_lock);
+        stats.queue_depth--;
+        stats.busy_workers++;
+        taskEXIT_CRITICAL(&stats_lock);
+
+        ESP_LOGD(TAG, "Running %s after %lu us in queue", job.req->uri, (unsigned long)wait_us);
+        job.handler(job.req);
+
+        esp_err_t err = httpd_req_async_handler_complete(job.req);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to complete async request: %s", esp_err_to_name(err));
+        }
+
+        taskENTER_CRITICAL(&stats_lock);
+        stats.busy_workers--;
+        stats.completed++;
+        stats.wait_us_total += wait_us;
+        if (wait_us > stats.wait_us_max)
+        {
+            stats.wait_us_max = wait_us;
+        }
+        taskEXIT_CRITICAL(&stats_lock);
+    }
+}
+
+void http_workers_start(void)
+{
+    if (job_queue != NULL)
+    {
+        return;
+    }
+
+    job_queue = xQueueCreate(CONFIG_HTTP_WORKER_QUEUE_SIZE, sizeof(http_worker_job_t));
+    if (job_queue == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create worker queue");
+        return;
+    }
+
+    int started = 0;
+    for (int i = 0; i < CONFIG_HTTP_WORKER_COUNT; i++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "http_worker_%d", i);
+        if (xTaskCreatePinnedToCore(http_worker_task, name, TASK_HTTP_WORKER_STACK_SIZE, NULL, TASK_HTTP_WORKER_PRIORITY, &worker_handles[i], TASK_HTTP_WORKER_CORE) != pdPASS)
+        {
+            ESP_LOGE(TAG, "Failed to start %s", name);
+            worker_handles[i] = NULL;
+            continue;
+        }
+        started++;
+    }
+    if (started == 0)
+    {
+        // Nobody would serve the queue, handlers run inline on the httpd task instead
+        vQueueDelete(job_queue);
+        job_queue = NULL;
+        return;
+    }
+    ESP_LOGI(TAG, "Started %d HTTP workers", started);
+}
+
+esp_err_t http_workers_submit(httpd_req_t *req, http_worker_handler_t handler)
+{
+    if (job_queue == NULL)
+    {
+        // Pool not running, serve on the httpd task as before. The handler sees itself on a
+        // worker, so it does not submit again.
+        taskENTER_CRITICAL(&stats_lock);
+        stats.inlined++;
+        taskEXIT_CRITICAL(&stats_lock);
+        TaskHandle_t previous = inline_task;
+        inline_task = xTaskGetCurrentTaskHandle();
+        esp_err_t err = handler(req);
+        inline_task = previous;
+        return err;
+    }
+
+    http_worker_job_t job = {
+        .req = NULL,
+        .handler = handler,
+        .enqueued_us = esp_timer_get_time(),
+    };
+    esp_err_t err = httpd_req_async_handler_begin(req, &job.req);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to detach request: %s", esp_err_to_name(err));
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to queue request");
+    }
+
+    // Count the job before it becomes visible to the workers
+    taskENTER_CRITICAL(&stats_lock);
+    stats.queue_depth++;
+    taskEXIT_CRITICAL(&stats_lock);
+
+    if (xQueueSend(job_queue, &job, 0) != pdTRUE)
+    {
+        taskENTER_CRITICAL(&stats_lock);
+        stats.queue_depth--;
+        stats.rejected++;
+        taskEXIT_CRITICAL(&stats_lock);
+
+        // The detached copy owns the socket now, so answer through it
+        ESP_LOGW(TAG, "Worker queue full, rejecting %s", req->uri);
+        httpd_resp_set_status(job.req, "503 Service Unavailable");
+        httpd_resp_set_type(job.req, "text/plain");
+        httpd_resp_set_hdr(job.req, "Retry-After", "1");
+        httpd_resp_sendstr(job.req, "Server busy");
+        httpd_req_async_handler_complete(job.req);
+        return ESP_OK;
+    }
+
+    taskENTER_CRITICAL(&stats_lock);
+    stats.submitted++;
+    if (stats.queue_depth > stats.queue_depth_max)
+    {
+        stats.queue_depth_max = stats.queue_depth;
+    }
+    taskEXIT_CRITICAL(&stats_lock);
+
+    return ESP_OK;
+}
+
+void http_workers_get_stats(http_workers_stats_t *out)
+{
+    taskENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    taskEXIT_CRITICAL(&stats_lock);
+}
@@ -0,0 +1,50 @@
+#ifndef HTTP_WORKERS_H
+#define HTTP_WORKERS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_http_server.h"
+#include "config.h"
+
+typedef esp_err_t (*http_worker_handler_t)(httpd_req_t *req);
+
+typedef struct
+{
+    uint32_t submitted;       // requests handed to the pool
+    uint32_t completed;       // requests finished by a worker
+    uint32_t rejected;        // requests refused because the queue was full
+    uint32_t inlined;         // requests run on the httpd task because the pool is not running
+    uint32_t queue_depth;     // requests currently waiting for a worker
+    uint32_t queue_depth_max; // highest queue depth seen
+    uint32_t busy_workers;    // workers currently running a handler
+    uint64_t wait_us_total;   // sum of queue wait times of completed requests
+    uint32_t wait_us_max;     // longest queue wait time
+} http_workers_stats_t;
+
+/**
+ * @brief Start the worker tasks that run slow HTTP handlers off the httpd task.
+ */
+void http_workers_start(void);
+
+/**
+ * @brief Check whether the caller is one of the worker tasks, or runs a submitted handler
+ * inline because the pool is not running.
+ */
+bool http_workers_is_worker_task(void);
+
+/**
+ * @brief Hand a request over to the worker pool.
+ *
+ * The request is detached with httpd_req_async_handler_begin(), so the httpd
+ * task can go on serving other sockets while `handler` runs on a worker.
+ * Without a running pool the handler is called inline.
+ * @return ESP_OK when queued or answered with 503 because the queue is full.
+ */
+esp_err_t http_workers_submit(httpd_req_t *req, http_worker_handler_t handler);
+
+/**
+ * @brief Take a snapshot of the pool counters.
+ */
+void http_workers_get_stats(http_workers_stats_t *stats);
+
+#endif // HTTP_WORKERS_H
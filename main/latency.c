@@ -0,0 +1,36 @@
+#include "latency.h"
+#include <string.h>
+#include <sys/param.h>
+
+static histogram_t histograms[LATENCY_PATH_COUNT] = {
+    [LATENCY_ADC_TO_PUBLISH] = HISTOGRAM_INITIALIZER("latency_adc_to_publish", HISTOGRAM_UNIT_US),
+    [LATENCY_PUBLISH_TO_LCD] = HISTOGRAM_INITIALIZER("latency_publish_to_lcd", HISTOGRAM_UNIT_US),
+    [LATENCY_PUBLISH_TO_HTTP] = HISTOGRAM_INITIALIZER("latency_publish_to_http", HISTOGRAM_UNIT_US),
+};
+
+void latency_init(void)
+{
+    for (int path = 0; path < LATENCY_PATH_COUNT; path++)
+    {
+        histogram_register(&histograms[path]);
+    }
+}
+
+void latency_record(latency_path_t path, int64_t latency_us)
+{
+    if (path >= LATENCY_PATH_COUNT)
+    {
+        return;
+    }
+    histogram_record(&histograms[path], latency_us <= 0 ? 0 : (uint32_t)MIN(latency_us, (int64_t)UINT32_MAX));
+}
+
+void latency_get_stats(latency_path_t path, histogram_stats_t *stats)
+{
+    if (path >= LATENCY_PATH_COUNT)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    histogram_get_stats(&histograms[path], stats);
+}
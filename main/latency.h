@@ -0,0 +1,36 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include "histogram.h"
+
+/*
+ * How old the readings are by the time someone sees them. Every snapshot
+ * published by the temperature task carries the time its newest ADC frame
+ * was read and the time it was published (ntc_adc_get_snapshot_stamp()),
+ * the consumers record how long after the publish they delivered it.
+ */
+typedef enum
+{
+    LATENCY_ADC_TO_PUBLISH = 0, // newest ADC frame read -> snapshot published
+    LATENCY_PUBLISH_TO_LCD,     // snapshot published -> first frame on the glass after it
+    LATENCY_PUBLISH_TO_HTTP,    // snapshot published -> /api/readings response sent
+    LATENCY_PATH_COUNT
+} latency_path_t;
+
+/**
+ * @brief Register the latency histograms ("latency_adc_to_publish", ...).
+ */
+void latency_init(void);
+
+/**
+ * @brief Add one latency to the histogram of a path. Negative values count as 0.
+ */
+void latency_record(latency_path_t path, int64_t latency_us);
+
+/**
+ * @brief Statistics of a path in microseconds.
+ */
+void latency_get_stats(latency_path_t path, histogram_stats_t *stats);
+
+#endif // LATENCY_H
@@ -1,5 +1,11 @@
 #include "lcd.h"
 #include "ntc_adc.h"
+#include "retained_state.h"
+#include "alarm.h"
+#include "virtual_channel.h"
+#include "sample_scheduler.h"
+#include "latency.h"
+#include "esp_timer.h"
 #include <string.h>
 #include "esp_netif.h"
 
@@ -44,11 +50,15 @@ static char status_line_buffer[STATUS_LINE_MAX][LCD_COLS] = {
     [0 ... STATUS_LINE_MAX - 1] = {[0 ... LCD_COLS - 1] = ' '}};
 static int status_line_buffer_index = 0;
 static bool next_render_requested = false;
+static bool status_line_rebuild_requested = false;
 
 static uint8_t cursor_col = 0;
 static uint8_t cursor_row = 0;
 
 static lcd_screen_state_t lcd_screen_state = LCD_SCREEN_SPLASH;
+static histogram_t render_histogram = HISTOGRAM_INITIALIZER("lcd_render", HISTOGRAM_UNIT_CYCLES);
+static int64_t last_short_press_us = 0;
+static uint32_t shown_snapshot_sequence = 0; // last snapshot whose readings reached the glass
 
 static void replace_zeros_with_spaces(char *buffer, size_t length)
 {
@@ -165,7 +175,17 @@ static void lcd_event_handler(void *handler_arg, esp_event_base_t base, int32_t
             ESP_LOGI(TAG, "Short button press detected");
             if (lcd_screen_state != LCD_SCREEN_AP_MODE)
             {
-                lcd_next_screen(); // Cycle to the next screen
+                int64_t now_us = esp_timer_get_time();
+                if (lcd_screen_state != LCD_SCREEN_LATENCY && now_us - last_short_press_us < LCD_DOUBLE_PRESS_MS * 1000)
+                {
+                    lcd_set_screen_state(LCD_SCREEN_LATENCY);
+                    now_us = 0; // A third press leaves again
+                }
+                else
+                {
+                    lcd_next_screen(); // Cycle to the next screen
+                }
+                last_short_press_us = now_us;
             }
             break;
         /*case EVENT_BUTTON_LONG_PRESS:
@@ -181,6 +201,10 @@ static void lcd_event_handler(void *handler_arg, esp_event_base_t base, int32_t
             lcd_screen_state = LCD_SCREEN_RESTARTING; // Set screen state to restarting
             next_render_requested = true;
             break;
+        case EVENT_ALARM_RAISED:
+        case EVENT_ALARM_CLEARED:
+            next_render_requested = true; // Show the alarm marks right away
+            break;
         default:
             break;
         }
@@ -237,6 +261,18 @@ void lcd_initialize(void)
     lcd_status_line_init();
 #endif
 
+    // Go straight back to the screen shown before the reset, with the retained readings
+    if (retained_has_snapshot())
+    {
+        retained_snapshot_t snapshot;
+        retained_get_snapshot(&snapshot);
+        if (snapshot.screen_state >= LCD_SCREEN_START_SCREEN && snapshot.screen_state < LCD_SCREEN_MAX)
+        {
+            lcd_screen_state = snapshot.screen_state;
+        }
+    }
+
+    histogram_register(&render_histogram);
     lcd_init_cycle();
 
     lcd_render();
@@ -246,14 +282,24 @@ void lcd_initialize(void)
     events_subscribe(EVENT_BUTTON_LONG_PRESS, lcd_event_handler, NULL);
     events_subscribe(EVENT_WIFI_STATE_CHANGED, lcd_event_handler, NULL);
     events_subscribe(EVENT_RESTART_REQUESTED, lcd_event_handler, NULL);
+    events_subscribe(EVENT_ALARM_RAISED, lcd_event_handler, NULL);
+    events_subscribe(EVENT_ALARM_CLEARED, lcd_event_handler, NULL);
 
     // Create LCD update task
     xTaskCreatePinnedToCore(lcd_update_task, "lcd_update_task", 4096, NULL, 5, NULL, 0);
 }
 
+esp_err_t lcd_apply_settings(uint32_t changed_fields)
+{
+    // The status lines are rebuilt on the LCD task before the next frame
+    status_line_rebuild_requested = true;
+    next_render_requested = true;
+    return ESP_OK;
+}
+
 void lcd_set_screen_state(lcd_screen_state_t state)
 {
-    if (state < LCD_SCREEN_MAX)
+    if (state < LCD_SCREEN_MAX || state == LCD_SCREEN_LATENCY)
     {
         lcd_screen_state = state;
     }
@@ -261,6 +307,10 @@ void lcd_set_screen_state(lcd_screen_state_t state)
     {
         lcd_screen_state = LCD_SCREEN_START_SCREEN;
     }
+    if (lcd_screen_state >= LCD_SCREEN_START_SCREEN && lcd_screen_state < LCD_SCREEN_MAX)
+    {
+        retained_store_screen(lcd_screen_state);
+    }
     lcd_clear_buffer();
     next_render_requested = true;
 }
@@ -271,10 +321,18 @@ void lcd_next_screen(void)
     {
         lcd_screen_state++;
     }
+    if (lcd_screen_state == LCD_SCREEN_VIRTUAL && virtual_channel_get_mask() == 0)
+    {
+        lcd_screen_state++;
+    }
     if (lcd_screen_state >= LCD_SCREEN_MAX)
     {
         lcd_screen_state = LCD_SCREEN_START_SCREEN;
     }
+    if (lcd_screen_state >= LCD_SCREEN_START_SCREEN)
+    {
+        retained_store_screen(lcd_screen_state);
+    }
     lcd_clear_buffer();
     next_render_requested = true;
 }
@@ -366,6 +424,7 @@ void lcd_clear_buffer(void)
 
 void lcd_render(void)
 {
+    HISTOGRAM_TIME_SCOPE(&render_histogram);
     for (uint8_t row = 0; row < LCD_ROWS; row++)
     {
         lcd_set_cursor_position(0, row);
@@ -397,6 +456,11 @@ void lcd_format_temperature(float temp, char *buffer, size_t buffer_size)
     {
         return; // Buffer too small
     }
+    if (!isfinite(temp))
+    {
+        memcpy(buffer, " --.-", 5);
+        return;
+    }
     if (temp < 0)
     {
         buffer[0] = '-';
@@ -414,6 +478,12 @@ void lcd_format_temperature(float temp, char *buffer, size_t buffer_size)
 
 static bool isRendering = false;
 
+// Screens showing the readings of the latest snapshot
+static bool lcd_screen_shows_readings(lcd_screen_state_t state)
+{
+    return state >= LCD_SCREEN_START_SCREEN && state <= LCD_SCREEN_VIRTUAL;
+}
+
 void lcd_render_cycle()
 {
     if (isRendering)
@@ -421,6 +491,9 @@ void lcd_render_cycle()
         return;
     }
     isRendering = true;
+    ntc_snapshot_stamp_t stamp;
+    ntc_adc_get_snapshot_stamp(&stamp);
+    lcd_screen_state_t rendered_state = lcd_screen_state;
     switch (lcd_screen_state)
     {
     case LCD_SCREEN_SPLASH:
@@ -445,15 +518,27 @@ void lcd_render_cycle()
         lcd_temperaure_screen(LCD_BOTTOM_STAT_NONE);
         break;
 #endif
+    case LCD_SCREEN_VIRTUAL:
+        lcd_virtual_screen();
+        break;
     case LCD_SCREEN_STATUS_1:
     case LCD_SCREEN_STATUS_2:
     case LCD_SCREEN_STATUS_3:
         lcd_status_screen(lcd_screen_state - LCD_SCREEN_STATUS_1);
         break;
+    case LCD_SCREEN_LATENCY:
+        lcd_latency_screen();
+        break;
     default:
         break;
     }
     lcd_render();
+    // The readings of that snapshot are on the glass now, count each snapshot once
+    if (stamp.sequence != 0 && stamp.sequence != shown_snapshot_sequence && lcd_screen_shows_readings(rendered_state))
+    {
+        shown_snapshot_sequence = stamp.sequence;
+        latency_record(LATENCY_PUBLISH_TO_LCD, esp_timer_get_time() - stamp.published_us);
+    }
     isRendering = false;
 }
 
@@ -496,6 +581,71 @@ void lcd_restarting_screen(void)
     lcd_write_text(" Please wait... ");
 }
 
+void lcd_virtual_screen(void)
+{
+    lcd_clear_buffer();
+    uint8_t mask = virtual_channel_get_mask();
+    if (mask == 0)
+    {
+        lcd_copy_to_lcd_buffer("No virtual channels", LCD_COLS, 0, 0);
+        return;
+    }
+    uint8_t row = 0;
+    for (uint8_t i = 0; i < VIRTUAL_CHANNEL_MAX && row < LCD_ROWS; i++)
+    {
+        virtual_channel_config_t config;
+        if ((mask & (1 << i)) == 0 || virtual_channel_get(i, &config) != ESP_OK)
+        {
+            continue;
+        }
+        // "name          12.3C"
+        char buffer[6] = {0};
+        lcd_copy_to_lcd_buffer(config.name, VIRTUAL_NAME_MAX_LEN - 1, 0, row);
+        lcd_format_temperature(virtual_channel_get_value(i), buffer, sizeof(buffer));
+        lcd_copy_to_lcd_buffer(buffer, 5, LCD_COLS - 6, row);
+        lcd_copy_to_lcd_buffer("C", 1, LCD_COLS - 1, row);
+        row++;
+    }
+}
+
+// Latency in ms, 5 characters
+static void lcd_format_latency(uint32_t latency_us, char *buffer, size_t buffer_size)
+{
+    if (latency_us < 100000)
+    {
+        snprintf(buffer, buffer_size, "%5.1f", latency_us / 1000.0f);
+    }
+    else
+    {
+        snprintf(buffer, buffer_size, "%5lu", (unsigned long)MIN(latency_us / 1000, 99999));
+    }
+}
+
+void lcd_latency_screen(void)
+{
+    static const char *const labels[LATENCY_PATH_COUNT] = {"ADC>pub", "pub>LCD", "pub>HTTP"};
+    lcd_clear_buffer();
+    lcd_copy_to_lcd_buffer("Lat. ms   p50   p99", 19, 0, 0);
+    for (int path = 0; path < LATENCY_PATH_COUNT && path + 1 < LCD_ROWS; path++)
+    {
+        // "pub>LCD  480.0 512.0"
+        histogram_stats_t stats;
+        latency_get_stats(path, &stats);
+        char p50[8];
+        char p99[8];
+        lcd_copy_to_lcd_buffer(labels[path], strlen(labels[path]), 0, path + 1);
+        if (stats.count == 0)
+        {
+            lcd_copy_to_lcd_buffer("--", 2, 11, path + 1);
+            continue;
+        }
+        lcd_format_latency(stats.p50, p50, sizeof(p50));
+        lcd_format_latency(stats.p99, p99, sizeof(p99));
+        lcd_copy_to_lcd_buffer(p50, 5, 8, path + 1);
+        lcd_copy_to_lcd_buffer(p99, 5, 14, path + 1);
+    }
+}
+
 void lcd_status_screen(int8_t index)
 {
 
@@ -658,6 +808,12 @@ void lcd_temperaure_screen(lcd_bottom_stat_t bottom_statistics)
 #endif
     uint8_t sensor_p = 0;
     char bgBuffer[] = "TN:     C  TM:     C";
+    if (ntc_adc_is_stale())
+    {
+        // Last readings from before the reset, the ADC is not running yet
+        bgBuffer[2] = '*';
+        bgBuffer[13] = '*';
+    }
     // const int8_t sensor_count_per_column = SENSOR_COUNT / 2;
     for (uint8_t i = 0; i < SENSOR_COUNT_PER_COLUMN; i++)
     {
@@ -677,6 +833,7 @@ void lcd_temperaure_screen(lcd_bottom_stat_t bottom_statistics)
     float min_temp = 200.0;
     float max_temp = -20.0;
     float avg_temp = 0.0;
+    uint8_t avg_count = 0;
 
     sensor_p = 0;
     for (uint8_t i = 0; i < SENSOR_MAX_COUNT; i++)
@@ -687,7 +844,17 @@ void lcd_temperaure_screen(lcd_bottom_stat_t bottom_statistics)
         }
         if (system_state.sensor_mask & (1 << i))
         {
-            float temp = ntc_adc_raw_to_temperature(ntc_get_channel_data(i));
+            ntc_channel_status_t status = ntc_get_channel_status(i);
+            float temp = ntc_get_channel_temperature(i);
+            if (isnan(temp))
+            {
+                // Open, shorted or stuck sensor: its status in place of the value
+                lcd_set_cursor(sensor_p < SENSOR_COUNT_PER_COLUMN ? 3 : 14, sensor_p % SENSOR_COUNT_PER_COLUMN);
+                snprintf(buffer, sizeof(buffer), "%5s", ntc_channel_status_name(status));
+                lcd_write_text(buffer);
+                sensor_p++;
+                continue;
+            }
             if (bottom_statistics != LCD_BOTTOM_STAT_NONE && temp < min_temp)
             {
                 min_temp = temp;
@@ -699,10 +866,16 @@ void lcd_temperaure_screen(lcd_bottom_stat_t bottom_statistics)
             if (bottom_statistics != LCD_BOTTOM_STAT_NONE)
             {
                 avg_temp += temp;
+                avg_count++;
             }
             lcd_set_cursor(sensor_p < SENSOR_COUNT_PER_COLUMN ? 3 : 14, sensor_p % SENSOR_COUNT_PER_COLUMN);
             lcd_format_temperature(temp, buffer, sizeof(buffer));
             lcd_write_text(buffer);
+            if (alarm_get_active(i) || status == NTC_STATUS_NOISY)
+            {
+                lcd_set_cursor(sensor_p < SENSOR_COUNT_PER_COLUMN ? 2 : 13, sensor_p % SENSOR_COUNT_PER_COLUMN);
+                lcd_write_text(status == NTC_STATUS_NOISY ? "?" : "!");
+            }
         }
         else
         {
@@ -717,7 +890,12 @@ void lcd_temperaure_screen(lcd_bottom_stat_t bottom_statistics)
         return; // No statistics to display
     }
 
-    avg_temp /= 6.0;
+    // Faulted sensors do not count
+    if (avg_count == 0)
+    {
+        min_temp = max_temp = NAN;
+    }
+    avg_temp = avg_count > 0 ? avg_temp / avg_count : NAN;
     lcd_set_cursor(0, 3);
     lcd_format_temperature(min_temp, buffer, sizeof(buffer));
     lcd_write_text(buffer);
@@ -731,21 +909,39 @@ void lcd_temperaure_screen(lcd_bottom_stat_t bottom_statistics)
     lcd_write_text(buffer);
 }
 
+// Readings only change with a snapshot, in quiet mode there is no point in redrawing at LCD_FPS
+static TickType_t lcd_frame_delay(void)
+{
+    if (sample_scheduler_get_mode() == SAMPLE_MODE_QUIET)
+    {
+        return pdMS_TO_TICKS(sample_scheduler_interval_ms());
+    }
+    return pdMS_TO_TICKS(1000 / LCD_FPS);
+}
+
 void lcd_update_task(void *pvParameter)
 {
-    const TickType_t frame_delay = pdMS_TO_TICKS(1000 / LCD_FPS);
     TickType_t last_render_tick = xTaskGetTickCount();
     int lcd_status_line_counter = 0;
 
     for (;;)
     {
+        if (status_line_rebuild_requested)
+        {
+            status_line_rebuild_requested = false;
+#ifdef STATUS_LINE_ENABLED
+            lcd_status_line_init();
+            handle_wifi_state_change();
+#endif
+        }
+
         if (next_render_requested)
         {
             next_render_requested = false;
             last_render_tick = xTaskGetTickCount(); // Reset the render tick
             lcd_render_cycle();
         }
-        else if (xTaskGetTickCount() - last_render_tick >= frame_delay)
+        else if (xTaskGetTickCount() - last_render_tick >= lcd_frame_delay())
         {
             if (++lcd_status_line_counter >= 5)
             {
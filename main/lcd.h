@@ -34,6 +34,7 @@
 #define LCD_DB4 (1 << 4) // Data bit 4
 
 #define LCD_FPS 2 // Frames per second
+#define LCD_DOUBLE_PRESS_MS 400 // Two short presses within this open the latency screen
 #define LCD_COLS 20
 #define LCD_ROWS 4
 #define LCD_ROW_OFFSET {0x00, 0x40, 0x14, 0x54} // Row offsets for 20x4 LCD
@@ -49,10 +50,12 @@ typedef enum {
 #else
     LCD_SCREEN_TEMPERATURE,
 #endif
+    LCD_SCREEN_VIRTUAL, // skipped while no virtual channel is defined
     LCD_SCREEN_STATUS_1,
     LCD_SCREEN_STATUS_2,
     LCD_SCREEN_STATUS_3,
-    LCD_SCREEN_MAX
+    LCD_SCREEN_MAX,
+    LCD_SCREEN_LATENCY, // hidden, outside the rotation: opened with a double press
 } lcd_screen_state_t;
 
 #ifdef STATUS_LINE_ENABLED
@@ -117,6 +120,12 @@ void lcd_status_line(void);
 void lcd_status_line_init(void);
 #endif
 
+// Display the virtual channels on the LCD, one per row.
+void lcd_virtual_screen(void);
+
+// Display the reading latencies (p50/p99 in ms) on the LCD.
+void lcd_latency_screen(void);
+
 // Display a list of status messages on the LCD.
 void lcd_status_screen(int8_t index);
 
@@ -135,6 +144,9 @@ lcd_screen_state_t lcd_get_screen_state(void);
 // Go to the next screen.
 void lcd_next_screen(void);
 
+// Refresh the lines showing changed settings (see settings_field_t).
+esp_err_t lcd_apply_settings(uint32_t changed_fields);
+
 // Set the current screen state.
 void lcd_set_screen_state(lcd_screen_state_t state);
 
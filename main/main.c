@@ -6,57 +6,85 @@
 
 #include "config.h"
 #include "state_manager.h"
-#include "nvs_manager.h"
 #include "wifi_manager.h"
 #include "status_led.h"
 #include "button_manager.h"
 #include "ntc_adc.h"
 #include "lcd.h"
 #include "server.h"
+#include "asset_store.h"
+#include "boot_manager.h"
+#include "retained_state.h"
+#include "history.h"
+#include "alarm.h"
+#include "virtual_channel.h"
+#include "latency.h"
 
 /* Todos:
  * - Deinitialize modules on shutdown event
- * - Merge fatfs with nvs_manager, maybe use it instead of nvs for storing config
  * - Update frontend source from CDN.
 */
 
-void app_main(void)
+static void boot_adc(void)
 {
-    vTaskDelay(pdMS_TO_TICKS(3000));
-    ESP_LOGI("main", "Prio: %d, Core: %d", uxTaskPriorityGet(NULL), xPortGetCoreID());
-    
-    system_initialize();
-
-    vTaskDelay(pdMS_TO_TICKS(100));
-
-    events_init();
-
-    vTaskDelay(pdMS_TO_TICKS(100));
-
-    wifi_initialize();
-
-    status_led_init();
-
-    button_init();
-
-    vTaskDelay(pdMS_TO_TICKS(100));
-
-    ntc_init_mutex();
+    alarm_init();
+    virtual_channel_init();
+    latency_init();
+    ESP_ERROR_CHECK_WITHOUT_ABORT(ntc_adc_initialize());
+}
 
+static void boot_lcd(void)
+{
     i2c_initialize();
     lcd_initialize();
+}
 
-    vTaskDelay(pdMS_TO_TICKS(100));
+static void boot_ui(void)
+{
+    status_led_init();
+    button_init();
+}
 
-    ntc_adc_initialize();
+static void boot_http(void)
+{
+    asset_store_init();
+    start_http_server();
+}
 
-    vTaskDelay(pdMS_TO_TICKS(3000));
+static void boot_start_screen(void)
+{
+    // A screen restored from retained memory is already showing
+    if (lcd_get_screen_state() == LCD_SCREEN_SPLASH)
+    {
+        lcd_set_screen_state(LCD_SCREEN_START_SCREEN);
+    }
+}
 
-    lcd_set_screen_state(LCD_SCREEN_START_SCREEN);
+// Each step starts as soon as its dependencies are done
+static const boot_step_t boot_steps[] = {
+    {BOOT_STEP_SYSTEM, "system", system_initialize, 0, 0},
+    {BOOT_STEP_EVENTS, "events", events_init, 0, 1},
+    // Alarm evaluation on the temperature task posts events from the first snapshot on
+    {BOOT_STEP_ADC, "adc", boot_adc, BOOT_DEP(BOOT_STEP_SYSTEM) | BOOT_DEP(BOOT_STEP_EVENTS), 1},
+    {BOOT_STEP_FIRST_READING, "first_reading", NULL, BOOT_DEP(BOOT_STEP_ADC), 1},
+    {BOOT_STEP_LCD, "lcd", boot_lcd, BOOT_DEP(BOOT_STEP_SYSTEM) | BOOT_DEP(BOOT_STEP_EVENTS), 0},
+    {BOOT_STEP_UI, "ui", boot_ui, BOOT_DEP(BOOT_STEP_EVENTS), tskNO_AFFINITY},
+    {BOOT_STEP_WIFI, "wifi", wifi_initialize, BOOT_DEP(BOOT_STEP_SYSTEM) | BOOT_DEP(BOOT_STEP_EVENTS), 0},
+    // Subscribers of EVENT_WIFI_STATE_CHANGED have to be registered before the first post
+    {BOOT_STEP_WIFI_CONNECT, "wifi_connect", wifi_connect, BOOT_DEP(BOOT_STEP_WIFI) | BOOT_DEP(BOOT_STEP_LCD) | BOOT_DEP(BOOT_STEP_UI), 0},
+    // The API handlers use the calibration, filter, alarm and virtual channel state set up by the ADC step
+    {BOOT_STEP_HTTP, "http", boot_http, BOOT_DEP(BOOT_STEP_WIFI) | BOOT_DEP(BOOT_STEP_ADC), 1},
+    {BOOT_STEP_HISTORY, "history", history_start, BOOT_DEP(BOOT_STEP_SYSTEM), 0},
+    {BOOT_STEP_START_SCREEN, "start_screen", boot_start_screen, BOOT_DEP(BOOT_STEP_LCD) | BOOT_DEP(BOOT_STEP_FIRST_READING), tskNO_AFFINITY},
+};
 
-    wifi_connect();
+void app_main(void)
+{
+    retained_init();
 
-    vTaskDelay(pdMS_TO_TICKS(100));
+    // Needed by the LCD before the ADC is up
+    ntc_init_mutex();
+    ntc_adc_restore_snapshot();
 
-    start_http_server();
+    boot_run(boot_steps, sizeof(boot_steps) / sizeof(boot_steps[0]));
 }
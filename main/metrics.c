@@ -0,0 +1,232 @@
+#include "metrics.h"
+#include <math.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "ntc_adc.h"
+#include "virtual_channel.h"
+#include "histogram.h"
+#include "wifi_manager.h"
+
+/*
+ * OpenMetrics text exposition for Prometheus. Streamed through the caller's
+ * chunk writer: no heap allocation and no float printf, so frequent scrapes
+ * stay out of the way of the temperature task.
+ */
+
+static const char *TAG = "metrics";
+
+// Tasks whose stacks can be listed per scrape; with more the stack family is left out and a warning logged
+#define METRICS_TASK_MAX 32
+
+// Fixed-point text of a value, the float printf path is not used
+static void metrics_write_value(chunk_writer_t *writer, double value, int decimals)
+{
+    static const uint32_t scales[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+    if (isnan(value))
+    {
+        chunk_writer_write(writer, "NaN", 3);
+        return;
+    }
+    if (isinf(value))
+    {
+        chunk_writer_printf(writer, "%cInf", value > 0 ? '+' : '-');
+        return;
+    }
+    uint32_t scale = scales[MIN(decimals, 6)];
+    long long scaled = llround(fabs(value) * scale);
+    chunk_writer_printf(writer, "%s%lld", value < 0 && scaled != 0 ? "-" : "", scaled / scale);
+    if (scale > 1)
+    {
+        chunk_writer_printf(writer, ".%0*lld", MIN(decimals, 6), scaled % scale);
+    }
+}
+
+static void metrics_write_label(chunk_writer_t *writer, const char *value)
+{
+    for (const char *c = value; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            chunk_writer_write(writer, "\\", 1);
+        }
+        if (*c == '\n')
+        {
+            chunk_writer_write(writer, "\\n", 2);
+            continue;
+        }
+        chunk_writer_write(writer, c, 1);
+    }
+}
+
+static void metrics_family(chunk_writer_t *writer, const char *name, const char *type, const char *unit, const char *help)
+{
+    chunk_writer_printf(writer, "# TYPE %s %s\n", name, type);
+    if (unit != NULL)
+    {
+        chunk_writer_printf(writer, "# UNIT %s %s\n", name, unit);
+    }
+    chunk_writer_printf(writer, "# HELP %s %s\n", name, help);
+}
+
+static void metrics_write_timing(chunk_writer_t *writer)
+{
+    static const char *const quantiles[] = {"0.5", "0.9", "0.99"};
+    metrics_family(writer, "ntc_timing_seconds", "summary", "seconds",
+                   "Timed hot paths and reading latencies, quantiles are bucket upper bounds.");
+    for (histogram_t *histogram = histogram_next(NULL); histogram != NULL; histogram = histogram_next(histogram))
+    {
+        histogram_stats_t stats;
+        histogram_get_stats(histogram, &stats);
+        const uint32_t values[] = {stats.p50, stats.p90, stats.p99};
+        for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+        {
+            chunk_writer_printf(writer, "ntc_timing_seconds{path=\"%s\",quantile=\"%s\"} ", histogram->name,
+                                quantiles[i]);
+            metrics_write_value(writer, histogram_to_us(histogram, values[i]) / 1e6, 6);
+            chunk_writer_write(writer, "\n", 1);
+        }
+        chunk_writer_printf(writer, "ntc_timing_seconds_sum{path=\"%s\"} ", histogram->name);
+        metrics_write_value(writer, histogram_to_us(histogram, stats.sum) / 1e6, 6);
+        chunk_writer_printf(writer, "\nntc_timing_seconds_count{path=\"%s\"} %lu\n", histogram->name,
+                            (unsigned long)stats.count);
+    }
+}
+
+static void metrics_write_tasks(chunk_writer_t *writer)
+{
+#if configUSE_TRACE_FACILITY
+    // One scrape at a time, on the httpd task
+    static TaskStatus_t tasks[METRICS_TASK_MAX];
+    UBaseType_t task_total = uxTaskGetNumberOfTasks();
+    metrics_family(writer, "esp_tasks", "gauge", NULL, "Tasks that exist, listed or not.");
+    chunk_writer_printf(writer, "esp_tasks %lu\n", (unsigned long)task_total);
+
+    // uxTaskGetSystemState() fills nothing at all when the array is too small, also when a task
+    // was created since the count
+    UBaseType_t task_count = task_total <= METRICS_TASK_MAX ? uxTaskGetSystemState(tasks, METRICS_TASK_MAX, NULL) : 0;
+    if (task_count == 0)
+    {
+        ESP_LOGW(TAG, "%lu tasks, stacks of at most %d can be listed", (unsigned long)task_total, METRICS_TASK_MAX);
+        return;
+    }
+    metrics_family(writer, "esp_task_stack_high_water_mark_bytes", "gauge", "bytes",
+                   "Least free stack a task has had since it started.");
+    for (UBaseType_t i = 0; i < task_count; i++)
+    {
+        chunk_writer_printf(writer, "esp_task_stack_high_water_mark_bytes{task=\"");
+        metrics_write_label(writer, tasks[i].pcTaskName);
+        chunk_writer_printf(writer, "\"} %lu\n", (unsigned long)tasks[i].usStackHighWaterMark);
+    }
+#endif
+}
+
+void metrics_write(chunk_writer_t *writer, const metrics_http_endpoint_t *endpoints, size_t endpoint_count)
+{
+    metrics_family(writer, "ntc_temperature_celsius", "gauge", "celsius",
+                   "Filtered temperature per channel, NaN while the sensor is faulted.");
+    for (uint8_t i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        if ((system_state.sensor_mask & (1 << i)) == 0)
+        {
+            continue;
+        }
+        chunk_writer_printf(writer, "ntc_temperature_celsius{channel=\"%u\"} ", i);
+        metrics_write_value(writer, ntc_get_channel_temperature(i), 3);
+        chunk_writer_write(writer, "\n", 1);
+    }
+
+    uint8_t virtual_mask = virtual_channel_get_mask();
+    for (uint8_t i = 0; i < VIRTUAL_CHANNEL_MAX; i++)
+    {
+        virtual_channel_config_t config;
+        if ((virtual_mask & (1 << i)) == 0 || virtual_channel_get(i, &config) != ESP_OK)
+        {
+            continue;
+        }
+        chunk_writer_printf(writer, "ntc_temperature_celsius{channel=\"%u\",name=\"", SENSOR_MAX_COUNT + i);
+        metrics_write_label(writer, config.name);
+        chunk_writer_write(writer, "\"} ", 3);
+        metrics_write_value(writer, virtual_channel_get_value(i), 3);
+        chunk_writer_write(writer, "\n", 1);
+    }
+
+    // A stateset, so the temperature series stays the same while the status changes
+    metrics_family(writer, "ntc_channel_status", "stateset", NULL, "Fault classification per channel.");
+    for (uint8_t i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        if ((system_state.sensor_mask & (1 << i)) == 0)
+        {
+            continue;
+        }
+        ntc_channel_status_t status = ntc_get_channel_status(i);
+        for (ntc_channel_status_t state = NTC_STATUS_OK; state <= NTC_STATUS_NOISY; state++)
+        {
+            chunk_writer_printf(writer, "ntc_channel_status{channel=\"%u\",ntc_channel_status=\"%s\"} %d\n", i,
+                                ntc_channel_status_name(state), state == status);
+        }
+    }
+
+    metrics_family(writer, "ntc_samples_per_second", "gauge", NULL,
+                   "ADC conversions per second and channel over the last snapshot interval.");
+    for (uint8_t i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        if ((system_state.sensor_mask & (1 << i)) == 0)
+        {
+            continue;
+        }
+        ntc_channel_counters_t counters;
+        ntc_adc_get_channel_counters(i, &counters);
+        chunk_writer_printf(writer, "ntc_samples_per_second{channel=\"%u\"} ", i);
+        metrics_write_value(writer, counters.rate_hz, 1);
+        chunk_writer_write(writer, "\n", 1);
+    }
+    metrics_family(writer, "ntc_conversions", "counter", NULL, "ADC conversions per channel since boot.");
+    for (uint8_t i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        ntc_channel_counters_t counters;
+        ntc_adc_get_channel_counters(i, &counters);
+        if (counters.conversions > 0)
+        {
+            chunk_writer_printf(writer, "ntc_conversions_total{channel=\"%u\"} %llu\n", i,
+                                (unsigned long long)counters.conversions);
+        }
+    }
+    metrics_family(writer, "ntc_adc_pool_overflows", "counter", NULL,
+                   "Times the ADC driver dropped conversions because frames were not read in time.");
+    chunk_writer_printf(writer, "ntc_adc_pool_overflows_total %lu\n", (unsigned long)ntc_adc_get_overflow_count());
+
+    metrics_write_timing(writer);
+
+    metrics_family(writer, "http_requests", "counter", NULL, "HTTP requests per endpoint.");
+    for (size_t i = 0; i < endpoint_count; i++)
+    {
+        chunk_writer_printf(writer, "http_requests_total{endpoint=\"%s\"} %lu\n", endpoints[i].name,
+                            (unsigned long)endpoints[i].requests);
+    }
+    metrics_family(writer, "http_request_errors", "counter", NULL, "HTTP requests whose handler failed or that were refused because the worker queue was full.");
+    for (size_t i = 0; i < endpoint_count; i++)
+    {
+        chunk_writer_printf(writer, "http_request_errors_total{endpoint=\"%s\"} %lu\n", endpoints[i].name,
+                            (unsigned long)endpoints[i].errors);
+    }
+
+    metrics_family(writer, "esp_heap_free_bytes", "gauge", "bytes", "Free heap.");
+    chunk_writer_printf(writer, "esp_heap_free_bytes %lu\n", (unsigned long)esp_get_free_heap_size());
+    metrics_family(writer, "esp_heap_minimum_free_bytes", "gauge", "bytes", "Least free heap since boot.");
+    chunk_writer_printf(writer, "esp_heap_minimum_free_bytes %lu\n", (unsigned long)esp_get_minimum_free_heap_size());
+    metrics_write_tasks(writer);
+
+    metrics_family(writer, "wifi_reconnects", "counter", NULL, "Station reconnection attempts since boot.");
+    chunk_writer_printf(writer, "wifi_reconnects_total %lu\n", (unsigned long)wifi_get_reconnect_count());
+    int8_t rssi;
+    if (system_state.wifi_state == WIFI_STATE_STA && wifi_get_rssi(&rssi) == ESP_OK)
+    {
+        metrics_family(writer, "wifi_rssi_dbm", "gauge", "dbm", "Signal strength of the access point.");
+        chunk_writer_printf(writer, "wifi_rssi_dbm %d\n", rssi);
+    }
+
+    chunk_writer_write(writer, "# EOF\n", 6);
+}
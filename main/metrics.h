@@ -0,0 +1,22 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "chunk_writer.h"
+
+// Request counters of one HTTP endpoint, snapshotted by the server
+typedef struct
+{
+    const char *name;
+    uint32_t requests;
+    uint32_t errors;
+} metrics_http_endpoint_t;
+
+/**
+ * @brief Write the OpenMetrics text exposition, ending with "# EOF".
+ * Every metric family is written as one contiguous block, as the format requires.
+ */
+void metrics_write(chunk_writer_t *writer, const metrics_http_endpoint_t *endpoints, size_t endpoint_count);
+
+#endif // METRICS_H
@@ -1,14 +1,57 @@
 #include "ntc_adc.h"
 #include "esp_log.h"
+#include "boot_manager.h"
+#include "retained_state.h"
+#include "alarm.h"
+#include "ntc_filter.h"
+#include "virtual_channel.h"
+#include "sample_scheduler.h"
+#include "capture.h"
+#include "latency.h"
+#include "histogram.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include <sys/param.h>
 
 static const char *TAG = "ntc_adc";
 
 // Static variables for ADC handle and mutex
 static adc_continuous_handle_t adc_handle;
 static SemaphoreHandle_t channel_data_mutex;
+static TaskHandle_t temperature_task_handle = NULL;
 
 // Array to store ADC channel data
 static uint16_t channel_data[SENSOR_MAX_COUNT] = {0};
+// Raw code statistics between two snapshots, for the fault classifier
+typedef struct
+{
+    uint32_t count;
+    uint32_t sum;
+    uint64_t sum_squares;
+    uint16_t min;
+    uint16_t max;
+} channel_window_t;
+static channel_window_t channel_window[SENSOR_MAX_COUNT];
+static uint16_t stuck_code[SENSOR_MAX_COUNT];
+static uint8_t stuck_snapshots[SENSOR_MAX_COUNT];
+static volatile ntc_channel_status_t channel_status[SENSOR_MAX_COUNT];
+
+// Set once the ADC stored its first sample, until then channel_data holds the retained snapshot
+static volatile bool channel_data_live = false;
+
+// Sensor mask change handed over to the temperature task. The sequence numbers tell a
+// requester its own completion from the late one of a request that timed out.
+static volatile uint32_t reconfigure_requested = 0;
+static volatile uint32_t reconfigure_completed = 0;
+static volatile uint8_t pending_sensor_mask = 0;
+static volatile esp_err_t reconfigure_result = ESP_OK;
+static SemaphoreHandle_t reconfigure_done = NULL;
+
+static histogram_t frame_histogram = HISTOGRAM_INITIALIZER("adc_frame", HISTOGRAM_UNIT_CYCLES);
+static ntc_snapshot_stamp_t snapshot_stamp;
+static ntc_channel_counters_t channel_counters[SENSOR_MAX_COUNT];
+static portMUX_TYPE snapshot_stamp_lock = portMUX_INITIALIZER_UNLOCKED;
+static volatile uint32_t pool_overflows = 0;
 
 // Retrieve ADC data for a specific channel
 uint16_t ntc_get_channel_data(uint8_t channel_index)
@@ -28,19 +71,76 @@ uint16_t ntc_get_channel_data(uint8_t channel_index)
 }
 
 // Convert raw ADC value to temperature in Celsius
-float ntc_adc_raw_to_temperature(uint16_t adc_raw)
+float ntc_adc_raw_to_temperature(uint8_t channel_index, uint16_t adc_raw)
+{
+    return ntc_calibration_convert(channel_index, adc_raw);
+}
+
+ntc_channel_status_t ntc_get_channel_status(uint8_t channel_index)
 {
-    // Convert ADC value to voltage (12-bit ADC, 0 dB attenuation = 0–1.1V range)
-    float voltage_mv = (adc_raw * 1100) / 4095.0; // Convert to mV
+    return channel_index < SENSOR_MAX_COUNT ? channel_status[channel_index] : NTC_STATUS_OK;
+}
 
-    // Calculate NTC resistance
-    float R_ntc = R_FIXED * (V_SUPPLY / voltage_mv - 1.0);
+const char *ntc_channel_status_name(ntc_channel_status_t status)
+{
+    static const char *const names[] = {
+        [NTC_STATUS_OK] = "OK",
+        [NTC_STATUS_OPEN] = "OPEN",
+        [NTC_STATUS_SHORT] = "SHRT",
+        [NTC_STATUS_STUCK] = "STCK",
+        [NTC_STATUS_NOISY] = "NOIS",
+    };
+    return status <= NTC_STATUS_NOISY ? names[status] : "?";
+}
+
+float ntc_get_channel_temperature(uint8_t channel_index)
+{
+    ntc_channel_status_t status = ntc_get_channel_status(channel_index);
+    if (status == NTC_STATUS_OPEN || status == NTC_STATUS_SHORT || status == NTC_STATUS_STUCK)
+    {
+        return NAN;
+    }
+    return ntc_adc_raw_to_temperature(channel_index, ntc_get_channel_data(channel_index));
+}
+
+// Classify a channel from the codes seen since the last snapshot
+static ntc_channel_status_t ntc_adc_classify(uint8_t channel, const channel_window_t *window)
+{
+    if (window->count == 0)
+    {
+        return channel_status[channel]; // No conversions, keep the last verdict
+    }
+    if (window->max <= NTC_RAW_OPEN_MAX)
+    {
+        return NTC_STATUS_OPEN;
+    }
+    if (window->min >= NTC_RAW_SHORT_MIN)
+    {
+        return NTC_STATUS_SHORT;
+    }
 
-    // Convert resistance to temperature using Steinhart-Hart equation
-    float t_kelvin = 1.0 / ((1.0 / T0_KELVIN) + (1.0 / NTC_BETA) * log(R_ntc / NTC_R25));
-    float temperature = t_kelvin - 273.15; // Convert to Celsius
+    // Variance in integer codes, count * sum_squares - sum^2 = count^2 * variance
+    uint64_t spread = (uint64_t)window->count * window->sum_squares - (uint64_t)window->sum * window->sum;
+    if (spread > (uint64_t)NTC_NOISE_MAX_STDDEV * NTC_NOISE_MAX_STDDEV * window->count * window->count)
+    {
+        stuck_snapshots[channel] = 0;
+        return NTC_STATUS_NOISY;
+    }
 
-    return temperature;
+    // A live input always dithers by a few codes
+    if (window->min == window->max && window->min == stuck_code[channel])
+    {
+        if (stuck_snapshots[channel] < NTC_STUCK_SNAPSHOTS)
+        {
+            stuck_snapshots[channel]++;
+        }
+    }
+    else
+    {
+        stuck_snapshots[channel] = 0;
+    }
+    stuck_code[channel] = window->min == window->max ? window->min : UINT16_MAX;
+    return stuck_snapshots[channel] >= NTC_STUCK_SNAPSHOTS ? NTC_STATUS_STUCK : NTC_STATUS_OK;
 }
 
 // Initialize the mutex for thread safety
@@ -54,22 +154,105 @@ void ntc_init_mutex()
     }
 }
 
-// Initialize the ADC
-esp_err_t ntc_adc_initialize()
+void ntc_adc_restore_snapshot()
 {
-    if (channel_data_mutex == NULL)
+    if (!retained_has_snapshot())
     {
-        ntc_init_mutex(); // Initialize mutex if not already done
+        return;
     }
+    retained_snapshot_t snapshot;
+    retained_get_snapshot(&snapshot);
+    xSemaphoreTake(channel_data_mutex, portMAX_DELAY);
+    memcpy(channel_data, snapshot.raw, sizeof(channel_data));
+    xSemaphoreGive(channel_data_mutex);
+    ESP_LOGI(TAG, "Showing retained readings until the ADC is running");
+}
 
-    // ADC configuration
-    adc_continuous_handle_cfg_t adc_config = {
-        .max_store_buf_size = 1024,
-        .conv_frame_size = 256,
-    };
-    ESP_ERROR_CHECK(adc_continuous_new_handle(&adc_config, &adc_handle));
+bool ntc_adc_is_stale()
+{
+    return !channel_data_live;
+}
 
-    // Configure channels
+// Hand the current readings to the retained snapshot, the virtual channels, the alarm rules and the sample scheduler
+static void ntc_adc_publish_snapshot(int64_t acquired_us)
+{
+    uint16_t raw[SENSOR_MAX_COUNT];
+    channel_window_t window[SENSOR_MAX_COUNT];
+    xSemaphoreTake(channel_data_mutex, portMAX_DELAY);
+    memcpy(raw, channel_data, sizeof(raw));
+    memcpy(window, channel_window, sizeof(window));
+    memset(channel_window, 0, sizeof(channel_window));
+    xSemaphoreGive(channel_data_mutex);
+    uint8_t sensor_mask = system_state.sensor_mask;
+    retained_store_readings(raw, sensor_mask);
+
+    float temperatures[SENSOR_MAX_COUNT];
+    for (int i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        ntc_channel_status_t status = (sensor_mask & (1 << i)) ? ntc_adc_classify(i, &window[i]) : NTC_STATUS_OK;
+        if (status != channel_status[i])
+        {
+            ESP_LOGW(TAG, "Channel %d: %s -> %s", i, ntc_channel_status_name(channel_status[i]),
+                     ntc_channel_status_name(status));
+            channel_status[i] = status;
+        }
+        temperatures[i] = (sensor_mask & (1 << i)) ? ntc_get_channel_temperature(i) : NAN;
+    }
+    virtual_channel_evaluate(temperatures);
+    uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+    alarm_evaluate(temperatures, sensor_mask, now_ms);
+    sample_scheduler_update(temperatures, sensor_mask, now_ms);
+
+    int64_t published_us = esp_timer_get_time();
+    int64_t interval_us = snapshot_stamp.sequence != 0 ? published_us - snapshot_stamp.published_us : 0;
+    taskENTER_CRITICAL(&snapshot_stamp_lock);
+    for (int i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        channel_counters[i].conversions += window[i].count;
+        channel_counters[i].rate_hz = interval_us > 0 ? window[i].count * 1e6f / interval_us : 0.0f;
+    }
+    snapshot_stamp.sequence++;
+    snapshot_stamp.acquired_us = acquired_us;
+    snapshot_stamp.published_us = published_us;
+    taskEXIT_CRITICAL(&snapshot_stamp_lock);
+    latency_record(LATENCY_ADC_TO_PUBLISH, published_us - acquired_us);
+}
+
+void ntc_adc_get_channel_counters(uint8_t channel_index, ntc_channel_counters_t *counters)
+{
+    if (channel_index >= SENSOR_MAX_COUNT)
+    {
+        memset(counters, 0, sizeof(*counters));
+        return;
+    }
+    taskENTER_CRITICAL(&snapshot_stamp_lock);
+    *counters = channel_counters[channel_index];
+    taskEXIT_CRITICAL(&snapshot_stamp_lock);
+}
+
+uint32_t ntc_adc_get_overflow_count(void)
+{
+    return pool_overflows;
+}
+
+// The temperature task fell behind and the driver dropped conversions
+static bool IRAM_ATTR ntc_adc_on_pool_overflow(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata,
+                                               void *user_data)
+{
+    pool_overflows++;
+    return false;
+}
+
+void ntc_adc_get_snapshot_stamp(ntc_snapshot_stamp_t *stamp)
+{
+    taskENTER_CRITICAL(&snapshot_stamp_lock);
+    *stamp = snapshot_stamp;
+    taskEXIT_CRITICAL(&snapshot_stamp_lock);
+}
+
+// Build the conversion pattern for the channels enabled in sensor_mask
+static esp_err_t ntc_adc_configure_channels(uint8_t sensor_mask)
+{
     adc_continuous_config_t channel_config = {
         .sample_freq_hz = SOC_ADC_SAMPLE_FREQ_THRES_LOW, // Sampling frequency
         .conv_mode = ADC_CONV_SINGLE_UNIT_1,
@@ -80,29 +263,128 @@ esp_err_t ntc_adc_initialize()
     adc_digi_pattern_config_t patterns[8] = {0};
     for (int i = 0; i < 8; i++)
     {
-        if (system_state.sensor_mask & (1 << i)) // & LCD_SENSOR_DISPLAY_MASK
+        if (sensor_mask & (1 << i)) // & LCD_SENSOR_DISPLAY_MASK
         {
             ESP_LOGI(TAG, "Initializing ADC channel %d - Pattern: %d", i, pI);
             // Add channel to the configuration
-            patterns[pI].atten = ADC_ATTEN_DB_0;
+            patterns[pI].atten = NTC_ADC_ATTEN;
             patterns[pI].channel = i;
-            patterns[pI].unit = ADC_UNIT_1;
-            patterns[pI].bit_width = ADC_BITWIDTH_12;
+            patterns[pI].unit = NTC_ADC_UNIT;
+            patterns[pI].bit_width = NTC_ADC_BITWIDTH;
             pI++;
         }
     }
     channel_config.pattern_num = pI;
     channel_config.adc_pattern = patterns;
 
-    ESP_ERROR_CHECK(adc_continuous_config(adc_handle, &channel_config));
+    // Every channel is converted once per pass over the pattern
+    ntc_filter_set_sample_period((uint32_t)(1000000ULL * MAX(pI, 1) / channel_config.sample_freq_hz));
+    sample_scheduler_set_full_rate(channel_config.sample_freq_hz);
+    capture_set_rate(channel_config.sample_freq_hz);
+
+    return adc_continuous_config(adc_handle, &channel_config);
+}
+
+// Initialize the ADC
+esp_err_t ntc_adc_initialize()
+{
+    if (channel_data_mutex == NULL)
+    {
+        ntc_init_mutex(); // Initialize mutex if not already done
+    }
+    reconfigure_done = xSemaphoreCreateBinary();
+    histogram_register(&frame_histogram);
+    ntc_filter_init();
+    ntc_calibration_init();
+
+    // ADC configuration
+    adc_continuous_handle_cfg_t adc_config = {
+        .max_store_buf_size = 1024,
+        .conv_frame_size = CAPTURE_FRAME_SIZE,
+    };
+    ESP_ERROR_CHECK(adc_continuous_new_handle(&adc_config, &adc_handle));
+    adc_continuous_evt_cbs_t callbacks = {
+        .on_pool_ovf = ntc_adc_on_pool_overflow,
+    };
+    ESP_ERROR_CHECK(adc_continuous_register_event_callbacks(adc_handle, &callbacks, NULL));
+
+    // Configure channels
+    ESP_ERROR_CHECK(ntc_adc_configure_channels(system_state.sensor_mask));
 
     // Create temperature reading task
-    xTaskCreatePinnedToCore(ntc_temperature_task, "temperature_task", TASK_NTC_TEMP_STACK_SIZE, NULL, TASK_NTC_TEMP_PRIORITY, NULL, TASK_NTC_TEMP_CORE);
+    xTaskCreatePinnedToCore(ntc_temperature_task, "temperature_task", TASK_NTC_TEMP_STACK_SIZE, NULL, TASK_NTC_TEMP_PRIORITY, &temperature_task_handle, TASK_NTC_TEMP_CORE);
     //xTaskCreatePinnedToCore(ntc_report_temperature_task, "report_temperature_task", TASK_NTC_REPORT_STACK_SIZE, NULL, TASK_NTC_REPORT_PRIORITY, NULL, TASK_NTC_REPORT_CORE);
 
     return ESP_OK;
 }
 
+// Runs on the temperature task, the only reader of adc_handle
+static esp_err_t ntc_adc_reconfigure(uint8_t sensor_mask)
+{
+    ESP_LOGI(TAG, "Reconfiguring ADC for sensor mask 0x%02X", sensor_mask);
+    esp_err_t err = adc_continuous_stop(adc_handle);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    err = ntc_adc_configure_channels(sensor_mask);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to configure ADC channels: %s", esp_err_to_name(err));
+    }
+
+    // Restart the filters, the sample period changed; drop stale samples of the channels that were switched off
+    if (xSemaphoreTake(channel_data_mutex, portMAX_DELAY))
+    {
+        for (int i = 0; i < SENSOR_MAX_COUNT; i++)
+        {
+            ntc_filter_reset(i);
+            if ((sensor_mask & (1 << i)) == 0)
+            {
+                channel_data[i] = 0;
+            }
+        }
+        xSemaphoreGive(channel_data_mutex);
+    }
+
+    esp_err_t start_err = adc_continuous_start(adc_handle);
+    return err != ESP_OK ? err : start_err;
+}
+
+esp_err_t ntc_adc_apply_settings(uint32_t changed_fields)
+{
+    if ((changed_fields & SETTINGS_FIELD_SENSOR_MASK) == 0)
+    {
+        return ESP_OK;
+    }
+    if (reconfigure_done == NULL)
+    {
+        return ESP_OK; // Not running yet, the new mask is picked up by ntc_adc_initialize()
+    }
+
+    pending_sensor_mask = system_state.sensor_mask;
+    uint32_t sequence = reconfigure_requested + 1;
+    reconfigure_requested = sequence;
+    if (temperature_task_handle != NULL)
+    {
+        // Ends a quiet-mode pause early
+        xTaskNotifyGive(temperature_task_handle);
+    }
+    TickType_t start = xTaskGetTickCount();
+    TickType_t timeout = pdMS_TO_TICKS(3000);
+    while ((int32_t)(reconfigure_completed - sequence) < 0)
+    {
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= timeout || xSemaphoreTake(reconfigure_done, timeout - waited) != pdTRUE)
+        {
+            ESP_LOGE(TAG, "Timed out waiting for ADC reconfiguration");
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+    return reconfigure_result;
+}
+
 // Start ADC in continuous mode
 void ntc_adc_start()
 {
@@ -115,32 +397,108 @@ void ntc_adc_stop()
     ESP_ERROR_CHECK(adc_continuous_stop(adc_handle));
 }
 
+// Quiet mode: stop the ADC until the next burst
+static void ntc_adc_pause(uint32_t pause_ms)
+{
+    ntc_adc_stop();
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(pause_ms));
+
+    // Restart the filters: the median settles within the burst, the low-pass would lag across the pause
+    if (xSemaphoreTake(channel_data_mutex, portMAX_DELAY))
+    {
+        for (int i = 0; i < SENSOR_MAX_COUNT; i++)
+        {
+            ntc_filter_reset(i);
+        }
+        xSemaphoreGive(channel_data_mutex);
+    }
+    adc_continuous_flush_pool(adc_handle);
+    ntc_adc_start();
+}
+
 // Process ADC data and update channel data
 void ntc_adc_process_data()
 {
-    uint8_t buffer[256];
     adc_digi_output_data_t *data;
+    TickType_t last_publish_tick = xTaskGetTickCount();
+    int64_t last_frame_us = 0; // read time of the newest frame with conversions
 
     while (1)
     {
+        uint32_t requested = reconfigure_requested;
+        if (requested != reconfigure_completed)
+        {
+            reconfigure_result = ntc_adc_reconfigure(pending_sensor_mask);
+            reconfigure_completed = requested;
+            xSemaphoreGive(reconfigure_done);
+        }
+
+        // Frames are read straight into the capture ring
+        uint8_t *buffer = capture_frame_buffer();
         uint32_t read_size = 0;
-        esp_err_t ret = adc_continuous_read(adc_handle, buffer, sizeof(buffer), &read_size, pdMS_TO_TICKS(1000));
+        esp_err_t ret = adc_continuous_read(adc_handle, buffer, CAPTURE_FRAME_SIZE, &read_size, pdMS_TO_TICKS(1000));
+        int64_t start_us = esp_timer_get_time();
+        // Processing of one frame including the snapshot it may close, not the wait for it
+        HISTOGRAM_TIME_START(frame_timing, &frame_histogram);
         if (ret == ESP_OK)
         {
-            for (int i = 0; i < read_size; i += sizeof(adc_digi_output_data_t))
+            // One lock per frame: the filters and the fault statistics run under it
+            if (xSemaphoreTake(channel_data_mutex, portMAX_DELAY))
             {
-                data = (adc_digi_output_data_t *)&buffer[i];
-                if (data->type1.channel >= SENSOR_MAX_COUNT)
-                {
-                    continue; // Skip invalid channels
-                }
-                
-                if (xSemaphoreTake(channel_data_mutex, portMAX_DELAY))
+                for (int i = 0; i < read_size; i += sizeof(adc_digi_output_data_t))
                 {
-                    channel_data[data->type1.channel] = data->type1.data;
-                    xSemaphoreGive(channel_data_mutex);
+                    data = (adc_digi_output_data_t *)&buffer[i];
+                    uint8_t channel = data->type1.channel;
+                    if (channel >= SENSOR_MAX_COUNT)
+                    {
+                        continue; // Skip invalid channels
+                    }
+
+                    uint16_t code = data->type1.data;
+                    channel_data[channel] = ntc_filter_process(channel, code);
+                    // Running statistics of the unfiltered codes for the fault classifier, evaluated once per snapshot
+                    channel_window_t *window = &channel_window[channel];
+                    window->min = window->count == 0 ? code : MIN(window->min, code);
+                    window->max = window->count == 0 ? code : MAX(window->max, code);
+                    window->count++;
+                    window->sum += code;
+                    window->sum_squares += (uint32_t)code * code;
                 }
+                xSemaphoreGive(channel_data_mutex);
             }
+            if (read_size > 0)
+            {
+                last_frame_us = start_us;
+            }
+            if (!channel_data_live && read_size > 0)
+            {
+                channel_data_live = true;
+                boot_mark_done(BOOT_STEP_FIRST_READING);
+            }
+        }
+        capture_commit(ret == ESP_OK ? read_size : 0, start_us);
+
+        // In quiet mode a snapshot closes each burst, the ADC then pauses for the rest of the interval.
+        // An armed capture needs every frame, so the ADC keeps running.
+        bool bursts = sample_scheduler_get_mode() == SAMPLE_MODE_QUIET && !capture_is_armed();
+        uint32_t due_ms = bursts ? SAMPLE_SCHEDULER_BURST_MS : RETAINED_PUBLISH_INTERVAL_MS;
+        bool publish = channel_data_live && xTaskGetTickCount() - last_publish_tick >= pdMS_TO_TICKS(due_ms);
+        if (publish)
+        {
+            ntc_adc_publish_snapshot(last_frame_us);
+        }
+        sample_scheduler_account(read_size / sizeof(adc_digi_output_data_t),
+                                 (uint32_t)(esp_timer_get_time() - start_us));
+        HISTOGRAM_TIME_STOP(frame_timing);
+
+        if (publish && bursts && sample_scheduler_get_mode() == SAMPLE_MODE_QUIET && reconfigure_requested == reconfigure_completed)
+        {
+            uint32_t interval_ms = sample_scheduler_interval_ms();
+            ntc_adc_pause(interval_ms - MIN(interval_ms, SAMPLE_SCHEDULER_BURST_MS));
+        }
+        if (publish)
+        {
+            last_publish_tick = xTaskGetTickCount();
         }
     }
 }
@@ -157,7 +515,7 @@ void ntc_report_temperature_task(void *pvParameter)
 {
     while (1)
     {
-        float temp = ntc_adc_raw_to_temperature(ntc_get_channel_data(1));
+        float temp = ntc_adc_raw_to_temperature(1, ntc_get_channel_data(1));
         printf("%.2f\n", temp);
         vTaskDelay(pdMS_TO_TICKS(100)); // Report every second
     }
@@ -8,13 +8,37 @@
 #include "driver/gpio.h" // Include for GPIO functionality
 #include "config.h"
 #include "state_manager.h"
+#include "settings_manager.h"
+#include "ntc_calibration.h"
 
-// Constants for NTC thermistor calculations
-#define R_FIXED 1000.0             // 1kΩ fixed resistor
-#define V_SUPPLY 3300.0            // Supply voltage in mV
-#define NTC_BETA 3950.0            // Beta value for NTC thermistor
-#define NTC_R25 100000.0           // Resistance at 25°C in ohms
-#define T0_KELVIN 298.15           // 25°C in Kelvin
+// Fault classification, from the raw codes seen between two snapshots.
+// The open and short code ranges are NTC_RAW_OPEN_MAX / NTC_RAW_SHORT_MIN in ntc_calibration.h.
+#define NTC_NOISE_MAX_STDDEV 48    // codes; above: noisy (loose contact, interference)
+#define NTC_STUCK_SNAPSHOTS 30     // identical code for this many snapshots: stuck
+
+typedef enum
+{
+    NTC_STATUS_OK = 0,
+    NTC_STATUS_OPEN,
+    NTC_STATUS_SHORT,
+    NTC_STATUS_STUCK,
+    NTC_STATUS_NOISY,
+} ntc_channel_status_t;
+
+// Timing of the last snapshot published by the temperature task
+typedef struct
+{
+    uint32_t sequence;    // 0 until the first snapshot
+    int64_t acquired_us;  // esp_timer time the newest ADC frame of the snapshot was read
+    int64_t published_us; // esp_timer time the snapshot was handed to the consumers
+} ntc_snapshot_stamp_t;
+
+// Conversions of a channel, updated with every snapshot
+typedef struct
+{
+    uint64_t conversions; // since boot
+    float rate_hz;        // conversions per second over the last snapshot interval
+} ntc_channel_counters_t;
 
 /**
  * @brief Initialize the ADC for continuous sampling.
@@ -27,6 +51,25 @@ esp_err_t ntc_adc_initialize();
  */
 void ntc_init_mutex();
 
+/**
+ * @brief Seed the channel data with the readings retained across the last reset.
+ * Call after ntc_init_mutex(), before the ADC starts.
+ */
+void ntc_adc_restore_snapshot();
+
+/**
+ * @brief Check whether the channel data still holds retained readings from before the reset.
+ */
+bool ntc_adc_is_stale();
+
+/**
+ * @brief Apply changed settings owned by the ADC (the sensor mask) without a restart.
+ * The conversion pattern is rebuilt on the temperature task; the call waits for it.
+ * @param changed_fields Bitmask of settings_field_t.
+ * @return ESP_OK on success, or an error code on failure.
+ */
+esp_err_t ntc_adc_apply_settings(uint32_t changed_fields);
+
 /**
  * @brief Start the ADC in continuous mode.
  */
@@ -50,11 +93,42 @@ void ntc_adc_process_data();
 uint16_t ntc_get_channel_data(uint8_t channel_index);
 
 /**
- * @brief Convert raw ADC value to temperature in Celsius.
+ * @brief Convert raw ADC value to temperature in Celsius with the channel's calibration.
+ * @param channel_index Index of the channel, selects the calibration.
  * @param adc_raw Raw ADC value.
- * @return Temperature in Celsius.
+ * @return Temperature in Celsius, NAN for codes outside the conversion range.
+ */
+float ntc_adc_raw_to_temperature(uint8_t channel_index, uint16_t adc_raw);
+
+/**
+ * @brief Fault status of a channel, updated with every snapshot.
+ */
+ntc_channel_status_t ntc_get_channel_status(uint8_t channel_index);
+
+/**
+ * @brief Short name of a status ("OK", "OPEN", "SHRT", "STCK", "NOIS").
+ */
+const char *ntc_channel_status_name(ntc_channel_status_t status);
+
+/**
+ * @brief Temperature of a channel in Celsius, NAN if it is open, shorted or stuck.
+ */
+float ntc_get_channel_temperature(uint8_t channel_index);
+
+/**
+ * @brief Stamp of the last published snapshot, the reference for the latency statistics.
+ */
+void ntc_adc_get_snapshot_stamp(ntc_snapshot_stamp_t *stamp);
+
+/**
+ * @brief Conversion counters of a channel.
+ */
+void ntc_adc_get_channel_counters(uint8_t channel_index, ntc_channel_counters_t *counters);
+
+/**
+ * @brief Times the driver's conversion pool overflowed because frames were not read in time.
  */
-float ntc_adc_raw_to_temperature(uint16_t adc_raw);
+uint32_t ntc_adc_get_overflow_count(void);
 
 /**
  * @brief Task to start ADC and process temperature data.
@@ -0,0 +1,287 @@
+#include "ntc_calibration.h"
+#include <math.h>
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#include "state_manager.h"
+#include "settings_manager.h"
+#include "config_store.h"
+
+static const char *TAG = "ntc_calibration";
+
+static float calibration_tables[SENSOR_MAX_COUNT][NTC_TABLE_POINTS];
+static portMUX_TYPE calibration_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// eFuse calibration, NULL on chips without one: the ideal transfer curve is used
+static adc_cali_handle_t adc_cali_handle = NULL;
+// Calibrated voltage at every table point, fixed after boot
+static float calibration_node_mv[NTC_TABLE_POINTS];
+
+// Tables are built outside the lock into the scratch table, then copied in
+static float calibration_scratch[NTC_TABLE_POINTS];
+static SemaphoreHandle_t calibration_build_mutex = NULL;
+
+void ntc_calibration_default(ntc_calibration_t *calibration)
+{
+    memset(calibration, 0, sizeof(*calibration));
+    calibration->model = NTC_MODEL_BETA;
+    calibration->r_fixed = R_FIXED;
+    calibration->beta = NTC_BETA;
+    calibration->r0 = NTC_R25;
+}
+
+bool ntc_calibration_valid(const ntc_calibration_t *calibration)
+{
+    if (!isfinite(calibration->r_fixed) || calibration->r_fixed <= 0 || !isfinite(calibration->offset_c))
+    {
+        return false;
+    }
+    switch (calibration->model)
+    {
+    case NTC_MODEL_BETA:
+        return isfinite(calibration->beta) && calibration->beta > 0 && isfinite(calibration->r0) && calibration->r0 > 0;
+    case NTC_MODEL_STEINHART_HART:
+        return isfinite(calibration->a) && isfinite(calibration->b) && isfinite(calibration->c);
+    default:
+        return false;
+    }
+}
+
+static uint16_t ntc_calibration_node_code(int index)
+{
+    if (index < NTC_TABLE_FINE_POINTS)
+    {
+        return NTC_TABLE_FIRST_CODE + index * NTC_TABLE_FINE_STEP;
+    }
+    // The last segment may be shorter than NTC_TABLE_STEP
+    return MIN(NTC_TABLE_FINE_END + (index - NTC_TABLE_FINE_POINTS) * NTC_TABLE_STEP, NTC_TABLE_LAST_CODE);
+}
+
+static float ntc_calibration_code_to_mv(uint16_t adc_raw)
+{
+    int voltage_mv;
+    if (adc_cali_handle != NULL && adc_cali_raw_to_voltage(adc_cali_handle, adc_raw, &voltage_mv) == ESP_OK)
+    {
+        return voltage_mv;
+    }
+    return (adc_raw * ADC_FULL_SCALE_MV) / 4095.0f;
+}
+
+static void ntc_calibration_adc_init(void)
+{
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t err = ESP_ERR_NOT_SUPPORTED;
+    const char *scheme = "none";
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+    adc_cali_curve_fitting_config_t cali_config = {
+        .unit_id = NTC_ADC_UNIT,
+        .chan = ADC_CHANNEL_0, // the fit is the same for every channel of the unit
+        .atten = NTC_ADC_ATTEN,
+        .bitwidth = NTC_ADC_BITWIDTH,
+    };
+    err = adc_cali_create_scheme_curve_fitting(&cali_config, &adc_cali_handle);
+    scheme = "curve fitting";
+#elif ADC_CALI_SCHEME_LINE_FITTING_SUPPORTED
+    adc_cali_line_fitting_config_t cali_config = {
+        .unit_id = NTC_ADC_UNIT,
+        .atten = NTC_ADC_ATTEN,
+        .bitwidth = NTC_ADC_BITWIDTH,
+        .default_vref = 1100, // only used when the eFuse holds no Vref either
+    };
+    err = adc_cali_create_scheme_line_fitting(&cali_config, &adc_cali_handle);
+    scheme = "line fitting";
+#endif
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "No ADC calibration (%s), assuming the ideal transfer curve", esp_err_to_name(err));
+        adc_cali_handle = NULL;
+    }
+
+    for (int i = 0; i < NTC_TABLE_POINTS; i++)
+    {
+        uint16_t code = ntc_calibration_node_code(i);
+        if (adc_cali_handle == NULL)
+        {
+            calibration_node_mv[i] = ntc_calibration_code_to_mv(code);
+            continue;
+        }
+        // Symmetric window: exact for a locally straight curve, averages out the whole-mV steps
+        int half = MIN(NTC_CALI_AVERAGE_CODES, MIN(code - 1, 4094 - code));
+        int32_t sum_mv = 0;
+        for (int c = code - half; c <= code + half; c++)
+        {
+            sum_mv += (int32_t)ntc_calibration_code_to_mv(c);
+        }
+        calibration_node_mv[i] = (float)sum_mv / (2 * half + 1);
+    }
+    if (adc_cali_handle != NULL)
+    {
+        ESP_LOGI(TAG, "ADC %s calibration: code %d = %.1f mV, code %d = %.1f mV, %lld us", scheme,
+                 NTC_TABLE_FIRST_CODE, calibration_node_mv[0], NTC_TABLE_LAST_CODE,
+                 calibration_node_mv[NTC_TABLE_POINTS - 1], esp_timer_get_time() - start_us);
+    }
+}
+
+// Beta or Steinhart-Hart equation for a divider voltage
+static float ntc_calibration_equation(const ntc_calibration_t *calibration, float voltage_mv)
+{
+    if (!(voltage_mv > 0))
+    {
+        return NAN;
+    }
+    float r_ntc = calibration->r_fixed * (V_SUPPLY / voltage_mv - 1.0f);
+    if (r_ntc <= 0)
+    {
+        return NAN; // log() of a zero or negative resistance
+    }
+
+    float inverse_kelvin;
+    if (calibration->model == NTC_MODEL_STEINHART_HART)
+    {
+        float ln_r = logf(r_ntc);
+        inverse_kelvin = calibration->a + calibration->b * ln_r + calibration->c * ln_r * ln_r * ln_r;
+    }
+    else
+    {
+        inverse_kelvin = 1.0f / T0_KELVIN + logf(r_ntc / calibration->r0) / calibration->beta;
+    }
+    if (!(inverse_kelvin > 0))
+    {
+        return NAN;
+    }
+    return 1.0f / inverse_kelvin - 273.15f + calibration->offset_c;
+}
+
+float ntc_calibration_evaluate(const ntc_calibration_t *calibration, uint16_t adc_raw)
+{
+    if (adc_raw == 0 || adc_raw >= 4095)
+    {
+        return NAN; // the input is outside the measurable range
+    }
+    return ntc_calibration_equation(calibration, ntc_calibration_code_to_mv(adc_raw));
+}
+
+// Fill the scratch table, false if the curve is not finite over the whole table
+static bool ntc_calibration_build(const ntc_calibration_t *calibration)
+{
+    for (int i = 0; i < NTC_TABLE_POINTS; i++)
+    {
+        calibration_scratch[i] = ntc_calibration_equation(calibration, calibration_node_mv[i]);
+        if (!isfinite(calibration_scratch[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Build and install the table of a channel, system_state keeps the calibration
+static esp_err_t ntc_calibration_install(uint8_t channel, const ntc_calibration_t *calibration)
+{
+    if (!ntc_calibration_valid(calibration))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(calibration_build_mutex, portMAX_DELAY);
+    bool built = ntc_calibration_build(calibration);
+    if (built)
+    {
+        taskENTER_CRITICAL(&calibration_lock);
+        memcpy(calibration_tables[channel], calibration_scratch, sizeof(calibration_scratch));
+        system_state.calibration[channel] = *calibration;
+        taskEXIT_CRITICAL(&calibration_lock);
+    }
+    xSemaphoreGive(calibration_build_mutex);
+    return built ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+void ntc_calibration_init(void)
+{
+    if (calibration_build_mutex == NULL)
+    {
+        calibration_build_mutex = xSemaphoreCreateMutex();
+        ntc_calibration_adc_init();
+    }
+    for (uint8_t i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        ntc_calibration_t calibration = system_state.calibration[i];
+        if (ntc_calibration_install(i, &calibration) != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Channel %d: invalid stored calibration, using the default", i);
+            ntc_calibration_default(&calibration);
+            ntc_calibration_install(i, &calibration);
+        }
+    }
+}
+
+esp_err_t ntc_calibration_set(uint8_t channel, const ntc_calibration_t *calibration)
+{
+    if (channel >= SENSOR_MAX_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (calibration_build_mutex == NULL)
+    {
+        return ESP_ERR_INVALID_STATE; // Before ntc_calibration_init()
+    }
+    esp_err_t err = ntc_calibration_install(channel, calibration);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    ESP_LOGI(TAG, "Channel %d: %s calibration, offset %.2f °C", channel,
+             calibration->model == NTC_MODEL_STEINHART_HART ? "Steinhart-Hart" : "Beta", calibration->offset_c);
+    config_store_mark_dirty(SETTINGS_FIELD_CALIBRATION);
+    return ESP_OK;
+}
+
+esp_err_t ntc_calibration_get(uint8_t channel, ntc_calibration_t *calibration)
+{
+    if (channel >= SENSOR_MAX_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    taskENTER_CRITICAL(&calibration_lock);
+    *calibration = system_state.calibration[channel];
+    taskEXIT_CRITICAL(&calibration_lock);
+    return ESP_OK;
+}
+
+float ntc_calibration_convert(uint8_t channel, uint16_t adc_raw)
+{
+    if (channel >= SENSOR_MAX_COUNT)
+    {
+        return NAN;
+    }
+    if (adc_raw < NTC_TABLE_FIRST_CODE || adc_raw > NTC_TABLE_LAST_CODE)
+    {
+        // Open or shorted input, rare enough for the full equation
+        ntc_calibration_t calibration;
+        ntc_calibration_get(channel, &calibration);
+        return ntc_calibration_evaluate(&calibration, adc_raw);
+    }
+
+    uint32_t index;
+    if (adc_raw < NTC_TABLE_FINE_END)
+    {
+        index = (adc_raw - NTC_TABLE_FIRST_CODE) / NTC_TABLE_FINE_STEP;
+    }
+    else
+    {
+        // The last code is a node of its own, interpolate from the one before it
+        index = MIN(NTC_TABLE_FINE_POINTS + (adc_raw - NTC_TABLE_FINE_END) / NTC_TABLE_STEP, NTC_TABLE_POINTS - 2);
+    }
+    uint16_t low_code = ntc_calibration_node_code(index);
+    uint32_t step = ntc_calibration_node_code(index + 1) - low_code;
+    uint32_t fraction = adc_raw - low_code;
+    taskENTER_CRITICAL(&calibration_lock);
+    float low = calibration_tables[channel][index];
+    float high = calibration_tables[channel][index + 1];
+    taskEXIT_CRITICAL(&calibration_lock);
+    return low + (high - low) * fraction / step;
+}
@@ -0,0 +1,102 @@
+#ifndef NTC_CALIBRATION_H
+#define NTC_CALIBRATION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "hal/adc_types.h"
+#include "config.h"
+
+// Divider and thermistor used by channels without their own calibration
+#define R_FIXED 1000.0             // 1kΩ fixed resistor
+#define V_SUPPLY 3300.0            // Supply voltage in mV
+#define ADC_FULL_SCALE_MV 1100.0   // 12-bit ADC, 0 dB attenuation, ideal transfer curve
+#define NTC_BETA 3950.0            // Beta value for NTC thermistor
+#define NTC_R25 100000.0           // Resistance at 25°C in ohms
+#define T0_KELVIN 298.15           // 25°C in Kelvin
+
+// ADC setup of every sensor input, also selects the eFuse calibration
+#define NTC_ADC_UNIT ADC_UNIT_1
+#define NTC_ADC_ATTEN ADC_ATTEN_DB_0
+#define NTC_ADC_BITWIDTH ADC_BITWIDTH_12
+// The eFuse calibration reports whole mV (about 4 codes at 0 dB); table points
+// average it over +-NTC_CALI_AVERAGE_CODES codes to get the fraction back
+#define NTC_CALI_AVERAGE_CODES 8
+
+// The NTC sits between the supply and the input: an open lead reads 0, a short saturates.
+// Only the ADC floor counts as open, code 16 is still a valid reading around -14 °C with the default divider.
+#define NTC_RAW_OPEN_MAX 2     // every code at or below: open
+#define NTC_RAW_SHORT_MIN 4080 // every code at or above: short
+
+// Conversion table covering every code between the open and short ranges, so
+// every valid reading is a table lookup; only fault codes take the full equation.
+// The curve is steepest at low codes: the first NTC_TABLE_FINE_POINTS points are
+// NTC_TABLE_FINE_STEP codes apart, the rest NTC_TABLE_STEP, the last one is
+// NTC_TABLE_LAST_CODE.
+#define NTC_TABLE_FIRST_CODE (NTC_RAW_OPEN_MAX + 1)
+#define NTC_TABLE_LAST_CODE (NTC_RAW_SHORT_MIN - 1)
+#define NTC_TABLE_FINE_STEP 2
+#define NTC_TABLE_FINE_POINTS 134 // up to code ~270
+#define NTC_TABLE_FINE_END (NTC_TABLE_FIRST_CODE + NTC_TABLE_FINE_POINTS * NTC_TABLE_FINE_STEP)
+#define NTC_TABLE_STEP 16
+#define NTC_TABLE_COARSE_POINTS ((NTC_TABLE_LAST_CODE - NTC_TABLE_FINE_END + NTC_TABLE_STEP - 1) / NTC_TABLE_STEP)
+#define NTC_TABLE_POINTS (NTC_TABLE_FINE_POINTS + NTC_TABLE_COARSE_POINTS + 1)
+
+typedef enum
+{
+    NTC_MODEL_BETA = 0,      // 1/T = 1/T0 + ln(R/R0)/beta, T0 = 25 °C
+    NTC_MODEL_STEINHART_HART // 1/T = A + B ln(R) + C ln(R)^3
+} ntc_model_t;
+
+// Stored as is in the config record, only append fields
+typedef struct
+{
+    uint8_t model; // ntc_model_t
+    uint8_t reserved[3];
+    float r_fixed;  // Ω, divider resistor
+    float beta;     // K, NTC_MODEL_BETA
+    float r0;       // Ω at 25 °C, NTC_MODEL_BETA
+    float a;        // NTC_MODEL_STEINHART_HART coefficients
+    float b;
+    float c;
+    float offset_c; // added to the result
+} ntc_calibration_t;
+
+/**
+ * @brief Calibration matching the R_FIXED / NTC_BETA / NTC_R25 defaults.
+ */
+void ntc_calibration_default(ntc_calibration_t *calibration);
+
+/**
+ * @brief Check a calibration for usable coefficients.
+ */
+bool ntc_calibration_valid(const ntc_calibration_t *calibration);
+
+/**
+ * @brief Load the ADC eFuse calibration and build the conversion tables of
+ * every channel from system_state. Invalid stored calibrations are replaced by the default.
+ */
+void ntc_calibration_init(void);
+
+/**
+ * @brief Change the calibration of a channel: rebuilds its table and stores it in the config.
+ * @return ESP_ERR_INVALID_ARG for an invalid channel or calibration,
+ * ESP_ERR_INVALID_STATE before ntc_calibration_init().
+ */
+esp_err_t ntc_calibration_set(uint8_t channel, const ntc_calibration_t *calibration);
+
+esp_err_t ntc_calibration_get(uint8_t channel, ntc_calibration_t *calibration);
+
+/**
+ * @brief Temperature in Celsius of a raw code with the channel's calibration.
+ * A table lookup with linear interpolation, safe from any task.
+ * @return NAN for codes outside the conversion range.
+ */
+float ntc_calibration_convert(uint8_t channel, uint16_t adc_raw);
+
+/**
+ * @brief The full conversion the tables are built from: eFuse-calibrated code to mV, then the equation.
+ */
+float ntc_calibration_evaluate(const ntc_calibration_t *calibration, uint16_t adc_raw);
+
+#endif // NTC_CALIBRATION_H
@@ -0,0 +1,165 @@
+#include "ntc_filter.h"
+#include <math.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "ntc_filter";
+
+typedef struct
+{
+    uint16_t ring[NTC_FILTER_MEDIAN_MAX];   // codes in arrival order
+    uint16_t sorted[NTC_FILTER_MEDIAN_MAX]; // the same codes, ascending
+    uint8_t head;                           // slot of the oldest code once full
+    uint8_t count;
+    bool primed;
+    int32_t output_q19;
+    uint32_t alpha_q31;
+    ntc_filter_params_t params;
+} ntc_filter_state_t;
+
+// Owned by the temperature task
+static ntc_filter_state_t filter_states[SENSOR_MAX_COUNT];
+static uint32_t filter_sample_period_us = 1000;
+
+// Parameter changes handed over from other tasks
+static ntc_filter_params_t filter_params[SENSOR_MAX_COUNT];
+static volatile uint8_t filter_params_pending = 0;
+static portMUX_TYPE filter_params_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// A 12-bit code in Q19 still fits an int32_t; the fraction bits keep steps smaller than alpha can resolve from stalling
+#define NTC_FILTER_STATE_SHIFT 19
+// At 60 s and a 1 us period alpha is ~36 in Q31, Q16 would round everything above ~13 s at 1 ms to the same value
+#define NTC_FILTER_ALPHA_SHIFT 31
+
+static uint32_t ntc_filter_alpha(uint32_t tau_ms)
+{
+    if (tau_ms == 0)
+    {
+        return 1UL << NTC_FILTER_ALPHA_SHIFT;
+    }
+    // Exact step response of an RC low-pass sampled every filter_sample_period_us; expm1 stays exact for tiny ratios
+    double alpha = -expm1(-(double)filter_sample_period_us / (tau_ms * 1000.0));
+    uint32_t alpha_q31 = (uint32_t)llround(alpha * (double)(1UL << NTC_FILTER_ALPHA_SHIFT));
+    return alpha_q31 > 0 ? alpha_q31 : 1;
+}
+
+bool ntc_filter_params_valid(const ntc_filter_params_t *params)
+{
+    return params->median_window >= 1 && params->median_window <= NTC_FILTER_MEDIAN_MAX &&
+           (params->median_window & 1) && params->tau_ms <= NTC_FILTER_TAU_MAX_MS;
+}
+
+void ntc_filter_init(void)
+{
+    ntc_filter_params_t params = {
+        .median_window = CONFIG_NTC_FILTER_MEDIAN_WINDOW,
+        .tau_ms = CONFIG_NTC_FILTER_TAU_MS,
+    };
+    for (int i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        filter_params[i] = params;
+        filter_states[i].params = params;
+        ntc_filter_reset(i);
+    }
+    ESP_LOGI(TAG, "Median of %d, tau %lu ms", params.median_window, (unsigned long)params.tau_ms);
+}
+
+void ntc_filter_set_sample_period(uint32_t sample_period_us)
+{
+    filter_sample_period_us = sample_period_us > 0 ? sample_period_us : 1;
+    for (int i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        filter_states[i].alpha_q31 = ntc_filter_alpha(filter_states[i].params.tau_ms);
+    }
+}
+
+esp_err_t ntc_filter_set_params(uint8_t channel, const ntc_filter_params_t *params)
+{
+    if (channel >= SENSOR_MAX_COUNT || !ntc_filter_params_valid(params))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    taskENTER_CRITICAL(&filter_params_lock);
+    filter_params[channel] = *params;
+    filter_params_pending |= 1 << channel;
+    taskEXIT_CRITICAL(&filter_params_lock);
+    return ESP_OK;
+}
+
+esp_err_t ntc_filter_get_params(uint8_t channel, ntc_filter_params_t *params)
+{
+    if (channel >= SENSOR_MAX_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    taskENTER_CRITICAL(&filter_params_lock);
+    *params = filter_params[channel];
+    taskEXIT_CRITICAL(&filter_params_lock);
+    return ESP_OK;
+}
+
+void ntc_filter_reset(uint8_t channel)
+{
+    ntc_filter_state_t *state = &filter_states[channel];
+    state->head = 0;
+    state->count = 0;
+    state->primed = false;
+    state->alpha_q31 = ntc_filter_alpha(state->params.tau_ms);
+}
+
+// Replace the oldest code of the window with the new one, keeping `sorted` in order
+static uint16_t ntc_filter_median(ntc_filter_state_t *state, uint16_t code)
+{
+    uint8_t window = state->params.median_window;
+    uint8_t i;
+    if (state->count == window)
+    {
+        uint16_t oldest = state->ring[state->head];
+        for (i = 0; state->sorted[i] != oldest; i++)
+        {
+        }
+        memmove(&state->sorted[i], &state->sorted[i + 1], (state->count - i - 1) * sizeof(uint16_t));
+        state->count--;
+    }
+    state->ring[state->head] = code;
+    state->head = (state->head + 1) % window;
+
+    for (i = state->count; i > 0 && state->sorted[i - 1] > code; i--)
+    {
+        state->sorted[i] = state->sorted[i - 1];
+    }
+    state->sorted[i] = code;
+    state->count++;
+    return state->sorted[state->count / 2];
+}
+
+uint16_t ntc_filter_process(uint8_t channel, uint16_t code)
+{
+    ntc_filter_state_t *state = &filter_states[channel];
+    if (filter_params_pending & (1 << channel))
+    {
+        taskENTER_CRITICAL(&filter_params_lock);
+        state->params = filter_params[channel];
+        filter_params_pending &= ~(1 << channel);
+        taskEXIT_CRITICAL(&filter_params_lock);
+        ntc_filter_reset(channel);
+    }
+
+    uint16_t median = state->params.median_window > 1 ? ntc_filter_median(state, code) : code;
+
+    int32_t input_q19 = (int32_t)median << NTC_FILTER_STATE_SHIFT;
+    if (!state->primed)
+    {
+        // Follow the median until its window is full, so a spike in the first codes is not held by the low-pass
+        state->primed = state->params.median_window == 1 || state->count == state->params.median_window;
+        state->output_q19 = input_q19;
+    }
+    else
+    {
+        int64_t step = (int64_t)(input_q19 - state->output_q19) * state->alpha_q31;
+        state->output_q19 += (int32_t)((step + (1LL << (NTC_FILTER_ALPHA_SHIFT - 1))) >> NTC_FILTER_ALPHA_SHIFT);
+    }
+    return (uint16_t)((state->output_q19 + (1 << (NTC_FILTER_STATE_SHIFT - 1))) >> NTC_FILTER_STATE_SHIFT);
+}
@@ -0,0 +1,61 @@
+#ifndef NTC_FILTER_H
+#define NTC_FILTER_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "config.h"
+
+#define NTC_FILTER_MEDIAN_MAX 15 // longest median window, odd
+#define NTC_FILTER_TAU_MAX_MS 60000
+
+/*
+ * Per-channel filter stage run on every conversion: a running median over
+ * the last median_window codes rejects single-sample spikes, then a
+ * first-order IIR low-pass with time constant tau_ms smooths the result.
+ * Integer only: the median window is kept sorted incrementally and the IIR
+ * keeps its output in Q19 with a Q31 coefficient, so the longest time
+ * constant still resolves at the shortest sample period.
+ */
+typedef struct
+{
+    uint8_t median_window; // 1 (off) .. NTC_FILTER_MEDIAN_MAX, odd
+    uint32_t tau_ms;       // 0 disables the low-pass
+} ntc_filter_params_t;
+
+/**
+ * @brief Load the Kconfig defaults for every channel.
+ */
+void ntc_filter_init(void);
+
+/**
+ * @brief Time between two conversions of the same channel; sets the IIR coefficients.
+ * Call from the temperature task whenever the conversion pattern changes.
+ */
+void ntc_filter_set_sample_period(uint32_t sample_period_us);
+
+/**
+ * @brief Check a window length and time constant without applying them.
+ */
+bool ntc_filter_params_valid(const ntc_filter_params_t *params);
+
+/**
+ * @brief Change the filter of a channel; the temperature task picks it up
+ * before the next conversion and restarts the channel's filter.
+ * @return ESP_ERR_INVALID_ARG for an even or too long window or a too long time constant.
+ */
+esp_err_t ntc_filter_set_params(uint8_t channel, const ntc_filter_params_t *params);
+
+esp_err_t ntc_filter_get_params(uint8_t channel, ntc_filter_params_t *params);
+
+/**
+ * @brief Forget the state of a channel, the next code restarts it.
+ */
+void ntc_filter_reset(uint8_t channel);
+
+/**
+ * @brief Filter one conversion. Temperature task only.
+ * @return The filtered code.
+ */
+uint16_t ntc_filter_process(uint8_t channel, uint16_t code);
+
+#endif // NTC_FILTER_H
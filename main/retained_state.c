@@ -0,0 +1,119 @@
+#include "retained_state.h"
+#include <stddef.h>
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_system.h"
+
+static const char *TAG = "retained";
+
+#define RETAINED_MAGIC   0x52544e44 // "DNTR"
+#define RETAINED_VERSION 1
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t length;
+    retained_snapshot_t snapshot;
+    uint32_t crc; // over everything above
+} retained_block_t;
+
+static RTC_NOINIT_ATTR retained_block_t retained_block;
+static portMUX_TYPE retained_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool retained_valid = false;
+
+static uint32_t retained_crc(void)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)&retained_block, offsetof(retained_block_t, crc));
+}
+
+// Callers hold retained_lock
+static void retained_seal(void)
+{
+    retained_block.crc = retained_crc();
+}
+
+bool retained_init(void)
+{
+    esp_reset_reason_t reason = esp_reset_reason();
+
+    retained_valid = reason != ESP_RST_POWERON && reason != ESP_RST_BROWNOUT &&
+                     retained_block.magic == RETAINED_MAGIC &&
+                     retained_block.version == RETAINED_VERSION &&
+                     retained_block.length == sizeof(retained_snapshot_t) &&
+                     retained_block.crc == retained_crc();
+
+    taskENTER_CRITICAL(&retained_lock);
+    if (!retained_valid)
+    {
+        memset(&retained_block, 0, sizeof(retained_block));
+        retained_block.magic = RETAINED_MAGIC;
+        retained_block.version = RETAINED_VERSION;
+        retained_block.length = sizeof(retained_snapshot_t);
+    }
+    retained_block.snapshot.boot_count++;
+    retained_seal();
+    taskEXIT_CRITICAL(&retained_lock);
+
+    if (retained_valid)
+    {
+        ESP_LOGI(TAG, "Restored snapshot (boot %lu, reset reason %d)", (unsigned long)retained_block.snapshot.boot_count, reason);
+    }
+    else
+    {
+        ESP_LOGI(TAG, "No retained snapshot (reset reason %d)", reason);
+    }
+    return retained_valid;
+}
+
+bool retained_has_snapshot(void)
+{
+    return retained_valid;
+}
+
+void retained_get_snapshot(retained_snapshot_t *snapshot)
+{
+    taskENTER_CRITICAL(&retained_lock);
+    *snapshot = retained_block.snapshot;
+    taskEXIT_CRITICAL(&retained_lock);
+}
+
+void retained_store_readings(const uint16_t raw[SENSOR_MAX_COUNT], uint8_t sensor_mask)
+{
+    taskENTER_CRITICAL(&retained_lock);
+    retained_snapshot_t *snapshot = &retained_block.snapshot;
+    if (snapshot->stats_count >= RETAINED_STATS_WINDOW || snapshot->sensor_mask != sensor_mask)
+    {
+        snapshot->stats_count = 0;
+    }
+    for (int i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        retained_channel_stats_t *stats = &snapshot->stats[i];
+        snapshot->raw[i] = raw[i];
+        if (snapshot->stats_count == 0)
+        {
+            stats->min = raw[i];
+            stats->max = raw[i];
+            stats->sum = 0;
+        }
+        stats->min = MIN(stats->min, raw[i]);
+        stats->max = MAX(stats->max, raw[i]);
+        stats->sum += raw[i];
+    }
+    snapshot->sensor_mask = sensor_mask;
+    snapshot->stats_count++;
+    retained_seal();
+    taskEXIT_CRITICAL(&retained_lock);
+}
+
+void retained_store_screen(uint8_t screen_state)
+{
+    taskENTER_CRITICAL(&retained_lock);
+    retained_block.snapshot.screen_state = screen_state;
+    retained_seal();
+    taskEXIT_CRITICAL(&retained_lock);
+}
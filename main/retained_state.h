@@ -0,0 +1,56 @@
+#ifndef RETAINED_STATE_H
+#define RETAINED_STATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "config.h"
+
+#define RETAINED_PUBLISH_INTERVAL_MS 1000 // How often the temperature task refreshes the snapshot
+#define RETAINED_STATS_WINDOW        3600 // Snapshots per statistics window
+
+typedef struct
+{
+    uint16_t min;
+    uint16_t max;
+    uint32_t sum;
+} retained_channel_stats_t;
+
+// Kept in RTC memory, survives every reset except power loss
+typedef struct
+{
+    uint16_t raw[SENSOR_MAX_COUNT];                     // last published ADC values
+    uint8_t sensor_mask;                                // channels valid in raw
+    uint8_t screen_state;                               // last temperature/status screen (lcd_screen_state_t)
+    uint16_t stats_count;                               // snapshots in the statistics window
+    retained_channel_stats_t stats[SENSOR_MAX_COUNT];   // per channel, over the statistics window
+    uint32_t boot_count;                                // resets since power on
+} retained_snapshot_t;
+
+/**
+ * @brief Validate the retained memory and count the boot. Call first thing in app_main().
+ * @return true if a snapshot from before the reset is available.
+ */
+bool retained_init(void);
+
+/**
+ * @brief Check whether retained_init() found a snapshot from before the reset.
+ */
+bool retained_has_snapshot(void);
+
+/**
+ * @brief Copy the retained snapshot.
+ */
+void retained_get_snapshot(retained_snapshot_t *snapshot);
+
+/**
+ * @brief Publish new readings and add them to the statistics window.
+ */
+void retained_store_readings(const uint16_t raw[SENSOR_MAX_COUNT], uint8_t sensor_mask);
+
+/**
+ * @brief Remember the screen to show after a reset.
+ */
+void retained_store_screen(uint8_t screen_state);
+
+#endif // RETAINED_STATE_H
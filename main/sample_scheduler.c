@@ -0,0 +1,170 @@
+#include "sample_scheduler.h"
+#include <math.h>
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "retained_state.h"
+#include "alarm.h"
+
+static const char *TAG = "sample_scheduler";
+
+// Only touched by the temperature task
+static float anchor_temperatures[SENSOR_MAX_COUNT];
+static uint32_t anchor_ms;
+static bool anchored = false;
+static uint32_t last_active_ms;
+static uint32_t last_update_ms;
+static uint32_t window_conversions; // since the previous snapshot
+static uint32_t window_busy_us;
+
+static sample_scheduler_stats_t scheduler_stats;
+static portMUX_TYPE scheduler_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void sample_scheduler_set_full_rate(uint32_t rate_hz)
+{
+    taskENTER_CRITICAL(&scheduler_lock);
+    scheduler_stats.full_rate_hz = rate_hz;
+    taskEXIT_CRITICAL(&scheduler_lock);
+}
+
+void sample_scheduler_account(uint32_t conversions, uint32_t busy_us)
+{
+    window_conversions += conversions;
+    window_busy_us += busy_us;
+}
+
+// Fastest change of any enabled channel against the anchor, in °C/min
+static float sample_scheduler_max_rate(const float *temperatures, uint8_t channel_mask, uint32_t now_ms)
+{
+    float max_rate = 0.0f;
+    if (!anchored)
+    {
+        return max_rate;
+    }
+    // A step shows up right away, a slow drift once the window has passed
+    uint32_t span_ms = MAX(now_ms - anchor_ms, SAMPLE_SCHEDULER_RATE_WINDOW_MS);
+    for (int i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        if ((channel_mask & (1 << i)) == 0 || !isfinite(temperatures[i]) || !isfinite(anchor_temperatures[i]))
+        {
+            continue;
+        }
+        float rate = fabsf(temperatures[i] - anchor_temperatures[i]) * 60000.0f / span_ms;
+        max_rate = MAX(max_rate, rate);
+    }
+    return max_rate;
+}
+
+#ifdef CONFIG_SAMPLING_ADAPTIVE
+static bool sample_scheduler_alarm_active(uint8_t channel_mask)
+{
+    for (int i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        if ((channel_mask & (1 << i)) && alarm_get_active(i))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
+sample_mode_t sample_scheduler_update(const float *temperatures, uint8_t channel_mask, uint32_t now_ms)
+{
+    float max_rate = sample_scheduler_max_rate(temperatures, channel_mask, now_ms);
+    sample_mode_t mode = scheduler_stats.mode;
+#ifdef CONFIG_SAMPLING_ADAPTIVE
+    bool active = max_rate * 1000.0f > CONFIG_SAMPLING_ACTIVITY_MC_PER_MIN || sample_scheduler_alarm_active(channel_mask);
+#else
+    bool active = true;
+#endif
+    if (!anchored || active || now_ms - anchor_ms >= SAMPLE_SCHEDULER_RATE_WINDOW_MS)
+    {
+        memcpy(anchor_temperatures, temperatures, sizeof(anchor_temperatures));
+        anchor_ms = now_ms;
+        anchored = true;
+    }
+
+    if (active)
+    {
+        last_active_ms = now_ms;
+        mode = SAMPLE_MODE_FULL;
+    }
+#ifdef CONFIG_SAMPLING_ADAPTIVE
+    else if (now_ms - last_active_ms >= CONFIG_SAMPLING_QUIET_AFTER_S * 1000)
+    {
+        mode = SAMPLE_MODE_QUIET;
+    }
+#endif
+
+    // Effective rate of the interval that just ended, and what running flat out would have cost
+    uint32_t elapsed_ms = last_update_ms != 0 ? now_ms - last_update_ms : 0;
+    taskENTER_CRITICAL(&scheduler_lock);
+    sample_scheduler_stats_t *stats = &scheduler_stats;
+    if (elapsed_ms > 0)
+    {
+        stats->effective_rate_hz = (uint32_t)(window_conversions * 1000ULL / elapsed_ms);
+        uint64_t expected = (uint64_t)stats->full_rate_hz * elapsed_ms / 1000;
+        if (window_conversions > 0 && expected > window_conversions)
+        {
+            stats->saved_us += (expected - window_conversions) * window_busy_us / window_conversions;
+        }
+        if (stats->mode == SAMPLE_MODE_QUIET)
+        {
+            stats->quiet_ms += elapsed_ms;
+        }
+    }
+    stats->conversions += window_conversions;
+    stats->busy_us += window_busy_us;
+    stats->max_rate_c_per_min = max_rate;
+    bool changed = mode != stats->mode;
+    if (changed)
+    {
+        stats->mode = mode;
+        stats->transitions++;
+    }
+    uint64_t saved_us = stats->saved_us;
+    taskEXIT_CRITICAL(&scheduler_lock);
+    last_update_ms = now_ms;
+    window_conversions = 0;
+    window_busy_us = 0;
+
+#ifdef CONFIG_SAMPLING_ADAPTIVE
+    if (changed && mode == SAMPLE_MODE_QUIET)
+    {
+        ESP_LOGI(TAG, "Stable for %d s, sampling %d ms every %d ms", CONFIG_SAMPLING_QUIET_AFTER_S,
+                 SAMPLE_SCHEDULER_BURST_MS, CONFIG_SAMPLING_QUIET_INTERVAL_MS);
+    }
+#endif
+    if (changed && mode == SAMPLE_MODE_FULL)
+    {
+        ESP_LOGI(TAG, "Activity (%.2f °C/min), full rate; %llu ms CPU time saved so far", max_rate,
+                 saved_us / 1000);
+    }
+    return mode;
+}
+
+sample_mode_t sample_scheduler_get_mode(void)
+{
+    return scheduler_stats.mode;
+}
+
+uint32_t sample_scheduler_interval_ms(void)
+{
+#ifdef CONFIG_SAMPLING_ADAPTIVE
+    if (scheduler_stats.mode == SAMPLE_MODE_QUIET)
+    {
+        return CONFIG_SAMPLING_QUIET_INTERVAL_MS;
+    }
+#endif
+    return RETAINED_PUBLISH_INTERVAL_MS;
+}
+
+void sample_scheduler_get_stats(sample_scheduler_stats_t *stats)
+{
+    taskENTER_CRITICAL(&scheduler_lock);
+    *stats = scheduler_stats;
+    taskEXIT_CRITICAL(&scheduler_lock);
+}
@@ -0,0 +1,64 @@
+#ifndef SAMPLE_SCHEDULER_H
+#define SAMPLE_SCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+
+// ADC run time per snapshot in quiet mode, fills the median windows of every channel
+#define SAMPLE_SCHEDULER_BURST_MS 100
+// Shortest span a rate of change is measured over, keeps the filtered noise below the threshold
+#define SAMPLE_SCHEDULER_RATE_WINDOW_MS 30000
+
+/*
+ * While every channel is stable the temperature task stops the ADC between
+ * snapshots and only runs it for a short burst (quiet mode). A rate of
+ * change above the activity threshold or an active alarm switches back to
+ * continuous conversion with the next snapshot. Kconfig "Adaptive sampling".
+ */
+typedef enum
+{
+    SAMPLE_MODE_FULL = 0, // continuous conversion, a snapshot every RETAINED_PUBLISH_INTERVAL_MS
+    SAMPLE_MODE_QUIET,    // a burst every CONFIG_SAMPLING_QUIET_INTERVAL_MS, the ADC is stopped in between
+} sample_mode_t;
+
+typedef struct
+{
+    sample_mode_t mode;
+    uint32_t full_rate_hz;      // conversions per second while the ADC runs
+    uint32_t effective_rate_hz; // conversions per second since the previous snapshot
+    float max_rate_c_per_min;   // fastest change seen in the last snapshot
+    uint64_t conversions;       // processed since boot
+    uint64_t busy_us;           // temperature task time spent on conversions and snapshots
+    uint64_t saved_us;          // estimated busy time the quiet mode avoided
+    uint64_t quiet_ms;          // time spent in quiet mode
+    uint32_t transitions;       // mode changes
+} sample_scheduler_stats_t;
+
+/**
+ * @brief Conversion rate of the running ADC, the reference for the effective rate.
+ */
+void sample_scheduler_set_full_rate(uint32_t rate_hz);
+
+/**
+ * @brief Count processed conversions and the time they took. Temperature task only.
+ */
+void sample_scheduler_account(uint32_t conversions, uint32_t busy_us);
+
+/**
+ * @brief Measure the activity of the snapshot and pick the mode for the next one. Temperature task only.
+ * @param temperatures °C per physical channel, NAN where missing.
+ * @return The mode to run until the next snapshot.
+ */
+sample_mode_t sample_scheduler_update(const float *temperatures, uint8_t channel_mask, uint32_t now_ms);
+
+sample_mode_t sample_scheduler_get_mode(void);
+
+/**
+ * @brief Time between two snapshots in the current mode.
+ */
+uint32_t sample_scheduler_interval_ms(void);
+
+void sample_scheduler_get_stats(sample_scheduler_stats_t *stats);
+
+#endif // SAMPLE_SCHEDULER_H
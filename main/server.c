@@ -1,5 +1,31 @@
 #include "server.h"
+#include "asset_store.h"
+#include "http_workers.h"
+#include "settings_manager.h"
+#include "form_parser.h"
+#include "config_store.h"
+#include "boot_manager.h"
+#include "retained_state.h"
+#include "ntc_adc.h"
+#include "ts_store.h"
+#include "history_rrd.h"
+#include "history_query.h"
+#include "history_export.h"
+#include "alarm.h"
+#include "ntc_filter.h"
+#include "virtual_channel.h"
+#include "sample_scheduler.h"
+#include "capture.h"
+#include "latency.h"
+#include "histogram.h"
+#include "wifi_manager.h"
+#include "chunk_writer.h"
+#include "metrics.h"
 #include "cJSON.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include <ctype.h>
+#include <errno.h>
 
 #ifndef MIN
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -9,32 +35,151 @@
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #endif
 
+// Upper bound for a /settings body, every field percent-encoded
+#define SETTINGS_BODY_MAX_LEN 2048
+// Upper bound for an /api/channels body
+#define CHANNELS_BODY_MAX_LEN 512
+// Registered handlers plus room for more, the httpd default is 8
+#define HTTP_MAX_URI_HANDLERS 14
+
+#define HISTORY_DEFAULT_POINTS 500
+#define HISTORY_DEFAULT_SPAN_S 3600
+
 static const char *TAG = "http_server";
 
 static esp_err_t config_http_handler(httpd_req_t *req);
 static esp_err_t settings_http_post_handler(httpd_req_t *req);
 static esp_err_t http_get_handler(httpd_req_t *req);
 static esp_err_t websocket_http_handler(httpd_req_t *req);
+static esp_err_t diag_http_handler(httpd_req_t *req);
+static esp_err_t readings_http_handler(httpd_req_t *req);
+static esp_err_t history_http_handler(httpd_req_t *req);
+static esp_err_t export_http_handler(httpd_req_t *req);
+static esp_err_t channels_http_handler(httpd_req_t *req);
+static esp_err_t virtual_http_handler(httpd_req_t *req);
+static esp_err_t alarms_http_handler(httpd_req_t *req);
+static esp_err_t capture_http_handler(httpd_req_t *req);
+static esp_err_t metrics_http_handler(httpd_req_t *req);
+static esp_err_t http_metered_handler(httpd_req_t *req);
 
 static httpd_handle_t server = NULL;
 
+// Request counters per URI handler, for /metrics
+typedef enum
+{
+    HTTP_ENDPOINT_CONFIG = 0,
+    HTTP_ENDPOINT_SETTINGS,
+    HTTP_ENDPOINT_DIAG,
+    HTTP_ENDPOINT_READINGS,
+    HTTP_ENDPOINT_HISTORY,
+    HTTP_ENDPOINT_EXPORT,
+    HTTP_ENDPOINT_CHANNELS,
+    HTTP_ENDPOINT_VIRTUAL,
+    HTTP_ENDPOINT_ALARMS,
+    HTTP_ENDPOINT_CAPTURE,
+    HTTP_ENDPOINT_METRICS,
+    HTTP_ENDPOINT_FILES,
+    HTTP_ENDPOINT_COUNT
+} http_endpoint_id_t;
+
+typedef struct
+{
+    const char *name;
+    esp_err_t (*handler)(httpd_req_t *req);
+    uint32_t requests;
+    uint32_t errors; // the handler failed or the busy pool answered 503; the client may have seen a partial response
+} http_endpoint_t;
+
+static http_endpoint_t http_endpoints[HTTP_ENDPOINT_COUNT] = {
+    [HTTP_ENDPOINT_CONFIG] = {"config", config_http_handler},
+    [HTTP_ENDPOINT_SETTINGS] = {"settings", settings_http_post_handler},
+    [HTTP_ENDPOINT_DIAG] = {"diag", diag_http_handler},
+    [HTTP_ENDPOINT_READINGS] = {"readings", readings_http_handler},
+    [HTTP_ENDPOINT_HISTORY] = {"history", history_http_handler},
+    [HTTP_ENDPOINT_EXPORT] = {"export", export_http_handler},
+    [HTTP_ENDPOINT_CHANNELS] = {"channels", channels_http_handler},
+    [HTTP_ENDPOINT_VIRTUAL] = {"virtual", virtual_http_handler},
+    [HTTP_ENDPOINT_ALARMS] = {"alarms", alarms_http_handler},
+    [HTTP_ENDPOINT_CAPTURE] = {"capture", capture_http_handler},
+    [HTTP_ENDPOINT_METRICS] = {"metrics", metrics_http_handler},
+    [HTTP_ENDPOINT_FILES] = {"files", http_get_handler},
+};
+static portMUX_TYPE http_endpoint_lock = portMUX_INITIALIZER_UNLOCKED;
+static histogram_t request_histogram = HISTOGRAM_INITIALIZER("http_request", HISTOGRAM_UNIT_US);
+
 static httpd_uri_t config_uri = {
     .uri = "/config*",
     .method = HTTP_ANY,
-    .handler = config_http_handler,
-    .user_ctx = NULL
+    .handler = http_metered_handler,
+    .user_ctx = &http_endpoints[HTTP_ENDPOINT_CONFIG]
 };
 static httpd_uri_t settings_uri = {
     .uri = "/settings*",
     .method = HTTP_POST,
-    .handler = settings_http_post_handler,
-    .user_ctx = NULL
+    .handler = http_metered_handler,
+    .user_ctx = &http_endpoints[HTTP_ENDPOINT_SETTINGS]
+};
+static httpd_uri_t diag_uri = {
+    .uri = "/api/diag",
+    .method = HTTP_GET,
+    .handler = http_metered_handler,
+    .user_ctx = &http_endpoints[HTTP_ENDPOINT_DIAG]
+};
+static httpd_uri_t readings_uri = {
+    .uri = "/api/readings",
+    .method = HTTP_GET,
+    .handler = http_metered_handler,
+    .user_ctx = &http_endpoints[HTTP_ENDPOINT_READINGS]
+};
+static httpd_uri_t history_uri = {
+    .uri = "/api/history",
+    .method = HTTP_GET,
+    .handler = http_metered_handler,
+    .user_ctx = &http_endpoints[HTTP_ENDPOINT_HISTORY]
+};
+static httpd_uri_t export_uri = {
+    .uri = "/api/export",
+    .method = HTTP_GET,
+    .handler = http_metered_handler,
+    .user_ctx = &http_endpoints[HTTP_ENDPOINT_EXPORT]
 };
+static httpd_uri_t channels_uri = {
+    .uri = "/api/channels",
+    .method = HTTP_ANY,
+    .handler = http_metered_handler,
+    .user_ctx = &http_endpoints[HTTP_ENDPOINT_CHANNELS]
+};
+static httpd_uri_t virtual_uri = {
+    .uri = "/api/virtual",
+    .method = HTTP_ANY,
+    .handler = http_metered_handler,
+    .user_ctx = &http_endpoints[HTTP_ENDPOINT_VIRTUAL]
+};
+static httpd_uri_t alarms_uri = {
+    .uri = "/api/alarms",
+    .method = HTTP_ANY,
+    .handler = http_metered_handler,
+    .user_ctx = &http_endpoints[HTTP_ENDPOINT_ALARMS]
+};
+static httpd_uri_t capture_uri = {
+    .uri = "/api/capture",
+    .method = HTTP_ANY,
+    .handler = http_metered_handler,
+    .user_ctx = &http_endpoints[HTTP_ENDPOINT_CAPTURE]
+};
+
+static httpd_uri_t metrics_uri = {
+    .uri = "/metrics",
+    .method = HTTP_GET,
+    .handler = http_metered_handler,
+    .user_ctx = &http_endpoints[HTTP_ENDPOINT_METRICS]
+};
+
 static httpd_uri_t root_uri = {
     .uri = "/*",
     .method = HTTP_GET,
-    .handler = http_get_handler,
-    .user_ctx = NULL
+    .handler = http_metered_handler,
+    .user_ctx = &http_endpoints[HTTP_ENDPOINT_FILES]
 };
 static httpd_uri_t websocket_uri = {
     .uri = "/ws",
@@ -118,7 +263,14 @@ static esp_err_t send_dynamic_file(httpd_req_t *req)
     }
     ESP_LOGI(TAG, "Full file path: %s", file_path);
 
-    esp_err_t err = file_exists_in_fatfs(file_path);
+    // Bundled frontend assets are served from the memory-mapped asset partition
+    esp_err_t err = asset_store_send(req, file_path, strcspn(file_path, "?#"));
+    if (err != ESP_ERR_NOT_FOUND)
+    {
+        return err;
+    }
+
+    err = file_exists_in_fatfs(file_path);
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "File does not exist: %s", esp_err_to_name(err));
@@ -135,99 +287,130 @@ static esp_err_t send_dynamic_file(httpd_req_t *req)
     return ESP_OK;
 }
 
-static esp_err_t get_post_field_value(const char *buffer, const char *field, char *value, size_t value_len)
-{
-    // iterate over the buffer to find the field
-    // first, find the exact field name followd by '='
-    // then copy the value until '&' or end of string
-    char *buffer_ptr = (char *)buffer;
-    size_t field_len = strlen(field);
-
-    while (*buffer_ptr != '\0')
-    {
-        if (strncmp(buffer_ptr, field, field_len) == 0 && buffer_ptr[field_len] == '=')
-        {
-            buffer_ptr += field_len + 1;             // move pointer to the start of the value
-            char *end_ptr = strchr(buffer_ptr, '&'); // find the end of the value
-            if (end_ptr == NULL)
-            {
-                end_ptr = buffer_ptr + strlen(buffer_ptr); // set end pointer to the end of the string
-            }
-            size_t value_length = MIN(end_ptr - buffer_ptr, value_len - 1); // copy only up to value_len - 1 characters
-            strncpy(value, buffer_ptr, value_length);
-            value[value_length] = '\0'; // null-terminate the string
-            return ESP_OK;
-        }
-        buffer_ptr++;
-    }
-
-    return ESP_FAIL; // field not found
-}
-
 static esp_err_t parse_ap_post_request(httpd_req_t *req)
 {
-    /* if esp is in AP mode, the only incoming data is the SSID and password of the STA network
-     * the data is sent as a form-urlencoded string, e.g. ssid=myssid&pass=mypassword
-     * we need to parse this string and save the values in the system_state structure
-     * buffer lenght should be SSID_MAX_LEN + PASS_MAX_LEN + strlen("ssid=&password=") + N
+    /* The settings are sent either as a form-urlencoded string, e.g. sta_ssid=my+ssid&sta_pass=...,
+     * or as a flat JSON object with the same keys. The body is tokenized in one pass while it is
+     * received, so it never has to fit into a buffer and values are percent/escape decoded.
      */
-    char buffer[512];
-    int ret = httpd_req_recv(req, buffer, sizeof(buffer) - 1);
-    if (ret <= 0)
-    {
-        ESP_LOGE(TAG, "Socket error: %d", ret);
-        return send_error_response(req, "500 Internal Server Error", "Failed to receive data");
-    }
-    buffer[ret] = '\0'; // null-terminate the string
     char sta_ssid[SSID_MAX_LEN] = {0};
     char sta_pass[PASS_MAX_LEN] = {0};
     char ap_ssid[SSID_MAX_LEN] = {0};
     char ap_pass[PASS_MAX_LEN] = {0};
     char sensor_mask_str[4] = {0};
-    int sensor_mask = 0;
+    char startup_mode_str[2] = {0};
+    long sensor_mask = 0;
 
-    ESP_LOGI(TAG, "Received data: %s", buffer);
+    form_field_t fields[] = {
+        {.name = "sta_ssid", .value = sta_ssid, .value_size = sizeof(sta_ssid)},
+        {.name = "sta_pass", .value = sta_pass, .value_size = sizeof(sta_pass)},
+        {.name = "ap_ssid", .value = ap_ssid, .value_size = sizeof(ap_ssid)},
+        {.name = "ap_pass", .value = ap_pass, .value_size = sizeof(ap_pass)},
+        {.name = "sensor_mask", .value = sensor_mask_str, .value_size = sizeof(sensor_mask_str)},
+        {.name = "wifi_startup_mode", .value = startup_mode_str, .value_size = sizeof(startup_mode_str)}, // optional
+    };
+    const size_t required_fields = 5;
 
-    if (get_post_field_value(buffer, "sta_ssid", sta_ssid, sizeof(sta_ssid)) != ESP_OK)
+    if (req->content_len > SETTINGS_BODY_MAX_LEN)
     {
-        ESP_LOGE(TAG, "Failed to get SSID from POST data");
-        return send_error_response(req, "400 Bad Request", "Invalid SSID format");
+        ESP_LOGE(TAG, "Settings body too large: %d", req->content_len);
+        return send_error_response(req, "413 Payload Too Large", "Request body too large");
     }
-    if (get_post_field_value(buffer, "sta_pass", sta_pass, sizeof(sta_pass)) != ESP_OK)
+
+    char content_type[32] = {0};
+    httpd_req_get_hdr_value_str(req, "Content-Type", content_type, sizeof(content_type));
+    form_parser_format_t format = strncasecmp(content_type, "application/json", 16) == 0 ? FORM_PARSER_JSON : FORM_PARSER_URLENCODED;
+
+    form_parser_t parser;
+    form_parser_init(&parser, format, fields, sizeof(fields) / sizeof(fields[0]));
+
+    char chunk[128];
+    size_t remaining = req->content_len;
+    while (remaining > 0)
     {
-        ESP_LOGE(TAG, "Failed to get password from POST data");
-        return send_error_response(req, "400 Bad Request", "Invalid password format");
+        int ret = httpd_req_recv(req, chunk, MIN(remaining, sizeof(chunk)));
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+        {
+            continue; // Retry receiving on timeout
+        }
+        if (ret <= 0)
+        {
+            ESP_LOGE(TAG, "Socket error: %d", ret);
+            return send_error_response(req, "500 Internal Server Error", "Failed to receive data");
+        }
+        if (form_parser_feed(&parser, chunk, ret) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Malformed settings body");
+            return send_error_response(req, "400 Bad Request", "Malformed request body");
+        }
+        remaining -= ret;
     }
-    if (get_post_field_value(buffer, "ap_ssid", ap_ssid, sizeof(ap_ssid)) != ESP_OK)
+    if (form_parser_finish(&parser) != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to get AP SSID from POST data");
-        return send_error_response(req, "400 Bad Request", "Invalid AP SSID format");
+        ESP_LOGE(TAG, "Truncated settings body");
+        return send_error_response(req, "400 Bad Request", "Malformed request body");
     }
-    if (get_post_field_value(buffer, "ap_pass", ap_pass, sizeof(ap_pass)) != ESP_OK)
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
     {
-        ESP_LOGE(TAG, "Failed to get AP password from POST data");
-        return send_error_response(req, "400 Bad Request", "Invalid AP password format");
+        if (!fields[i].found && i < required_fields)
+        {
+            ESP_LOGE(TAG, "Failed to get %s from POST data", fields[i].name);
+            return send_error_response(req, "400 Bad Request", "Missing field");
+        }
+        if (fields[i].truncated)
+        {
+            ESP_LOGE(TAG, "Value of %s is too long", fields[i].name);
+            return send_error_response(req, "400 Bad Request", "Field value too long");
+        }
     }
-    if (get_post_field_value(buffer, "sensor_mask", sensor_mask_str, sizeof(sensor_mask_str)) != ESP_OK)
+
+    char *end_ptr = NULL;
+    sensor_mask = strtol(sensor_mask_str, &end_ptr, 10);
+    if (end_ptr == sensor_mask_str || *end_ptr != '\0' || sensor_mask < 0 || sensor_mask > 0xFF)
     {
-        ESP_LOGE(TAG, "Failed to get sensor mask from POST data");
+        ESP_LOGE(TAG, "Invalid sensor mask: %s", sensor_mask_str);
         return send_error_response(req, "400 Bad Request", "Invalid sensor mask format");
     }
-    sensor_mask = atoi(sensor_mask_str);
 
-    strlcpy(system_state.sta_ssid, sta_ssid, sizeof(system_state.sta_ssid));
-    strlcpy(system_state.sta_pass, sta_pass, sizeof(system_state.sta_pass));
-    strlcpy(system_state.ap_ssid, ap_ssid, sizeof(system_state.ap_ssid));
-    strlcpy(system_state.ap_pass, ap_pass, sizeof(system_state.ap_pass));
-    system_state.sensor_mask = sensor_mask;
+    system_state_t requested = system_state;
+    strlcpy(requested.sta_ssid, sta_ssid, sizeof(requested.sta_ssid));
+    strlcpy(requested.sta_pass, sta_pass, sizeof(requested.sta_pass));
+    strlcpy(requested.ap_ssid, ap_ssid, sizeof(requested.ap_ssid));
+    strlcpy(requested.ap_pass, ap_pass, sizeof(requested.ap_pass));
+    requested.sensor_mask = sensor_mask;
+    if (fields[5].found)
+    {
+        if (startup_mode_str[0] != '0' + WIFI_STARTUP_MODE_STA && startup_mode_str[0] != '0' + WIFI_STARTUP_MODE_AP)
+        {
+            return send_error_response(req, "400 Bad Request", "Invalid WiFi startup mode");
+        }
+        requested.wifi_startup_mode = startup_mode_str[0] - '0';
+    }
+
+    ESP_LOGI(TAG, "SSID: %s, Password: %s", requested.sta_ssid, requested.sta_pass);
 
-    ESP_LOGI(TAG, "SSID: %s, Password: %s", system_state.sta_ssid, system_state.sta_pass);
+    uint32_t changed_fields = 0;
+    bool restart_required = false;
+    esp_err_t err = settings_apply(&requested, &changed_fields, &restart_required);
+    if (err != ESP_OK)
+    {
+        return send_error_response(req, "400 Bad Request", "Invalid settings");
+    }
 
-    vTaskDelay(pdMS_TO_TICKS(100));
+    if (!restart_required)
+    {
+        ESP_LOGI(TAG, "Settings applied without restart (changed: 0x%02lX)", (unsigned long)changed_fields);
+        return send_ok_response(req, changed_fields ? "Settings saved and applied." : "Settings unchanged.");
+    }
 
-    store_running_config_in_fatfs();
-    ESP_LOGI(TAG, "Running config stored");
-    esp_err_t err = send_ok_response(req, "STA credentials saved successfully. Restarting ESP32...");
+    err = config_store_flush();
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write config before restart: %s", esp_err_to_name(err));
+        return send_error_response(req, "500 Internal Server Error", "Failed to save settings");
+    }
+    err = send_ok_response(req, "Settings saved successfully. Restarting ESP32...");
 
     events_post(EVENT_RESTART_REQUESTED, NULL, 0);
     ESP_LOGI(TAG, "Restart requested");
@@ -244,6 +427,12 @@ static esp_err_t config_http_handler(httpd_req_t *req)
     ESP_LOGI(TAG, "Config handler Prio: %d, Core: %d", uxTaskPriorityGet(NULL), xPortGetCoreID());
     dump_request(req);
 
+    // The JSON config is only an import/export format, imports go through the settings pipeline
+    if (req->method == HTTP_POST)
+    {
+        return parse_ap_post_request(req);
+    }
+
     cJSON *root = cJSON_CreateObject();
     if (root == NULL)
     {
@@ -255,6 +444,7 @@ static esp_err_t config_http_handler(httpd_req_t *req)
     cJSON_AddStringToObject(root, "sta_ssid", system_state.sta_ssid);
     cJSON_AddStringToObject(root, "sta_pass", system_state.sta_pass);
     cJSON_AddNumberToObject(root, "sensor_mask", system_state.sensor_mask);
+    cJSON_AddNumberToObject(root, "wifi_startup_mode", system_state.wifi_startup_mode);
 
 #ifdef CONFIG_IDF_TARGET_ESP32
     cJSON_AddStringToObject(root, "target", "ESP32");
@@ -264,7 +454,15 @@ static esp_err_t config_http_handler(httpd_req_t *req)
     cJSON_AddStringToObject(root, "target", "Other");
 #endif
 
-    return send_ok_response(req, cJSON_Print(root));
+    char *json = cJSON_Print(root);
+    cJSON_Delete(root);
+    if (json == NULL)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Failed to print JSON object");
+    }
+    esp_err_t err = send_ok_response(req, json);
+    free(json);
+    return err;
 }
 
 static esp_err_t settings_http_post_handler(httpd_req_t *req)
@@ -278,73 +476,1362 @@ static esp_err_t settings_http_post_handler(httpd_req_t *req)
 
 static esp_err_t http_get_handler(httpd_req_t *req)
 {
+    // File transfers can take long on slow clients, keep them off the httpd task
+    if (!http_workers_is_worker_task())
+    {
+        return http_workers_submit(req, http_metered_handler);
+    }
+
     ESP_LOGI(TAG, "HTTP Handler Prio: %d, Core: %d", uxTaskPriorityGet(NULL), xPortGetCoreID());
     dump_request(req);
 
     return send_dynamic_file(req);
 }
 
-static esp_err_t send_sync_response(httpd_req_t *req, const char *message) {
-    httpd_ws_frame_t ws_pkt;
-    memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+static esp_err_t diag_http_handler(httpd_req_t *req)
+{
+    http_workers_stats_t workers;
+    http_workers_get_stats(&workers);
 
-    ws_pkt.payload = (uint8_t *)message;
-    ws_pkt.len = strlen(message);
-    ws_pkt.type = HTTPD_WS_TYPE_TEXT;
+    cJSON *root = cJSON_CreateObject();
+    if (root == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create JSON object");
+        return send_error_response(req, "500 Internal Server Error", "Failed to create JSON object");
+    }
 
-    return httpd_ws_send_frame(req, &ws_pkt);
+    cJSON *http = cJSON_AddObjectToObject(root, "http_workers");
+    cJSON_AddNumberToObject(http, "workers", CONFIG_HTTP_WORKER_COUNT);
+    cJSON_AddNumberToObject(http, "busy", workers.busy_workers);
+    cJSON_AddNumberToObject(http, "queue_depth", workers.queue_depth);
+    cJSON_AddNumberToObject(http, "queue_depth_max", workers.queue_depth_max);
+    cJSON_AddNumberToObject(http, "submitted", workers.submitted);
+    cJSON_AddNumberToObject(http, "completed", workers.completed);
+    cJSON_AddNumberToObject(http, "rejected", workers.rejected);
+    cJSON_AddNumberToObject(http, "inlined", workers.inlined);
+    cJSON_AddNumberToObject(http, "wait_us_avg", workers.completed ? (double)(workers.wait_us_total / workers.completed) : 0);
+    cJSON_AddNumberToObject(http, "wait_us_max", workers.wait_us_max);
+
+    config_store_stats_t config;
+    config_store_get_stats(&config);
+    cJSON *store = cJSON_AddObjectToObject(root, "config_store");
+    cJSON_AddNumberToObject(store, "dirty_marks", config.dirty_marks);
+    cJSON_AddNumberToObject(store, "writes", config.writes);
+    cJSON_AddNumberToObject(store, "write_errors", config.write_errors);
+    cJSON_AddNumberToObject(store, "pending", config.pending);
+    cJSON_AddNumberToObject(store, "last_write_ms", config.last_write_us / 1000);
+
+    sample_scheduler_stats_t sampling;
+    sample_scheduler_get_stats(&sampling);
+    cJSON *sampling_json = cJSON_AddObjectToObject(root, "sampling");
+    cJSON_AddStringToObject(sampling_json, "mode", sampling.mode == SAMPLE_MODE_QUIET ? "quiet" : "full");
+    cJSON_AddNumberToObject(sampling_json, "full_rate_hz", sampling.full_rate_hz);
+    cJSON_AddNumberToObject(sampling_json, "effective_rate_hz", sampling.effective_rate_hz);
+    cJSON_AddNumberToObject(sampling_json, "interval_ms", sample_scheduler_interval_ms());
+    cJSON_AddNumberToObject(sampling_json, "max_rate_c_per_min", sampling.max_rate_c_per_min);
+    cJSON_AddNumberToObject(sampling_json, "conversions", sampling.conversions);
+    cJSON_AddNumberToObject(sampling_json, "busy_ms", sampling.busy_us / 1000);
+    cJSON_AddNumberToObject(sampling_json, "saved_ms", sampling.saved_us / 1000);
+    cJSON_AddNumberToObject(sampling_json, "quiet_s", sampling.quiet_ms / 1000);
+    cJSON_AddNumberToObject(sampling_json, "transitions", sampling.transitions);
+
+    ntc_snapshot_stamp_t stamp;
+    ntc_adc_get_snapshot_stamp(&stamp);
+    cJSON *latency_json = cJSON_AddObjectToObject(root, "latency");
+    cJSON_AddNumberToObject(latency_json, "sequence", stamp.sequence);
+    cJSON_AddNumberToObject(latency_json, "snapshot_age_us", stamp.sequence ? esp_timer_get_time() - stamp.published_us : 0);
+
+    // Every registered histogram: the latency paths and the timed hot paths, in microseconds
+    cJSON *timing_json = cJSON_AddObjectToObject(root, "timing");
+    for (histogram_t *histogram = histogram_next(NULL); histogram != NULL; histogram = histogram_next(histogram))
+    {
+        histogram_stats_t stats;
+        histogram_get_stats(histogram, &stats);
+        cJSON *histogram_json = cJSON_AddObjectToObject(timing_json, histogram->name);
+        cJSON_AddNumberToObject(histogram_json, "count", stats.count);
+        cJSON_AddNumberToObject(histogram_json, "avg_us", stats.count ? histogram_to_us(histogram, stats.sum / stats.count) : 0);
+        cJSON_AddNumberToObject(histogram_json, "p50_us", histogram_to_us(histogram, stats.p50));
+        cJSON_AddNumberToObject(histogram_json, "p90_us", histogram_to_us(histogram, stats.p90));
+        cJSON_AddNumberToObject(histogram_json, "p99_us", histogram_to_us(histogram, stats.p99));
+        cJSON_AddNumberToObject(histogram_json, "max_us", histogram_to_us(histogram, stats.max));
+        if (histogram->dropped > 0)
+        {
+            cJSON_AddNumberToObject(histogram_json, "dropped", histogram->dropped);
+        }
+    }
+
+    ts_store_stats_t history;
+    ts_store_get_stats(&history);
+    cJSON *history_json = cJSON_AddObjectToObject(root, "history");
+    cJSON_AddNumberToObject(history_json, "segments", history.segment_count);
+    cJSON_AddNumberToObject(history_json, "segments_used", history.segments_used);
+    cJSON_AddNumberToObject(history_json, "records_written", history.records_written);
+    cJSON_AddNumberToObject(history_json, "segments_erased", history.segments_erased);
+    cJSON_AddNumberToObject(history_json, "write_errors", history.write_errors);
+    cJSON_AddNumberToObject(history_json, "crc_errors", history.crc_errors);
+    cJSON_AddNumberToObject(history_json, "samples_pending", history.samples_pending);
+    cJSON_AddNumberToObject(history_json, "oldest", history.oldest_ts);
+    cJSON_AddNumberToObject(history_json, "newest", history.newest_ts);
+    cJSON_AddNumberToObject(history_json, "recovery_us", history.recovery_us);
+    cJSON *tiers_json = cJSON_AddArrayToObject(history_json, "tiers");
+    for (int tier = 0; tier < HISTORY_TIER_COUNT; tier++)
+    {
+        history_tier_info_t info;
+        if (history_rrd_get_info(tier, &info) != ESP_OK)
+        {
+            break;
+        }
+        cJSON *tier_json = cJSON_CreateObject();
+        cJSON_AddNumberToObject(tier_json, "resolution_s", info.resolution_s);
+        cJSON_AddNumberToObject(tier_json, "points", info.points);
+        cJSON_AddNumberToObject(tier_json, "used", info.used);
+        cJSON_AddItemToArray(tiers_json, tier_json);
+    }
+
+    size_t boot_count;
+    const boot_record_t *timeline = boot_get_timeline(&boot_count);
+    cJSON *boot = cJSON_AddObjectToObject(root, "boot");
+    cJSON *steps = cJSON_AddArrayToObject(boot, "steps");
+    for (size_t i = 0; i < boot_count; i++)
+    {
+        if (timeline[i].name == NULL)
+        {
+            continue;
+        }
+        cJSON *step = cJSON_CreateObject();
+        cJSON_AddStringToObject(step, "name", timeline[i].name);
+        cJSON_AddNumberToObject(step, "start_ms", timeline[i].start_us / 1000.0);
+        cJSON_AddNumberToObject(step, "end_ms", timeline[i].end_us / 1000.0);
+        cJSON_AddNumberToObject(step, "core", timeline[i].core);
+        cJSON_AddItemToArray(steps, step);
+    }
+    cJSON_AddNumberToObject(boot, "first_reading_ms", timeline[BOOT_STEP_FIRST_READING].end_us / 1000.0);
+    cJSON_AddNumberToObject(boot, "http_ready_ms", timeline[BOOT_STEP_HTTP].end_us / 1000.0);
+
+    char *json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json == NULL)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Failed to print JSON object");
+    }
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t err = httpd_resp_sendstr(req, json);
+    free(json);
+    return err;
 }
 
-static esp_err_t websocket_http_handler(httpd_req_t *req)
+// Counts and times every request. A handler that hands its request to the worker pool is called
+// back in here on the worker (or inline when the pool is down) and measured there; a request the
+// full queue turned away with 503 is counted as an error on the httpd task.
+static esp_err_t http_metered_handler(httpd_req_t *req)
 {
-    ESP_LOGI(TAG, "WebSocket Handler Prio: %d, Core: %d", uxTaskPriorityGet(NULL), xPortGetCoreID());
-    dump_request(req);
+    http_endpoint_t *endpoint = req->user_ctx;
+    bool on_worker = http_workers_is_worker_task();
+    http_workers_stats_t before;
+    if (!on_worker)
+    {
+        // Only the httpd task submits, so a change in the counters was caused by this request
+        http_workers_get_stats(&before);
+    }
 
-    if (req->method == HTTP_GET) {
-        ESP_LOGI(TAG, "Handshake done, the new connection was opened");
+    HISTOGRAM_TIME_START(timing, &request_histogram);
+    esp_err_t err = endpoint->handler(req);
+
+    bool rejected = false;
+    if (!on_worker)
+    {
+        http_workers_stats_t after;
+        http_workers_get_stats(&after);
+        if (after.submitted != before.submitted || after.inlined != before.inlined)
+        {
+            return err;
+        }
+        rejected = after.rejected != before.rejected;
+    }
+    HISTOGRAM_TIME_STOP(timing);
+
+    taskENTER_CRITICAL(&http_endpoint_lock);
+    endpoint->requests++;
+    if (err != ESP_OK || rejected)
+    {
+        endpoint->errors++;
+    }
+    taskEXIT_CRITICAL(&http_endpoint_lock);
+    return err;
+}
+
+// OpenMetrics text exposition for Prometheus, see metrics.c
+static esp_err_t metrics_http_handler(httpd_req_t *req)
+{
+    metrics_http_endpoint_t endpoints[HTTP_ENDPOINT_COUNT];
+    taskENTER_CRITICAL(&http_endpoint_lock);
+    for (int i = 0; i < HTTP_ENDPOINT_COUNT; i++)
+    {
+        endpoints[i] = (metrics_http_endpoint_t){
+            .name = http_endpoints[i].name,
+            .requests = http_endpoints[i].requests,
+            .errors = http_endpoints[i].errors,
+        };
+    }
+    taskEXIT_CRITICAL(&http_endpoint_lock);
+
+    // Only used on the httpd task, one scrape at a time
+    static chunk_writer_t writer;
+    chunk_writer_init(&writer, req);
+    httpd_resp_set_type(req, "application/openmetrics-text; version=1.0.0; charset=utf-8");
+    metrics_write(&writer, endpoints, HTTP_ENDPOINT_COUNT);
+    return chunk_writer_finish(&writer);
+}
+
+// Current readings; right after a reset these are the retained ones, marked stale
+static esp_err_t readings_http_handler(httpd_req_t *req)
+{
+    cJSON *root = cJSON_CreateObject();
+    if (root == NULL)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Failed to create JSON object");
+    }
+
+    cJSON_AddBoolToObject(root, "stale", ntc_adc_is_stale());
+    ntc_snapshot_stamp_t stamp;
+    ntc_adc_get_snapshot_stamp(&stamp);
+    cJSON *snapshot_json = cJSON_AddObjectToObject(root, "snapshot");
+    cJSON_AddNumberToObject(snapshot_json, "sequence", stamp.sequence);
+    cJSON_AddNumberToObject(snapshot_json, "acquired_us", stamp.acquired_us);
+    cJSON_AddNumberToObject(snapshot_json, "published_us", stamp.published_us);
+    cJSON_AddNumberToObject(snapshot_json, "now_us", esp_timer_get_time());
+    cJSON *channels = cJSON_AddArrayToObject(root, "channels");
+    for (uint8_t i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        if ((system_state.sensor_mask & (1 << i)) == 0)
+        {
+            continue;
+        }
+        uint16_t raw = ntc_get_channel_data(i);
+        cJSON *channel = cJSON_CreateObject();
+        cJSON_AddNumberToObject(channel, "channel", i);
+        cJSON_AddNumberToObject(channel, "raw", raw);
+        cJSON_AddNumberToObject(channel, "temperature", ntc_get_channel_temperature(i));
+        cJSON_AddStringToObject(channel, "status", ntc_channel_status_name(ntc_get_channel_status(i)));
+        uint8_t alarms = alarm_get_active(i);
+        cJSON *alarms_json = cJSON_AddArrayToObject(channel, "alarms");
+        for (int type = 0; type < ALARM_TYPE_COUNT; type++)
+        {
+            if (alarms & (1 << type))
+            {
+                cJSON_AddItemToArray(alarms_json, cJSON_CreateString(alarm_type_name(type)));
+            }
+        }
+        cJSON_AddItemToArray(channels, channel);
+    }
+    uint8_t virtual_mask = virtual_channel_get_mask();
+    for (uint8_t i = 0; i < VIRTUAL_CHANNEL_MAX; i++)
+    {
+        virtual_channel_config_t config;
+        if ((virtual_mask & (1 << i)) == 0 || virtual_channel_get(i, &config) != ESP_OK)
+        {
+            continue;
+        }
+        cJSON *channel = cJSON_CreateObject();
+        cJSON_AddNumberToObject(channel, "channel", SENSOR_MAX_COUNT + i);
+        cJSON_AddStringToObject(channel, "name", config.name);
+        cJSON_AddBoolToObject(channel, "virtual", true);
+        cJSON_AddNumberToObject(channel, "temperature", virtual_channel_get_value(i));
+        cJSON_AddItemToArray(channels, channel);
+    }
+
+    retained_snapshot_t snapshot;
+    retained_get_snapshot(&snapshot);
+    cJSON_AddNumberToObject(root, "boot_count", snapshot.boot_count);
+    if (snapshot.stats_count > 0)
+    {
+        cJSON *window = cJSON_AddObjectToObject(root, "window");
+        cJSON_AddNumberToObject(window, "samples", snapshot.stats_count);
+        cJSON *stats = cJSON_AddArrayToObject(window, "channels");
+        for (uint8_t i = 0; i < SENSOR_MAX_COUNT; i++)
+        {
+            if ((snapshot.sensor_mask & (1 << i)) == 0)
+            {
+                continue;
+            }
+            const retained_channel_stats_t *channel_stats = &snapshot.stats[i];
+            cJSON *channel = cJSON_CreateObject();
+            cJSON_AddNumberToObject(channel, "channel", i);
+            cJSON_AddNumberToObject(channel, "min", ntc_adc_raw_to_temperature(i, channel_stats->min));
+            cJSON_AddNumberToObject(channel, "avg", ntc_adc_raw_to_temperature(i, channel_stats->sum / snapshot.stats_count));
+            cJSON_AddNumberToObject(channel, "max", ntc_adc_raw_to_temperature(i, channel_stats->max));
+            cJSON_AddItemToArray(stats, channel);
+        }
+    }
+
+    char *json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json == NULL)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Failed to print JSON object");
+    }
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t err = httpd_resp_sendstr(req, json);
+    free(json);
+    if (err == ESP_OK && stamp.sequence != 0)
+    {
+        latency_record(LATENCY_PUBLISH_TO_HTTP, esp_timer_get_time() - stamp.published_us);
+    }
+    return err;
+}
+
+// The query string of the URL, NULL if there is none; the caller frees it
+static esp_err_t read_query_string(httpd_req_t *req, char **query)
+{
+    *query = NULL;
+    size_t query_len = httpd_req_get_url_query_len(req) + 1;
+    if (query_len <= 1)
+    {
         return ESP_OK;
     }
+    *query = malloc(query_len);
+    if (*query == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_err_t err = httpd_req_get_url_query_str(req, *query, query_len);
+    if (err != ESP_OK)
+    {
+        free(*query);
+        *query = NULL;
+    }
+    return err;
+}
 
-    // Buffer to store incoming WebSocket message
-    char buffer[1024];
-    int buffer_len = sizeof(buffer);
+// Physical and virtual channels in use
+static uint16_t default_channels(void)
+{
+    return system_state.sensor_mask | virtual_channel_get_mask() << SENSOR_MAX_COUNT;
+}
 
-    // Read incoming WebSocket message
-    httpd_ws_frame_t ws_frame;
-    memset(&ws_frame, 0, sizeof(httpd_ws_frame_t));
-    ws_frame.type = HTTPD_WS_TYPE_TEXT;
-    ws_frame.payload = (uint8_t *)buffer;
-    ws_frame.len = buffer_len;
+// Whole string as an unsigned decimal no larger than max, without sign, whitespace or trailing characters
+static bool parse_uint(const char *value, uint32_t max, uint32_t *result)
+{
+    char *end;
+    errno = 0;
+    unsigned long parsed = strtoul(value, &end, 10);
+    if (!isdigit((unsigned char)value[0]) || *end != '\0' || errno == ERANGE || parsed > max)
+    {
+        return false;
+    }
+    *result = parsed;
+    return true;
+}
 
-    esp_err_t ret = httpd_ws_recv_frame(req, &ws_frame, buffer_len);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Error receiving WebSocket message: %s", esp_err_to_name(ret));
-        return ret;
+// Channel list parameter "ch=0,3,5", virtual channels follow the physical ones.
+// Returns false for a malformed list; a missing parameter leaves channel_mask unchanged.
+static bool query_channels(const char *query, uint16_t *channel_mask)
+{
+    char param[48];
+    if (query == NULL || httpd_query_key_value(query, "ch", param, sizeof(param)) != ESP_OK)
+    {
+        return true;
+    }
+    *channel_mask = 0;
+    char *save = NULL;
+    for (char *token = strtok_r(param, ",", &save); token != NULL; token = strtok_r(NULL, ",", &save))
+    {
+        uint32_t channel;
+        if (!parse_uint(token, CHANNEL_MAX_COUNT - 1, &channel))
+        {
+            return false;
+        }
+        *channel_mask |= 1 << channel;
     }
+    return true;
+}
 
-    // Process the received message
-    ESP_LOGI(TAG, "Received message: %s", buffer);
+// Inverse of query_channels()
+static void format_channels(uint16_t channel_mask, char *buffer, size_t size)
+{
+    size_t length = 0;
+    buffer[0] = '\0';
+    for (int i = 0; i < CHANNEL_MAX_COUNT && length < size; i++)
+    {
+        if (channel_mask & (1 << i))
+        {
+            length += snprintf(buffer + length, size - length, length > 0 ? ",%d" : "%d", i);
+        }
+    }
+}
 
-    // Send a synchronous response
-    const char *response = "Message received";
-    ret = send_sync_response(req, response);
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Error sending WebSocket response: %s", esp_err_to_name(ret));
-        return ret;
+// Time parameter in store seconds; negative values are relative to now.
+// Returns false for a malformed value; a missing or empty parameter leaves value unchanged.
+static bool query_time(const char *query, const char *key, uint32_t now, uint32_t *value)
+{
+    char param[16];
+    if (query == NULL || httpd_query_key_value(query, key, param, sizeof(param)) != ESP_OK ||
+        param[0] == '\0')
+    {
+        return true;
+    }
+    char *end;
+    long long parsed = strtoll(param, &end, 10);
+    if (end == param || *end != '\0')
+    {
+        return false;
     }
+    *value = parsed < 0 ? (uint32_t)MAX((long long)now + parsed, 0) : (uint32_t)MIN(parsed, (long long)UINT32_MAX);
+    return true;
+}
 
-    return ESP_OK;
+static void history_write_value(chunk_writer_t *writer, int16_t value)
+{
+    if (value == TS_VALUE_INVALID)
+    {
+        chunk_writer_printf(writer, ",null");
+    }
+    else
+    {
+        chunk_writer_printf(writer, ",%.2f", value / 100.0);
+    }
 }
 
-void start_http_server(void)
+typedef struct
 {
-    ESP_LOGI(TAG, "Prio: %d, Core: %d", uxTaskPriorityGet(NULL), xPortGetCoreID());
-    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    chunk_writer_t *writer;
+    uint16_t channel_mask;
+    uint32_t count;
+} history_stream_t;
 
-    /* Use the URI wildcard matching function in order to
-     * allow the same handler to respond to multiple different
-     * target URIs which match the wildcard scheme */
-    config.uri_match_fn = httpd_uri_match_wildcard;
+static bool history_point_visitor(const history_point_t *point, void *ctx)
+{
+    history_stream_t *stream = ctx;
+    chunk_writer_printf(stream->writer, "%s[%lu", stream->count++ > 0 ? "," : "", (unsigned long)point->timestamp);
+    for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+    {
+        if (stream->channel_mask & (1 << i))
+        {
+            history_write_value(stream->writer, point->min[i]);
+            history_write_value(stream->writer, point->avg[i]);
+            history_write_value(stream->writer, point->max[i]);
+        }
+    }
+    chunk_writer_printf(stream->writer, "]");
+    return chunk_writer_ok(stream->writer);
+}
+
+/*
+ * GET /api/history?ch=0,3&from=-86400&to=&points=500
+ * ch: channel list (default: enabled sensors), from/to: store seconds, negative
+ * values relative to now (default: the last hour), points: buckets wanted.
+ * Every point is [timestamp, min, avg, max per channel] in °C, streamed as it is read.
+ */
+static esp_err_t history_http_handler(httpd_req_t *req)
+{
+    // Reading a day from flash takes a while, keep it off the httpd task
+    if (!http_workers_is_worker_task())
+    {
+        return http_workers_submit(req, http_metered_handler);
+    }
+
+    char *query_str = NULL;
+    if (read_query_string(req, &query_str) != ESP_OK)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Failed to read query");
+    }
+
+    uint32_t now = ts_store_now();
+    history_query_t query = {
+        .from = now - MIN(now, HISTORY_DEFAULT_SPAN_S),
+        .to = now,
+        .channel_mask = default_channels(),
+        .points = HISTORY_DEFAULT_POINTS,
+    };
+    bool valid = query_time(query_str, "from", now, &query.from) && query_time(query_str, "to", now, &query.to) &&
+                 query_channels(query_str, &query.channel_mask);
+    char param[32];
+    if (query_str != NULL && httpd_query_key_value(query_str, "points", param, sizeof(param)) == ESP_OK)
+    {
+        uint32_t points;
+        if (parse_uint(param, UINT32_MAX, &points) && points > 0)
+        {
+            query.points = (uint16_t)MIN(points, HISTORY_QUERY_MAX_POINTS);
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+    free(query_str);
+    if (!valid || query.to < query.from || query.channel_mask == 0)
+    {
+        return send_error_response(req, "400 Bad Request", "Invalid range or channels");
+    }
+
+    history_plan_t plan;
+    history_query_plan(&query, &plan);
+
+    chunk_writer_t *writer = malloc(sizeof(chunk_writer_t));
+    if (writer == NULL)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Out of memory");
+    }
+    chunk_writer_init(writer, req);
+    httpd_resp_set_type(req, "application/json");
+
+    chunk_writer_printf(writer, "{\"now\":%lu,\"from\":%lu,\"to\":%lu,\"source\":\"%s\",\"tier\":%d,"
+                                "\"resolution\":%lu,\"bucket\":%lu,\"channels\":[",
+                        (unsigned long)now, (unsigned long)query.from, (unsigned long)query.to,
+                        plan.source == HISTORY_SOURCE_RRD ? "ram" : "flash", plan.tier,
+                        (unsigned long)plan.resolution_s, (unsigned long)plan.bucket_s);
+    char channels[3 * CHANNEL_MAX_COUNT];
+    format_channels(query.channel_mask, channels, sizeof(channels));
+    chunk_writer_printf(writer, "%s],\"points\":[", channels);
+
+    history_stream_t stream = {.writer = writer, .channel_mask = query.channel_mask};
+    int64_t start_us = esp_timer_get_time();
+    history_query_run(&query, &plan, history_point_visitor, &stream);
+    chunk_writer_printf(writer, "]}");
+    esp_err_t err = chunk_writer_finish(writer);
+    free(writer);
+
+    ESP_LOGI(TAG, "History: %lu points from %s in %lld ms", (unsigned long)stream.count,
+             plan.source == HISTORY_SOURCE_RRD ? "ram" : "flash", (esp_timer_get_time() - start_us) / 1000);
+    return err;
+}
+
+// Export response state; header values must stay valid until the response is sent
+typedef struct
+{
+    chunk_writer_t writer;
+    char etag[12];
+    char disposition[64];
+    char location[128];
+    char content_range[48];
+    char header[64];
+} export_response_t;
+
+// Parse "bytes=start-[end]"; suffix ranges are not supported
+static bool parse_range(const char *value, uint64_t *start, uint64_t *end)
+{
+    unsigned long long first, last;
+    char dash;
+    int fields = sscanf(value, "bytes=%llu%c%llu", &first, &dash, &last);
+    if (fields < 2 || dash != '-' || (fields == 3 && last < first))
+    {
+        return false;
+    }
+    *start = first;
+    *end = fields == 3 ? last : UINT64_MAX;
+    return true;
+}
+
+/*
+ * GET /api/export?ch=0,3&from=&to=&format=csv|bin&compress=1
+ * Streams the samples of the flash store. Defaults: every stored sample of
+ * the enabled channels as CSV. The body only depends on the parameters, so
+ * a download can be resumed with Range (If-Range against the ETag) using
+ * the explicit URL in Content-Location.
+ */
+static esp_err_t export_http_handler(httpd_req_t *req)
+{
+    // Multi-megabyte transfers, keep them off the httpd task
+    if (!http_workers_is_worker_task())
+    {
+        return http_workers_submit(req, http_metered_handler);
+    }
+
+    char *query_str = NULL;
+    if (read_query_string(req, &query_str) != ESP_OK)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Failed to read query");
+    }
+    uint32_t now = ts_store_now();
+    history_export_t export = {
+        .from = 0,
+        .to = now,
+        .channel_mask = default_channels(),
+        .format = HISTORY_EXPORT_CSV,
+    };
+    bool valid = query_time(query_str, "from", now, &export.from) && query_time(query_str, "to", now, &export.to) &&
+                 query_channels(query_str, &export.channel_mask);
+    export.to = MIN(export.to, now);
+    char param[8];
+    if (query_str != NULL && httpd_query_key_value(query_str, "format", param, sizeof(param)) == ESP_OK)
+    {
+        export.format = strcmp(param, "bin") == 0 ? HISTORY_EXPORT_BINARY : HISTORY_EXPORT_CSV;
+    }
+    if (query_str != NULL && httpd_query_key_value(query_str, "compress", param, sizeof(param)) == ESP_OK)
+    {
+        uint32_t compress;
+        valid = valid && parse_uint(param, 1, &compress);
+        export.compress = valid && compress != 0;
+    }
+    free(query_str);
+    if (!valid || export.to < export.from || export.channel_mask == 0)
+    {
+        return send_error_response(req, "400 Bad Request", "Invalid range or channels");
+    }
+    if (export.compress && export.format != HISTORY_EXPORT_BINARY)
+    {
+        return send_error_response(req, "400 Bad Request", "Compression needs format=bin");
+    }
+
+    ts_store_stats_t store;
+    ts_store_get_stats(&store);
+    if (store.segment_count == 0)
+    {
+        return send_error_response(req, "503 Service Unavailable", "History store not available");
+    }
+
+    export_response_t *response = malloc(sizeof(export_response_t));
+    if (response == NULL)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Out of memory");
+    }
+    const char *extension = export.format == HISTORY_EXPORT_CSV ? "csv" : "bin";
+    snprintf(response->etag, sizeof(response->etag), "\"%08lx\"", (unsigned long)history_export_etag(&export));
+    snprintf(response->disposition, sizeof(response->disposition), "attachment; filename=\"history-%lu-%lu.%s\"",
+             (unsigned long)export.from, (unsigned long)export.to, extension);
+    char channels[3 * CHANNEL_MAX_COUNT];
+    format_channels(export.channel_mask, channels, sizeof(channels));
+    snprintf(response->location, sizeof(response->location), "/api/export?ch=%s&from=%lu&to=%lu&format=%s&compress=%d",
+             channels, (unsigned long)export.from, (unsigned long)export.to, extension, export.compress);
+
+    // A range only applies to the same body
+    uint64_t range_start = 0, range_end = UINT64_MAX;
+    bool ranged = httpd_req_get_hdr_value_str(req, "Range", response->header, sizeof(response->header)) == ESP_OK &&
+                  parse_range(response->header, &range_start, &range_end);
+    if (ranged && httpd_req_get_hdr_value_str(req, "If-Range", response->header, sizeof(response->header)) == ESP_OK &&
+        strcmp(response->header, response->etag) != 0)
+    {
+        ranged = false;
+    }
+
+    httpd_resp_set_type(req, export.format == HISTORY_EXPORT_CSV ? "text/csv" : "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", response->disposition);
+    httpd_resp_set_hdr(req, "Content-Location", response->location);
+    httpd_resp_set_hdr(req, "ETag", response->etag);
+    httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+
+    esp_err_t err;
+    if (ranged)
+    {
+        // The total size takes a counting pass over the range
+        chunk_writer_init(&response->writer, NULL);
+        err = history_export_write(&export, &response->writer);
+        uint64_t total = chunk_writer_size(&response->writer);
+        if (err != ESP_OK)
+        {
+            free(response);
+            return send_error_response(req, "500 Internal Server Error", "Failed to read history");
+        }
+        if (range_start >= total)
+        {
+            snprintf(response->content_range, sizeof(response->content_range), "bytes */%llu", total);
+            httpd_resp_set_hdr(req, "Content-Range", response->content_range);
+            err = send_error_response(req, "416 Range Not Satisfiable", "Range not satisfiable");
+            free(response);
+            return err;
+        }
+        range_end = MIN(range_end, total - 1);
+        snprintf(response->content_range, sizeof(response->content_range), "bytes %llu-%llu/%llu", range_start,
+                 range_end, total);
+        httpd_resp_set_status(req, "206 Partial Content");
+        httpd_resp_set_hdr(req, "Content-Range", response->content_range);
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    chunk_writer_init(&response->writer, req);
+    chunk_writer_set_range(&response->writer, range_start, range_end);
+    err = history_export_write(&export, &response->writer);
+    if (err == ESP_OK)
+    {
+        err = chunk_writer_finish(&response->writer);
+    }
+    ESP_LOGI(TAG, "Export: %llu bytes in %lld ms", chunk_writer_size(&response->writer),
+             (esp_timer_get_time() - start_us) / 1000);
+    free(response);
+    return err;
+}
+
+// Receive a small form or flat JSON body into fields
+static esp_err_t receive_form(httpd_req_t *req, form_field_t *fields, size_t field_count, size_t max_len)
+{
+    if (req->content_len > max_len)
+    {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    char content_type[32] = {0};
+    httpd_req_get_hdr_value_str(req, "Content-Type", content_type, sizeof(content_type));
+    form_parser_format_t format = strncasecmp(content_type, "application/json", 16) == 0 ? FORM_PARSER_JSON : FORM_PARSER_URLENCODED;
+
+    form_parser_t parser;
+    form_parser_init(&parser, format, fields, field_count);
+    char chunk[128];
+    size_t remaining = req->content_len;
+    while (remaining > 0)
+    {
+        int ret = httpd_req_recv(req, chunk, MIN(remaining, sizeof(chunk)));
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return ESP_FAIL;
+        }
+        if (form_parser_feed(&parser, chunk, ret) != ESP_OK)
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        remaining -= ret;
+    }
+    return form_parser_finish(&parser) == ESP_OK ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+// Parse a float form value, false for anything but a complete finite number
+static bool parse_float(const char *value, float *result)
+{
+    char *end;
+    *result = strtof(value, &end);
+    return end != value && *end == '\0' && isfinite(*result);
+}
+
+/*
+ * GET /api/channels: per-channel signal chain settings and status.
+ * POST /api/channels: channel=3&median_window=5&tau_ms=200 (or the same as flat JSON),
+ * calibration with model=beta&beta=3950&r0=100000 or model=steinhart_hart&a=..&b=..&c=..,
+ * plus r_fixed and offset_c. Fields left out keep their value.
+ */
+static esp_err_t channels_http_handler(httpd_req_t *req)
+{
+    if (req->method == HTTP_POST)
+    {
+        enum
+        {
+            FIELD_CHANNEL,
+            FIELD_MEDIAN_WINDOW,
+            FIELD_TAU_MS,
+            FIELD_MODEL,
+            FIELD_R_FIXED,
+            FIELD_BETA,
+            FIELD_R0,
+            FIELD_A,
+            FIELD_B,
+            FIELD_C,
+            FIELD_OFFSET_C,
+            FIELD_COUNT
+        };
+        static const char *const names[FIELD_COUNT] = {
+            "channel", "median_window", "tau_ms", "model", "r_fixed", "beta", "r0", "a", "b", "c", "offset_c",
+        };
+        char values[FIELD_COUNT][24];
+        form_field_t fields[FIELD_COUNT];
+        for (int k = 0; k < FIELD_COUNT; k++)
+        {
+            values[k][0] = '\0';
+            fields[k] = (form_field_t){.name = names[k], .value = values[k], .value_size = sizeof(values[k])};
+        }
+        esp_err_t err = receive_form(req, fields, FIELD_COUNT, CHANNELS_BODY_MAX_LEN);
+        if (err != ESP_OK || !fields[FIELD_CHANNEL].found)
+        {
+            return send_error_response(req, "400 Bad Request", "Malformed request body");
+        }
+        for (int k = 0; k < FIELD_COUNT; k++)
+        {
+            if (fields[k].truncated)
+            {
+                return send_error_response(req, "400 Bad Request", "Value too long");
+            }
+        }
+
+        uint32_t channel;
+        ntc_filter_params_t params;
+        ntc_calibration_t calibration;
+        if (!parse_uint(values[FIELD_CHANNEL], UINT8_MAX, &channel) || ntc_filter_get_params(channel, &params) != ESP_OK ||
+            ntc_calibration_get(channel, &calibration) != ESP_OK)
+        {
+            return send_error_response(req, "400 Bad Request", "Invalid channel");
+        }
+
+        // Everything is checked before anything is applied, a rejected request changes nothing
+        bool filter_changed = fields[FIELD_MEDIAN_WINDOW].found || fields[FIELD_TAU_MS].found;
+        uint32_t median_window = params.median_window;
+        if (fields[FIELD_MEDIAN_WINDOW].found && !parse_uint(values[FIELD_MEDIAN_WINDOW], UINT8_MAX, &median_window))
+        {
+            return send_error_response(req, "400 Bad Request", "Invalid filter settings");
+        }
+        params.median_window = median_window;
+        if (fields[FIELD_TAU_MS].found && !parse_uint(values[FIELD_TAU_MS], UINT32_MAX, &params.tau_ms))
+        {
+            return send_error_response(req, "400 Bad Request", "Invalid filter settings");
+        }
+        if (filter_changed && !ntc_filter_params_valid(&params))
+        {
+            return send_error_response(req, "400 Bad Request", "Invalid filter settings");
+        }
+
+        bool calibration_changed = false;
+        if (fields[FIELD_MODEL].found)
+        {
+            if (strcmp(values[FIELD_MODEL], "beta") == 0)
+            {
+                calibration.model = NTC_MODEL_BETA;
+            }
+            else if (strcmp(values[FIELD_MODEL], "steinhart_hart") == 0)
+            {
+                calibration.model = NTC_MODEL_STEINHART_HART;
+            }
+            else
+            {
+                return send_error_response(req, "400 Bad Request", "Invalid model");
+            }
+            calibration_changed = true;
+        }
+        float *const coefficients[FIELD_COUNT] = {
+            [FIELD_R_FIXED] = &calibration.r_fixed,
+            [FIELD_BETA] = &calibration.beta,
+            [FIELD_R0] = &calibration.r0,
+            [FIELD_A] = &calibration.a,
+            [FIELD_B] = &calibration.b,
+            [FIELD_C] = &calibration.c,
+            [FIELD_OFFSET_C] = &calibration.offset_c,
+        };
+        for (int k = FIELD_R_FIXED; k < FIELD_COUNT; k++)
+        {
+            if (!fields[k].found)
+            {
+                continue;
+            }
+            if (!parse_float(values[k], coefficients[k]))
+            {
+                return send_error_response(req, "400 Bad Request", "Invalid calibration value");
+            }
+            calibration_changed = true;
+        }
+        if (calibration_changed && !ntc_calibration_valid(&calibration))
+        {
+            return send_error_response(req, "400 Bad Request", "Invalid calibration");
+        }
+
+        // The table build can still reject a calibration, so it goes first; valid filter settings always apply
+        err = calibration_changed ? ntc_calibration_set(channel, &calibration) : ESP_OK;
+        if (err == ESP_ERR_INVALID_STATE)
+        {
+            return send_error_response(req, "503 Service Unavailable", "Still booting");
+        }
+        if (err != ESP_OK)
+        {
+            return send_error_response(req, "400 Bad Request", "Invalid calibration");
+        }
+        if (filter_changed)
+        {
+            ntc_filter_set_params(channel, &params);
+            ESP_LOGI(TAG, "Channel %d filter: median %d, tau %lu ms", channel, params.median_window,
+                     (unsigned long)params.tau_ms);
+        }
+    }
+
+    cJSON *root = cJSON_CreateArray();
+    if (root == NULL)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Failed to create JSON object");
+    }
+    for (uint8_t i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        ntc_filter_params_t params;
+        ntc_filter_get_params(i, &params);
+        cJSON *channel = cJSON_CreateObject();
+        cJSON_AddNumberToObject(channel, "channel", i);
+        cJSON_AddBoolToObject(channel, "enabled", (system_state.sensor_mask & (1 << i)) != 0);
+        cJSON_AddStringToObject(channel, "status", ntc_channel_status_name(ntc_get_channel_status(i)));
+        cJSON_AddNumberToObject(channel, "median_window", params.median_window);
+        cJSON_AddNumberToObject(channel, "tau_ms", params.tau_ms);
+        ntc_calibration_t calibration;
+        ntc_calibration_get(i, &calibration);
+        cJSON *calibration_json = cJSON_AddObjectToObject(channel, "calibration");
+        if (calibration.model == NTC_MODEL_STEINHART_HART)
+        {
+            cJSON_AddStringToObject(calibration_json, "model", "steinhart_hart");
+            cJSON_AddNumberToObject(calibration_json, "a", calibration.a);
+            cJSON_AddNumberToObject(calibration_json, "b", calibration.b);
+            cJSON_AddNumberToObject(calibration_json, "c", calibration.c);
+        }
+        else
+        {
+            cJSON_AddStringToObject(calibration_json, "model", "beta");
+            cJSON_AddNumberToObject(calibration_json, "beta", calibration.beta);
+            cJSON_AddNumberToObject(calibration_json, "r0", calibration.r0);
+        }
+        cJSON_AddNumberToObject(calibration_json, "r_fixed", calibration.r_fixed);
+        cJSON_AddNumberToObject(calibration_json, "offset_c", calibration.offset_c);
+        cJSON_AddItemToArray(root, channel);
+    }
+
+    char *json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json == NULL)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Failed to print JSON object");
+    }
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t err = httpd_resp_sendstr(req, json);
+    free(json);
+    return err;
+}
+
+/*
+ * GET /api/virtual: the virtual channel slots; slot i is history channel SENSOR_MAX_COUNT + i.
+ * POST /api/virtual: index=0&name=delta&expression=t0-t3 (or flat JSON),
+ * an empty expression removes the channel.
+ */
+static esp_err_t virtual_http_handler(httpd_req_t *req)
+{
+    if (req->method == HTTP_POST)
+    {
+        enum
+        {
+            FIELD_INDEX,
+            FIELD_NAME,
+            FIELD_EXPRESSION,
+            FIELD_COUNT
+        };
+        char index[8] = "";
+        char name[VIRTUAL_NAME_MAX_LEN] = "";
+        char expression[VIRTUAL_EXPRESSION_MAX_LEN] = "";
+        form_field_t fields[FIELD_COUNT] = {
+            [FIELD_INDEX] = {.name = "index", .value = index, .value_size = sizeof(index)},
+            [FIELD_NAME] = {.name = "name", .value = name, .value_size = sizeof(name)},
+            [FIELD_EXPRESSION] = {.name = "expression", .value = expression, .value_size = sizeof(expression)},
+        };
+        esp_err_t err = receive_form(req, fields, FIELD_COUNT, CHANNELS_BODY_MAX_LEN);
+        if (err != ESP_OK || !fields[FIELD_INDEX].found || !fields[FIELD_EXPRESSION].found)
+        {
+            return send_error_response(req, "400 Bad Request", "Malformed request body");
+        }
+        for (int k = 0; k < FIELD_COUNT; k++)
+        {
+            if (fields[k].truncated)
+            {
+                return send_error_response(req, "400 Bad Request", "Value too long");
+            }
+        }
+
+        uint32_t slot;
+        if (!parse_uint(index, VIRTUAL_CHANNEL_MAX - 1, &slot))
+        {
+            return send_error_response(req, "400 Bad Request", "Invalid virtual channel index");
+        }
+        const char *error = NULL;
+        if (virtual_channel_set(slot, name, expression, &error) != ESP_OK)
+        {
+            char message[64];
+            snprintf(message, sizeof(message), "Invalid virtual channel: %s", error);
+            return send_error_response(req, "400 Bad Request", message);
+        }
+    }
+
+    cJSON *root = cJSON_CreateArray();
+    if (root == NULL)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Failed to create JSON object");
+    }
+    for (uint8_t i = 0; i < VIRTUAL_CHANNEL_MAX; i++)
+    {
+        virtual_channel_config_t config;
+        virtual_channel_get(i, &config);
+        cJSON *channel = cJSON_CreateObject();
+        cJSON_AddNumberToObject(channel, "index", i);
+        cJSON_AddNumberToObject(channel, "channel", SENSOR_MAX_COUNT + i);
+        cJSON_AddStringToObject(channel, "name", config.name);
+        cJSON_AddStringToObject(channel, "expression", config.expression);
+        if (config.expression[0] != '\0')
+        {
+            cJSON_AddNumberToObject(channel, "temperature", virtual_channel_get_value(i));
+        }
+        cJSON_AddItemToArray(root, channel);
+    }
+
+    char *json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json == NULL)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Failed to print JSON object");
+    }
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t err = httpd_resp_sendstr(req, json);
+    free(json);
+    return err;
+}
+
+/*
+ * GET /api/alarms: the alarm rule of every physical channel and its active alarms.
+ * POST /api/alarms: channel=2&type=high&enabled=1&threshold=85&hysteresis=2&min_duration_ms=5000
+ * (or the same as flat JSON), type is high, low or rate (°C/min). Fields left out keep their value.
+ */
+static esp_err_t alarms_http_handler(httpd_req_t *req)
+{
+    if (req->method == HTTP_POST)
+    {
+        enum
+        {
+            FIELD_CHANNEL,
+            FIELD_TYPE,
+            FIELD_ENABLED,
+            FIELD_THRESHOLD,
+            FIELD_HYSTERESIS,
+            FIELD_MIN_DURATION_MS,
+            FIELD_COUNT
+        };
+        static const char *const names[FIELD_COUNT] = {
+            "channel", "type", "enabled", "threshold", "hysteresis", "min_duration_ms",
+        };
+        char values[FIELD_COUNT][24];
+        form_field_t fields[FIELD_COUNT];
+        for (int k = 0; k < FIELD_COUNT; k++)
+        {
+            values[k][0] = '\0';
+            fields[k] = (form_field_t){.name = names[k], .value = values[k], .value_size = sizeof(values[k])};
+        }
+        esp_err_t err = receive_form(req, fields, FIELD_COUNT, CHANNELS_BODY_MAX_LEN);
+        if (err != ESP_OK || !fields[FIELD_CHANNEL].found || !fields[FIELD_TYPE].found)
+        {
+            return send_error_response(req, "400 Bad Request", "Malformed request body");
+        }
+        for (int k = 0; k < FIELD_COUNT; k++)
+        {
+            if (fields[k].truncated)
+            {
+                return send_error_response(req, "400 Bad Request", "Value too long");
+            }
+        }
+
+        uint32_t channel;
+        alarm_rule_t rule;
+        if (!parse_uint(values[FIELD_CHANNEL], UINT8_MAX, &channel) || alarm_get_rule(channel, &rule) != ESP_OK)
+        {
+            return send_error_response(req, "400 Bad Request", "Invalid channel");
+        }
+        int type = 0;
+        while (type < ALARM_TYPE_COUNT && strcmp(values[FIELD_TYPE], alarm_type_name(type)) != 0)
+        {
+            type++;
+        }
+        if (type == ALARM_TYPE_COUNT)
+        {
+            return send_error_response(req, "400 Bad Request", "Invalid alarm type");
+        }
+
+        alarm_limit_t *limit = &rule.limits[type];
+        if (fields[FIELD_ENABLED].found)
+        {
+            const char *enabled = values[FIELD_ENABLED];
+            if (strcmp(enabled, "1") == 0 || strcmp(enabled, "true") == 0)
+            {
+                limit->enabled = true;
+            }
+            else if (strcmp(enabled, "0") == 0 || strcmp(enabled, "false") == 0)
+            {
+                limit->enabled = false;
+            }
+            else
+            {
+                return send_error_response(req, "400 Bad Request", "Invalid enabled flag");
+            }
+        }
+        if ((fields[FIELD_THRESHOLD].found && !parse_float(values[FIELD_THRESHOLD], &limit->threshold)) ||
+            (fields[FIELD_HYSTERESIS].found && !parse_float(values[FIELD_HYSTERESIS], &limit->hysteresis)) ||
+            (fields[FIELD_MIN_DURATION_MS].found &&
+             !parse_uint(values[FIELD_MIN_DURATION_MS], UINT32_MAX, &limit->min_duration_ms)) ||
+            alarm_set_rule(channel, &rule) != ESP_OK)
+        {
+            return send_error_response(req, "400 Bad Request", "Invalid alarm rule");
+        }
+    }
+
+    cJSON *root = cJSON_CreateArray();
+    if (root == NULL)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Failed to create JSON object");
+    }
+    for (uint8_t i = 0; i < SENSOR_MAX_COUNT; i++)
+    {
+        alarm_rule_t rule;
+        alarm_get_rule(i, &rule);
+        uint8_t active = alarm_get_active(i);
+        cJSON *channel = cJSON_CreateObject();
+        cJSON_AddNumberToObject(channel, "channel", i);
+        cJSON_AddBoolToObject(channel, "enabled", (system_state.sensor_mask & (1 << i)) != 0);
+        for (int type = 0; type < ALARM_TYPE_COUNT; type++)
+        {
+            const alarm_limit_t *limit = &rule.limits[type];
+            cJSON *limit_json = cJSON_AddObjectToObject(channel, alarm_type_name(type));
+            cJSON_AddBoolToObject(limit_json, "enabled", limit->enabled);
+            cJSON_AddNumberToObject(limit_json, "threshold", limit->threshold);
+            cJSON_AddNumberToObject(limit_json, "hysteresis", limit->hysteresis);
+            cJSON_AddNumberToObject(limit_json, "min_duration_ms", limit->min_duration_ms);
+            cJSON_AddBoolToObject(limit_json, "active", (active & (1 << type)) != 0);
+        }
+        cJSON_AddItemToArray(root, channel);
+    }
+
+    char *json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json == NULL)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Failed to print JSON object");
+    }
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t err = httpd_resp_sendstr(req, json);
+    free(json);
+    return err;
+}
+
+static const char *const capture_trigger_names[] = {"manual", "above", "below", "slope"};
+static const char *const capture_state_names[] = {"recording", "armed", "triggered", "frozen"};
+
+// GET /api/capture?download=csv|bin: the frozen capture, on a worker task
+static esp_err_t capture_download(httpd_req_t *req, bool binary)
+{
+    if (!http_workers_is_worker_task())
+    {
+        return http_workers_submit(req, http_metered_handler);
+    }
+    capture_status_t status;
+    capture_get_status(&status);
+    if (status.state != CAPTURE_FROZEN)
+    {
+        return send_error_response(req, "409 Conflict", "No capture to download");
+    }
+    chunk_writer_t *writer = malloc(sizeof(chunk_writer_t));
+    if (writer == NULL)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Out of memory");
+    }
+    char disposition[64];
+    snprintf(disposition, sizeof(disposition), "attachment; filename=\"capture-%lu.%s\"",
+             (unsigned long)status.captures, binary ? "bin" : "csv");
+    httpd_resp_set_type(req, binary ? "application/octet-stream" : "text/csv");
+    httpd_resp_set_hdr(req, "Content-Disposition", disposition);
+
+    chunk_writer_init(writer, req);
+    esp_err_t err = capture_write(writer, binary);
+    if (err == ESP_OK)
+    {
+        err = chunk_writer_finish(writer);
+    }
+    else
+    {
+        // Re-armed meanwhile
+        err = send_error_response(req, "409 Conflict", "No capture to download");
+    }
+    free(writer);
+    return err;
+}
+
+/*
+ * GET /api/capture: capture state; ?download=csv or ?download=bin streams the frozen capture.
+ * POST /api/capture: action=arm&type=above|below|slope|manual&channel=2&level=80&pre_ms=200&post_ms=500,
+ * action=trigger fires now, action=disarm drops trigger and capture (or the same as flat JSON).
+ */
+static esp_err_t capture_http_handler(httpd_req_t *req)
+{
+    if (req->method == HTTP_GET)
+    {
+        char *query_str = NULL;
+        if (read_query_string(req, &query_str) != ESP_OK)
+        {
+            return send_error_response(req, "500 Internal Server Error", "Failed to read query");
+        }
+        char param[8];
+        bool download = query_str != NULL && httpd_query_key_value(query_str, "download", param, sizeof(param)) == ESP_OK;
+        free(query_str);
+        if (download)
+        {
+            return capture_download(req, strcmp(param, "bin") == 0);
+        }
+    }
+    else if (req->method == HTTP_POST)
+    {
+        enum
+        {
+            FIELD_ACTION,
+            FIELD_TYPE,
+            FIELD_CHANNEL,
+            FIELD_LEVEL,
+            FIELD_PRE_MS,
+            FIELD_POST_MS,
+            FIELD_COUNT
+        };
+        static const char *const names[FIELD_COUNT] = {"action", "type", "channel", "level", "pre_ms", "post_ms"};
+        char values[FIELD_COUNT][16];
+        form_field_t fields[FIELD_COUNT];
+        for (int k = 0; k < FIELD_COUNT; k++)
+        {
+            values[k][0] = '\0';
+            fields[k] = (form_field_t){.name = names[k], .value = values[k], .value_size = sizeof(values[k])};
+        }
+        esp_err_t err = receive_form(req, fields, FIELD_COUNT, CHANNELS_BODY_MAX_LEN);
+        if (err != ESP_OK || !fields[FIELD_ACTION].found)
+        {
+            return send_error_response(req, "400 Bad Request", "Malformed request body");
+        }
+
+        const char *action = values[FIELD_ACTION];
+        if (strcmp(action, "arm") == 0)
+        {
+            capture_trigger_t trigger = {
+                .type = CAPTURE_TRIGGER_MANUAL,
+            };
+            uint32_t channel = 0;
+            if ((fields[FIELD_CHANNEL].found && !parse_uint(values[FIELD_CHANNEL], UINT8_MAX, &channel)) ||
+                (fields[FIELD_PRE_MS].found && !parse_uint(values[FIELD_PRE_MS], UINT32_MAX, &trigger.pre_ms)) ||
+                (fields[FIELD_POST_MS].found && !parse_uint(values[FIELD_POST_MS], UINT32_MAX, &trigger.post_ms)))
+            {
+                return send_error_response(req, "400 Bad Request", "Invalid trigger");
+            }
+            trigger.channel = channel;
+            bool type_found = !fields[FIELD_TYPE].found;
+            for (int type = 0; type < sizeof(capture_trigger_names) / sizeof(capture_trigger_names[0]); type++)
+            {
+                if (strcmp(values[FIELD_TYPE], capture_trigger_names[type]) == 0)
+                {
+                    trigger.type = type;
+                    type_found = true;
+                }
+            }
+            if (!type_found)
+            {
+                return send_error_response(req, "400 Bad Request", "Invalid trigger type");
+            }
+            if (fields[FIELD_LEVEL].found && !parse_float(values[FIELD_LEVEL], &trigger.level))
+            {
+                return send_error_response(req, "400 Bad Request", "Invalid level");
+            }
+            err = capture_arm(&trigger);
+        }
+        else if (strcmp(action, "trigger") == 0)
+        {
+            err = capture_trigger_now();
+        }
+        else if (strcmp(action, "disarm") == 0)
+        {
+            err = capture_disarm();
+        }
+        else
+        {
+            return send_error_response(req, "400 Bad Request", "Invalid action");
+        }
+        if (err == ESP_ERR_INVALID_STATE)
+        {
+            return send_error_response(req, "409 Conflict", "Capture is being downloaded");
+        }
+        if (err != ESP_OK)
+        {
+            return send_error_response(req, "400 Bad Request", "Invalid trigger");
+        }
+    }
+
+    capture_status_t status;
+    capture_get_status(&status);
+    cJSON *root = cJSON_CreateObject();
+    if (root == NULL)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Failed to create JSON object");
+    }
+    cJSON_AddStringToObject(root, "state", capture_state_names[status.state]);
+    cJSON *trigger = cJSON_AddObjectToObject(root, "trigger");
+    cJSON_AddStringToObject(trigger, "type", capture_trigger_names[status.trigger.type]);
+    cJSON_AddNumberToObject(trigger, "channel", status.trigger.channel);
+    cJSON_AddNumberToObject(trigger, "level", status.trigger.level);
+    cJSON_AddNumberToObject(trigger, "pre_ms", status.trigger.pre_ms);
+    cJSON_AddNumberToObject(trigger, "post_ms", status.trigger.post_ms);
+    cJSON_AddNumberToObject(root, "frame_capacity", status.frame_capacity);
+    cJSON_AddNumberToObject(root, "rate_hz", status.rate_hz);
+    cJSON_AddNumberToObject(root, "captures", status.captures);
+    if (status.state == CAPTURE_FROZEN)
+    {
+        cJSON_AddNumberToObject(root, "frames", status.frames);
+        cJSON_AddNumberToObject(root, "conversions", status.conversions);
+        cJSON_AddNumberToObject(root, "trigger_us", status.trigger_us);
+        cJSON_AddNumberToObject(root, "pre_ms", (status.trigger_us - status.first_us) / 1000);
+        cJSON_AddNumberToObject(root, "post_ms", (status.last_us - status.trigger_us) / 1000);
+    }
+
+    char *json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (json == NULL)
+    {
+        return send_error_response(req, "500 Internal Server Error", "Failed to print JSON object");
+    }
+    httpd_resp_set_type(req, "application/json");
+    esp_err_t err = httpd_resp_sendstr(req, json);
+    free(json);
+    return err;
+}
+
+static esp_err_t send_sync_response(httpd_req_t *req, const char *message) {
+    httpd_ws_frame_t ws_pkt;
+    memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+
+    ws_pkt.payload = (uint8_t *)message;
+    ws_pkt.len = strlen(message);
+    ws_pkt.type = HTTPD_WS_TYPE_TEXT;
+
+    return httpd_ws_send_frame(req, &ws_pkt);
+}
+
+static esp_err_t websocket_http_handler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "WebSocket Handler Prio: %d, Core: %d", uxTaskPriorityGet(NULL), xPortGetCoreID());
+    dump_request(req);
+
+    if (req->method == HTTP_GET) {
+        ESP_LOGI(TAG, "Handshake done, the new connection was opened");
+        return ESP_OK;
+    }
+
+    // Buffer to store incoming WebSocket message
+    char buffer[1024];
+    int buffer_len = sizeof(buffer);
+
+    // Read incoming WebSocket message
+    httpd_ws_frame_t ws_frame;
+    memset(&ws_frame, 0, sizeof(httpd_ws_frame_t));
+    ws_frame.type = HTTPD_WS_TYPE_TEXT;
+    ws_frame.payload = (uint8_t *)buffer;
+    ws_frame.len = buffer_len;
+
+    esp_err_t ret = httpd_ws_recv_frame(req, &ws_frame, buffer_len);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error receiving WebSocket message: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    // Process the received message
+    ESP_LOGI(TAG, "Received message: %s", buffer);
+
+    // Send a synchronous response
+    const char *response = "Message received";
+    ret = send_sync_response(req, response);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Error sending WebSocket response: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    return ESP_OK;
+}
+
+void start_http_server(void)
+{
+    ESP_LOGI(TAG, "Prio: %d, Core: %d", uxTaskPriorityGet(NULL), xPortGetCoreID());
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+
+    /* Use the URI wildcard matching function in order to
+     * allow the same handler to respond to multiple different
+     * target URIs which match the wildcard scheme */
+    config.uri_match_fn = httpd_uri_match_wildcard;
+    config.max_uri_handlers = HTTP_MAX_URI_HANDLERS;
+
+    histogram_register(&request_histogram);
+    http_workers_start();
 
     ESP_LOGI(TAG, "Starting HTTP server...");
     if (httpd_start(&server, &config) == ESP_OK)
@@ -352,6 +1839,15 @@ void start_http_server(void)
         //httpd_register_uri_handler(server, &websocket_uri);
         httpd_register_uri_handler(server, &settings_uri);
         httpd_register_uri_handler(server, &config_uri);
+        httpd_register_uri_handler(server, &diag_uri);
+        httpd_register_uri_handler(server, &readings_uri);
+        httpd_register_uri_handler(server, &history_uri);
+        httpd_register_uri_handler(server, &export_uri);
+        httpd_register_uri_handler(server, &channels_uri);
+        httpd_register_uri_handler(server, &virtual_uri);
+        httpd_register_uri_handler(server, &alarms_uri);
+        httpd_register_uri_handler(server, &capture_uri);
+        httpd_register_uri_handler(server, &metrics_uri);
         httpd_register_uri_handler(server, &root_uri);
         ESP_LOGI(TAG, "HTTP server started successfully.");
     }
@@ -0,0 +1,115 @@
+#include "settings_manager.h"
+#include <string.h>
+#include "esp_log.h"
+#include "ntc_adc.h"
+#include "wifi_manager.h"
+#include "lcd.h"
+#include "config_store.h"
+
+static const char *TAG = "settings";
+
+typedef struct
+{
+    const char *name;
+    uint32_t fields; // settings_field_t owned by the subsystem
+    esp_err_t (*apply)(uint32_t changed_fields);
+} settings_owner_t;
+
+static const settings_owner_t settings_owners[] = {
+    {"adc", SETTINGS_FIELD_SENSOR_MASK, ntc_adc_apply_settings},
+    {"wifi", SETTINGS_FIELDS_WIFI, wifi_apply_settings},
+    {"lcd", SETTINGS_FIELDS_LCD, lcd_apply_settings},
+};
+
+uint32_t settings_diff(const system_state_t *requested)
+{
+    uint32_t changed = 0;
+    if (strncmp(requested->ap_ssid, system_state.ap_ssid, sizeof(system_state.ap_ssid)) != 0)
+    {
+        changed |= SETTINGS_FIELD_AP_SSID;
+    }
+    if (strncmp(requested->ap_pass, system_state.ap_pass, sizeof(system_state.ap_pass)) != 0)
+    {
+        changed |= SETTINGS_FIELD_AP_PASS;
+    }
+    if (strncmp(requested->sta_ssid, system_state.sta_ssid, sizeof(system_state.sta_ssid)) != 0)
+    {
+        changed |= SETTINGS_FIELD_STA_SSID;
+    }
+    if (strncmp(requested->sta_pass, system_state.sta_pass, sizeof(system_state.sta_pass)) != 0)
+    {
+        changed |= SETTINGS_FIELD_STA_PASS;
+    }
+    if (requested->sensor_mask != system_state.sensor_mask)
+    {
+        changed |= SETTINGS_FIELD_SENSOR_MASK;
+    }
+    if (requested->wifi_startup_mode != system_state.wifi_startup_mode)
+    {
+        changed |= SETTINGS_FIELD_WIFI_STARTUP_MODE;
+    }
+    return changed;
+}
+
+esp_err_t settings_apply(const system_state_t *requested, uint32_t *changed_fields, bool *restart_required)
+{
+    *restart_required = false;
+    if (changed_fields != NULL)
+    {
+        *changed_fields = 0;
+    }
+
+    if (requested->sensor_mask == 0)
+    {
+        ESP_LOGE(TAG, "At least one sensor has to be enabled");
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t ap_pass_len = strnlen(requested->ap_pass, sizeof(requested->ap_pass));
+    if (ap_pass_len > 0 && ap_pass_len < WIFI_AP_PASS_MIN_LEN)
+    {
+        // esp_wifi_set_config() would reject it, leaving the AP on the old password
+        ESP_LOGE(TAG, "AP password has to be empty or at least %d characters", WIFI_AP_PASS_MIN_LEN);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint32_t changed = settings_diff(requested);
+    if (changed_fields != NULL)
+    {
+        *changed_fields = changed;
+    }
+    if (changed == 0)
+    {
+        ESP_LOGI(TAG, "Settings unchanged");
+        return ESP_OK;
+    }
+    ESP_LOGI(TAG, "Changed settings: 0x%02lX", (unsigned long)changed);
+
+    strlcpy(system_state.ap_ssid, requested->ap_ssid, sizeof(system_state.ap_ssid));
+    strlcpy(system_state.ap_pass, requested->ap_pass, sizeof(system_state.ap_pass));
+    strlcpy(system_state.sta_ssid, requested->sta_ssid, sizeof(system_state.sta_ssid));
+    strlcpy(system_state.sta_pass, requested->sta_pass, sizeof(system_state.sta_pass));
+    system_state.sensor_mask = requested->sensor_mask;
+    system_state.wifi_startup_mode = requested->wifi_startup_mode;
+
+    // Persisted by the config store's background writer
+    config_store_mark_dirty(changed);
+
+    esp_err_t err;
+    for (size_t i = 0; i < sizeof(settings_owners) / sizeof(settings_owners[0]); i++)
+    {
+        const settings_owner_t *owner = &settings_owners[i];
+        if ((changed & owner->fields) == 0)
+        {
+            continue;
+        }
+        err = owner->apply(changed & owner->fields);
+        if (err != ESP_OK)
+        {
+            // The stored config takes effect on the next boot
+            ESP_LOGE(TAG, "Subsystem %s failed to apply settings: %s", owner->name, esp_err_to_name(err));
+            *restart_required = true;
+        }
+    }
+
+    return ESP_OK;
+}
@@ -0,0 +1,45 @@
+#ifndef SETTINGS_MANAGER_H
+#define SETTINGS_MANAGER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "state_manager.h"
+
+// Persistent settings fields, used as a bitmask of changes
+typedef enum {
+    SETTINGS_FIELD_AP_SSID           = 1 << 0,
+    SETTINGS_FIELD_AP_PASS           = 1 << 1,
+    SETTINGS_FIELD_STA_SSID          = 1 << 2,
+    SETTINGS_FIELD_STA_PASS          = 1 << 3,
+    SETTINGS_FIELD_SENSOR_MASK       = 1 << 4,
+    SETTINGS_FIELD_WIFI_STARTUP_MODE = 1 << 5,
+    SETTINGS_FIELD_CALIBRATION       = 1 << 6, // set through ntc_calibration_set()
+    SETTINGS_FIELD_VIRTUAL_CHANNELS  = 1 << 7, // set through virtual_channel_set()
+    SETTINGS_FIELD_ALARMS            = 1 << 8, // set through alarm_set_rule()
+} settings_field_t;
+
+#define SETTINGS_FIELDS_WIFI (SETTINGS_FIELD_AP_SSID | SETTINGS_FIELD_AP_PASS | SETTINGS_FIELD_STA_SSID | SETTINGS_FIELD_STA_PASS)
+#define SETTINGS_FIELDS_LCD  (SETTINGS_FIELD_AP_SSID | SETTINGS_FIELD_STA_SSID | SETTINGS_FIELD_SENSOR_MASK | SETTINGS_FIELD_WIFI_STARTUP_MODE)
+
+/**
+ * @brief Compare the persistent settings of `requested` with the running system_state.
+ * @return Bitmask of settings_field_t that differ.
+ */
+uint32_t settings_diff(const system_state_t *requested);
+
+/**
+ * @brief Apply new settings to the running system.
+ *
+ * Changed fields are copied into system_state, stored, and handed only to the
+ * subsystems that own them. When a subsystem cannot apply its change at runtime
+ * the stored config is picked up by a restart instead.
+ * @param requested Full settings; only the persistent fields are used.
+ * @param changed_fields Optional, receives the bitmask of changed fields.
+ * @param restart_required Set to true when the caller has to restart the device.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for invalid values (no sensor enabled,
+ *         an AP password shorter than WIFI_AP_PASS_MIN_LEN).
+ */
+esp_err_t settings_apply(const system_state_t *requested, uint32_t *changed_fields, bool *restart_required);
+
+#endif // SETTINGS_MANAGER_H
@@ -1,9 +1,13 @@
 #include "state_manager.h"
 #include "esp_log.h"
 #include "cJSON.h"
+#include "config_store.h"
+#include "wifi_manager.h"
+#include "histogram.h"
 
 void log_system_state(void);
 void fatfs_test(void);
+static void fatfs_unmount_now(void);
 
 const char *TAG = "state_manager";
 
@@ -25,6 +29,18 @@ static esp_event_loop_handle_t custom_event_loop = NULL;
 // Define the event base for custom events
 ESP_EVENT_DEFINE_BASE(CUSTOM_EVENTS);
 
+// Subscribed handlers, called through events_dispatch() to time them
+typedef struct
+{
+    esp_event_handler_t handler;
+    void *arg;
+} event_subscription_t;
+static event_subscription_t event_subscriptions[EVENT_SUBSCRIPTION_MAX];
+static uint8_t event_subscription_count = 0;
+static portMUX_TYPE event_subscription_lock = portMUX_INITIALIZER_UNLOCKED;
+static histogram_t dispatch_histogram = HISTOGRAM_INITIALIZER("event_dispatch", HISTOGRAM_UNIT_CYCLES);
+static histogram_t send_file_histogram = HISTOGRAM_INITIALIZER("send_file", HISTOGRAM_UNIT_US);
+
 // Handle of the wear levelling library instance
 static wl_handle_t s_wl_handle = WL_INVALID_HANDLE;
 
@@ -35,6 +51,8 @@ static SemaphoreHandle_t fatfs_mutex = NULL;
 const char *base_path = "/spiflash";
 
 static const char *config_file_path = "/spiflash/config.json";
+// The FAT is only formatted after the legacy config.json had its chance to be imported
+static bool fatfs_format_allowed = false;
 
 #define CHECK_FILE_EXTENSION(filename, ext) (strcasecmp(&filename[strlen(filename) - strlen(ext)], ext) == 0)
 
@@ -61,6 +79,7 @@ static esp_err_t send_content_type_from_file(httpd_req_t *req, const char *filep
 void system_initialize(void)
 {
     memset(&system_state, 0, sizeof(system_state_t)); // Initialize system state to zero
+    histogram_register(&send_file_histogram);
 
     fatfs_mutex = xSemaphoreCreateMutex();
     if (fatfs_mutex == NULL)
@@ -69,8 +88,6 @@ void system_initialize(void)
         return;
     }
 
-    fatfs_test();
-
     /*system_state_t *state = calloc(1, sizeof(system_state_t));
     if (state == NULL)
     {
@@ -79,25 +96,44 @@ void system_initialize(void)
     }
     memcpy(state, &system_state, sizeof(system_state_t));*/
 
-    esp_err_t err = read_running_config_from_fatfs();
+    // Defaults first, so fields missing from an older record keep sane values
+    load_default_running_config();
+    esp_err_t err = config_store_init();
+    if (err == ESP_OK)
+    {
+        err = config_store_load();
+    }
     if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to read running config from FATFS: %s", esp_err_to_name(err));
-        load_default_running_config();
-        ESP_ERROR_CHECK(store_running_config_in_fatfs());
+        ESP_LOGW(TAG, "No valid config record (%s), importing legacy JSON config", esp_err_to_name(err));
+        err = read_running_config_from_fatfs();
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to read running config from FATFS: %s", esp_err_to_name(err));
+            load_default_running_config();
+        }
+        ESP_ERROR_CHECK_WITHOUT_ABORT(config_store_save());
+    }
+    // Older firmware and the JSON import did not check the length, esp_wifi_set_config() rejects it
+    size_t ap_pass_len = strnlen(system_state.ap_pass, sizeof(system_state.ap_pass));
+    if (ap_pass_len > 0 && ap_pass_len < WIFI_AP_PASS_MIN_LEN)
+    {
+        ESP_LOGW(TAG, "Stored AP password is shorter than %d characters, using the default", WIFI_AP_PASS_MIN_LEN);
+        snprintf(system_state.ap_pass, sizeof(system_state.ap_pass), CONFIG_DEFAULT_AP_PASSWORD);
+        config_store_mark_dirty(SETTINGS_FIELD_AP_PASS);
     }
+    fatfs_format_allowed = true;
+    log_system_state();
 
-    // Initialize NVS and read config
+    // NVS only backs the WiFi driver, the config lives in the config partition
     nvs_initialize();
 }
 
 void system_shutdown(void)
 {
+    ESP_ERROR_CHECK_WITHOUT_ABORT(config_store_flush());
 
-    if (s_wl_handle != WL_INVALID_HANDLE)
-    {
-        unmount_fatfs();
-    }
+    fatfs_unmount_now();
 
     if (fatfs_mutex != NULL)
     {
@@ -161,78 +197,26 @@ esp_err_t load_default_running_config()
     system_state.wifi_startup_mode = WIFI_STARTUP_MODE_AP;
 #endif
 
-    return ESP_OK;
-}
-
-esp_err_t store_running_config_in_fatfs()
-{
-    cJSON *json = cJSON_CreateObject();
-    if (json == NULL)
-    {
-        ESP_LOGE(TAG, "Failed to create JSON object");
-        return ESP_FAIL;
-    }
-    cJSON_AddStringToObject(json, "ap_ssid", system_state.ap_ssid);
-    cJSON_AddStringToObject(json, "ap_pass", system_state.ap_pass);
-    cJSON_AddStringToObject(json, "sta_ssid", system_state.sta_ssid);
-    cJSON_AddStringToObject(json, "sta_pass", system_state.sta_pass);
-    cJSON_AddNumberToObject(json, "sensor_mask", system_state.sensor_mask);
-    cJSON_AddNumberToObject(json, "wifi_startup_mode", system_state.wifi_startup_mode);
-    char *json_string = cJSON_PrintUnformatted(json);
-    if (json_string == NULL)
-    {
-        ESP_LOGE(TAG, "Failed to print JSON object");
-        cJSON_Delete(json);
-        return ESP_FAIL;
-    }
-    ESP_LOGI(TAG, "JSON string: %s", json_string);
-
-    esp_err_t err = mount_fatfs();
-    if (err != ESP_OK)
+    for (int i = 0; i < SENSOR_MAX_COUNT; i++)
     {
-        ESP_LOGE(TAG, "Failed to mount FATFS: %s", esp_err_to_name(err));
-        ESP_ERROR_CHECK_WITHOUT_ABORT(unmount_fatfs());
-        cJSON_Delete(json);
-        free(json_string);
-        return err;
+        ntc_calibration_default(&system_state.calibration[i]);
+        alarm_rule_default(&system_state.alarm_rules[i]);
     }
-    ESP_LOGI(TAG, "FATFS mounted successfully");
 
-    int fd = open(config_file_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd < 0)
-    {
-        ESP_LOGE(TAG, "Failed to open config file: %s", esp_err_to_name(errno));
-        ESP_ERROR_CHECK_WITHOUT_ABORT(unmount_fatfs());
-        cJSON_Delete(json);
-        free(json_string);
-        return ESP_FAIL;
-    }
-    ESP_LOGI(TAG, "Config file opened successfully");
+    return ESP_OK;
+}
 
-    ssize_t bytes_written = write(fd, json_string, strlen(json_string));
-    if (bytes_written < 0)
+static void copy_json_string(const cJSON *json, const char *name, char *value, size_t value_size)
+{
+    const cJSON *item = cJSON_GetObjectItem(json, name);
+    if (cJSON_IsString(item) && item->valuestring != NULL)
     {
-        ESP_LOGE(TAG, "Failed to write to config file: %s", esp_err_to_name(errno));
-        close(fd);
-        ESP_ERROR_CHECK_WITHOUT_ABORT(unmount_fatfs());
-        cJSON_Delete(json);
-        free(json_string);
-        return ESP_FAIL;
+        strlcpy(value, item->valuestring, value_size);
     }
-    ESP_LOGI(TAG, "Config file written successfully");
-
-    close(fd);
-    free(json_string);
-    cJSON_Delete(json);
-    err = unmount_fatfs();
-    if (err != ESP_OK)
+    else
     {
-        ESP_LOGE(TAG, "Failed to unmount FATFS: %s", esp_err_to_name(err));
-        return err;
+        ESP_LOGW(TAG, "Config field %s missing", name);
     }
-    ESP_LOGI(TAG, "FATFS unmounted successfully");
-    ESP_LOGI(TAG, "Stored running config to FATFS successfully");
-    return ESP_OK;
 }
 
 esp_err_t read_running_config_from_fatfs()
@@ -241,7 +225,6 @@ esp_err_t read_running_config_from_fatfs()
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to mount FATFS: %s", esp_err_to_name(err));
-        ESP_ERROR_CHECK_WITHOUT_ABORT(unmount_fatfs());
         return err;
     }
     ESP_LOGI(TAG, "FATFS mounted successfully");
@@ -286,26 +269,24 @@ esp_err_t read_running_config_from_fatfs()
     }
     ESP_LOGI(TAG, "JSON parsed successfully");
 
-    char *ap_ssid = cJSON_GetObjectItem(json, "ap_ssid")->valuestring;
-    char *ap_pass = cJSON_GetObjectItem(json, "ap_pass")->valuestring;
-    char *sta_ssid = cJSON_GetObjectItem(json, "sta_ssid")->valuestring;
-    char *sta_pass = cJSON_GetObjectItem(json, "sta_pass")->valuestring;
-    int sensor_mask = cJSON_GetObjectItem(json, "sensor_mask")->valueint;
-    int wifi_startup_mode = cJSON_GetObjectItem(json, "wifi_startup_mode")->valueint;
-    ESP_LOGI(TAG, "Parsed JSON values: ap_ssid=%s, ap_pass=%s, sta_ssid=%s, sta_pass=%s, sensor_mask=%d, wifi_startup_mode=%d",
-             ap_ssid, ap_pass, sta_ssid, sta_pass, sensor_mask, wifi_startup_mode);
-
-    strlcpy(system_state.ap_ssid, ap_ssid, sizeof(system_state.ap_ssid));
-    strlcpy(system_state.ap_pass, ap_pass, sizeof(system_state.ap_pass));
-    strlcpy(system_state.sta_ssid, sta_ssid, sizeof(system_state.sta_ssid));
-    strlcpy(system_state.sta_pass, sta_pass, sizeof(system_state.sta_pass));
-    system_state.sensor_mask = sensor_mask;
-    system_state.wifi_startup_mode = wifi_startup_mode;
-    ESP_LOGI(TAG, "Stored running config from FATFS successfully");
+    // Missing or mistyped fields keep their current (default) values
+    copy_json_string(json, "ap_ssid", system_state.ap_ssid, sizeof(system_state.ap_ssid));
+    copy_json_string(json, "ap_pass", system_state.ap_pass, sizeof(system_state.ap_pass));
+    copy_json_string(json, "sta_ssid", system_state.sta_ssid, sizeof(system_state.sta_ssid));
+    copy_json_string(json, "sta_pass", system_state.sta_pass, sizeof(system_state.sta_pass));
+    cJSON *item = cJSON_GetObjectItem(json, "sensor_mask");
+    if (cJSON_IsNumber(item))
+    {
+        system_state.sensor_mask = item->valueint;
+    }
+    item = cJSON_GetObjectItem(json, "wifi_startup_mode");
+    if (cJSON_IsNumber(item))
+    {
+        system_state.wifi_startup_mode = item->valueint;
+    }
+    ESP_LOGI(TAG, "Imported running config from FATFS successfully");
     cJSON_Delete(json);
 
-    log_system_state();
-
     return ESP_OK;
 }
 
@@ -327,6 +308,8 @@ void events_init(void)
 {
     ESP_LOGI(TAG, "init Prio: %d, Core: %d", uxTaskPriorityGet(NULL), xPortGetCoreID());
 
+    histogram_register(&dispatch_histogram);
+
     esp_event_loop_args_t loop_args = {
         .queue_size = EVENT_LOOP_QUEUE_SIZE,
         .task_name = "custom_evt_loop",
@@ -366,6 +349,13 @@ void events_post(int32_t event_id, const void *event_data, size_t event_data_siz
     }
 }
 
+static void events_dispatch(void *handler_arg, esp_event_base_t base, int32_t id, void *event_data)
+{
+    const event_subscription_t *subscription = handler_arg;
+    HISTOGRAM_TIME_SCOPE(&dispatch_histogram);
+    subscription->handler(subscription->arg, base, id, event_data);
+}
+
 void events_subscribe(int32_t event_id, esp_event_handler_t event_handler, void *event_handler_arg)
 {
     if (custom_event_loop == NULL)
@@ -374,8 +364,29 @@ void events_subscribe(int32_t event_id, esp_event_handler_t event_handler, void
         return;
     }
 
-    esp_err_t err = esp_event_handler_instance_register_with(custom_event_loop, CUSTOM_EVENTS, event_id,
-                                                             event_handler, event_handler_arg, NULL);
+    // Subscribers register from several boot steps at once
+    event_subscription_t *subscription = NULL;
+    taskENTER_CRITICAL(&event_subscription_lock);
+    if (event_subscription_count < EVENT_SUBSCRIPTION_MAX)
+    {
+        subscription = &event_subscriptions[event_subscription_count++];
+        subscription->handler = event_handler;
+        subscription->arg = event_handler_arg;
+    }
+    taskEXIT_CRITICAL(&event_subscription_lock);
+
+    esp_err_t err;
+    if (subscription != NULL)
+    {
+        err = esp_event_handler_instance_register_with(custom_event_loop, CUSTOM_EVENTS, event_id,
+                                                       events_dispatch, subscription, NULL);
+    }
+    else
+    {
+        // Out of slots: still delivered, just not timed
+        err = esp_event_handler_instance_register_with(custom_event_loop, CUSTOM_EVENTS, event_id,
+                                                       event_handler, event_handler_arg, NULL);
+    }
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to subscribe to event: %s", esp_err_to_name(err));
@@ -401,7 +412,6 @@ esp_err_t file_exists_in_fatfs(const char *file_path)
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to mount FATFS: %s", esp_err_to_name(err));
-        ESP_ERROR_CHECK_WITHOUT_ABORT(unmount_fatfs());
         return ESP_FAIL;
     }
     ESP_LOGI(TAG, "FATFS mounted successfully");
@@ -421,6 +431,7 @@ esp_err_t file_exists_in_fatfs(const char *file_path)
 
 esp_err_t send_file_from_fatfs(httpd_req_t *req, const char *file_path)
 {
+    HISTOGRAM_TIME_SCOPE(&send_file_histogram);
     ESP_LOGI(TAG, "Serving file: %s", file_path);
 
     char filename[256];
@@ -438,7 +449,6 @@ esp_err_t send_file_from_fatfs(httpd_req_t *req, const char *file_path)
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to mount FATFS: %s", esp_err_to_name(err));
-        ESP_ERROR_CHECK_WITHOUT_ABORT(unmount_fatfs());
         return err;
     }
     ESP_LOGI(TAG, "FATFS mounted successfully");
@@ -508,7 +518,6 @@ void list_directory(const char *path)
     if (dir == NULL)
     {
         ESP_LOGE(TAG, "Failed to open directory: %s", esp_err_to_name(errno));
-        ESP_ERROR_CHECK_WITHOUT_ABORT(unmount_fatfs());
         return;
     }
     struct dirent *entry;
@@ -549,27 +558,47 @@ void fatfs_test(void)
 }
 
 static TimerHandle_t unmount_timer = NULL;
+// Callers between mount_fatfs() and unmount_fatfs(), under fatfs_mutex
+static uint32_t fatfs_users = 0;
 
-static void unmount_timer_callback(TimerHandle_t xTimer)
+// Unmount unless someone is using the filesystem
+static void fatfs_unmount_now(void)
 {
-    ESP_LOGI(TAG, "Unmount timer expired, unmounting FATFS");
-    if (s_wl_handle != WL_INVALID_HANDLE)
+    if (fatfs_mutex == NULL || xSemaphoreTake(fatfs_mutex, 0) != pdTRUE)
+    {
+        // A mount or unmount is in progress, an unmount restarts the timer itself
+        return;
+    }
+    if (fatfs_users == 0 && s_wl_handle != WL_INVALID_HANDLE)
     {
         esp_err_t err = esp_vfs_fat_spiflash_unmount_rw_wl(base_path, s_wl_handle);
         s_wl_handle = WL_INVALID_HANDLE;
         if (err != ESP_OK)
         {
-            ESP_LOGE(TAG, "Failed to unmount FATFS in timer callback (%s)", esp_err_to_name(err));
+            ESP_LOGE(TAG, "Failed to unmount FATFS (%s)", esp_err_to_name(err));
         }
         else
         {
-            ESP_LOGI(TAG, "FATFS unmounted successfully in timer callback");
+            ESP_LOGI(TAG, "FATFS unmounted successfully");
         }
     }
+    xSemaphoreGive(fatfs_mutex);
 }
 
+static void unmount_timer_callback(TimerHandle_t xTimer)
+{
+    ESP_LOGI(TAG, "Unmount timer expired, unmounting FATFS");
+    fatfs_unmount_now();
+}
+
+// Mounts on first use; every successful call needs a matching unmount_fatfs()
 esp_err_t mount_fatfs(void)
 {
+    if (fatfs_mutex == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(fatfs_mutex, portMAX_DELAY);
     if (s_wl_handle != WL_INVALID_HANDLE)
     {
         ESP_LOGI(TAG, "FATFS already mounted, disabling unmount timer");
@@ -577,51 +606,73 @@ esp_err_t mount_fatfs(void)
         {
             xTimerStop(unmount_timer, 0);
         }
+        fatfs_users++;
+        xSemaphoreGive(fatfs_mutex);
         return ESP_OK;
     }
 
     ESP_LOGI(TAG, "Mounting FAT filesystem");
     const esp_vfs_fat_mount_config_t mount_config = {
         .max_files = 4,
-        .format_if_mount_failed = false,
+        .format_if_mount_failed = fatfs_format_allowed, // writable data only, see asset_store.c for the frontend
         .allocation_unit_size = CONFIG_WL_SECTOR_SIZE,
         .use_one_fat = false,
     };
     esp_err_t ret = esp_vfs_fat_spiflash_mount_rw_wl(base_path, "storage", &mount_config, &s_wl_handle);
     if (ret != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to mount FATFS (%s)", esp_err_to_name(ret));
+        ESP_LOGE(TAG, "Failed to mount FATFS (%s)%s", esp_err_to_name(ret),
+                 fatfs_format_allowed ? "" : ", left unformatted until the config is imported");
+        s_wl_handle = WL_INVALID_HANDLE;
+        xSemaphoreGive(fatfs_mutex);
         return ret;
     }
+    fatfs_users++;
+    xSemaphoreGive(fatfs_mutex);
 
     ESP_LOGI(TAG, "FATFS mounted successfully at %s", base_path);
     return ESP_OK;
 }
 
+// Releases a mount_fatfs(); the last user unmounts after a delay, in case the next one follows
 esp_err_t unmount_fatfs(void)
 {
-    if (s_wl_handle == WL_INVALID_HANDLE)
+    if (fatfs_mutex == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(fatfs_mutex, portMAX_DELAY);
+    if (fatfs_users == 0 || s_wl_handle == WL_INVALID_HANDLE)
     {
         ESP_LOGI(TAG, "FATFS already unmounted");
+        xSemaphoreGive(fatfs_mutex);
+        return ESP_OK;
+    }
+    if (--fatfs_users > 0)
+    {
+        xSemaphoreGive(fatfs_mutex);
         return ESP_OK;
     }
 
+    esp_err_t err = ESP_OK;
     if (unmount_timer == NULL)
     {
         unmount_timer = xTimerCreate("UnmountTimer", pdMS_TO_TICKS(2000), pdFALSE, NULL, unmount_timer_callback);
         if (unmount_timer == NULL)
         {
             ESP_LOGE(TAG, "Failed to create unmount timer");
-            return ESP_FAIL;
+            err = ESP_FAIL;
         }
     }
-
-    ESP_LOGI(TAG, "Starting unmount timer for 2000 ms");
-    if (xTimerStart(unmount_timer, 0) != pdPASS)
+    if (err == ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to start unmount timer");
-        return ESP_FAIL;
+        ESP_LOGI(TAG, "Starting unmount timer for 2000 ms");
+        if (xTimerStart(unmount_timer, 0) != pdPASS)
+        {
+            ESP_LOGE(TAG, "Failed to start unmount timer");
+            err = ESP_FAIL;
+        }
     }
-
-    return ESP_OK;
-}
\ No newline at end of file
+    xSemaphoreGive(fatfs_mutex);
+    return err;
+}
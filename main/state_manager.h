@@ -14,13 +14,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "nvs_flash.h"
-#include "nvs_manager.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/queue.h"
 #include "esp_log.h"
 #include "esp_event.h"
 #include "config.h"
+#include "ntc_calibration.h"
+#include "virtual_channel.h"
+#include "alarm.h"
 #include "state_manager.h"
 #include "esp_netif_ip_addr.h"
 #include "esp_vfs.h"
@@ -56,6 +58,9 @@ typedef struct
     char sta_pass[PASS_MAX_LEN];
     uint8_t sensor_mask;
     wifi_mode_enum wifi_startup_mode;
+    ntc_calibration_t calibration[SENSOR_MAX_COUNT];
+    virtual_channel_config_t virtual_channels[VIRTUAL_CHANNEL_MAX];
+    alarm_rule_t alarm_rules[SENSOR_MAX_COUNT];
 } system_state_t;
 
 // Declare an event base
@@ -68,6 +73,8 @@ enum {
     EVENT_BUTTON_LONG_PRESS,            // Event for button long press
     EVENT_BUTTON_SHORT_PRESS,           // Event for button short press
     EVENT_RESTART_REQUESTED,            // Event for restart requested
+    EVENT_ALARM_RAISED,                 // Alarm became active, data: alarm_event_t
+    EVENT_ALARM_CLEARED,                // Alarm cleared, data: alarm_event_t
 };
 
 extern system_state_t system_state;
@@ -82,8 +89,7 @@ void system_state_get(const void *field_ptr, void *output, size_t size);
 
 esp_err_t load_default_running_config();
 
-esp_err_t store_running_config_in_fatfs();
-
+// Import the legacy JSON config file; the running config lives in config_store
 esp_err_t read_running_config_from_fatfs();
 
 void events_init(void);
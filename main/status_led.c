@@ -1,5 +1,6 @@
 #include "status_led.h"
 #include "esp_log.h"
+#include "alarm.h"
 
 static const int16_t state_bit_masks[LED_MAX_STATES] = {
     [LED_OK] = 0xFFFF,
@@ -25,6 +26,8 @@ void status_led_init(void)
     events_subscribe(EVENT_WIFI_STATE_CHANGED, status_led_event_handler, NULL);
     events_subscribe(EVENT_BUTTON_SHORT_PRESS, status_led_event_handler, NULL);
     events_subscribe(EVENT_BUTTON_LONG_PRESS, status_led_event_handler, NULL);
+    events_subscribe(EVENT_ALARM_RAISED, status_led_event_handler, NULL);
+    events_subscribe(EVENT_ALARM_CLEARED, status_led_event_handler, NULL);
 
     current_led_state = LED_OK; // Set initial state to OK
 }
@@ -55,6 +58,10 @@ void status_led_event_handler(void *handler_arg, esp_event_base_t base, int32_t
     switch (id)
     {
     case EVENT_WIFI_STATE_CHANGED:
+        if (alarm_any_active())
+        {
+            break; // The alarm pattern stays until the alarms clear
+        }
         if (system_state.wifi_sta_connection_state == 0)
         {
             status_led_set(LED_OK); // Set to OK state when connected
@@ -78,6 +85,15 @@ void status_led_event_handler(void *handler_arg, esp_event_base_t base, int32_t
     case EVENT_BUTTON_LONG_PRESS:
         status_led_set(LED_THREE_BLINK); // Set to three blink on long press
         break;
+    case EVENT_ALARM_RAISED:
+        status_led_set(LED_FAST_BLINK);
+        break;
+    case EVENT_ALARM_CLEARED:
+        if (!alarm_any_active())
+        {
+            status_led_set(system_state.wifi_sta_connection_state == 0 ? LED_OK : LED_ERROR);
+        }
+        break;
     default:
         break;
     }
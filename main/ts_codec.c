@@ -0,0 +1,183 @@
+#include "ts_codec.h"
+#include <string.h>
+
+#define TS_CODEC_NIBBLE_ESCAPE 15
+
+static inline uint32_t zigzag_encode(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t zigzag_decode(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static size_t varint_put(uint8_t *out, uint32_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80)
+    {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+static bool varint_get(const uint8_t *data, size_t length, size_t *pos, uint32_t *value)
+{
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        if (*pos >= length)
+        {
+            return false;
+        }
+        uint8_t byte = data[(*pos)++];
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ts_codec_init(ts_codec_state_t *state, uint16_t channel_mask)
+{
+    memset(state, 0, sizeof(*state));
+    state->channel_mask = channel_mask;
+}
+
+size_t ts_codec_encode(ts_codec_state_t *state, const ts_sample_t *sample, uint8_t *out, size_t capacity)
+{
+    uint8_t buffer[TS_CODEC_SAMPLE_MAX];
+    size_t n;
+    int32_t delta = 0;
+
+    if (state->count == 0)
+    {
+        n = varint_put(buffer, sample->timestamp);
+    }
+    else
+    {
+        delta = (int32_t)(sample->timestamp - state->prev_timestamp);
+        int32_t dod = state->count == 1 ? delta : delta - state->prev_delta;
+        n = varint_put(buffer, zigzag_encode(dod));
+    }
+
+    // Nibbles first, escaped deltas after them
+    uint8_t *nibbles = buffer + n;
+    size_t channels = __builtin_popcount(state->channel_mask);
+    size_t escapes = n + (channels + 1) / 2;
+    memset(nibbles, 0, (channels + 1) / 2);
+    size_t k = 0;
+    for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+    {
+        if ((state->channel_mask & (1 << i)) == 0)
+        {
+            continue;
+        }
+        uint32_t zz = zigzag_encode((int32_t)sample->values[i] - state->prev[i]);
+        uint8_t nibble = zz < TS_CODEC_NIBBLE_ESCAPE ? zz : TS_CODEC_NIBBLE_ESCAPE;
+        nibbles[k / 2] |= (k & 1) ? nibble << 4 : nibble;
+        if (nibble == TS_CODEC_NIBBLE_ESCAPE)
+        {
+            escapes += varint_put(buffer + escapes, zz - TS_CODEC_NIBBLE_ESCAPE);
+        }
+        k++;
+    }
+    n = escapes;
+
+    if (n > capacity)
+    {
+        return 0;
+    }
+    memcpy(out, buffer, n);
+
+    for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+    {
+        if (state->channel_mask & (1 << i))
+        {
+            state->prev[i] = sample->values[i];
+        }
+    }
+    state->prev_delta = delta;
+    state->prev_timestamp = sample->timestamp;
+    state->count++;
+    return n;
+}
+
+void ts_codec_iter_init(ts_codec_iter_t *iter, const uint8_t *data, size_t length, uint16_t channel_mask, uint16_t count)
+{
+    iter->data = data;
+    iter->length = length;
+    iter->pos = 0;
+    iter->remaining = count;
+    ts_codec_init(&iter->state, channel_mask);
+}
+
+bool ts_codec_next(ts_codec_iter_t *iter, ts_sample_t *sample)
+{
+    if (iter->remaining == 0)
+    {
+        return false;
+    }
+
+    ts_codec_state_t *state = &iter->state;
+    uint32_t value;
+    if (!varint_get(iter->data, iter->length, &iter->pos, &value))
+    {
+        return false;
+    }
+    int32_t delta = 0;
+    if (state->count == 0)
+    {
+        sample->timestamp = value;
+    }
+    else
+    {
+        delta = state->count == 1 ? zigzag_decode(value) : state->prev_delta + zigzag_decode(value);
+        sample->timestamp = state->prev_timestamp + delta;
+    }
+
+    size_t channels = __builtin_popcount(state->channel_mask);
+    size_t nibble_pos = iter->pos;
+    iter->pos += (channels + 1) / 2;
+    if (iter->pos > iter->length)
+    {
+        return false;
+    }
+
+    sample->channel_mask = state->channel_mask;
+    size_t k = 0;
+    for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+    {
+        if ((state->channel_mask & (1 << i)) == 0)
+        {
+            sample->values[i] = TS_VALUE_INVALID;
+            continue;
+        }
+        uint8_t byte = iter->data[nibble_pos + k / 2];
+        uint32_t zz = (k & 1) ? byte >> 4 : byte & 0x0F;
+        if (zz == TS_CODEC_NIBBLE_ESCAPE)
+        {
+            if (!varint_get(iter->data, iter->length, &iter->pos, &value))
+            {
+                return false;
+            }
+            zz = value + TS_CODEC_NIBBLE_ESCAPE;
+        }
+        state->prev[i] = (int16_t)(state->prev[i] + zigzag_decode(zz));
+        sample->values[i] = state->prev[i];
+        k++;
+    }
+
+    state->prev_delta = delta;
+    state->prev_timestamp = sample->timestamp;
+    state->count++;
+    iter->remaining--;
+    return true;
+}
@@ -0,0 +1,62 @@
+#ifndef TS_CODEC_H
+#define TS_CODEC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "ts_store.h"
+
+/*
+ * Streaming block codec for history samples (TS_FORMAT_DOD).
+ *
+ * Per sample: the timestamp as zig-zag varint of its delta-of-delta (the
+ * first sample stores the timestamp, the second its delta), then one
+ * nibble per channel in the mask holding the zig-zag delta to the previous
+ * value. Deltas that do not fit a nibble store 15 and follow the nibbles as
+ * a varint. Slowly changing NTC readings mostly cost half a byte per channel.
+ */
+
+// Worst case for one sample: 5 byte timestamp, the nibble bytes, 3 bytes per escaped channel
+#define TS_CODEC_SAMPLE_MAX (5 + (CHANNEL_MAX_COUNT + 1) / 2 + 3 * CHANNEL_MAX_COUNT)
+
+typedef struct
+{
+    uint16_t channel_mask;
+    uint16_t count;
+    uint32_t prev_timestamp;
+    int32_t prev_delta;
+    int16_t prev[CHANNEL_MAX_COUNT];
+} ts_codec_state_t;
+
+typedef struct
+{
+    const uint8_t *data;
+    size_t length;
+    size_t pos;
+    uint16_t remaining;
+    ts_codec_state_t state;
+} ts_codec_iter_t;
+
+/**
+ * @brief Start a new block for samples with the given channels.
+ */
+void ts_codec_init(ts_codec_state_t *state, uint16_t channel_mask);
+
+/**
+ * @brief Encode one sample. Only channels of the block mask are stored.
+ * @return Bytes written, 0 if capacity is too small (state is left unchanged).
+ */
+size_t ts_codec_encode(ts_codec_state_t *state, const ts_sample_t *sample, uint8_t *out, size_t capacity);
+
+/**
+ * @brief Prepare lazy decoding of a block of count samples.
+ */
+void ts_codec_iter_init(ts_codec_iter_t *iter, const uint8_t *data, size_t length, uint16_t channel_mask, uint16_t count);
+
+/**
+ * @brief Decode the next sample.
+ * @return false at the end of the block or on malformed data.
+ */
+bool ts_codec_next(ts_codec_iter_t *iter, ts_sample_t *sample);
+
+#endif // TS_CODEC_H
@@ -0,0 +1,595 @@
+#include "ts_store.h"
+#include "ts_codec.h"
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/param.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "ts_store";
+
+#define TS_PAYLOAD_MAX   (TS_RECORD_SIZE - sizeof(ts_record_header_t))
+#define TS_SEQUENCE_NONE 0
+#define TS_UNIX_TIME_MIN 1700000000 // Anything earlier means the system clock was never set
+
+// Index entry, one per segment holding records, kept in sequence order
+typedef struct
+{
+    uint32_t sequence;
+    uint32_t t_first;
+    uint16_t sector;
+} ts_segment_t;
+
+static const esp_partition_t *ts_partition = NULL;
+static SemaphoreHandle_t ts_mutex = NULL;
+
+static size_t ts_sector_size = 0;
+static uint16_t ts_segment_count = 0;
+static uint16_t ts_pages_per_segment = 0;
+
+// Ring of index entries, ts_index[(ts_index_head + i) % ts_segment_count] is the i-th oldest
+static ts_segment_t *ts_index = NULL;
+static uint16_t ts_index_head = 0;
+static uint16_t ts_index_used = 0;
+
+// Write position
+static uint16_t ts_sector = 0;
+static uint16_t ts_page = 0;
+static uint32_t ts_sequence = TS_SEQUENCE_NONE;
+static bool ts_segment_indexed = false; // current segment has an index entry
+static uint32_t ts_newest = 0;
+static uint32_t ts_clock_base = 0;
+
+// Record being filled in RAM
+static ts_record_header_t ts_staging_header;
+static uint8_t ts_staging_payload[TS_PAYLOAD_MAX];
+static ts_codec_state_t ts_staging_codec;
+
+static uint8_t ts_scratch[TS_RECORD_SIZE];
+static ts_store_stats_t ts_stats;
+
+static void ts_store_shutdown_handler(void);
+
+static const ts_segment_t *ts_index_at(uint16_t i)
+{
+    return &ts_index[(ts_index_head + i) % ts_segment_count];
+}
+
+static uint32_t ts_record_crc(const ts_record_header_t *header, const uint8_t *payload)
+{
+    ts_record_header_t crc_header = *header;
+    crc_header.crc = 0;
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&crc_header, sizeof(crc_header));
+    return esp_rom_crc32_le(crc, payload, header->length);
+}
+
+// Bytes per TS_FORMAT_RAW sample, the codec formats are variable length
+static size_t ts_raw_sample_size(uint8_t channel_mask)
+{
+    return sizeof(uint32_t) + __builtin_popcount(channel_mask) * sizeof(int16_t);
+}
+
+// Read one record into buffer (TS_RECORD_SIZE bytes).
+// ESP_ERR_NOT_FOUND: page erased, ESP_ERR_INVALID_CRC: page written but damaged.
+static esp_err_t ts_read_record(uint16_t sector, uint16_t page, uint8_t *buffer)
+{
+    esp_err_t err = esp_partition_read(ts_partition, sector * ts_sector_size + page * TS_RECORD_SIZE, buffer, TS_RECORD_SIZE);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    const ts_record_header_t *header = (const ts_record_header_t *)buffer;
+    if (header->magic != TS_RECORD_MAGIC)
+    {
+        for (size_t i = 0; i < TS_RECORD_SIZE; i++)
+        {
+            if (buffer[i] != 0xFF)
+            {
+                return ESP_ERR_INVALID_CRC; // Torn write
+            }
+        }
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (header->length > TS_PAYLOAD_MAX || ts_record_crc(header, buffer + sizeof(*header)) != header->crc)
+    {
+        return ESP_ERR_INVALID_CRC;
+    }
+    return ESP_OK;
+}
+
+// Returns false to stop the query
+static bool ts_visit_sample(const ts_sample_t *sample, uint32_t from, uint32_t to, ts_store_visitor_t visitor, void *ctx)
+{
+    if (sample->timestamp > to)
+    {
+        return false;
+    }
+    return sample->timestamp < from || visitor(sample, ctx);
+}
+
+static void ts_decode_record(const ts_record_header_t *header, const uint8_t *payload, uint32_t from, uint32_t to,
+                             ts_store_visitor_t visitor, void *ctx, bool *stop)
+{
+    if (header->format == TS_FORMAT_DOD || header->format == TS_FORMAT_DOD_WIDE)
+    {
+        uint16_t channel_mask = header->channel_mask;
+        size_t offset = 0;
+        if (header->format == TS_FORMAT_DOD_WIDE)
+        {
+            if (header->length < 1)
+            {
+                return;
+            }
+            channel_mask |= payload[0] << 8;
+            offset = 1;
+        }
+        ts_codec_iter_t iter;
+        ts_sample_t sample;
+        ts_codec_iter_init(&iter, payload + offset, header->length - offset, channel_mask, header->count);
+        while (ts_codec_next(&iter, &sample))
+        {
+            if (!ts_visit_sample(&sample, from, to, visitor, ctx))
+            {
+                *stop = true;
+                return;
+            }
+        }
+        return;
+    }
+    if (header->format != TS_FORMAT_RAW)
+    {
+        ESP_LOGW(TAG, "Skipping record with unknown format %d", header->format);
+        return;
+    }
+
+    // Records written before the codec was introduced
+    size_t offset = 0;
+    size_t sample_size = ts_raw_sample_size(header->channel_mask);
+    for (uint16_t n = 0; n < header->count && offset + sample_size <= header->length; n++)
+    {
+        ts_sample_t sample = {.channel_mask = header->channel_mask};
+        memcpy(&sample.timestamp, payload + offset, sizeof(sample.timestamp));
+        offset += sizeof(sample.timestamp);
+        for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+        {
+            if (header->channel_mask & (1 << i))
+            {
+                memcpy(&sample.values[i], payload + offset, sizeof(int16_t));
+                offset += sizeof(int16_t);
+            }
+            else
+            {
+                sample.values[i] = TS_VALUE_INVALID;
+            }
+        }
+
+        if (!ts_visit_sample(&sample, from, to, visitor, ctx))
+        {
+            *stop = true;
+            return;
+        }
+    }
+}
+
+// Erase the next sector and make it the current segment. Caller holds ts_mutex.
+static esp_err_t ts_advance_segment(void)
+{
+    uint16_t sector = (ts_sector + 1) % ts_segment_count;
+    if (ts_sequence == TS_SEQUENCE_NONE && ts_index_used == 0)
+    {
+        sector = 0;
+    }
+
+    // The sector being reused normally holds the oldest segment
+    if (ts_index_used > 0 && ts_index_at(0)->sector == sector)
+    {
+        ts_index_head = (ts_index_head + 1) % ts_segment_count;
+        ts_index_used--;
+    }
+
+    esp_err_t err = esp_partition_erase_range(ts_partition, sector * ts_sector_size, ts_sector_size);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to erase sector %d: %s", sector, esp_err_to_name(err));
+        return err;
+    }
+    ts_stats.segments_erased++;
+    ts_sector = sector;
+    ts_page = 0;
+    ts_sequence++;
+    ts_segment_indexed = false;
+    return ESP_OK;
+}
+
+// Write the staged record. Caller holds ts_mutex.
+static esp_err_t ts_write_staged(void)
+{
+    if (ts_staging_header.count == 0)
+    {
+        return ESP_OK;
+    }
+
+    esp_err_t err = ESP_OK;
+    if (ts_page >= ts_pages_per_segment)
+    {
+        err = ts_advance_segment();
+        if (err != ESP_OK)
+        {
+            ts_stats.write_errors++;
+            return err;
+        }
+    }
+
+    ts_staging_header.magic = TS_RECORD_MAGIC;
+    ts_staging_header.sequence = ts_sequence;
+    ts_staging_header.crc = ts_record_crc(&ts_staging_header, ts_staging_payload);
+
+    memcpy(ts_scratch, &ts_staging_header, sizeof(ts_staging_header));
+    memcpy(ts_scratch + sizeof(ts_staging_header), ts_staging_payload, ts_staging_header.length);
+    // Only the used part of the page is programmed, the rest stays erased
+    err = esp_partition_write(ts_partition, ts_sector * ts_sector_size + ts_page * TS_RECORD_SIZE, ts_scratch,
+                              sizeof(ts_staging_header) + ts_staging_header.length);
+    // A failed page is skipped, recovery treats it as damaged
+    ts_page++;
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to write record: %s", esp_err_to_name(err));
+        ts_stats.write_errors++;
+        return err;
+    }
+
+    if (!ts_segment_indexed)
+    {
+        ts_segment_indexed = true;
+        ts_segment_t *entry = &ts_index[(ts_index_head + ts_index_used) % ts_segment_count];
+        entry->sequence = ts_sequence;
+        entry->t_first = ts_staging_header.t_first;
+        entry->sector = ts_sector;
+        ts_index_used++;
+    }
+    ts_stats.records_written++;
+    memset(&ts_staging_header, 0, sizeof(ts_staging_header));
+    return ESP_OK;
+}
+
+static void ts_index_sort(void)
+{
+    // Insertion sort by sequence, the index is at most a few hundred entries
+    for (uint16_t i = 1; i < ts_index_used; i++)
+    {
+        ts_segment_t entry = ts_index[i];
+        int j = i - 1;
+        while (j >= 0 && ts_index[j].sequence > entry.sequence)
+        {
+            ts_index[j + 1] = ts_index[j];
+            j--;
+        }
+        ts_index[j + 1] = entry;
+    }
+}
+
+esp_err_t ts_store_init(void)
+{
+    if (ts_partition != NULL)
+    {
+        return ESP_OK;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, TS_PARTITION_SUBTYPE, TS_PARTITION_LABEL);
+    if (partition == NULL)
+    {
+        ESP_LOGE(TAG, "History partition '%s' not found", TS_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    ts_sector_size = partition->erase_size;
+    ts_segment_count = partition->size / ts_sector_size;
+    ts_pages_per_segment = ts_sector_size / TS_RECORD_SIZE;
+    if (ts_segment_count < 2 || ts_pages_per_segment == 0)
+    {
+        ESP_LOGE(TAG, "History partition too small: %lu bytes", (unsigned long)partition->size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    ts_index = calloc(ts_segment_count, sizeof(ts_segment_t));
+    ts_mutex = xSemaphoreCreateMutex();
+    if (ts_index == NULL || ts_mutex == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to allocate history index");
+        free(ts_index);
+        ts_index = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    ts_partition = partition;
+
+    // The first valid record of each sector tells its segment sequence and start time
+    const ts_record_header_t *header = (const ts_record_header_t *)ts_scratch;
+    for (uint16_t sector = 0; sector < ts_segment_count; sector++)
+    {
+        esp_err_t err = ESP_ERR_NOT_FOUND;
+        for (uint16_t page = 0; page < ts_pages_per_segment; page++)
+        {
+            err = ts_read_record(sector, page, ts_scratch);
+            if (err != ESP_ERR_INVALID_CRC)
+            {
+                break;
+            }
+            ts_stats.crc_errors++;
+        }
+        if (err != ESP_OK || header->sequence == TS_SEQUENCE_NONE)
+        {
+            continue;
+        }
+        ts_index[ts_index_used].sequence = header->sequence;
+        ts_index[ts_index_used].t_first = header->t_first;
+        ts_index[ts_index_used].sector = sector;
+        ts_index_used++;
+    }
+    ts_index_sort();
+    ts_index_head = 0;
+
+    if (ts_index_used == 0)
+    {
+        // Empty store, the first write erases sector 0
+        ts_sequence = TS_SEQUENCE_NONE;
+        ts_sector = 0;
+        ts_page = ts_pages_per_segment;
+    }
+    else
+    {
+        // Continue after the last record of the newest segment
+        const ts_segment_t *newest = ts_index_at(ts_index_used - 1);
+        ts_sequence = newest->sequence;
+        ts_sector = newest->sector;
+        ts_segment_indexed = true;
+        ts_newest = newest->t_first;
+        for (ts_page = 0; ts_page < ts_pages_per_segment; ts_page++)
+        {
+            esp_err_t err = ts_read_record(ts_sector, ts_page, ts_scratch);
+            if (err == ESP_ERR_NOT_FOUND)
+            {
+                break;
+            }
+            if (err == ESP_OK)
+            {
+                ts_newest = MAX(ts_newest, header->t_last);
+            }
+            else
+            {
+                ts_stats.crc_errors++;
+            }
+        }
+    }
+
+    // Stored time keeps counting up across resets while the system clock is not set
+    ts_clock_base = ts_newest + 1;
+    memset(&ts_staging_header, 0, sizeof(ts_staging_header));
+    esp_register_shutdown_handler(ts_store_shutdown_handler);
+
+    ts_stats.segment_count = ts_segment_count;
+    ts_stats.recovery_us = esp_timer_get_time() - start_us;
+    ESP_LOGI(TAG, "History: %d/%d segments used, segment #%lu page %d, recovered in %lu us",
+             ts_index_used, ts_segment_count, (unsigned long)ts_sequence, ts_page, (unsigned long)ts_stats.recovery_us);
+    return ESP_OK;
+}
+
+uint32_t ts_store_now(void)
+{
+    time_t now = time(NULL);
+    if (now >= TS_UNIX_TIME_MIN)
+    {
+        return (uint32_t)now;
+    }
+    return ts_clock_base + (uint32_t)(esp_timer_get_time() / 1000000);
+}
+
+esp_err_t ts_store_append(const ts_sample_t *sample)
+{
+    if (ts_partition == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(ts_mutex, portMAX_DELAY);
+
+    ts_sample_t clamped = *sample;
+    clamped.timestamp = MAX(sample->timestamp, ts_newest);
+    esp_err_t err = ESP_OK;
+
+    // A record holds one channel set
+    if (ts_staging_header.count > 0 && ts_staging_codec.channel_mask != sample->channel_mask)
+    {
+        err = ts_write_staged();
+        memset(&ts_staging_header, 0, sizeof(ts_staging_header));
+    }
+
+    // Encode with a copy of the codec state, a sample that does not fit starts the next record
+    uint8_t encoded[TS_CODEC_SAMPLE_MAX];
+    ts_codec_state_t codec = ts_staging_codec;
+    size_t length = ts_staging_header.count > 0 ? ts_codec_encode(&codec, &clamped, encoded, sizeof(encoded)) : 0;
+    if (ts_staging_header.count > 0 && ts_staging_header.length + length > TS_PAYLOAD_MAX)
+    {
+        err = ts_write_staged();
+        memset(&ts_staging_header, 0, sizeof(ts_staging_header));
+    }
+    if (ts_staging_header.count == 0)
+    {
+        // Records with virtual channels carry the upper mask byte in front of the codec data
+        ts_staging_header.format = sample->channel_mask > 0xFF ? TS_FORMAT_DOD_WIDE : TS_FORMAT_DOD;
+        ts_staging_header.channel_mask = sample->channel_mask & 0xFF;
+        ts_staging_header.t_first = clamped.timestamp;
+        if (ts_staging_header.format == TS_FORMAT_DOD_WIDE)
+        {
+            ts_staging_payload[0] = sample->channel_mask >> 8;
+            ts_staging_header.length = 1;
+        }
+        ts_codec_init(&codec, sample->channel_mask);
+        length = ts_codec_encode(&codec, &clamped, encoded, sizeof(encoded));
+    }
+
+    memcpy(ts_staging_payload + ts_staging_header.length, encoded, length);
+    ts_staging_codec = codec;
+    ts_staging_header.length += length;
+    ts_staging_header.count++;
+    ts_staging_header.t_last = clamped.timestamp;
+    ts_newest = clamped.timestamp;
+
+    xSemaphoreGive(ts_mutex);
+    return err;
+}
+
+esp_err_t ts_store_flush(void)
+{
+    if (ts_partition == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(ts_mutex, portMAX_DELAY);
+    esp_err_t err = ts_write_staged();
+    xSemaphoreGive(ts_mutex);
+    return err;
+}
+
+// Position of the last segment starting at or before t, 0 if all start later. Caller holds ts_mutex.
+static uint16_t ts_index_search(uint32_t t)
+{
+    uint16_t low = 0;
+    uint16_t high = ts_index_used;
+    while (high - low > 1)
+    {
+        uint16_t mid = low + (high - low) / 2;
+        if (ts_index_at(mid)->t_first <= t)
+        {
+            low = mid;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+// Next segment after sequence, false if there is none. Caller holds ts_mutex.
+static bool ts_index_next(uint32_t sequence, ts_segment_t *segment)
+{
+    for (uint16_t i = 0; i < ts_index_used; i++)
+    {
+        const ts_segment_t *entry = ts_index_at(i);
+        if (entry->sequence > sequence)
+        {
+            *segment = *entry;
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t ts_store_query(uint32_t from, uint32_t to, ts_store_visitor_t visitor, void *ctx)
+{
+    if (ts_partition == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint8_t *buffer = malloc(TS_RECORD_SIZE);
+    if (buffer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    const ts_record_header_t *header = (const ts_record_header_t *)buffer;
+    bool stop = false;
+
+    xSemaphoreTake(ts_mutex, portMAX_DELAY);
+    ts_segment_t segment;
+    bool found = ts_index_used > 0;
+    if (found)
+    {
+        segment = *ts_index_at(ts_index_search(from));
+    }
+    xSemaphoreGive(ts_mutex);
+
+    while (found && !stop)
+    {
+        for (uint16_t page = 0; page < ts_pages_per_segment && !stop; page++)
+        {
+            // The lock is only held for the flash read; the writer may recycle
+            // the segment meanwhile, which shows up as a sequence mismatch
+            xSemaphoreTake(ts_mutex, portMAX_DELAY);
+            esp_err_t err = ts_read_record(segment.sector, page, buffer);
+            if (err == ESP_ERR_INVALID_CRC)
+            {
+                ts_stats.crc_errors++;
+            }
+            xSemaphoreGive(ts_mutex);
+
+            if (err == ESP_ERR_NOT_FOUND || (err == ESP_OK && header->sequence != segment.sequence))
+            {
+                break;
+            }
+            if (err != ESP_OK || header->t_last < from)
+            {
+                continue;
+            }
+            if (header->t_first > to)
+            {
+                stop = true;
+                break;
+            }
+            ts_decode_record(header, buffer + sizeof(*header), from, to, visitor, ctx, &stop);
+        }
+
+        xSemaphoreTake(ts_mutex, portMAX_DELAY);
+        found = ts_index_next(segment.sequence, &segment);
+        xSemaphoreGive(ts_mutex);
+    }
+
+    // Samples not written yet
+    if (!stop)
+    {
+        xSemaphoreTake(ts_mutex, portMAX_DELAY);
+        ts_record_header_t staged = ts_staging_header;
+        memcpy(buffer + sizeof(staged), ts_staging_payload, MIN(staged.length, TS_PAYLOAD_MAX));
+        xSemaphoreGive(ts_mutex);
+        if (staged.count > 0)
+        {
+            ts_decode_record(&staged, buffer + sizeof(staged), from, to, visitor, ctx, &stop);
+        }
+    }
+
+    free(buffer);
+    return ESP_OK;
+}
+
+void ts_store_get_stats(ts_store_stats_t *stats)
+{
+    if (ts_partition == NULL)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    xSemaphoreTake(ts_mutex, portMAX_DELAY);
+    *stats = ts_stats;
+    stats->segments_used = ts_index_used;
+    stats->samples_pending = ts_staging_header.count;
+    stats->oldest_ts = ts_index_used > 0 ? ts_index_at(0)->t_first : 0;
+    stats->newest_ts = ts_newest;
+    xSemaphoreGive(ts_mutex);
+}
+
+static void ts_store_shutdown_handler(void)
+{
+    if (xSemaphoreTake(ts_mutex, pdMS_TO_TICKS(100)) == pdTRUE)
+    {
+        ts_write_staged();
+        xSemaphoreGive(ts_mutex);
+    }
+}
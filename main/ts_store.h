@@ -0,0 +1,95 @@
+#ifndef TS_STORE_H
+#define TS_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "config.h"
+
+#define TS_PARTITION_LABEL   "history"
+#define TS_PARTITION_SUBTYPE 0x42
+#define TS_RECORD_MAGIC      0x5354 // "TS"
+#define TS_RECORD_SIZE       256    // One flash page, records never straddle a page
+#define TS_FORMAT_RAW        1      // Per sample: u32 timestamp, i16 value per channel in the mask
+#define TS_FORMAT_DOD        2      // ts_codec: delta-of-delta timestamps, nibble/varint value deltas
+#define TS_FORMAT_DOD_WIDE   3      // TS_FORMAT_DOD, the payload starts with the upper byte of the channel mask
+#define TS_VALUE_INVALID     INT16_MIN
+
+/*
+ * The partition is a ring of segments, one erase sector each. A segment is
+ * filled with page-sized records holding a batch of samples; all records of
+ * a segment carry its sequence number. When the writer reaches the end of
+ * the ring, the oldest segment is erased and reused.
+ */
+typedef struct
+{
+    uint16_t magic;
+    uint8_t format;       // TS_FORMAT_*
+    uint8_t channel_mask; // channels 0-7 present in every sample of the record
+    uint16_t count;       // samples in the record
+    uint16_t length;      // payload bytes after the header
+    uint32_t sequence;    // segment sequence number
+    uint32_t t_first;     // timestamp of the first sample
+    uint32_t t_last;      // timestamp of the last sample
+    uint32_t crc;         // CRC32 of this header (with crc = 0) and the payload
+} ts_record_header_t;
+
+typedef struct
+{
+    uint32_t timestamp;               // seconds, see ts_store_now()
+    uint16_t channel_mask;             // valid entries in values
+    int16_t values[CHANNEL_MAX_COUNT]; // temperature in 0.01 °C, indexed by channel
+} ts_sample_t;
+
+typedef struct
+{
+    uint32_t segment_count;   // segments in the partition
+    uint32_t segments_used;   // segments holding records
+    uint32_t records_written;
+    uint32_t segments_erased;
+    uint32_t write_errors;
+    uint32_t crc_errors;      // damaged records skipped while reading
+    uint32_t samples_pending; // samples buffered in RAM, not yet on flash
+    uint32_t oldest_ts;
+    uint32_t newest_ts;
+    uint32_t recovery_us;     // time ts_store_init() took to rebuild the index
+} ts_store_stats_t;
+
+// Return false to stop the query
+typedef bool (*ts_store_visitor_t)(const ts_sample_t *sample, void *ctx);
+
+/**
+ * @brief Find the history partition and rebuild the segment index.
+ * Only the first record of every segment and the records of the newest
+ * segment are read.
+ */
+esp_err_t ts_store_init(void);
+
+/**
+ * @brief Current store time in seconds.
+ * Unix time once the system clock is set, otherwise a clock that continues
+ * from the newest stored sample, so timestamps never go backwards.
+ */
+uint32_t ts_store_now(void);
+
+/**
+ * @brief Add a sample. Samples are buffered until a record is full.
+ * A timestamp older than the newest sample is moved up to it.
+ */
+esp_err_t ts_store_append(const ts_sample_t *sample);
+
+/**
+ * @brief Write the buffered samples now.
+ */
+esp_err_t ts_store_flush(void);
+
+/**
+ * @brief Call visitor for every sample with from <= timestamp <= to, oldest first.
+ * Finding the first segment is a binary search over the index; the store is
+ * not locked while visitor runs.
+ */
+esp_err_t ts_store_query(uint32_t from, uint32_t to, ts_store_visitor_t visitor, void *ctx);
+
+void ts_store_get_stats(ts_store_stats_t *stats);
+
+#endif // TS_STORE_H
@@ -0,0 +1,515 @@
+#include "virtual_channel.h"
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "state_manager.h"
+#include "settings_manager.h"
+#include "config_store.h"
+
+static const char *TAG = "virtual_channel";
+
+typedef enum
+{
+    VIRTUAL_OP_CONST = 0,
+    VIRTUAL_OP_CHANNEL,
+    VIRTUAL_OP_ADD,
+    VIRTUAL_OP_SUB,
+    VIRTUAL_OP_MUL,
+    VIRTUAL_OP_DIV,
+    VIRTUAL_OP_NEG,
+    VIRTUAL_OP_ABS,
+    VIRTUAL_OP_MIN, // arg: argument count
+    VIRTUAL_OP_MAX,
+    VIRTUAL_OP_AVG,
+} virtual_op_t;
+
+typedef struct
+{
+    const char *name;
+    virtual_op_t op;
+    uint8_t min_args;
+    uint8_t max_args;
+} virtual_function_t;
+
+static const virtual_function_t virtual_functions[] = {
+    {"min", VIRTUAL_OP_MIN, 1, VIRTUAL_STACK_MAX},
+    {"max", VIRTUAL_OP_MAX, 1, VIRTUAL_STACK_MAX},
+    {"avg", VIRTUAL_OP_AVG, 1, VIRTUAL_STACK_MAX},
+    {"abs", VIRTUAL_OP_ABS, 1, 1},
+};
+
+typedef struct
+{
+    const char *text;
+    size_t pos;
+    virtual_program_t *program;
+    uint8_t depth; // stack depth when the emitted code runs
+    uint8_t nesting;
+    const char *error;
+} virtual_parser_t;
+
+// Owned by the temperature task
+static virtual_program_t virtual_programs[VIRTUAL_CHANNEL_MAX];
+static float virtual_values[VIRTUAL_CHANNEL_MAX];
+
+// Programs handed over from other tasks, and the config they came from
+static virtual_program_t virtual_staged[VIRTUAL_CHANNEL_MAX];
+static volatile uint8_t virtual_pending = 0;
+static volatile uint8_t virtual_mask = 0;
+static portMUX_TYPE virtual_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static bool virtual_parse_expression(virtual_parser_t *parser);
+
+static bool virtual_fail(virtual_parser_t *parser, const char *error)
+{
+    if (parser->error == NULL)
+    {
+        parser->error = error;
+    }
+    return false;
+}
+
+// Append an instruction; pops and pushes keep track of the stack depth
+static bool virtual_emit(virtual_parser_t *parser, virtual_op_t op, uint8_t arg, float value, uint8_t pops)
+{
+    virtual_program_t *program = parser->program;
+    if (program->length >= VIRTUAL_PROGRAM_MAX)
+    {
+        return virtual_fail(parser, "expression too long");
+    }
+    parser->depth = parser->depth - pops + 1;
+    if (parser->depth > VIRTUAL_STACK_MAX)
+    {
+        return virtual_fail(parser, "expression too deep");
+    }
+    program->code[program->length++] = (virtual_instruction_t){.op = op, .arg = arg, .value = value};
+    return true;
+}
+
+static char virtual_peek(virtual_parser_t *parser)
+{
+    while (isspace((unsigned char)parser->text[parser->pos]))
+    {
+        parser->pos++;
+    }
+    return parser->text[parser->pos];
+}
+
+static bool virtual_accept(virtual_parser_t *parser, char c)
+{
+    if (virtual_peek(parser) != c)
+    {
+        return false;
+    }
+    parser->pos++;
+    return true;
+}
+
+static bool virtual_parse_call(virtual_parser_t *parser, const char *name, size_t name_length)
+{
+    const virtual_function_t *function = NULL;
+    for (size_t i = 0; i < sizeof(virtual_functions) / sizeof(virtual_functions[0]); i++)
+    {
+        if (strlen(virtual_functions[i].name) == name_length &&
+            strncmp(virtual_functions[i].name, name, name_length) == 0)
+        {
+            function = &virtual_functions[i];
+        }
+    }
+    if (function == NULL)
+    {
+        return virtual_fail(parser, "unknown function");
+    }
+    if (!virtual_accept(parser, '('))
+    {
+        return virtual_fail(parser, "expected (");
+    }
+
+    uint8_t args = 0;
+    do
+    {
+        if (!virtual_parse_expression(parser))
+        {
+            return false;
+        }
+        args++;
+    } while (virtual_accept(parser, ','));
+    if (!virtual_accept(parser, ')'))
+    {
+        return virtual_fail(parser, "expected )");
+    }
+    if (args < function->min_args || args > function->max_args)
+    {
+        return virtual_fail(parser, "wrong number of arguments");
+    }
+    return virtual_emit(parser, function->op, args, 0, args);
+}
+
+// number | tN | function(args) | (expression)
+static bool virtual_parse_primary(virtual_parser_t *parser)
+{
+    char c = virtual_peek(parser);
+    const char *start = parser->text + parser->pos;
+    if (isdigit((unsigned char)c) || c == '.')
+    {
+        char *end;
+        float value = strtof(start, &end);
+        if (end == start || !isfinite(value))
+        {
+            return virtual_fail(parser, "invalid number");
+        }
+        parser->pos += end - start;
+        return virtual_emit(parser, VIRTUAL_OP_CONST, 0, value, 0);
+    }
+    if (c == '(')
+    {
+        parser->pos++;
+        if (!virtual_parse_expression(parser))
+        {
+            return false;
+        }
+        return virtual_accept(parser, ')') || virtual_fail(parser, "expected )");
+    }
+    if (!isalpha((unsigned char)c))
+    {
+        return virtual_fail(parser, c == '\0' ? "unexpected end" : "unexpected character");
+    }
+
+    size_t length = 0;
+    while (isalnum((unsigned char)start[length]))
+    {
+        length++;
+    }
+    parser->pos += length;
+    if (start[0] == 't' && length >= 2 && isdigit((unsigned char)start[1]))
+    {
+        // Every character after the t is part of the channel number, t1x is not t1
+        size_t digits = strspn(start + 1, "0123456789");
+        int channel = atoi(start + 1);
+        if (digits != length - 1 || length > 3 || channel >= SENSOR_MAX_COUNT)
+        {
+            return virtual_fail(parser, "no such channel");
+        }
+        parser->program->channel_mask |= 1 << channel;
+        return virtual_emit(parser, VIRTUAL_OP_CHANNEL, channel, 0, 0);
+    }
+    return virtual_parse_call(parser, start, length);
+}
+
+// The nesting limit bounds the recursion, and with it the stack of the calling task
+static bool virtual_parse_unary(virtual_parser_t *parser)
+{
+    if (++parser->nesting > VIRTUAL_NESTING_MAX)
+    {
+        return virtual_fail(parser, "expression too deep");
+    }
+    bool ok;
+    if (virtual_accept(parser, '-'))
+    {
+        ok = virtual_parse_unary(parser) && virtual_emit(parser, VIRTUAL_OP_NEG, 0, 0, 1);
+    }
+    else
+    {
+        ok = virtual_parse_primary(parser);
+    }
+    parser->nesting--;
+    return ok;
+}
+
+static bool virtual_parse_term(virtual_parser_t *parser)
+{
+    if (!virtual_parse_unary(parser))
+    {
+        return false;
+    }
+    while (1)
+    {
+        virtual_op_t op;
+        if (virtual_accept(parser, '*'))
+        {
+            op = VIRTUAL_OP_MUL;
+        }
+        else if (virtual_accept(parser, '/'))
+        {
+            op = VIRTUAL_OP_DIV;
+        }
+        else
+        {
+            return true;
+        }
+        if (!virtual_parse_unary(parser) || !virtual_emit(parser, op, 0, 0, 2))
+        {
+            return false;
+        }
+    }
+}
+
+static bool virtual_parse_expression(virtual_parser_t *parser)
+{
+    if (!virtual_parse_term(parser))
+    {
+        return false;
+    }
+    while (1)
+    {
+        virtual_op_t op;
+        if (virtual_accept(parser, '+'))
+        {
+            op = VIRTUAL_OP_ADD;
+        }
+        else if (virtual_accept(parser, '-'))
+        {
+            op = VIRTUAL_OP_SUB;
+        }
+        else
+        {
+            return true;
+        }
+        if (!virtual_parse_term(parser) || !virtual_emit(parser, op, 0, 0, 2))
+        {
+            return false;
+        }
+    }
+}
+
+esp_err_t virtual_channel_compile(const char *expression, virtual_program_t *program, const char **error)
+{
+    memset(program, 0, sizeof(*program));
+    virtual_parser_t parser = {.text = expression, .program = program};
+    bool ok = virtual_parse_expression(&parser);
+    if (ok && virtual_peek(&parser) != '\0')
+    {
+        ok = virtual_fail(&parser, "unexpected character");
+    }
+    if (!ok)
+    {
+        if (error != NULL)
+        {
+            *error = parser.error;
+        }
+        memset(program, 0, sizeof(*program));
+        return ESP_ERR_INVALID_ARG;
+    }
+    return ESP_OK;
+}
+
+float virtual_channel_run(const virtual_program_t *program, const float *temperatures)
+{
+    float stack[VIRTUAL_STACK_MAX];
+    int sp = 0;
+    for (int i = 0; i < program->length; i++)
+    {
+        const virtual_instruction_t *instruction = &program->code[i];
+        switch (instruction->op)
+        {
+        case VIRTUAL_OP_CONST:
+            stack[sp++] = instruction->value;
+            break;
+        case VIRTUAL_OP_CHANNEL:
+            stack[sp++] = temperatures[instruction->arg];
+            break;
+        case VIRTUAL_OP_ADD:
+            sp--;
+            stack[sp - 1] += stack[sp];
+            break;
+        case VIRTUAL_OP_SUB:
+            sp--;
+            stack[sp - 1] -= stack[sp];
+            break;
+        case VIRTUAL_OP_MUL:
+            sp--;
+            stack[sp - 1] *= stack[sp];
+            break;
+        case VIRTUAL_OP_DIV:
+            sp--;
+            stack[sp - 1] = stack[sp] != 0 ? stack[sp - 1] / stack[sp] : NAN;
+            break;
+        case VIRTUAL_OP_NEG:
+            stack[sp - 1] = -stack[sp - 1];
+            break;
+        case VIRTUAL_OP_ABS:
+            stack[sp - 1] = fabsf(stack[sp - 1]);
+            break;
+        default: // VIRTUAL_OP_MIN, VIRTUAL_OP_MAX, VIRTUAL_OP_AVG over the top arg values
+        {
+            sp -= instruction->arg;
+            float result = NAN;
+            float sum = 0;
+            int count = 0;
+            for (int k = sp; k < sp + instruction->arg; k++)
+            {
+                float value = stack[k];
+                if (isnan(value))
+                {
+                    continue;
+                }
+                if (count == 0 || (instruction->op == VIRTUAL_OP_MIN && value < result) ||
+                    (instruction->op == VIRTUAL_OP_MAX && value > result))
+                {
+                    result = value;
+                }
+                sum += value;
+                count++;
+            }
+            stack[sp++] = instruction->op == VIRTUAL_OP_AVG && count > 0 ? sum / count : result;
+            break;
+        }
+        }
+    }
+    return sp == 1 ? stack[0] : NAN;
+}
+
+static bool virtual_name_valid(const char *name)
+{
+    size_t length = strnlen(name, VIRTUAL_NAME_MAX_LEN);
+    if (length == 0 || length >= VIRTUAL_NAME_MAX_LEN)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        if (!isalnum((unsigned char)name[i]) && strchr("_-. ", name[i]) == NULL)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Hand a program to the temperature task
+static void virtual_channel_stage(uint8_t index, const virtual_program_t *program)
+{
+    taskENTER_CRITICAL(&virtual_lock);
+    virtual_staged[index] = *program;
+    virtual_pending |= 1 << index;
+    if (program->length > 0)
+    {
+        virtual_mask |= 1 << index;
+    }
+    else
+    {
+        virtual_mask &= ~(1 << index);
+    }
+    taskEXIT_CRITICAL(&virtual_lock);
+}
+
+void virtual_channel_init(void)
+{
+    for (uint8_t i = 0; i < VIRTUAL_CHANNEL_MAX; i++)
+    {
+        virtual_channel_config_t *config = &system_state.virtual_channels[i];
+        config->name[VIRTUAL_NAME_MAX_LEN - 1] = '\0';
+        config->expression[VIRTUAL_EXPRESSION_MAX_LEN - 1] = '\0';
+        virtual_values[i] = NAN;
+
+        virtual_program_t program = {0};
+        const char *error = NULL;
+        if (config->expression[0] != '\0' && virtual_channel_compile(config->expression, &program, &error) != ESP_OK)
+        {
+            ESP_LOGW(TAG, "Virtual channel %d: '%s' does not compile (%s), removed", i, config->expression, error);
+            memset(config, 0, sizeof(*config));
+        }
+        virtual_channel_stage(i, &program);
+        if (program.length > 0)
+        {
+            ESP_LOGI(TAG, "Channel %d (%s) = %s, %d instructions", SENSOR_MAX_COUNT + i, config->name,
+                     config->expression, program.length);
+        }
+    }
+}
+
+esp_err_t virtual_channel_set(uint8_t index, const char *name, const char *expression, const char **error)
+{
+    const char *unused;
+    if (error == NULL)
+    {
+        error = &unused;
+    }
+    if (index >= VIRTUAL_CHANNEL_MAX)
+    {
+        *error = "no such channel";
+        return ESP_ERR_INVALID_ARG;
+    }
+    virtual_channel_config_t config = {0};
+    virtual_program_t program = {0};
+    if (expression[0] != '\0')
+    {
+        if (strlen(expression) >= VIRTUAL_EXPRESSION_MAX_LEN)
+        {
+            *error = "expression too long";
+            return ESP_ERR_INVALID_ARG;
+        }
+        if (!virtual_name_valid(name))
+        {
+            *error = "invalid name";
+            return ESP_ERR_INVALID_ARG;
+        }
+        esp_err_t err = virtual_channel_compile(expression, &program, error);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        strlcpy(config.name, name, sizeof(config.name));
+        strlcpy(config.expression, expression, sizeof(config.expression));
+    }
+
+    taskENTER_CRITICAL(&virtual_lock);
+    system_state.virtual_channels[index] = config;
+    taskEXIT_CRITICAL(&virtual_lock);
+    virtual_channel_stage(index, &program);
+    config_store_mark_dirty(SETTINGS_FIELD_VIRTUAL_CHANNELS);
+    ESP_LOGI(TAG, "Channel %d (%s) = %s", SENSOR_MAX_COUNT + index, config.name,
+             program.length > 0 ? config.expression : "removed");
+    return ESP_OK;
+}
+
+esp_err_t virtual_channel_get(uint8_t index, virtual_channel_config_t *config)
+{
+    if (index >= VIRTUAL_CHANNEL_MAX)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    taskENTER_CRITICAL(&virtual_lock);
+    *config = system_state.virtual_channels[index];
+    taskEXIT_CRITICAL(&virtual_lock);
+    return ESP_OK;
+}
+
+uint8_t virtual_channel_get_mask(void)
+{
+    return virtual_mask;
+}
+
+float virtual_channel_get_value(uint8_t index)
+{
+    if (index >= VIRTUAL_CHANNEL_MAX || (virtual_mask & (1 << index)) == 0)
+    {
+        return NAN;
+    }
+    return virtual_values[index];
+}
+
+void virtual_channel_evaluate(const float *temperatures)
+{
+    if (virtual_pending)
+    {
+        taskENTER_CRITICAL(&virtual_lock);
+        for (int i = 0; i < VIRTUAL_CHANNEL_MAX; i++)
+        {
+            if (virtual_pending & (1 << i))
+            {
+                virtual_programs[i] = virtual_staged[i];
+            }
+        }
+        virtual_pending = 0;
+        taskEXIT_CRITICAL(&virtual_lock);
+    }
+
+    for (int i = 0; i < VIRTUAL_CHANNEL_MAX; i++)
+    {
+        virtual_values[i] = virtual_programs[i].length > 0 ? virtual_channel_run(&virtual_programs[i], temperatures) : NAN;
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef VIRTUAL_CHANNEL_H
+#define VIRTUAL_CHANNEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "config.h"
+
+#define VIRTUAL_NAME_MAX_LEN 12       // including the terminator
+#define VIRTUAL_EXPRESSION_MAX_LEN 64 // including the terminator
+#define VIRTUAL_PROGRAM_MAX 32        // instructions of a compiled expression
+#define VIRTUAL_STACK_MAX 8           // evaluation stack depth
+#define VIRTUAL_NESTING_MAX 8         // parentheses and function calls
+
+/*
+ * Channels computed from the physical ones on every snapshot, e.g.
+ *   t0 - t3             supply - return
+ *   avg(t4, t5, t6)     group average
+ *   max(t0, t5) + 0.5   hottest zone with a margin
+ * tN is the temperature of physical channel N in °C. Operators + - * / and
+ * parentheses, functions min, max, avg (1 to 8 arguments) and abs. min, max
+ * and avg skip missing readings, everything else turns them into a missing
+ * result. Expressions are compiled once into a stack program.
+ */
+
+// Stored as is in the config record
+typedef struct
+{
+    char name[VIRTUAL_NAME_MAX_LEN];
+    char expression[VIRTUAL_EXPRESSION_MAX_LEN]; // empty: channel unused
+} virtual_channel_config_t;
+
+typedef struct
+{
+    uint8_t op;  // virtual_op_t
+    uint8_t arg; // channel or argument count
+    float value; // constant
+} virtual_instruction_t;
+
+typedef struct
+{
+    uint8_t length;
+    uint8_t channel_mask; // physical channels read by the program
+    virtual_instruction_t code[VIRTUAL_PROGRAM_MAX];
+} virtual_program_t;
+
+/**
+ * @brief Compile an expression.
+ * @param error Receives a short description of the problem on failure, may be NULL.
+ * @return ESP_ERR_INVALID_ARG for a malformed or too complex expression.
+ */
+esp_err_t virtual_channel_compile(const char *expression, virtual_program_t *program, const char **error);
+
+/**
+ * @brief Run a compiled program on physical temperatures (SENSOR_MAX_COUNT values, NAN if missing).
+ */
+float virtual_channel_run(const virtual_program_t *program, const float *temperatures);
+
+/**
+ * @brief Compile the channels stored in system_state; broken ones are cleared.
+ */
+void virtual_channel_init(void);
+
+/**
+ * @brief Define, change or (with an empty expression) remove a virtual channel and store it in the config.
+ * @param error Receives a short description of the problem on failure, may be NULL.
+ * @return ESP_ERR_INVALID_ARG for an invalid index, name or expression.
+ */
+esp_err_t virtual_channel_set(uint8_t index, const char *name, const char *expression, const char **error);
+
+esp_err_t virtual_channel_get(uint8_t index, virtual_channel_config_t *config);
+
+/**
+ * @brief Defined virtual channels as a bitmask of their index (0 .. VIRTUAL_CHANNEL_MAX - 1).
+ */
+uint8_t virtual_channel_get_mask(void);
+
+/**
+ * @brief Latest value of a virtual channel in °C, NAN if it is undefined or missing.
+ */
+float virtual_channel_get_value(uint8_t index);
+
+/**
+ * @brief Evaluate every defined channel. Called on the temperature task with each snapshot.
+ * @param temperatures °C per physical channel, NAN where missing.
+ */
+void virtual_channel_evaluate(const float *temperatures);
+
+#endif // VIRTUAL_CHANNEL_H
@@ -1,6 +1,7 @@
 #include "wifi_manager.h"
 #include "lwip/sockets.h"
 #include "esp_mac.h"
+#include "freertos/timers.h"
 // #include "lwip/netdb.h"
 // #include "lwip/dns.h"
 
@@ -13,6 +14,10 @@ static esp_event_handler_instance_t instance_got_ip;
 static esp_netif_t *ap_netif = NULL;
 static esp_netif_t *sta_netif = NULL;
 static TaskHandle_t wifi_switch_task_handle = NULL;
+static volatile uint32_t sta_reconnects = 0;
+static TimerHandle_t apply_timer = NULL;
+static portMUX_TYPE apply_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t apply_pending_fields = 0;
 
 static void event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
 {
@@ -57,6 +62,7 @@ static void event_handler(void *arg, esp_event_base_t event_base, int32_t event_
 
             vTaskDelay(pdMS_TO_TICKS(3000));
             ESP_LOGI(TAG, "Retrying connection...");
+            sta_reconnects++;
             esp_wifi_connect(); // Retry connection
             break;
         }
@@ -89,6 +95,42 @@ static void event_handler(void *arg, esp_event_base_t event_base, int32_t event_
     events_post(EVENT_WIFI_STATE_CHANGED, NULL, 0);
 }
 
+static void wifi_build_sta_config(wifi_config_t *wifi_config)
+{
+    *wifi_config = (wifi_config_t){
+        .sta = {
+            .ssid = "",
+            .password = "",
+            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+        },
+    };
+
+    strlcpy((char *)wifi_config->sta.ssid, system_state.sta_ssid, sizeof(wifi_config->sta.ssid));
+    strlcpy((char *)wifi_config->sta.password, system_state.sta_pass, sizeof(wifi_config->sta.password));
+}
+
+static void wifi_build_ap_config(wifi_config_t *wifi_config)
+{
+    *wifi_config = (wifi_config_t){
+        .ap = {
+            .ssid = "",
+            .ssid_len = 0,
+            .password = "",
+            .max_connection = WIFI_AP_MAX_CONN,
+            .authmode = WIFI_AUTH_WPA_WPA2_PSK,
+        },
+    };
+
+    strlcpy((char *)wifi_config->ap.ssid, system_state.ap_ssid, sizeof(wifi_config->ap.ssid));
+    strlcpy((char *)wifi_config->ap.password, system_state.ap_pass, sizeof(wifi_config->ap.password));
+    wifi_config->ap.ssid_len = strnlen(system_state.ap_ssid, sizeof(wifi_config->ap.ssid));
+
+    if (strlen((const char *)wifi_config->ap.password) == 0)
+    {
+        wifi_config->ap.authmode = WIFI_AUTH_OPEN;
+    }
+}
+
 void wifi_sta_init(void)
 {
     if (sta_netif == NULL)
@@ -107,16 +149,8 @@ void wifi_sta_init(void)
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
 
     // Configure WiFi STA settings
-    wifi_config_t wifi_config = {
-        .sta = {
-            .ssid = "",
-            .password = "",
-            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
-        },
-    };
-
-    strlcpy((char *)wifi_config.sta.ssid, system_state.sta_ssid, sizeof(wifi_config.sta.ssid));
-    strlcpy((char *)wifi_config.sta.password, system_state.sta_pass, sizeof(wifi_config.sta.password));
+    wifi_config_t wifi_config;
+    wifi_build_sta_config(&wifi_config);
 
     ESP_LOGI(TAG, "Connecting to SSID: %s", wifi_config.sta.ssid);
     ESP_LOGI(TAG, "Password: %s", wifi_config.sta.password);
@@ -155,24 +189,8 @@ void wifi_ap_init(void)
     //ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL, NULL));
 
     // Configure WiFi AP settings
-    wifi_config_t wifi_config = {
-        .ap = {
-            .ssid = "",
-            .ssid_len = 0,
-            .password = "",
-            .max_connection = WIFI_AP_MAX_CONN,
-            .authmode = WIFI_AUTH_WPA_WPA2_PSK,
-        },
-    };
-
-    strlcpy((char *)wifi_config.ap.ssid, system_state.ap_ssid, sizeof(wifi_config.ap.ssid));
-    strlcpy((char *)wifi_config.ap.password, system_state.ap_pass, sizeof(wifi_config.ap.password));
-    wifi_config.ap.ssid_len = strnlen(system_state.ap_ssid, sizeof(wifi_config.ap.ssid));
-
-    if (strlen((const char *)wifi_config.ap.password) == 0)
-    {
-        wifi_config.ap.authmode = WIFI_AUTH_OPEN;
-    }
+    wifi_config_t wifi_config;
+    wifi_build_ap_config(&wifi_config);
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
     ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_AP, &wifi_config));
@@ -190,6 +208,42 @@ static void _wifi_button_long_press_event_handler(void *handler_arg, esp_event_b
     ESP_LOGI(TAG, "WiFi mode switched successfully.");
 }
 
+// Runs on the timer task once the settings response is out, reconfiguring drops the client's connection
+static void wifi_apply_timer_callback(TimerHandle_t xTimer)
+{
+    wifi_config_t wifi_config;
+    esp_err_t err = ESP_OK;
+
+    taskENTER_CRITICAL(&apply_lock);
+    uint32_t changed_fields = apply_pending_fields;
+    apply_pending_fields = 0;
+    taskEXIT_CRITICAL(&apply_lock);
+
+    // Credentials of the inactive interface are only used on the next mode switch
+    if (system_state.wifi_state == WIFI_STATE_AP && (changed_fields & (SETTINGS_FIELD_AP_SSID | SETTINGS_FIELD_AP_PASS)))
+    {
+        ESP_LOGI(TAG, "Applying new AP settings, SSID: %s", system_state.ap_ssid);
+        wifi_build_ap_config(&wifi_config);
+        err = esp_wifi_set_config(ESP_IF_WIFI_AP, &wifi_config);
+    }
+    else if (system_state.wifi_state == WIFI_STATE_STA && (changed_fields & (SETTINGS_FIELD_STA_SSID | SETTINGS_FIELD_STA_PASS)))
+    {
+        ESP_LOGI(TAG, "Applying new STA settings, SSID: %s", system_state.sta_ssid);
+        wifi_build_sta_config(&wifi_config);
+        err = esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config);
+        if (err == ESP_OK)
+        {
+            // The disconnect handler reconnects with the new credentials
+            err = esp_wifi_disconnect();
+        }
+    }
+
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to apply WiFi settings: %s", esp_err_to_name(err));
+    }
+}
+
 void wifi_initialize()
 {
     // Initialize TCP/IP stack
@@ -200,6 +254,12 @@ void wifi_initialize()
     ESP_ERROR_CHECK(esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL, &instance_got_ip));
 
     events_subscribe(EVENT_BUTTON_LONG_PRESS, _wifi_button_long_press_event_handler, NULL);
+
+    apply_timer = xTimerCreate("WifiApplyTimer", pdMS_TO_TICKS(WIFI_APPLY_DELAY_MS), pdFALSE, NULL, wifi_apply_timer_callback);
+    if (apply_timer == NULL)
+    {
+        ESP_LOGE(TAG, "Failed to create WiFi apply timer");
+    }
 }
 
 void wifi_connect()
@@ -220,8 +280,6 @@ void wifi_connect()
         }
         events_post(EVENT_WIFI_STATE_CHANGED, NULL, 0);
     }
-
-    vTaskDelay(pdMS_TO_TICKS(1000)); // Wait for WiFi to initialize
 }
 
 static void wifi_switch_task(void *arg)
@@ -288,4 +346,35 @@ void wifi_switch_mode()
     {
         ESP_LOGI(TAG, "WiFi switch task already running.");
     }
-}
\ No newline at end of file
+}
+
+esp_err_t wifi_apply_settings(uint32_t changed_fields)
+{
+    if (apply_timer == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    taskENTER_CRITICAL(&apply_lock);
+    apply_pending_fields |= changed_fields;
+    taskEXIT_CRITICAL(&apply_lock);
+
+    // Restarts the delay when settings change again before it expired
+    return xTimerReset(apply_timer, 0) == pdPASS ? ESP_OK : ESP_FAIL;
+}
+
+uint32_t wifi_get_reconnect_count(void)
+{
+    return sta_reconnects;
+}
+
+esp_err_t wifi_get_rssi(int8_t *rssi)
+{
+    wifi_ap_record_t ap_info;
+    esp_err_t err = esp_wifi_sta_get_ap_info(&ap_info);
+    if (err == ESP_OK)
+    {
+        *rssi = ap_info.rssi;
+    }
+    return err;
+}
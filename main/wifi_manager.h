@@ -8,17 +8,23 @@
 #include "esp_event.h"
 #include "freertos/FreeRTOS.h"
 #include "config.h"
-#include "nvs_manager.h"
 #include "state_manager.h"
+#include "settings_manager.h"
 #include "esp_log.h"
 
-#define WIFI_AP_SSID_KEY "ap_ssid"
-#define WIFI_AP_PASS_KEY "ap_pass"
 #define WIFI_AP_MAX_CONN 4
 #define WIFI_AP_CHANNEL 1
+#define WIFI_AP_PASS_MIN_LEN 8 // WPA2 passphrase, an empty password makes the AP open
+#define WIFI_APPLY_DELAY_MS 1000 // Lets the HTTP response reach the client before the interface restarts
 
 void wifi_initialize(void);
 void wifi_connect(void);
 void wifi_switch_mode(void);
+// Apply changed WiFi credentials to the running interface after WIFI_APPLY_DELAY_MS
+esp_err_t wifi_apply_settings(uint32_t changed_fields);
+// Connection attempts after the station lost or could not reach the access point
+uint32_t wifi_get_reconnect_count(void);
+// Signal strength of the access point the station is associated with
+esp_err_t wifi_get_rssi(int8_t *rssi);
 
 #endif // WIFI_MANAGER_H
@@ -0,0 +1,316 @@
+/*
+ * Host fuzz and throughput harness for main/form_parser.c.
+ *
+ * Every input is parsed twice, once in a single form_parser_feed() call and
+ * once split into random chunks, and both runs must agree byte for byte:
+ * the parser is fed straight from httpd_req_recv(), which can split a body
+ * anywhere. Values must always stay NUL-terminated inside their buffers.
+ * Hand-written bodies pin down the decoded values and the rejected inputs.
+ * Built with -fsanitize=address,undefined by the Makefile.
+ *
+ *     ./form_parser_fuzz [iterations] [seed]   random mutations of the seed bodies
+ *     ./form_parser_fuzz --bench [megabytes]   parse throughput of typical bodies
+ *
+ * With clang, -DFORM_PARSER_LIBFUZZER -fsanitize=fuzzer builds a libFuzzer
+ * target from the same checks instead.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "form_parser.h"
+
+#define FIELD_COUNT 6
+#define INPUT_MAX   1024
+
+static const char *const field_names[FIELD_COUNT] = {"ssid", "password", "channel", "alpha", "enabled", "name"};
+// Small buffers on purpose, so truncation is exercised
+static const size_t field_sizes[FIELD_COUNT] = {33, 65, 4, 12, 6, 1};
+
+static const char *const seeds[] = {
+    "ssid=My+Network&password=p%40ss%26word&channel=3",
+    "ssid=&password&channel=12&channel=4&unknown=x%2",
+    "name=a&alpha=0.25&enabled=true&ssid=%E2%82%AC",
+    "{\"ssid\":\"My Network\",\"password\":\"p\\\"w\\\\d\",\"channel\":3}",
+    "{\"alpha\":-1.5e-3,\"enabled\":false,\"name\":null,\"skip\":{\"a\":[1,2,{\"b\":\"}\"}]}}",
+    "{ \"ssid\" : \"\\u00e9\\u20ac\\ud83d\" , \"channel\" : [1] , \"enabled\" : true }",
+    "{}",
+};
+
+typedef struct
+{
+    esp_err_t err;
+    char values[FIELD_COUNT][INPUT_MAX];
+    form_field_t fields[FIELD_COUNT];
+} parse_result_t;
+
+static uint32_t rng_state;
+
+static uint32_t rng_next(void)
+{
+    // xorshift32, reproducible from the seed on the command line
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void parse(form_parser_format_t format, const char *data, size_t len, bool chunked, parse_result_t *result)
+{
+    memset(result, 0, sizeof(*result));
+    for (int i = 0; i < FIELD_COUNT; i++)
+    {
+        result->fields[i].name = field_names[i];
+        result->fields[i].value = result->values[i];
+        result->fields[i].value_size = field_sizes[i];
+        // Poison the bytes behind the buffer, they must stay untouched
+        memset(result->values[i], 0x5A, sizeof(result->values[i]));
+    }
+
+    form_parser_t parser;
+    form_parser_init(&parser, format, result->fields, FIELD_COUNT);
+    size_t offset = 0;
+    result->err = ESP_OK;
+    while (result->err == ESP_OK && offset < len)
+    {
+        size_t chunk = chunked ? 1 + rng_next() % 8 : len;
+        chunk = chunk < len - offset ? chunk : len - offset;
+        result->err = form_parser_feed(&parser, data + offset, chunk);
+        offset += chunk;
+    }
+    if (result->err == ESP_OK)
+    {
+        result->err = form_parser_finish(&parser);
+    }
+}
+
+static void check(bool condition, const char *what, form_parser_format_t format, const char *data, size_t len)
+{
+    if (condition)
+    {
+        return;
+    }
+    fprintf(stderr, "FAIL: %s (%s input, %zu bytes): \"", what, format == FORM_PARSER_JSON ? "JSON" : "urlencoded", len);
+    fwrite(data, 1, len, stderr);
+    fprintf(stderr, "\"\n");
+    abort();
+}
+
+static void check_input(form_parser_format_t format, const char *data, size_t len)
+{
+    static parse_result_t whole;
+    static parse_result_t chunked;
+    parse(format, data, len, false, &whole);
+    parse(format, data, len, true, &chunked);
+
+    check(whole.err == chunked.err, "result depends on the chunking", format, data, len);
+    for (int i = 0; i < FIELD_COUNT; i++)
+    {
+        const form_field_t *a = &whole.fields[i];
+        const form_field_t *b = &chunked.fields[i];
+        size_t size = field_sizes[i];
+        check(memchr(a->value, '\0', size) != NULL, "value not terminated", format, data, len);
+        check(a->value[size] == 0x5A && b->value[size] == 0x5A, "value written past its buffer", format, data, len);
+        if (whole.err == ESP_OK)
+        {
+            check(a->found == b->found && a->truncated == b->truncated && strcmp(a->value, b->value) == 0,
+                  "field differs between the chunkings", format, data, len);
+        }
+    }
+}
+
+// The fuzz run only compares the chunkings with each other, these pin down what is decoded
+typedef struct
+{
+    const char *body;
+    esp_err_t err;
+    int field;         // index into field_names, -1 to check only the result
+    const char *value; // NULL: the field is not found
+} decoded_case_t;
+
+static const decoded_case_t decoded_cases[] = {
+    {"ssid=My+Network&password=p%40ss%26word&channel=3", ESP_OK, 0, "My Network"},
+    {"ssid=My+Network&password=p%40ss%26word&channel=3", ESP_OK, 1, "p@ss&word"},
+    {"ssid=My+Network&password=p%40ss%26word&channel=3", ESP_OK, 2, "3"},
+    {"ssid=%E2%82%ac", ESP_OK, 0, "\xe2\x82\xac"},
+    {"channel=12345", ESP_OK, 2, "123"},
+    {"ssid=ab%4", ESP_ERR_INVALID_ARG, -1, NULL},
+    {"ssid=ab%", ESP_ERR_INVALID_ARG, -1, NULL},
+    {"ssid=a%4g", ESP_ERR_INVALID_ARG, -1, NULL},
+    {"{\"password\":\"p\\\"w\\\\d\"}", ESP_OK, 1, "p\"w\\d"},
+    {"{\"ssid\":\"\\u00e9\\u20ac\"}", ESP_OK, 0, "\xc3\xa9\xe2\x82\xac"},
+    {"{\"ssid\":\"a\\nb\\/c\"}", ESP_OK, 0, "a\nb/c"},
+    {"{\"channel\":[1],\"ssid\":\"x\"}", ESP_OK, 2, NULL},
+    {"{\"channel\":[1],\"ssid\":\"x\"}", ESP_OK, 0, "x"},
+    {"{\"ssid\":null}", ESP_OK, 0, NULL},
+    {"{\"ssid\":\"\\u00e\"}", ESP_ERR_INVALID_ARG, -1, NULL},
+    {"{\"ssid\":\"abc", ESP_ERR_INVALID_ARG, -1, NULL},
+};
+
+static void check_decoded(const char *body, esp_err_t err, int field, const char *value)
+{
+    static parse_result_t result;
+    form_parser_format_t format = body[0] == '{' ? FORM_PARSER_JSON : FORM_PARSER_URLENCODED;
+    size_t len = strlen(body);
+    parse(format, body, len, true, &result);
+    check(result.err == err, err == ESP_OK ? "valid body rejected" : "malformed body accepted", format, body, len);
+    if (field >= 0)
+    {
+        const form_field_t *f = &result.fields[field];
+        check(value == NULL ? !f->found : f->found && strcmp(f->value, value) == 0, "wrong decoded value", format, body, len);
+    }
+}
+
+// {"skip":[[..]],"ssid":"x"} with `depth` brackets
+static void check_nesting(int depth, esp_err_t err)
+{
+    static char body[INPUT_MAX];
+    int len = snprintf(body, sizeof(body), "{\"skip\":");
+    for (int i = 0; i < depth; i++)
+    {
+        body[len++] = '[';
+    }
+    for (int i = 0; i < depth; i++)
+    {
+        body[len++] = ']';
+    }
+    snprintf(body + len, sizeof(body) - len, ",\"ssid\":\"x\"}");
+    check_decoded(body, err, 0, err == ESP_OK ? "x" : NULL);
+}
+
+static size_t mutate(const char *seed, char *out)
+{
+    static const char tokens[] = "{}[]\":,\\u%+=&0aF \n\x01\xff";
+    size_t len = strlen(seed);
+    memcpy(out, seed, len);
+    int edits = 1 + rng_next() % 6;
+    for (int i = 0; i < edits; i++)
+    {
+        size_t pos = len > 0 ? rng_next() % (len + 1) : 0;
+        switch (rng_next() % 4)
+        {
+        case 0: // Overwrite with a structural byte
+            if (pos < len)
+            {
+                out[pos] = tokens[rng_next() % (sizeof(tokens) - 1)];
+            }
+            break;
+        case 1: // Insert any byte
+            if (len < INPUT_MAX - 1)
+            {
+                memmove(&out[pos + 1], &out[pos], len - pos);
+                out[pos] = (char)rng_next();
+                len++;
+            }
+            break;
+        case 2: // Delete
+            if (pos < len)
+            {
+                memmove(&out[pos], &out[pos + 1], len - pos - 1);
+                len--;
+            }
+            break;
+        default: // Repeat a run, for long keys and values
+        {
+            size_t run = 1 + rng_next() % 48;
+            if (pos < len && len + run < INPUT_MAX)
+            {
+                memmove(&out[pos + run], &out[pos], len - pos);
+                memset(&out[pos], out[pos], run);
+                len += run;
+            }
+            break;
+        }
+        }
+    }
+    return len;
+}
+
+static void bench(double megabytes)
+{
+    const char *bodies[] = {seeds[0], seeds[3]};
+    const form_parser_format_t formats[] = {FORM_PARSER_URLENCODED, FORM_PARSER_JSON};
+    for (int b = 0; b < 2; b++)
+    {
+        size_t len = strlen(bodies[b]);
+        size_t rounds = (size_t)(megabytes * 1e6 / len) + 1;
+        // Set up once, like a handler with its field array on the stack
+        static parse_result_t result;
+        parse(formats[b], bodies[b], len, false, &result);
+        struct timespec start;
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (size_t r = 0; r < rounds; r++)
+        {
+            form_parser_t parser;
+            form_parser_init(&parser, formats[b], result.fields, FIELD_COUNT);
+            if (form_parser_feed(&parser, bodies[b], len) != ESP_OK || form_parser_finish(&parser) != ESP_OK)
+            {
+                fprintf(stderr, "benchmark body did not parse\n");
+                exit(1);
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%-10s %3zu byte body: %8.1f MB/s, %6.0f ns per body\n", b == 0 ? "urlencoded" : "JSON", len,
+               rounds * len / seconds / 1e6, seconds * 1e9 / rounds);
+    }
+}
+
+#ifdef FORM_PARSER_LIBFUZZER
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size == 0 || size > INPUT_MAX)
+    {
+        return 0;
+    }
+    rng_state = 0x9E3779B9u ^ (uint32_t)size;
+    // The first byte picks the format
+    form_parser_format_t format = data[0] & 1 ? FORM_PARSER_JSON : FORM_PARSER_URLENCODED;
+    check_input(format, (const char *)data + 1, size - 1);
+    return 0;
+}
+#else
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+    {
+        bench(argc > 2 ? atof(argv[2]) : 50.0);
+        return 0;
+    }
+
+    unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 0) : 200000;
+    rng_state = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 0) : (uint32_t)time(NULL);
+    if (rng_state == 0)
+    {
+        rng_state = 1;
+    }
+    printf("form_parser: %lu iterations, seed %lu\n", iterations, (unsigned long)rng_state);
+
+    for (size_t i = 0; i < sizeof(decoded_cases) / sizeof(decoded_cases[0]); i++)
+    {
+        const decoded_case_t *c = &decoded_cases[i];
+        check_decoded(c->body, c->err, c->field, c->value);
+    }
+    check_nesting(FORM_PARSER_DEPTH_MAX, ESP_OK);
+    check_nesting(FORM_PARSER_DEPTH_MAX + 1, ESP_ERR_INVALID_ARG);
+    check_nesting(300, ESP_ERR_INVALID_ARG); // used to wrap the depth counter
+
+    const size_t seed_count = sizeof(seeds) / sizeof(seeds[0]);
+    for (size_t s = 0; s < seed_count; s++)
+    {
+        check_input(seeds[s][0] == '{' ? FORM_PARSER_JSON : FORM_PARSER_URLENCODED, seeds[s], strlen(seeds[s]));
+    }
+    static char input[INPUT_MAX];
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        const char *seed = seeds[rng_next() % seed_count];
+        size_t len = mutate(seed, input);
+        // Also feed every body to the other tokenizer
+        form_parser_format_t format = (seed[0] == '{') ^ (rng_next() % 8 == 0) ? FORM_PARSER_JSON : FORM_PARSER_URLENCODED;
+        check_input(format, input, len);
+    }
+    printf("form_parser: OK\n");
+    return 0;
+}
+#endif
@@ -0,0 +1,2 @@
+// Host stand-in, see idf_host.h
+#include "idf_host.h"
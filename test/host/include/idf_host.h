@@ -0,0 +1,72 @@
+// Host stand-ins for the ESP-IDF and FreeRTOS declarations the host-built modules see through
+// their headers. Only types and prototypes; the harness provides what is actually called.
+#ifndef IDF_HOST_H
+#define IDF_HOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "esp_err.h"
+
+#define portNUM_PROCESSORS 2
+#define configUSE_TRACE_FACILITY 1
+typedef uint32_t TickType_t;
+typedef unsigned int UBaseType_t;
+typedef int BaseType_t;
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void *QueueHandle_t;
+typedef void *EventGroupHandle_t;
+typedef struct
+{
+    int owner;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define taskENTER_CRITICAL(lock) ((void)(lock))
+#define taskEXIT_CRITICAL(lock) ((void)(lock))
+
+typedef struct
+{
+    const char *pcTaskName;
+    uint32_t usStackHighWaterMark;
+} TaskStatus_t;
+UBaseType_t uxTaskGetNumberOfTasks(void);
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *tasks, UBaseType_t count, uint32_t *total_run_time);
+
+int esp_cpu_get_core_id(void);
+uint32_t esp_cpu_get_cycle_count(void);
+int64_t esp_timer_get_time(void);
+
+// Part of newlib on the target, glibc only has it since 2.38
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+typedef struct
+{
+    uint32_t addr;
+} esp_ip4_addr_t;
+typedef const char *esp_event_base_t;
+#define ESP_EVENT_DECLARE_BASE(id) extern esp_event_base_t const id
+typedef void (*esp_event_handler_t)(void *arg, esp_event_base_t base, int32_t id, void *data);
+
+typedef struct
+{
+    void *user_ctx;
+    const char *uri;
+    int method;
+} httpd_req_t;
+esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf, ssize_t len);
+
+typedef int adc_unit_t;
+typedef int adc_channel_t;
+typedef int adc_atten_t;
+typedef int gpio_num_t;
+
+#define ESP_LOGE(tag, ...) (fprintf(stderr, "E %s: ", tag), fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))
+#define ESP_LOGW(tag, ...) (fprintf(stderr, "W %s: ", tag), fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))
+#define ESP_LOGI(tag, ...) ((void)(tag))
+#define ESP_LOGD(tag, ...) ((void)(tag))
+
+#endif // IDF_HOST_H
@@ -0,0 +1,334 @@
+/*
+ * Host check of the /metrics exposition written by main/metrics.c.
+ *
+ * metrics_write() runs against stubbed readings, counters and histograms,
+ * and the text is checked the way a strict OpenMetrics parser reads it:
+ * every family is declared by "# TYPE" once, its metadata and samples
+ * follow in one contiguous block, sample names belong to the family, and
+ * "# EOF" is the last line. A few hand-written expositions make sure the
+ * check itself rejects what it should.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/param.h>
+#include "metrics.h"
+#include "ntc_adc.h"
+#include "virtual_channel.h"
+#include "histogram.h"
+#include "wifi_manager.h"
+
+// Inputs of the current scenario
+system_state_t system_state;
+static uint8_t virtual_mask;
+static bool rssi_available;
+static UBaseType_t task_total = 3;
+
+static char exposition[65536];
+static size_t exposition_length;
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf, ssize_t len)
+{
+    (void)req;
+    if (buf != NULL && len > 0)
+    {
+        if (exposition_length + (size_t)len >= sizeof(exposition))
+        {
+            return ESP_FAIL;
+        }
+        memcpy(exposition + exposition_length, buf, len);
+        exposition_length += len;
+    }
+    return ESP_OK;
+}
+
+float ntc_get_channel_temperature(uint8_t channel_index)
+{
+    return channel_index == 3 ? NAN : 20.0f + channel_index * 1.125f;
+}
+
+ntc_channel_status_t ntc_get_channel_status(uint8_t channel_index)
+{
+    return channel_index == 3 ? NTC_STATUS_OPEN : NTC_STATUS_OK;
+}
+
+const char *ntc_channel_status_name(ntc_channel_status_t status)
+{
+    static const char *const names[] = {"OK", "OPEN", "SHRT", "STCK", "NOIS"};
+    return names[status];
+}
+
+void ntc_adc_get_channel_counters(uint8_t channel_index, ntc_channel_counters_t *counters)
+{
+    counters->conversions = 1000ULL * channel_index;
+    counters->rate_hz = 2500.0f;
+}
+
+uint32_t ntc_adc_get_overflow_count(void)
+{
+    return 2;
+}
+
+uint8_t virtual_channel_get_mask(void)
+{
+    return virtual_mask;
+}
+
+esp_err_t virtual_channel_get(uint8_t index, virtual_channel_config_t *config)
+{
+    memset(config, 0, sizeof(*config));
+    snprintf(config->name, sizeof(config->name), index == 0 ? "mean \"in\"" : "delta\\%u", index);
+    return ESP_OK;
+}
+
+float virtual_channel_get_value(uint8_t index)
+{
+    return -1.5f * index;
+}
+
+static histogram_t histograms[2] = {
+    HISTOGRAM_INITIALIZER("lcd_render", HISTOGRAM_UNIT_CYCLES),
+    HISTOGRAM_INITIALIZER("http_request", HISTOGRAM_UNIT_US),
+};
+
+histogram_t *histogram_next(const histogram_t *histogram)
+{
+    if (histogram == NULL)
+    {
+        return &histograms[0];
+    }
+    return histogram == &histograms[0] ? &histograms[1] : NULL;
+}
+
+void histogram_get_stats(const histogram_t *histogram, histogram_stats_t *stats)
+{
+    (void)histogram;
+    *stats = (histogram_stats_t){.count = 10, .sum = 1000, .p50 = 90, .p90 = 150, .p99 = 200, .max = 210};
+}
+
+double histogram_to_us(const histogram_t *histogram, uint64_t value)
+{
+    return histogram->unit == HISTOGRAM_UNIT_US ? (double)value : value / 240.0;
+}
+
+uint32_t wifi_get_reconnect_count(void)
+{
+    return 4;
+}
+
+esp_err_t wifi_get_rssi(int8_t *rssi)
+{
+    *rssi = -61;
+    return rssi_available ? ESP_OK : ESP_FAIL;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+    return task_total;
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *tasks, UBaseType_t count, uint32_t *total_run_time)
+{
+    (void)total_run_time;
+    static const char *const names[] = {"IDLE0", "temperature", "httpd"};
+    if (count < task_total || task_total > 3)
+    {
+        return 0;
+    }
+    for (UBaseType_t i = 0; i < task_total; i++)
+    {
+        tasks[i] = (TaskStatus_t){.pcTaskName = names[i], .usStackHighWaterMark = 512 + i};
+    }
+    return task_total;
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return 120000;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    return 90000;
+}
+
+// Sample name of a family, for the suffixes OpenMetrics allows per type
+static bool sample_belongs(const char *sample, const char *family, const char *type)
+{
+    size_t length = strlen(family);
+    if (strncmp(sample, family, length) != 0)
+    {
+        return false;
+    }
+    const char *suffix = sample + length;
+    if (strcmp(type, "counter") == 0)
+    {
+        return strcmp(suffix, "_total") == 0 || strcmp(suffix, "_created") == 0;
+    }
+    if (strcmp(type, "summary") == 0)
+    {
+        return *suffix == '\0' || strcmp(suffix, "_sum") == 0 || strcmp(suffix, "_count") == 0;
+    }
+    return *suffix == '\0';
+}
+
+// NULL if the exposition is valid, otherwise what is wrong with it
+static const char *check_exposition(const char *text, int *failed_line)
+{
+    static char families[64][64];
+    size_t family_count = 0;
+    char family[64] = "";
+    char type[16] = "";
+    bool eof = false;
+    int line_number = 0;
+    const char *line = text;
+    while (*line != '\0')
+    {
+        const char *end = strchr(line, '\n');
+        if (end == NULL)
+        {
+            *failed_line = line_number + 1;
+            return "line without newline";
+        }
+        char buffer[512];
+        size_t length = MIN((size_t)(end - line), sizeof(buffer) - 1);
+        memcpy(buffer, line, length);
+        buffer[length] = '\0';
+        line = end + 1;
+        *failed_line = ++line_number;
+
+        if (eof)
+        {
+            return "text after # EOF";
+        }
+        if (strcmp(buffer, "# EOF") == 0)
+        {
+            eof = true;
+            continue;
+        }
+        char name[64];
+        if (sscanf(buffer, "# TYPE %63s %15s", name, type) == 2)
+        {
+            for (size_t i = 0; i < family_count; i++)
+            {
+                if (strcmp(families[i], name) == 0)
+                {
+                    return "family declared twice, its samples are not contiguous";
+                }
+            }
+            strcpy(families[family_count++], name);
+            strcpy(family, name);
+            continue;
+        }
+        char unit[32];
+        if (sscanf(buffer, "# UNIT %63s %31s", name, unit) == 2)
+        {
+            size_t length = strlen(name);
+            size_t unit_length = strlen(unit);
+            if (strcmp(name, family) != 0)
+            {
+                return "metadata outside its family block";
+            }
+            if (length <= unit_length || name[length - unit_length - 1] != '_' || strcmp(name + length - unit_length, unit) != 0)
+            {
+                return "family name does not end with its unit";
+            }
+            continue;
+        }
+        if (sscanf(buffer, "# HELP %63s", name) == 1)
+        {
+            if (strcmp(name, family) != 0)
+            {
+                return "metadata outside its family block";
+            }
+            continue;
+        }
+        if (buffer[0] == '#')
+        {
+            return "unknown comment";
+        }
+        size_t name_length = strcspn(buffer, "{ ");
+        if (name_length == 0 || name_length >= sizeof(name))
+        {
+            return "malformed sample";
+        }
+        memcpy(name, buffer, name_length);
+        name[name_length] = '\0';
+        if (family[0] == '\0' || !sample_belongs(name, family, type))
+        {
+            return "sample outside its family block";
+        }
+        if (strcmp(type, "stateset") == 0 && strstr(buffer, family) == strstr(buffer + name_length, family))
+        {
+            return "stateset sample without the state label";
+        }
+    }
+    *failed_line = line_number;
+    return eof ? NULL : "missing # EOF";
+}
+
+static int failures;
+
+static void expect(const char *what, const char *text, bool valid)
+{
+    int line;
+    const char *error = check_exposition(text, &line);
+    if ((error == NULL) != valid)
+    {
+        failures++;
+        fprintf(stderr, "FAIL: %s: %s at line %d\n", what, error != NULL ? error : "accepted", line);
+    }
+}
+
+static void run_scenario(const char *what, uint8_t sensor_mask, uint8_t virtual_channels, bool rssi, UBaseType_t tasks)
+{
+    system_state.sensor_mask = sensor_mask;
+    system_state.wifi_state = WIFI_STATE_STA;
+    virtual_mask = virtual_channels;
+    rssi_available = rssi;
+    task_total = tasks;
+
+    static const metrics_http_endpoint_t endpoints[] = {{"readings", 12, 1}, {"metrics", 3, 0}};
+    static chunk_writer_t writer;
+    static httpd_req_t req;
+    exposition_length = 0;
+    chunk_writer_init(&writer, &req);
+    metrics_write(&writer, endpoints, sizeof(endpoints) / sizeof(endpoints[0]));
+    if (chunk_writer_finish(&writer) != ESP_OK)
+    {
+        failures++;
+        fprintf(stderr, "FAIL: %s: exposition too long\n", what);
+        return;
+    }
+    exposition[exposition_length] = '\0';
+    expect(what, exposition, true);
+}
+
+int main(int argc, char **argv)
+{
+    // The check itself
+    expect("valid", "# TYPE a gauge\n# HELP a x\na 1\n# TYPE b counter\nb_total 2\n# EOF\n", true);
+    expect("interleaved", "# TYPE a gauge\na 1\n# TYPE b gauge\nb 2\na{x=\"1\"} 3\n# EOF\n", false);
+    expect("reopened", "# TYPE a gauge\na 1\n# TYPE b gauge\nb 2\n# TYPE a gauge\na 3\n# EOF\n", false);
+    expect("no eof", "# TYPE a gauge\na 1\n", false);
+    expect("after eof", "# TYPE a gauge\na 1\n# EOF\na 2\n", false);
+    expect("counter without _total", "# TYPE c counter\nc 1\n# EOF\n", false);
+    expect("unit not in the name", "# TYPE d gauge\n# UNIT d bytes\nd 1\n# EOF\n", false);
+
+    run_scenario("all channels", 0xFF, 0x03, true, 3);
+    run_scenario("ESP32 channels, no virtual", 0xF9, 0x00, false, 3);
+    run_scenario("virtual only", 0x00, 0x01, true, 3);
+    run_scenario("too many tasks", 0x01, 0x02, false, 100);
+
+    if (argc > 1 && strcmp(argv[1], "-v") == 0)
+    {
+        fputs(exposition, stdout);
+    }
+    if (failures > 0)
+    {
+        return 1;
+    }
+    printf("metrics: OK\n");
+    return 0;
+}
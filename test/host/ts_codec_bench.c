@@ -0,0 +1,212 @@
+/*
+ * Host benchmark for main/ts_codec.c on a trace in the CSV format of
+ * GET /api/export?format=csv.
+ *
+ * The samples are packed into records the way ts_store_append() does it
+ * (a new block when the next sample no longer fits the payload of a
+ * TS_RECORD_SIZE page), every record is decoded again and compared with
+ * the input, and the compression ratio against TS_FORMAT_RAW and the
+ * encode/decode throughput are reported.
+ *
+ *     ./ts_codec_bench [trace.csv] [rounds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "ts_codec.h"
+
+#define TRACE_SAMPLES_MAX 200000
+#define LINE_MAX_LEN      512
+#define PAYLOAD_MAX       (TS_RECORD_SIZE - sizeof(ts_record_header_t))
+
+typedef struct
+{
+    size_t offset; // in the packed payloads
+    size_t length;
+    uint16_t count;
+} record_t;
+
+static ts_sample_t samples[TRACE_SAMPLES_MAX];
+static ts_sample_t decoded[TRACE_SAMPLES_MAX];
+static record_t records[TRACE_SAMPLES_MAX];
+static uint8_t payloads[TRACE_SAMPLES_MAX * TS_CODEC_SAMPLE_MAX];
+
+// Header "timestamp,ch0,ch3,..." gives the channel of every column; empty fields are invalid readings
+static size_t load_trace(const char *path, uint16_t *channel_mask)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    char line[LINE_MAX_LEN];
+    int columns[CHANNEL_MAX_COUNT];
+    int column_count = -1;
+    size_t count = 0;
+    *channel_mask = 0;
+    while (fgets(line, sizeof(line), file) != NULL && count < TRACE_SAMPLES_MAX)
+    {
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+        char *field = strtok(line, ",\n");
+        if (column_count < 0)
+        {
+            column_count = 0;
+            while ((field = strtok(NULL, ",\n")) != NULL && column_count < CHANNEL_MAX_COUNT)
+            {
+                int channel = atoi(field + 2);
+                columns[column_count++] = channel;
+                *channel_mask |= 1 << channel;
+            }
+            continue;
+        }
+
+        ts_sample_t *sample = &samples[count++];
+        sample->timestamp = (uint32_t)strtoul(field, NULL, 10);
+        sample->channel_mask = *channel_mask;
+        for (int i = 0; i < CHANNEL_MAX_COUNT; i++)
+        {
+            sample->values[i] = TS_VALUE_INVALID;
+        }
+        // strtok would merge empty fields, walk the rest by hand
+        char *cursor = field + strlen(field) + 1;
+        for (int c = 0; c < column_count && *cursor != '\0'; c++)
+        {
+            char *end = strchr(cursor, ',');
+            if (end == NULL)
+            {
+                end = cursor + strlen(cursor);
+            }
+            if (end > cursor && *cursor != '\n')
+            {
+                sample->values[columns[c]] = (int16_t)lround(strtod(cursor, NULL) * 100.0);
+            }
+            cursor = *end != '\0' ? end + 1 : end;
+        }
+    }
+    fclose(file);
+    if (count == 0)
+    {
+        fprintf(stderr, "%s: no samples\n", path);
+        exit(1);
+    }
+    return count;
+}
+
+static size_t encode_all(size_t count, uint16_t channel_mask)
+{
+    ts_codec_state_t codec;
+    size_t record_count = 0;
+    size_t offset = 0;
+    record_t *record = NULL;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint8_t encoded[TS_CODEC_SAMPLE_MAX];
+        ts_codec_state_t next = codec;
+        size_t length = record != NULL ? ts_codec_encode(&next, &samples[i], encoded, sizeof(encoded)) : 0;
+        if (record == NULL || record->length + length > PAYLOAD_MAX)
+        {
+            record = &records[record_count++];
+            record->offset = offset;
+            record->length = 0;
+            record->count = 0;
+            ts_codec_init(&next, channel_mask);
+            length = ts_codec_encode(&next, &samples[i], encoded, sizeof(encoded));
+        }
+        memcpy(&payloads[offset], encoded, length);
+        codec = next;
+        offset += length;
+        record->length += length;
+        record->count++;
+    }
+    return record_count;
+}
+
+static size_t decode_all(size_t record_count, uint16_t channel_mask)
+{
+    size_t count = 0;
+    for (size_t r = 0; r < record_count; r++)
+    {
+        ts_codec_iter_t iter;
+        ts_codec_iter_init(&iter, &payloads[records[r].offset], records[r].length, channel_mask, records[r].count);
+        while (ts_codec_next(&iter, &decoded[count]))
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "traces/ntc_1h_1hz.csv";
+    int rounds = argc > 2 ? atoi(argv[2]) : 200;
+    uint16_t channel_mask;
+    size_t count = load_trace(path, &channel_mask);
+    int channels = __builtin_popcount(channel_mask);
+
+    size_t record_count = encode_all(count, channel_mask);
+    if (decode_all(record_count, channel_mask) != count)
+    {
+        fprintf(stderr, "FAIL: decoded sample count differs\n");
+        return 1;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        if (decoded[i].timestamp != samples[i].timestamp)
+        {
+            fprintf(stderr, "FAIL: sample %zu: timestamp %lu, expected %lu\n", i, (unsigned long)decoded[i].timestamp,
+                    (unsigned long)samples[i].timestamp);
+            return 1;
+        }
+        for (int c = 0; c < CHANNEL_MAX_COUNT; c++)
+        {
+            if ((channel_mask & (1 << c)) && decoded[i].values[c] != samples[i].values[c])
+            {
+                fprintf(stderr, "FAIL: sample %zu channel %d: %d, expected %d\n", i, c, decoded[i].values[c],
+                        samples[i].values[c]);
+                return 1;
+            }
+        }
+    }
+
+    size_t payload_bytes = 0;
+    for (size_t r = 0; r < record_count; r++)
+    {
+        payload_bytes += records[r].length;
+    }
+    size_t raw_bytes = count * (4 + 2 * channels);
+    size_t raw_records = (count + PAYLOAD_MAX / (4 + 2 * channels) - 1) / (PAYLOAD_MAX / (4 + 2 * channels));
+    printf("%s: %zu samples, %d channels\n", path, count, channels);
+    printf("payload:   %zu bytes, %.2f bytes/sample, %.2fx smaller than TS_FORMAT_RAW (%zu bytes)\n", payload_bytes,
+           (double)payload_bytes / count, (double)raw_bytes / payload_bytes, raw_bytes);
+    printf("flash:     %zu records of %d bytes, TS_FORMAT_RAW needs %zu\n", record_count, TS_RECORD_SIZE, raw_records);
+
+    double start = now_s();
+    for (int r = 0; r < rounds; r++)
+    {
+        encode_all(count, channel_mask);
+    }
+    double encode_s = (now_s() - start) / rounds;
+    start = now_s();
+    for (int r = 0; r < rounds; r++)
+    {
+        decode_all(record_count, channel_mask);
+    }
+    double decode_s = (now_s() - start) / rounds;
+    printf("encode:    %6.1f M samples/s, %6.1f MB/s of raw samples\n", count / encode_s / 1e6, raw_bytes / encode_s / 1e6);
+    printf("decode:    %6.1f M samples/s, %6.1f MB/s of raw samples\n", count / decode_s / 1e6, raw_bytes / decode_s / 1e6);
+    return 0;
+}
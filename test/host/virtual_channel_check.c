@@ -0,0 +1,114 @@
+/*
+ * Host check of the virtual channel expression compiler in main/virtual_channel.c.
+ *
+ * Expressions are compiled and, where they are valid, run against fixed
+ * temperatures. Malformed ones have to be rejected with an error instead
+ * of compiling into something else, e.g. t1x into t1.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "virtual_channel.h"
+#include "state_manager.h"
+
+system_state_t system_state;
+
+void config_store_mark_dirty(uint32_t fields)
+{
+    (void)fields;
+}
+
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t length = strlen(src);
+    if (size > 0)
+    {
+        size_t copy = length < size - 1 ? length : size - 1;
+        memcpy(dst, src, copy);
+        dst[copy] = '\0';
+    }
+    return length;
+}
+
+// t3 is missing
+static const float temperatures[SENSOR_MAX_COUNT] = {20.0f, 21.0f, 22.0f, NAN, 24.0f, 25.0f, 26.0f, 27.0f};
+
+static int failures;
+
+static void expect_value(const char *expression, float expected, uint8_t channel_mask)
+{
+    virtual_program_t program;
+    const char *error = NULL;
+    if (virtual_channel_compile(expression, &program, &error) != ESP_OK)
+    {
+        failures++;
+        fprintf(stderr, "FAIL: \"%s\" rejected: %s\n", expression, error != NULL ? error : "no error");
+        return;
+    }
+    float value = virtual_channel_run(&program, temperatures);
+    bool match = isnan(expected) ? isnan(value) : fabsf(value - expected) < 1e-4f;
+    if (!match || program.channel_mask != channel_mask)
+    {
+        failures++;
+        fprintf(stderr, "FAIL: \"%s\" = %g (mask 0x%02X), expected %g (mask 0x%02X)\n", expression, value,
+                program.channel_mask, expected, channel_mask);
+    }
+}
+
+static void expect_error(const char *expression)
+{
+    virtual_program_t program;
+    const char *error = NULL;
+    if (virtual_channel_compile(expression, &program, &error) == ESP_OK)
+    {
+        failures++;
+        fprintf(stderr, "FAIL: \"%s\" accepted\n", expression);
+    }
+    else if (error == NULL)
+    {
+        failures++;
+        fprintf(stderr, "FAIL: \"%s\" rejected without an error\n", expression);
+    }
+}
+
+int main(void)
+{
+    expect_value("t0", 20.0f, 0x01);
+    expect_value("t7", 27.0f, 0x80);
+    expect_value("t2 - t0", 2.0f, 0x05);
+    expect_value("avg(t4, t5, t6)", 25.0f, 0x70);
+    expect_value("max(t0, t5) + 0.5", 25.5f, 0x21);
+    expect_value("-(t1 - t2) * 2", 2.0f, 0x06);
+    expect_value("abs(t0 - t2) / 4", 0.5f, 0x05);
+    expect_value("min(t3, t1)", 21.0f, 0x0A);
+    expect_value("t3 + 1", NAN, 0x08);
+
+    // Channel names
+    expect_error("t1x");
+    expect_error("t0x1");
+    expect_error("tx");
+    expect_error("t");
+    expect_error("t8");
+    expect_error("t10");
+    expect_error("t1x + 1");
+    expect_error("avg(t0, t1x)");
+
+    // Syntax and limits
+    expect_error("");
+    expect_error("t0 +");
+    expect_error("(t0");
+    expect_error("t0)");
+    expect_error("foo(t0)");
+    expect_error("abs(t0, t1)");
+    expect_error("min()");
+    expect_error("((((((((t0))))))))");
+    expect_error("t0 $ t1");
+
+    if (failures > 0)
+    {
+        return 1;
+    }
+    printf("virtual_channel: OK\n");
+    return 0;
+}
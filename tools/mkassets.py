@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+# Packs a directory of static web assets into a read-only image for the
+# "assets" partition. The firmware maps the partition with esp_partition_mmap()
+# and serves the blobs straight from flash (see main/asset_store.c).
+#
+# Layout (little endian):
+#   header   magic "ASTS", u16 version, u16 entry count, u32 image size
+#   index    entry count * { char path[64], char mime[32], u32 offset, u32 size }
+#            sorted by path so the firmware can binary search it
+#   blobs    file contents, each aligned to 4 bytes
+import argparse
+import os
+import struct
+import sys
+
+MAGIC = b'ASTS'
+VERSION = 1
+PATH_MAX = 64
+MIME_MAX = 32
+HEADER_FMT = '<4sHHI'
+ENTRY_FMT = '<%ds%dsII' % (PATH_MAX, MIME_MAX)
+ALIGN = 4
+
+MIME_TYPES = {
+    '.html': 'text/html',
+    '.js': 'application/javascript',
+    '.css': 'text/css',
+    '.png': 'image/png',
+    '.ico': 'image/x-icon',
+    '.svg': 'image/svg+xml',
+    '.json': 'application/json',
+    '.txt': 'text/plain',
+    '.woff2': 'font/woff2',
+}
+
+
+def collect(src):
+    files = []
+    for root, _, names in os.walk(src):
+        for name in names:
+            full = os.path.join(root, name)
+            rel = '/' + os.path.relpath(full, src).replace(os.sep, '/')
+            if len(rel.encode()) >= PATH_MAX:
+                sys.exit('mkassets: path too long: %s' % rel)
+            files.append((rel, full))
+    # The firmware compares paths with strcmp(), so sort by raw bytes
+    files.sort(key=lambda f: f[0].encode())
+    return files
+
+
+def build(src, out, max_size):
+    files = collect(src)
+    index_size = struct.calcsize(HEADER_FMT) + len(files) * struct.calcsize(ENTRY_FMT)
+    offset = (index_size + ALIGN - 1) & ~(ALIGN - 1)
+
+    entries = []
+    blobs = bytearray()
+    for rel, full in files:
+        with open(full, 'rb') as f:
+            data = f.read()
+        mime = MIME_TYPES.get(os.path.splitext(rel)[1].lower(), 'text/plain')
+        entries.append(struct.pack(ENTRY_FMT, rel.encode(), mime.encode(), offset + len(blobs), len(data)))
+        blobs += data
+        blobs += b'\0' * (-len(blobs) % ALIGN)
+
+    image = bytearray(struct.pack(HEADER_FMT, MAGIC, VERSION, len(files), offset + len(blobs)))
+    for e in entries:
+        image += e
+    image += b'\0' * (offset - len(image))
+    image += blobs
+
+    if max_size and len(image) > max_size:
+        sys.exit('mkassets: image is %d bytes, partition holds only %d' % (len(image), max_size))
+
+    with open(out, 'wb') as f:
+        f.write(image)
+    print('mkassets: packed %d files, %d bytes' % (len(files), len(image)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Pack web assets into an asset partition image')
+    parser.add_argument('src', help='directory with the built frontend')
+    parser.add_argument('out', help='output image file')
+    parser.add_argument('--max-size', type=lambda s: int(s, 0), default=0, help='partition size in bytes')
+    args = parser.parse_args()
+    build(args.src, args.out, args.max_size)
+
+
+if __name__ == '__main__':
+    main()